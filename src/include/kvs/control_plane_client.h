@@ -0,0 +1,41 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_CONTROL_PLANE_CLIENT_H
+#define KVS_CONTROL_PLANE_CLIENT_H
+
+typedef struct ControlPlaneClient *ControlPlaneClientHandle;
+
+/**
+ * @brief Create a client which keeps its connection to a control plane host open between requests, so consecutive
+ * requests like describe stream, create stream and get data endpoint, or the refreshes of the IoT credential, don't
+ * pay a TCP and TLS handshake each.
+ *
+ * The requests are sent one after another on the connection. A connection that has been idle too long, or is closed
+ * by the server, is replaced by a new one. The client is thread safe, but only one request uses the connection at a
+ * time, and the others make their own connection.
+ *
+ * @return The client handle on success, NULL otherwise
+ */
+ControlPlaneClientHandle ControlPlaneClient_create(void);
+
+/**
+ * @brief Close the connection and terminate the client.
+ *
+ * @param[in] xClient The client handle
+ */
+void ControlPlaneClient_terminate(ControlPlaneClientHandle xClient);
+
+#endif /* KVS_CONTROL_PLANE_CLIENT_H */
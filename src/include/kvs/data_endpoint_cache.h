@@ -0,0 +1,95 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_DATA_ENDPOINT_CACHE_H
+#define KVS_DATA_ENDPOINT_CACHE_H
+
+#include <stdint.h>
+
+typedef struct DataEndpointCache *DataEndpointCacheHandle;
+
+/**
+ * @brief Create a cache of PUT MEDIA data endpoints keyed by region and stream name, so a restart can skip describe
+ * stream and get data endpoint.
+ *
+ * The cache is thread safe, and can be shared by all streams of the process.
+ *
+ * @return The cache handle on success, NULL otherwise
+ */
+DataEndpointCacheHandle DataEndpointCache_create(void);
+
+/**
+ * @brief Terminate a cache of data endpoints
+ *
+ * @param[in] xCache The cache handle
+ */
+void DataEndpointCache_terminate(DataEndpointCacheHandle xCache);
+
+/**
+ * @brief Get the data endpoint of a stream if it's cached and not expired.
+ *
+ * @param[in] xCache The cache handle
+ * @param[in] pcRegion The region of the stream
+ * @param[in] pcStreamName The name of the stream
+ * @param[out] ppcEndpoint The endpoint that is memory allocated.
+ * @return 0 on success, KVS_ERROR_DATA_ENDPOINT_CACHE_MISS if there is no such endpoint, non-zero value otherwise
+ */
+int DataEndpointCache_get(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName, char **ppcEndpoint);
+
+/**
+ * @brief Set the data endpoint of a stream.
+ *
+ * @param[in] xCache The cache handle
+ * @param[in] pcRegion The region of the stream
+ * @param[in] pcStreamName The name of the stream
+ * @param[in] pcEndpoint The endpoint
+ * @param[in] uTtlSec The time to live of the endpoint
+ * @return 0 on success, non-zero value otherwise
+ */
+int DataEndpointCache_set(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName, const char *pcEndpoint, uint32_t uTtlSec);
+
+/**
+ * @brief Remove the data endpoint of a stream, for example when it can't be connected. It's also removed from the file
+ * when the cache is saved next time.
+ *
+ * @param[in] xCache The cache handle
+ * @param[in] pcRegion The region of the stream
+ * @param[in] pcStreamName The name of the stream
+ */
+void DataEndpointCache_remove(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName);
+
+/**
+ * @brief Load the endpoints saved by DataEndpointCache_save(). Expired endpoints are skipped, and the others keep the
+ * expiry they were saved with.
+ *
+ * @param[in] xCache The cache handle
+ * @param[in] pcPath The path of the file
+ * @return 0 on success, non-zero value otherwise
+ */
+int DataEndpointCache_load(DataEndpointCacheHandle xCache, const char *pcPath);
+
+/**
+ * @brief Save the endpoints to a file, so they can be used after a restart.
+ *
+ * The endpoints of other streams in the file are kept, so apps which share the file don't drop each other's endpoints.
+ * The file is replaced at once, so a crash never leaves a partial file.
+ *
+ * @param[in] xCache The cache handle
+ * @param[in] pcPath The path of the file
+ * @return 0 on success, non-zero value otherwise
+ */
+int DataEndpointCache_save(DataEndpointCacheHandle xCache, const char *pcPath);
+
+#endif /* KVS_DATA_ENDPOINT_CACHE_H */
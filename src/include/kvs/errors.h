@@ -48,6 +48,8 @@ typedef enum KvsModule {
 #define KVS_ERROR_C_UTIL_UNABLE_TO_CREATE_BUFFER        (-(KVS_ERROR_COMMON_BASE + 0x0006))
 #define KVS_ERROR_C_UTIL_UNABLE_TO_ENLARGE_BUFFER       (-(KVS_ERROR_COMMON_BASE + 0x0007))
 #define KVS_ERROR_TLSF_FAILED_TO_CREATE_POOL            (-(KVS_ERROR_COMMON_BASE + 0x0008))
+#define KVS_ERROR_WAKEUP_WAIT_FAILED                    (-(KVS_ERROR_COMMON_BASE + 0x0009))
+#define KVS_ERROR_FAIL_TO_CREATE_WAKEUP                 (-(KVS_ERROR_COMMON_BASE + 0x000A))
 
 /* Transport layer errors */
 #define KVS_ERROR_NETIO_SEND_MORE_THAN_REMAINING_DATA   (-(KVS_ERROR_COMMON_BASE + 0x0041))
@@ -55,6 +57,18 @@ typedef enum KvsModule {
 #define KVS_ERROR_NETIO_UNABLE_TO_SET_SEND_TIMEOUT      (-(KVS_ERROR_COMMON_BASE + 0x0043))
 #define KVS_ERROR_UNKNOWN_MBEDTLS_MESSAGE_DIGEST        (-(KVS_ERROR_COMMON_BASE + 0x0044))
 #define KVS_ERROR_INVALID_MBEDTLS_MESSAGE_DIGEST_SIZE   (-(KVS_ERROR_COMMON_BASE + 0x0045))
+#define KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR            (-(KVS_ERROR_COMMON_BASE + 0x0046))
+#define KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE        (-(KVS_ERROR_COMMON_BASE + 0x0047))
+#define KVS_ERROR_TLS_SESSION_CACHE_NOT_SUPPORTED       (-(KVS_ERROR_COMMON_BASE + 0x0048))
+#define KVS_ERROR_NETIO_SEND_FAILED                     (-(KVS_ERROR_COMMON_BASE + 0x0049))
+#define KVS_ERROR_NETIO_NOT_CONNECTED                   (-(KVS_ERROR_COMMON_BASE + 0x004A))
+#define KVS_ERROR_NETIO_CONNECT_FAILED                  (-(KVS_ERROR_COMMON_BASE + 0x004B))
+#define KVS_ERROR_NETIO_CONNECTION_CLOSED               (-(KVS_ERROR_COMMON_BASE + 0x004C))
+#define KVS_ERROR_NETIO_RECV_TIMEOUT                    (-(KVS_ERROR_COMMON_BASE + 0x004D))
+#define KVS_ERROR_NETIO_RECV_FAILED                     (-(KVS_ERROR_COMMON_BASE + 0x004E))
+#define KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED              (-(KVS_ERROR_COMMON_BASE + 0x004F))
+#define KVS_ERROR_NETIO_WOULD_BLOCK                     (-(KVS_ERROR_COMMON_BASE + 0x0050))
+#define KVS_ERROR_NETIO_UNABLE_TO_SET_NONBLOCKING       (-(KVS_ERROR_COMMON_BASE + 0x0051))
 
 /* RESTful and HTTP errors */
 #define KVS_ERROR_UNABLE_TO_GET_HTTP_HEADER_COUNT       (-(KVS_ERROR_COMMON_BASE + 0x0101))
@@ -79,6 +93,9 @@ typedef enum KvsModule {
 #define KVS_ERROR_FAIL_TO_CREATE_PUT_MEDIA_HANDLE       (-(KVS_ERROR_COMMON_BASE + 0x0114))
 #define KVS_ERROR_NO_PUTMEDIA_FRAGMENT_ACK_AVAILABLE    (-(KVS_ERROR_COMMON_BASE + 0x0115))
 #define KVS_ERROR_NO_AWS_ACCESS_KEY_OR_SECRET_KEY       (-(KVS_ERROR_COMMON_BASE + 0x0116))
+#define KVS_ERROR_DATA_ENDPOINT_CACHE_MISS              (-(KVS_ERROR_COMMON_BASE + 0x0117))
+#define KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR          (-(KVS_ERROR_COMMON_BASE + 0x0118))
+#define KVS_ERROR_DATA_ENDPOINT_CACHE_INVALID_FILE      (-(KVS_ERROR_COMMON_BASE + 0x0119))
 
 /* MKV errors */
 #define KVS_ERROR_MKV_UNKNOWN_CLUSTER_TYPE              (-(KVS_ERROR_COMMON_BASE + 0x0201))
@@ -99,9 +116,22 @@ typedef enum KvsModule {
 #define KVS_ERROR_ADD_FRAME_WHOSE_TIMESTAMP_GOES_BACK   (-(KVS_ERROR_COMMON_BASE + 0x0306))
 #define KVS_ERROR_STREAM_NOT_READY                      (-(KVS_ERROR_COMMON_BASE + 0x0307))
 #define KVS_ERROR_FAIL_TO_ADD_DATA_FRAME_TO_STREAM      (-(KVS_ERROR_COMMON_BASE + 0x0308))
+#define KVS_ERROR_STREAM_SPILL_IO_ERROR                 (-(KVS_ERROR_COMMON_BASE + 0x0309))
+#define KVS_ERROR_STREAM_SPILL_IS_FULL                  (-(KVS_ERROR_COMMON_BASE + 0x030A))
+#define KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER     (-(KVS_ERROR_COMMON_BASE + 0x030B))
 
 /* KVS application errors */
 #define KVS_ERROR_KVSAPP_UNKNOWN_DO_WORK_TYPE           (-(KVS_ERROR_COMMON_BASE + 0x0341))
+#define KVS_ERROR_KVSAPP_SENDER_NOT_SUPPORTED           (-(KVS_ERROR_COMMON_BASE + 0x0342))
+#define KVS_ERROR_KVSAPP_SENDER_IS_RUNNING              (-(KVS_ERROR_COMMON_BASE + 0x0343))
+#define KVS_ERROR_KVSAPP_SENDER_IS_NOT_RUNNING          (-(KVS_ERROR_COMMON_BASE + 0x0344))
+#define KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER           (-(KVS_ERROR_COMMON_BASE + 0x0345))
+#define KVS_ERROR_KVSAPP_NO_POLL_FD                     (-(KVS_ERROR_COMMON_BASE + 0x0346))
+#define KVS_ERROR_KVSAPP_GROUP_EPOLL_ERROR              (-(KVS_ERROR_COMMON_BASE + 0x0347))
+#define KVS_ERROR_KVSAPP_NOT_IN_GROUP                   (-(KVS_ERROR_COMMON_BASE + 0x0348))
+#define KVS_ERROR_KVSAPP_ASYNC_OPEN_NOT_SUPPORTED       (-(KVS_ERROR_COMMON_BASE + 0x0349))
+#define KVS_ERROR_KVSAPP_OPEN_IS_RUNNING                (-(KVS_ERROR_COMMON_BASE + 0x034A))
+#define KVS_ERROR_KVSAPP_FAIL_TO_START_OPEN             (-(KVS_ERROR_COMMON_BASE + 0x034B))
 
 #define KVS_ERRNO_NONE      0
 #define KVS_ERRNO_FAIL      KVS_ERROR_GENERIC
@@ -16,6 +16,10 @@
 #ifndef _AWS_IOT_CREDENTIAL_PROVIDER_H_
 #define _AWS_IOT_CREDENTIAL_PROVIDER_H_
 
+#include "kvs/control_plane_client.h"
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
+
 typedef struct
 {
     char *pCredentialHost;
@@ -24,6 +28,19 @@ typedef struct
     char *pRootCA;
     char *pCertificate;
     char *pPrivateKey;
+
+    /* The connection resumes the TLS session in this cache if it's not NULL, which saves the mutual authentication. */
+    TlsSessionCacheHandle xTlsSessionCache;
+
+    /* The connection reuses the credentials parsed in this TLS context if it's not NULL and they are the same. */
+    TlsContextHandle xTlsContext;
+
+    /* The largest TLS record the server is asked to send, or 0 for full-size records */
+    unsigned int uTlsMaxFragmentLen;
+
+    /* The request is sent on the kept-alive connection of this client if it's not NULL, so the refreshes of the
+     * credential reuse one connection. */
+    ControlPlaneClientHandle xControlPlaneClient;
 } IotCredentialRequest_t;
 
 typedef struct
@@ -58,6 +58,24 @@ typedef int (*OnDataFrameToBeSentCallback_t)(uint8_t *pData, size_t uDataLen, ui
  */
 typedef int (*OnMkvSentCallback_t)(uint8_t *pData, size_t uDataLen, void *pAppData);
 
+/**
+ * This callback is called by the sender thread for every fragment ACK.
+ *
+ * @param[in] eAckEventType The fragment ACK event type
+ * @param[in] uFragmentTimecode The fragment timecode
+ * @param[in] uErrorId The error ID if the event type is eError
+ * @param[in] pAppData Pointer of application data that is assigned in SenderParameter_t
+ */
+typedef void (*OnFragmentAckCallback_t)(ePutMediaFragmentAckEventType eAckEventType, uint64_t uFragmentTimecode, unsigned int uErrorId, void *pAppData);
+
+/**
+ * This callback is called by the setup thread of KvsApp_openAsync() when the PUT MEDIA connection is set up or fails.
+ *
+ * @param[in] xResult 0 if the connection is set up, or the error which KvsApp_open() would return
+ * @param[in] pAppData Pointer of application data that is assigned in function KvsApp_openAsync()
+ */
+typedef void (*OnOpenCompleteCallback_t)(int xResult, void *pAppData);
+
 typedef struct OnDataFrameTerminateCallbackInfo
 {
     OnDataFrameTerminateCallback_t onDataFrameTerminate;
@@ -82,14 +100,36 @@ typedef enum DoWorkExType
     DO_WORK_DEFAULT = 0,
 
     /* It's similar to doWork, except that it also sends out the end of frames. */
-    DO_WORK_SEND_END_OF_FRAMES = 1
+    DO_WORK_SEND_END_OF_FRAMES = 1,
+
+    /* It's similar to doWork, except that it sends all frames which are ready, up to a size limit, in one write. */
+    DO_WORK_SEND_BATCH = 2
 } DoWorkExType_t;
 
 typedef struct DoWorkExParamter
 {
     DoWorkExType_t eType;
+
+    /* If it's true, doWork returns instead of waiting for work, and the caller waits for the file descriptors of KvsApp_getPollFds(). */
+    bool bNoWait;
 } DoWorkExParamter_t;
 
+typedef struct SenderParameter
+{
+    /* The way the sender thread sends frames. DO_WORK_SEND_END_OF_FRAMES is only used when it's stopped. */
+    DoWorkExType_t eDoWorkType;
+
+    /* The CPU which the sender thread runs on, or -1 to let the system decide. */
+    int xCpuAffinity;
+
+    /* The SCHED_FIFO priority of the sender thread, or 0 to use the default scheduling. */
+    int xPriority;
+
+    /* It's called with every fragment ACK. It can be NULL. */
+    OnFragmentAckCallback_t onFragmentAck;
+    void *pAppData;
+} SenderParameter_t;
+
 /**
  * Create a KVS application.
  *
@@ -127,6 +167,25 @@ int KvsApp_setoption(KvsAppHandle handle, const char *pcOptionName, const char *
  */
 int KvsApp_open(KvsAppHandle handle);
 
+/**
+ * Open KVS application without blocking. The stream buffer is set up now if track info are already set, and the rest of
+ * KvsApp_open(), from the credential to the PUT MEDIA connection, runs in a setup thread. Frames can be added while it
+ * runs, so the frames of the encoder warming up aren't lost, and are sent once the connection is set up.
+ *
+ * Until the callback is called, only KvsApp_addFrame, KvsApp_addFrameWithCallbacks, KvsApp_getStreamMemStatTotal,
+ * KvsApp_close and KvsApp_terminate can be called. KvsApp_close and KvsApp_terminate wait for the setup thread. KvsApp_open,
+ * KvsApp_openAsync, KvsApp_setoption, KvsApp_setOnMkvSentCallback, KvsApp_start, KvsApp_doWork, KvsApp_doWorkEx,
+ * KvsApp_getPollFds and KvsApp_readFragmentAck return KVS_ERROR_KVSAPP_OPEN_IS_RUNNING. The callback can go on with any of
+ * them, e.g. KvsApp_start sends the frames on the connection set up by the setup thread, but it must not call
+ * KvsApp_terminate. It's only supported on POSIX platforms.
+ *
+ * @param[in] handle KVS application handle
+ * @param[in] onOpenComplete The callback which is called when the connection is set up or fails. It can be NULL.
+ * @param[in] pAppData The application data that will be passed in the argument of the callback
+ * @return 0 if the setup thread is started, non-zero value otherwise
+ */
+int KvsApp_openAsync(KvsAppHandle handle, OnOpenCompleteCallback_t onOpenComplete, void *pAppData);
+
 /**
  * Close KVS application. It includes closing connection, flush stream buffer and terminate it.
  *
@@ -167,6 +226,8 @@ int KvsApp_addFrameWithCallbacks(KvsAppHandle handle, uint8_t *pData, size_t uDa
 /**
  * Let KVS application do works. It will try to send out frames, and check if any messages from server.
  *
+ * If there is nothing to send, it blocks until a frame is added, a message arrives from server, or up to 1 second.
+ *
  * @param[in] handle KVS application handle
  * @return 0 on success, non-zero value otherwise
  */
@@ -181,6 +242,30 @@ int KvsApp_doWork(KvsAppHandle handle);
  */
 int KvsApp_doWorkEx(KvsAppHandle handle, DoWorkExParamter_t *pPara);
 
+/**
+ * Get the file descriptors which become readable when KVS application has work to do, so doWork can be driven by an event
+ * loop. Call KvsApp_doWorkEx() with bNoWait when one of them is readable, or at least every second. If doWork sends a
+ * frame, it signals the wakeup again, so the event loop comes back for the rest of the frames.
+ *
+ * The socket changes when KVS application is opened or closed, so get it again after that.
+ *
+ * @param[in] handle KVS application handle
+ * @param[out] pxWakeupFd The file descriptor which is readable when a frame is added
+ * @param[out] pxSocketFd The socket of PUT MEDIA which is readable when a fragment ACK arrives, or -1 if it's not opened
+ * @return 0 on success, non-zero value otherwise
+ */
+int KvsApp_getPollFds(KvsAppHandle handle, int *pxWakeupFd, int *pxSocketFd);
+
+/**
+ * Check if PUT MEDIA data is waiting for the socket to be writable, which only happens with OPTION_NETIO_NONBLOCKING.
+ * While it's true, doWork sends the waiting data but no new frame, so the event loop also waits until the socket of
+ * KvsApp_getPollFds() is writable, and calls KvsApp_doWorkEx() with bNoWait then.
+ *
+ * @param[in] handle KVS application handle
+ * @return true if data is waiting, false otherwise
+ */
+bool KvsApp_isSendPending(KvsAppHandle handle);
+
 /**
  * @brief Non-blocking read a fragment ACK if any.
  *
@@ -213,4 +298,25 @@ size_t KvsApp_getStreamMemStatTotal(KvsAppHandle handle);
  */
 int KvsApp_setOnMkvSentCallback(KvsAppHandle handle, OnMkvSentCallback_t onMkvSentCallback, void *pAppData);
 
+/**
+ * Start a sender thread which streams the frames added to KVS application.
+ *
+ * The thread opens the connection, calls doWork, delivers fragment ACKs to the callback, and reconnects with a backoff if
+ * the connection fails. While it runs, the application only adds frames, and must not call KvsApp_open, KvsApp_close,
+ * KvsApp_doWork, KvsApp_doWorkEx or KvsApp_readFragmentAck. It's only supported on POSIX platforms.
+ *
+ * @param[in] handle KVS application handle
+ * @param[in] pPara The parameter of the sender thread. If it's NULL, the thread uses DO_WORK_DEFAULT and the default scheduling.
+ * @return 0 on success, non-zero value otherwise
+ */
+int KvsApp_start(KvsAppHandle handle, SenderParameter_t *pPara);
+
+/**
+ * Stop the sender thread. The frames which are already added are sent before the connection is closed.
+ *
+ * @param[in] handle KVS application handle
+ * @return 0 on success, non-zero value otherwise
+ */
+int KvsApp_stop(KvsAppHandle handle);
+
 #endif /* KVSAPP_H */
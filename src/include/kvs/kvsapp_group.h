@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVSAPP_GROUP_H
+#define KVSAPP_GROUP_H
+
+#include <stdint.h>
+
+#include "kvs/kvsapp.h"
+
+typedef struct KvsAppGroup *KvsAppGroupHandle;
+
+typedef struct KvsAppGroupMemberParameter
+{
+    /* The way the member sends frames. DO_WORK_SEND_END_OF_FRAMES is only used when it's closed. */
+    DoWorkExType_t eDoWorkType;
+
+    /* The longest time between two doWork calls of the member, or 0 for 1 second. Set it to the coalesce delay of PUT
+     * MEDIA if frames are coalesced. */
+    uint32_t uMaxWaitMs;
+
+    /* It's called with every fragment ACK of the member. It can be NULL. */
+    OnFragmentAckCallback_t onFragmentAck;
+    void *pAppData;
+} KvsAppGroupMemberParameter_t;
+
+/**
+ * @brief Create a group which streams many KVS applications with a few worker threads.
+ *
+ * Each worker waits for the added frames and the fragment ACKs of its members in one epoll set, and runs doWork of the
+ * members which are ready. A member is opened in the background by KvsApp_openAsync, and is reopened with a backoff if
+ * it fails. The members use non-blocking sockets, so a slow connection doesn't delay the other members of the same
+ * worker: the data which doesn't fit in the socket is kept, and the member is resumed when epoll reports EPOLLOUT. Only
+ * closing a member sends the rest in blocking mode. Adding and removing members don't wait for the network I/O.
+ *
+ * It's only supported on Linux.
+ *
+ * @param[in] uWorkerCnt The number of worker threads
+ * @return The group handle on success, NULL otherwise
+ */
+KvsAppGroupHandle KvsAppGroup_create(unsigned int uWorkerCnt);
+
+/**
+ * @brief Stop the workers, close all members, and terminate the group. The KVS applications are not terminated.
+ *
+ * @param[in] xGroupHandle The group handle
+ */
+void KvsAppGroup_terminate(KvsAppGroupHandle xGroupHandle);
+
+/**
+ * @brief Add a KVS application to the worker which has the fewest members.
+ *
+ * While it's in the group, the application only adds frames, and must not call KvsApp_open, KvsApp_openAsync, KvsApp_close, doWork,
+ * KvsApp_readFragmentAck or KvsApp_start. It turns on OPTION_NETIO_NONBLOCKING of the application, and it's turned off
+ * when the application leaves the group.
+ *
+ * @param[in] xGroupHandle The group handle
+ * @param[in] xKvsAppHandle KVS application handle
+ * @param[in] pPara The parameter of the member. If it's NULL, it uses DO_WORK_DEFAULT without the ACK callback.
+ * @return 0 on success, non-zero value otherwise
+ */
+int KvsAppGroup_add(KvsAppGroupHandle xGroupHandle, KvsAppHandle xKvsAppHandle, KvsAppGroupMemberParameter_t *pPara);
+
+/**
+ * @brief Remove a KVS application from the group. It returns after its worker has sent the remaining frames and closed it,
+ * or after KvsAppGroup_terminate has closed it if the group is terminated meanwhile.
+ *
+ * @param[in] xGroupHandle The group handle
+ * @param[in] xKvsAppHandle KVS application handle
+ * @return 0 on success, non-zero value otherwise
+ */
+int KvsAppGroup_remove(KvsAppGroupHandle xGroupHandle, KvsAppHandle xKvsAppHandle);
+
+#endif /* KVSAPP_GROUP_H */
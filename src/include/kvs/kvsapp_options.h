@@ -20,6 +20,16 @@ typedef enum KvsApp_streamPolicy
 {
     STREAM_POLICY_NONE = 0,
     STREAM_POLICY_RING_BUFFER,
+
+    /* Like STREAM_POLICY_RING_BUFFER, but whole GOPs are evicted, so every frame left in the stream is decodable. */
+    STREAM_POLICY_GOP_RING_BUFFER,
+
+    /* Droppable frames are evicted first, then whole GOPs are evicted as STREAM_POLICY_GOP_RING_BUFFER does. */
+    STREAM_POLICY_DROPPABLE_FIRST_RING_BUFFER,
+
+    /* Like STREAM_POLICY_GOP_RING_BUFFER, but the evicted GOPs are spilled to segment files on local storage, and they
+     * are sent before the frames in memory. It's only available on POSIX platforms. */
+    STREAM_POLICY_SPILL_RING_BUFFER,
     STREAM_POLICY_MAX
 } KvsApp_streamPolicy_t;
 
@@ -37,12 +47,71 @@ static const char * const OPTION_IOT_X509_KEY = "Iot_x509PrivateKey";
 static const char * const OPTION_KVS_DATA_RETENTION_IN_HOURS = "Kvs_dataRetentionInHours";
 static const char * const OPTION_KVS_VIDEO_TRACK_INFO = "Kvs_videoTrackInfo";
 static const char * const OPTION_KVS_AUDIO_TRACK_INFO = "Kvs_audioTrackInfo";
+/* A path of a file and a uint32_t of seconds. The data endpoint of the stream is cached for the TTL after it's
+ * discovered, so the next KvsApp_open goes straight to PUT MEDIA, and discovers it again only if PUT MEDIA fails. With
+ * the file, the endpoints are loaded from it when it's set, and saved to it after they're discovered, so they're used
+ * after a restart too. The TTL is 24 hours by default. */
+static const char * const OPTION_KVS_DATA_ENDPOINT_CACHE_FILE = "Kvs_dataEndpointCacheFile";
+static const char * const OPTION_KVS_DATA_ENDPOINT_CACHE_TTL = "Kvs_dataEndpointCacheTtlSec";
 
 static const char * const OPTION_STREAM_POLICY = "Stream_policy";
 static const char * const OPTION_STREAM_POLICY_RING_BUFFER_MEM_LIMIT = "Stream_RbMemlimit";
+/* A bool of STREAM_POLICY_GOP_RING_BUFFER and STREAM_POLICY_DROPPABLE_FIRST_RING_BUFFER. If it's true, the audio frames
+ * of an evicted GOP are kept. */
+static const char * const OPTION_STREAM_POLICY_GOP_KEEP_AUDIO = "Stream_GopKeepAudio";
+/* A non-zero number of frames per track selects the lock-free stream. It requires one thread adding frames per track
+ * and one thread calling KvsApp_doWork, and it has to be set before the first frame is added. */
+static const char * const OPTION_STREAM_LOCK_FREE_QUEUE_SIZE = "Stream_lockFreeQueueSize";
+/* A directory string and a size_t of STREAM_POLICY_SPILL_RING_BUFFER. They have to be set before the first frame is
+ * added. */
+static const char * const OPTION_STREAM_SPILL_DIR = "Stream_spillDir";
+static const char * const OPTION_STREAM_SPILL_MAX_SIZE = "Stream_spillMaxSize";
+/* A size_t of bytes. If it's not 0, sent frames are kept until the persisted ACK of their fragment, and replayed after a
+ * reconnect, so nothing is lost with the connection. The oldest fragments are evicted beyond it. It has to be set
+ * before the first frame is added. With a lock-free stream, the kept frames hold their slots of the queue too. */
+static const char * const OPTION_STREAM_RETENTION_MEM_LIMIT = "Stream_retentionMemLimit";
+/* An unsigned int of milliseconds and a size_t of bytes. A new fragment starts when the video of a fragment would
+ * exceed either of them, even if it's not a key frame. 0 means no limit. With a lock-free stream, they have to be set
+ * before the first frame is added. */
+static const char * const OPTION_STREAM_FRAGMENT_DURATION = "Stream_fragmentDurationMs";
+static const char * const OPTION_STREAM_FRAGMENT_MAX_SIZE = "Stream_fragmentMaxSize";
 
 static const char * const OPTION_NETIO_CONNECTION_TIMEOUT = "NetIo_connTimeout";
 static const char * const OPTION_NETIO_STREAMING_RECV_TIMEOUT = "NetIo_recvTimeout";
 static const char * const OPTION_NETIO_STREAMING_SEND_TIMEOUT = "NetIo_sendTimeout";
+/* A path of a file. Reconnects always resume the TLS sessions of previous connections. With this option, the sessions
+ * are loaded from the file when it's set, and saved to it after every KvsApp_open, so they are resumed after a restart
+ * too. The file holds the session secrets, so keep it private. */
+static const char * const OPTION_NETIO_TLS_SESSION_CACHE_FILE = "NetIo_tlsSessionCacheFile";
+/* A bool. If it's true, the kernel encrypts the data of PUT MEDIA after the TLS handshake (Linux kTLS), so sending it
+ * doesn't run the cipher in user space. mbedTLS keeps encrypting if the kernel or the negotiated cipher suite doesn't
+ * support it. It takes effect on the next KvsApp_open. */
+static const char * const OPTION_NETIO_KTLS = "NetIo_ktls";
+/* An unsigned int of 512, 1024, 2048 or 4096, or 0 to turn it off. Connections ask the servers for TLS records of at
+ * most this size, which lets mbedTLS built with MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH shrink its record buffers, and
+ * PUT MEDIA sizes its coalesced chunks to fill whole records. Servers which don't support it keep full-size records.
+ * kTLS isn't used with it. It takes effect on the next KvsApp_open. */
+static const char * const OPTION_NETIO_TLS_MAX_FRAGMENT_LEN = "NetIo_tlsMaxFragmentLen";
+/* A TlsAead_t of kvs/tls_context.h. Its cipher suites are offered first in TLS handshakes, and the others follow. It's
+ * TLS_AEAD_DEFAULT by default, which keeps the order of mbedTLS. TLS_AEAD_FASTEST measures AES-GCM and
+ * ChaCha20-Poly1305 once before the next handshake and prefers the faster one. Servers which choose the cipher suite by
+ * their own order may still pick another. It takes effect on the next handshake. */
+static const char * const OPTION_NETIO_TLS_AEAD = "NetIo_tlsAead";
+/* A const NetIoTransport_t * of kvs/netio_transport.h, passed as the value itself. Connections to the KVS service run
+ * on it, like plain TCP or an in-process memory pipe to a local stand-in server. NULL sets the default TLS transport
+ * back. It takes effect on the next KvsApp_open. */
+static const char * const OPTION_NETIO_TRANSPORT = "NetIo_transport";
+/* A bool. If it's true, the socket of PUT MEDIA is non-blocking once PUT MEDIA is answered, so doWork doesn't wait for a
+ * slow connection. The data which the socket doesn't take is queued, and doWork holds frames back until it's sent, see
+ * KvsApp_isSendPending(). It's meant for event loops which call KvsApp_doWorkEx() with bNoWait, and the transport has
+ * to support trySend. DO_WORK_SEND_END_OF_FRAMES and KvsApp_close send the rest in the blocking mode. It takes effect
+ * on the next KvsApp_open. */
+static const char * const OPTION_NETIO_NONBLOCKING = "NetIo_nonBlocking";
+
+/* A size_t of bytes and an unsigned int of milliseconds. Consecutive frames are coalesced into one HTTP chunk until it
+ * reaches the size, or the first frame in it has waited for the delay. A size of 0 sends every frame in its own chunk.
+ * They take effect on the next KvsApp_open. */
+static const char * const OPTION_PUT_MEDIA_COALESCE_SIZE = "PutMedia_coalesceSize";
+static const char * const OPTION_PUT_MEDIA_COALESCE_DELAY = "PutMedia_coalesceDelayMs";
 
 #endif
@@ -43,6 +43,18 @@
  */
 bool isKeyFrame(uint8_t *pBuf, size_t uLen);
 
+/**
+ * @brief Check if no other frame refers to the frame
+ *
+ * A frame is a non-reference frame if it has VCL NALUs and nal_ref_idc of all of them is 0. It can be dropped without
+ * breaking the decoding of other frames.
+ *
+ * @param[in] pBuf The AVCC or Annex-B buffer
+ * @param[in] uLen The length of buffer
+ * @return true if it's a non-reference frame, or false otherwise
+ */
+bool NALU_isNonReferenceFrame(uint8_t *pBuf, size_t uLen);
+
 /**
  * @brief Get NALU type of the first NALU in the buffer
  *
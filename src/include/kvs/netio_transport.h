@@ -0,0 +1,126 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_NETIO_TRANSPORT_H
+#define KVS_NETIO_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
+
+/**
+ * A data buffer of a gathered send
+ */
+typedef struct NetIoVec
+{
+    const unsigned char *pBuffer;
+    size_t uLen;
+} NetIoVec_t;
+
+/**
+ * The options of a network I/O handle. A transport reads them when it connects and when they are updated, and ignores
+ * the ones it doesn't support.
+ */
+typedef struct NetIoOptions
+{
+    uint32_t uRecvTimeoutMs;
+    uint32_t uSendTimeoutMs;
+
+    /* The socket doesn't wait in send and recv. The handle sends with trySend then, and receiving nothing fails with
+     * KVS_ERROR_NETIO_WOULD_BLOCK instead of waiting for the receive timeout. */
+    bool bNonBlocking;
+
+    /* Options of TLS transports */
+    TlsSessionCacheHandle xTlsSessionCache;
+    TlsContextHandle xTlsContext;
+    bool bKtls;
+
+    /* The largest record the server is asked to send (TLS max_fragment_length), or 0 to not ask for it */
+    uint32_t uMaxFragmentLen;
+} NetIoOptions_t;
+
+/**
+ * The X509 credentials of a connection. They are only used by TLS transports.
+ */
+typedef struct NetIoX509
+{
+    const char *pcRootCA;
+    const char *pcCert;
+    const char *pcPrivKey;
+} NetIoX509_t;
+
+/**
+ * The operations of a transport. A network I/O handle dispatches to them, and pCtx is the connection returned by
+ * connect. All of them are mandatory except getSocket, updateOptions, isKtlsActive, getSendRecordLen and trySend.
+ */
+typedef struct NetIoTransport
+{
+    /* The name of the transport in logs */
+    const char *pcName;
+
+    /* Connect to a host, and return the connection in ppCtx. pxX509 is NULL if there is no client certificate. */
+    int (*connect)(const NetIoOptions_t *pxOptions, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509, void **ppCtx);
+
+    /* Send all bytes of a buffer, or of several buffers in order. */
+    int (*send)(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend);
+    int (*sendv)(void *pCtx, const NetIoVec_t *pxVecs, size_t uVecCnt);
+
+    /* Receive at least one byte, or fail if nothing is received within the receive timeout. */
+    int (*recv)(void *pCtx, unsigned char *pBuffer, size_t uBufferSize, size_t *puBytesReceived);
+
+    /* Wait until the connection is readable, and return false if it isn't after the timeout. */
+    bool (*poll)(void *pCtx, uint32_t uTimeoutMs);
+
+    /* Shut the connection down and free it. */
+    void (*close)(void *pCtx);
+
+    /* Get the socket which becomes readable with the connection, or -1 if there is none. */
+    int (*getSocket)(void *pCtx);
+
+    /* Apply the options again after they are changed on a connected handle. */
+    int (*updateOptions)(void *pCtx, const NetIoOptions_t *pxOptions);
+
+    /* Check if the kernel encrypts the records sent on the connection. */
+    bool (*isKtlsActive)(void *pCtx);
+
+    /* Get the largest data sent in one record, or 0 if the transport doesn't send records. */
+    size_t (*getSendRecordLen)(void *pCtx);
+
+    /* Send as many bytes as the connection takes, and return the number in puBytesSent. In the non-blocking mode it
+     * doesn't wait, so it can send none. Otherwise it waits like send, but may still send a part. The bytes which
+     * aren't sent must start the buffer of the next call, since a TLS record may be written partly. The non-blocking
+     * mode isn't supported without it. */
+    int (*trySend)(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent);
+} NetIoTransport_t;
+
+/**
+ * @brief Get the default transport, which runs TLS with mbedTLS over TCP
+ */
+const NetIoTransport_t *NetIoTransport_getMbedtls(void);
+
+/**
+ * @brief Get the transport of plain TCP without TLS, which is meant for local stand-in servers
+ */
+const NetIoTransport_t *NetIoTransport_getTcp(void);
+
+/**
+ * @brief Get the transport of in-process memory pipes. Hosts are listened by NetIoPipe_listen() of net/netio_pipe.h.
+ */
+const NetIoTransport_t *NetIoTransport_getPipe(void);
+
+#endif /* KVS_NETIO_TRANSPORT_H */
@@ -17,6 +17,7 @@
 #define KVS_PORT_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
 /* The string length of "date + time" format of ISO 8601 required by AWS Signature V4. */
 #define DATE_TIME_ISO_8601_FORMAT_STRING_SIZE           ( 17 )
@@ -61,4 +62,50 @@ uint8_t getRandomNumber(void);
  */
 void sleepInMs(uint32_t ms);
 
+typedef struct Wakeup *WakeupHandle;
+
+/**
+ * @brief Create a wakeup, which lets a thread block until another thread signals it.
+ *
+ * @return the wakeup handle on success, or NULL otherwise
+ */
+WakeupHandle wakeupCreate(void);
+
+/**
+ * @brief Terminate a wakeup.
+ *
+ * @param[in] xWakeup The wakeup handle
+ */
+void wakeupTerminate(WakeupHandle xWakeup);
+
+/**
+ * @brief Signal a wakeup. It can be called from any thread. If no thread is waiting, the next wait returns immediately.
+ *
+ * @param[in] xWakeup The wakeup handle
+ */
+void wakeupSignal(WakeupHandle xWakeup);
+
+/**
+ * @brief Wait until the wakeup is signalled, the socket is readable, or the timeout expires.
+ *
+ * Signals sent before the wait are consumed by it. Platforms that can't wait for a socket and a signal together only
+ * wait for the signal or the timeout.
+ *
+ * @param[in] xWakeup The wakeup handle
+ * @param[in] xSockFd The socket to wait for, or -1 if there is none
+ * @param[in] uTimeoutMs The timeout in milliseconds
+ * @return 0 on success, non-zero value otherwise
+ */
+int wakeupWait(WakeupHandle xWakeup, int xSockFd, uint32_t uTimeoutMs);
+
+/**
+ * @brief Get a file descriptor which is readable while the wakeup is signalled, so it can be added to an event loop.
+ *
+ * Reading the file descriptor doesn't consume the signals. Call wakeupWait() with zero timeout to consume them.
+ *
+ * @param[in] xWakeup The wakeup handle
+ * @return the file descriptor, or -1 if the platform has none
+ */
+int wakeupGetFd(WakeupHandle xWakeup);
+
 #endif /* KVS_PORT_H */
\ No newline at end of file
@@ -17,6 +17,14 @@
 #define KVS_REST_API_H
 
 #include <inttypes.h>
+#include <stdbool.h>
+
+#include "kvs/control_plane_client.h"
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
+
+/* The operations of a network transport, which are declared in kvs/netio_transport.h */
+struct NetIoTransport;
 
 typedef struct
 {
@@ -32,6 +40,23 @@ typedef struct
 
     unsigned int uRecvTimeoutMs;
     unsigned int uSendTimeoutMs;
+
+    /* Connections resume the TLS sessions in this cache if it's not NULL. */
+    TlsSessionCacheHandle xTlsSessionCache;
+
+    /* Connections borrow the random generator of this TLS context if it's not NULL. */
+    TlsContextHandle xTlsContext;
+
+    /* Connections ask the servers for TLS records of at most this size if it's not 0. PUT MEDIA sizes its coalesced
+     * chunks to fill whole records. */
+    unsigned int uTlsMaxFragmentLen;
+
+    /* Connections run on this transport if it's not NULL, otherwise they run TLS with mbedTLS over TCP. */
+    const struct NetIoTransport *pxNetIoTransport;
+
+    /* Describe stream, create stream and get data endpoint are sent on the kept-alive connection of this client if
+     * it's not NULL. PUT MEDIA always makes its own connection. */
+    ControlPlaneClientHandle xControlPlaneClient;
 } KvsServiceParameter_t;
 
 typedef struct
@@ -64,6 +89,21 @@ typedef struct
 
     unsigned int uRecvTimeoutMs;
     unsigned int uSendTimeoutMs;
+
+    /* Consecutive frames are coalesced into one HTTP chunk of up to uCoalesceSize bytes, and a chunk is sent at the
+     * latest uCoalesceDelayMs after its first frame. 0 of uCoalesceSize sends every frame in its own chunk. On a
+     * connection sending TLS records, the size is rounded down so a full chunk fills whole records, and frames are cut
+     * where a chunk is full so the chunks sent before a flush are all full. */
+    size_t uCoalesceSize;
+    unsigned int uCoalesceDelayMs;
+
+    /* The kernel encrypts the data sent after the TLS handshake if it's true and the kernel supports it (Linux kTLS).
+     * Otherwise mbedTLS keeps encrypting it. */
+    bool bKtls;
+
+    /* The socket is made non-blocking after the PUT MEDIA response if it's true, so the data which the socket doesn't
+     * take is queued in the handle instead of waiting for the send timeout. See Kvs_putMediaIsSendPending(). */
+    bool bNonBlocking;
 } KvsPutMediaParameter_t;
 
 typedef struct PutMedia *PutMediaHandle;
@@ -131,6 +171,10 @@ int Kvs_putMediaStart(KvsServiceParameter_t *pServPara, KvsPutMediaParameter_t *
 /**
  * @brief Update MKV header and frame data by using PUT MEDIA handle
  *
+ * If coalescing is enabled, a frame smaller than the coalescing size may be kept in the handle until the chunk is full,
+ * the coalescing delay expires, or Kvs_putMediaFlush() is called. On a connection sending TLS records, the end of any
+ * frame may be kept this way. The data is copied, so the caller can release it.
+ *
  * @param[in] xPutMediaHandle The handle of PUT MEDIA
  * @param[in] pMkvHeader The MKV header
  * @param[in] uMkvHeaderLen The length of MKV header
@@ -143,6 +187,8 @@ int Kvs_putMediaUpdate(PutMediaHandle xPutMediaHandle, uint8_t *pMkvHeader, size
 /**
  * @brief Update raw data by using PUT MEDIA handle
  *
+ * Coalesced frames are sent before the raw data.
+ *
  * @param[in] xPutMediaHandle The handle of PUT MEDIA
  * @param[in] pBuf The MKV header
  * @param[in] uLen The length of MKV header
@@ -150,8 +196,19 @@ int Kvs_putMediaUpdate(PutMediaHandle xPutMediaHandle, uint8_t *pMkvHeader, size
  */
 int Kvs_putMediaUpdateRaw(PutMediaHandle xPutMediaHandle, uint8_t *pBuf, size_t uLen);
 
+/**
+ * @brief Send the frames coalesced by Kvs_putMediaUpdate()
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_putMediaFlush(PutMediaHandle xPutMediaHandle);
+
 /**
  * @brief Do PUT MEDIA regular work
+ *
+ * It also sends the coalesced frames if the coalescing delay has expired, and the data queued in the non-blocking
+ * mode.
  * 
  * @param[in] xPutMediaHandle The handle of PUT MEDIA
  * @return 0 on success, non-zero value otherwise
@@ -161,6 +218,8 @@ int Kvs_putMediaDoWork(PutMediaHandle xPutMediaHandle);
 /**
  * @brief Terminate the handle of PUT MEDIA
  *
+ * The data queued in the non-blocking mode and the coalesced frames are sent before the connection is closed.
+ *
  * @param[in] xPutMediaHandle The handle of PUT MEDIA
  */
 void Kvs_putMediaFinish(PutMediaHandle xPutMediaHandle);
@@ -187,6 +246,40 @@ int Kvs_putMediaUpdateRecvTimeout(PutMediaHandle xPutMediaHandle, unsigned int u
 */
 int Kvs_putMediaUpdateSendTimeout(PutMediaHandle xPutMediaHandle, unsigned int uSendTimeoutMs);
 
+/**
+ * @brief Update the limits of coalescing frames into one HTTP chunk.
+ *
+ * Coalescing limits have been set in put media parameters. Frames already coalesced are sent before the limits change.
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @param[in] uCoalesceSize The maximum size of a coalesced chunk, or 0 to send every frame in its own chunk
+ * @param[in] uCoalesceDelayMs The maximum time in milliseconds a frame waits for the chunk to be sent
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_putMediaUpdateCoalescing(PutMediaHandle xPutMediaHandle, size_t uCoalesceSize, unsigned int uCoalesceDelayMs);
+
+/**
+ * @brief Switch the socket between the blocking and non-blocking modes.
+ *
+ * The non-blocking mode has been set in put media parameters. Switching back to blocking sends the queued data first.
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @param[in] bNonBlocking true for the non-blocking mode
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_putMediaUpdateNonBlocking(PutMediaHandle xPutMediaHandle, bool bNonBlocking);
+
+/**
+ * @brief Check if data queued in the non-blocking mode is waiting for the socket to be writable.
+ *
+ * The data is sent by the next Kvs_putMediaDoWork(), or before the data of the next update. The queue has no limit, so
+ * the caller should hold frames back and wait until the socket is writable while it's true.
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @return true if data is queued, false otherwise
+ */
+bool Kvs_putMediaIsSendPending(PutMediaHandle xPutMediaHandle);
+
 /**
  * @brief Non-blocking read a fragment ACK if any.
  *
@@ -201,4 +294,25 @@ int Kvs_putMediaUpdateSendTimeout(PutMediaHandle xPutMediaHandle, unsigned int u
  */
 int Kvs_putMediaReadFragmentAck(PutMediaHandle xPutMediaHandle, ePutMediaFragmentAckEventType *peAckEventType, uint64_t *puFragmentTimecode, unsigned int *puErrorId);
 
+/**
+ * @brief Get the newest fragment timecode which has a persisted ACK on this PUT MEDIA connection.
+ *
+ * It doesn't consume any fragment ACK, so it can be used along with Kvs_putMediaReadFragmentAck().
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @param[out] puFragmentTimecode Pointer to the fragment timecode
+ * @return 0 on success, KVS_ERROR_NO_PUTMEDIA_FRAGMENT_ACK_AVAILABLE if no fragment is persisted yet, non-zero value otherwise
+ */
+int Kvs_putMediaGetPersistedTimecode(PutMediaHandle xPutMediaHandle, uint64_t *puFragmentTimecode);
+
+/**
+ * @brief Get the socket of PUT MEDIA connection.
+ *
+ * The socket becomes readable when fragment ACKs arrive, so the caller can wait for it and then call Kvs_putMediaDoWork().
+ *
+ * @param[in] xPutMediaHandle The handle of PUT MEDIA
+ * @return the socket, or -1 if there is none
+ */
+int Kvs_putMediaGetSocket(PutMediaHandle xPutMediaHandle);
+
 #endif /* KVS_REST_API_H */
\ No newline at end of file
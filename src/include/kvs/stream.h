@@ -17,6 +17,16 @@
 #define KVS_STREAM_H
 
 #include "kvs/mkv_generator.h"
+#include "kvs/port.h"
+
+typedef enum DataFrameDropClass
+{
+    /* Other frames may depend on it. */
+    DATA_FRAME_REFERENCED = 0,
+
+    /* No other frame depends on it, so it can be dropped under memory pressure. */
+    DATA_FRAME_DROPPABLE
+} DataFrameDropClass_t;
 
 typedef struct DataFrameIn
 {
@@ -27,6 +37,7 @@ typedef struct DataFrameIn
     bool bIsKeyFrame;
     TrackType_t xTrackType;
     void *pUserData;
+    DataFrameDropClass_t xDropClass;
 } DataFrameIn_t;
 
 typedef struct DataFrame *DataFrameHandle;
@@ -42,6 +53,43 @@ typedef struct Stream *StreamHandle;
  */
 StreamHandle Kvs_streamCreate(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_t *pAudioTrackInfo);
 
+/**
+ * @brief Create a stream whose data frame descriptors come from a pool
+ *
+ * Each descriptor has fixed slots for the MKV header and the user data. Terminated data frames go back to the free
+ * list of the pool, so adding and terminating data frames doesn't call the allocator once the pool has grown to the
+ * number of pending frames. If pUserData of DataFrameIn_t is set, uUserDataSize bytes are copied from it into the
+ * descriptor when the data frame is added, and pUserData of the data frame points to the copy.
+ *
+ * All data frames must be terminated before the stream is terminated.
+ *
+ * @param[in] pVideoTrackInfo The video track info
+ * @param[in] pAudioTrackInfo The audio track info if any
+ * @param[in] uUserDataSize The size of user data kept in each descriptor
+ * @param[in] uPoolCnt The number of preallocated descriptors
+ * @return The stream handle on success, NULL otherwise
+ */
+StreamHandle Kvs_streamCreateWithPool(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_t *pAudioTrackInfo, size_t uUserDataSize, size_t uPoolCnt);
+
+/**
+ * @brief Create a lock-free stream backed by bounded single-producer/single-consumer queues
+ *
+ * Each track has a fixed number of preallocated descriptors and a bounded queue, and no lock is taken on any stream
+ * operation. It's only safe if each track has a single producer thread calling Kvs_streamAddDataFrame, and a single
+ * consumer thread calls all the other functions of the stream and terminates its data frames. Adding a data frame
+ * fails when the queue of its track is full. Frames of a track must be added in timestamp order, and the MKV header
+ * of a data frame is built when it's peeked or popped.
+ *
+ * All data frames must be terminated before the stream is terminated.
+ *
+ * @param[in] pVideoTrackInfo The video track info
+ * @param[in] pAudioTrackInfo The audio track info if any
+ * @param[in] uUserDataSize The size of user data kept in each descriptor
+ * @param[in] uQueueSize The number of frames each track can hold. It's rounded up to a power of two.
+ * @return The stream handle on success, NULL otherwise
+ */
+StreamHandle Kvs_streamCreateLockFree(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_t *pAudioTrackInfo, size_t uUserDataSize, size_t uQueueSize);
+
 /**
  * @brief Terminate a stream handle
  *
@@ -59,12 +107,41 @@ void Kvs_streamTermintate(StreamHandle xStreamHandle);
  */
 int Kvs_streamGetMkvEbmlSegHdr(StreamHandle xStreamHandle, uint8_t **ppMkvHeader, size_t *puMkvHeaderLen);
 
+/**
+ * @brief Set the limits of a cluster in a stream
+ *
+ * A cluster is a fragment of the KVS stream, so the limits bound the latency of its acknowledgement and the data lost
+ * when a connection breaks, even if the encoder has a long GOP. Only video frames are counted. The limits apply to the
+ * frames added afterwards. A lock-free stream must not have frames being added when it's called.
+ *
+ * @param[in] xStreamHandle The stream handle
+ * @param[in] uDurationMs The maximum duration of a cluster, or 0 if it's not limited
+ * @param[in] uSize The maximum data size of a cluster, or 0 if it's not limited
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamSetClusterLimit(StreamHandle xStreamHandle, uint32_t uDurationMs, size_t uSize);
+
+/**
+ * @brief Set the wakeup which is signalled whenever a data frame is added
+ *
+ * The thread sending the stream can wait for it instead of polling. A lock-free stream must not have frames being added
+ * when it's called.
+ *
+ * @param[in] xStreamHandle The stream handle
+ * @param[in] xWakeup The wakeup handle, or NULL to signal nothing
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamSetWakeup(StreamHandle xStreamHandle, WakeupHandle xWakeup);
+
 /**
  * @brief Add a data Frame to a stream
  *
  * Data members in DataFrameIn_t are set by application, then it will be added into stream with needed information
  * and return DataFrameHandle which wrapped these information.
  *
+ * A video simple block starts a new cluster if it would exceed the cluster limits, or if its delta timestamp wouldn't
+ * fit in the cluster. Such a cluster isn't a key frame, so its xClusterType is MKV_CLUSTER while bIsKeyFrame is false.
+ *
  * @param xStreamHandle[in] The stream handle
  * @param pxDataFrameIn[in] The data frame that is set by application
  * @return The data frame handle on success, NULL otherwise
@@ -120,6 +197,88 @@ bool Kvs_streamAvailOnTrack(StreamHandle xStreamHandle, TrackType_t xTrackType);
  */
 int Kvs_streamMemStatTotal(StreamHandle xStreamHandle, size_t *puMemTotal);
 
+/**
+ * @brief Get the number of frames and the memory used by a specific track in a stream
+ *
+ * @param xStreamHandle[in] The stream handle
+ * @param xTrackType[in] The specific track type
+ * @param puFrameCnt[out] The number of pending frames on the track
+ * @param puMemTotal[out] The total size of data frame handle and data on the track
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamStatOnTrack(StreamHandle xStreamHandle, TrackType_t xTrackType, size_t *puFrameCnt, size_t *puMemTotal);
+
+/**
+ * @brief Pop data frames from a stream until its total memory is no more than the limit
+ *
+ * All frames are popped under one lock. At most uMaxCnt frames are popped in one call, so the caller should call it
+ * again if *puCnt equals uMaxCnt. The popped frames are owned by the caller.
+ *
+ * @param xStreamHandle[in] The stream handle
+ * @param uMemLimit[in] The memory limit of the stream
+ * @param pxDataFrameHandles[out] The popped data frame handles
+ * @param uMaxCnt[in] The capacity of pxDataFrameHandles
+ * @param puCnt[out] The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamPopUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt);
+
+/**
+ * @brief Pop a run of data frames which are ready to be sent from a stream
+ *
+ * All frames are popped under one lock, in the same order as Kvs_streamPop. A frame is ready if the video track has a
+ * frame, and also the audio track if bAllTracks is set and the stream has one. It stops at the first frame which isn't
+ * ready, or whose MKV header and data would exceed uMaxBytes in total. The first frame is popped even if it exceeds
+ * uMaxBytes. The popped frames are owned by the caller.
+ *
+ * @param xStreamHandle[in] The stream handle
+ * @param uMaxCnt[in] The capacity of pxDataFrameHandles
+ * @param uMaxBytes[in] The maximum size of the MKV headers and data of the popped frames
+ * @param bAllTracks[in] Require a frame on every track of the stream
+ * @param pxDataFrameHandles[out] The popped data frame handles
+ * @param puCnt[out] The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamPopBatch(StreamHandle xStreamHandle, size_t uMaxCnt, size_t uMaxBytes, bool bAllTracks, DataFrameHandle *pxDataFrameHandles, size_t *puCnt);
+
+/**
+ * @brief Evict whole GOPs from a stream until its total memory is no more than the limit
+ *
+ * If the stream is over the limit, all frames placed before the second pending cluster are evicted together, so the
+ * stream still starts at a cluster or continues the GOP being sent. The newest GOP is never evicted, so the stream may
+ * stay over the limit by up to one GOP. If bKeepAudio is set, the audio frames of the evicted GOP are kept and moved
+ * to the last popped cluster, unless their delta timestamp doesn't fit in it.
+ *
+ * The evicted frames are handed out in the order they would have been popped, at most uMaxCnt at a time, and the next
+ * GOP is considered only after all of them are handed out. The caller should call it again until *puCnt is 0. The
+ * popped frames are owned by the caller.
+ *
+ * @param xStreamHandle[in] The stream handle
+ * @param uMemLimit[in] The memory limit of the stream
+ * @param bKeepAudio[in] Keep the audio frames of the evicted GOPs
+ * @param pxDataFrameHandles[out] The popped data frame handles
+ * @param uMaxCnt[in] The capacity of pxDataFrameHandles
+ * @param puCnt[out] The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamPopGopUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, bool bKeepAudio, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt);
+
+/**
+ * @brief Pop droppable data frames from a stream until its total memory is no more than the limit
+ *
+ * The oldest droppable frames are popped first, wherever they are in the stream. Clusters are never popped. A
+ * lock-free stream can only be popped from the front, so nothing is popped from it. The caller should call it again
+ * if *puCnt equals uMaxCnt. The popped frames are owned by the caller.
+ *
+ * @param xStreamHandle[in] The stream handle
+ * @param uMemLimit[in] The memory limit of the stream
+ * @param pxDataFrameHandles[out] The popped data frame handles
+ * @param uMaxCnt[in] The capacity of pxDataFrameHandles
+ * @param puCnt[out] The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamPopDroppableUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt);
+
 /**
  * @brief Get MKV header and data from a data frame
  *
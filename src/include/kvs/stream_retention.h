@@ -0,0 +1,133 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_STREAM_RETENTION_H
+#define KVS_STREAM_RETENTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kvs/stream.h"
+
+typedef struct StreamRetention *StreamRetentionHandle;
+
+/**
+ * @brief Create a retention window which keeps sent data frames until the fragment ACK says they are persisted
+ *
+ * Data frames are kept in the order they are sent, and grouped by the cluster they belong to. The timestamp of a
+ * cluster is the fragment timecode of its ACK, so a persisted ACK releases its cluster and every older one. After a
+ * reconnect, the kept frames are replayed on the new connection before any other frame. The frames are not copied, so
+ * the caller must not terminate them until they are popped.
+ *
+ * The retention is not thread safe. The caller has to serialize all calls to it.
+ *
+ * @param[in] uMemLimit The maximum size of kept frames, including their MKV headers
+ * @return The retention handle on success, NULL otherwise
+ */
+StreamRetentionHandle Kvs_streamRetentionCreate(size_t uMemLimit);
+
+/**
+ * @brief Terminate a retention window. The kept frames have to be popped and terminated before.
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ */
+void Kvs_streamRetentionTerminate(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Keep a data frame which has been sent
+ *
+ * The window starts at a cluster, so a simple block is not kept while the window is empty.
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @param[in] xDataFrameHandle The data frame which has been sent
+ * @param[out] pbIsRetained true if the frame is kept, false if the caller still owns it
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamRetentionAdd(StreamRetentionHandle xStreamRetentionHandle, DataFrameHandle xDataFrameHandle, bool *pbIsRetained);
+
+/**
+ * @brief Restart the replay on a new connection, so every kept frame is returned by Kvs_streamRetentionNextReplay again.
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ */
+void Kvs_streamRetentionRewind(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Get the oldest kept frame which isn't sent on the current connection yet. It stays in the window.
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @return The data frame to be sent, or NULL if all kept frames are sent
+ */
+DataFrameHandle Kvs_streamRetentionNextReplay(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Check if every kept frame is sent on the current connection
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @return true if there is no frame to be replayed, false otherwise
+ */
+bool Kvs_streamRetentionIsReplayDone(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Pop the frames of the clusters whose timestamps are not after a persisted fragment timecode
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @param[in] uFragmentTimecode The fragment timecode of a persisted ACK
+ * @param[out] pxDataFrameHandles The popped data frames, which the caller has to terminate
+ * @param[in] uMaxCnt The size of pxDataFrameHandles
+ * @param[out] puCnt The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamRetentionPopPersisted(StreamRetentionHandle xStreamRetentionHandle, uint64_t uFragmentTimecode, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt);
+
+/**
+ * @brief Pop the oldest clusters until the kept frames fit in the memory limit. A cluster is popped as a whole.
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @param[out] pxDataFrameHandles The popped data frames, which the caller has to terminate
+ * @param[in] uMaxCnt The size of pxDataFrameHandles
+ * @param[out] puCnt The number of popped data frames
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamRetentionPopUntilMem(StreamRetentionHandle xStreamRetentionHandle, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt);
+
+/**
+ * @brief Pop the oldest kept frame
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @return The data frame which the caller has to terminate, or NULL if the window is empty
+ */
+DataFrameHandle Kvs_streamRetentionPop(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Check if there is any kept frame
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @return true if there is no kept frame, false otherwise
+ */
+bool Kvs_streamRetentionIsEmpty(StreamRetentionHandle xStreamRetentionHandle);
+
+/**
+ * @brief Get the number of kept frames and their size
+ *
+ * @param[in] xStreamRetentionHandle The retention handle
+ * @param[out] puFrameCnt The number of kept frames
+ * @param[out] puSize The size of kept frames, including their MKV headers
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamRetentionStat(StreamRetentionHandle xStreamRetentionHandle, size_t *puFrameCnt, size_t *puSize);
+
+#endif /* KVS_STREAM_RETENTION_H */
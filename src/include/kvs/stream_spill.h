@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_STREAM_SPILL_H
+#define KVS_STREAM_SPILL_H
+
+#include "kvs/mkv_generator.h"
+#include "kvs/stream.h"
+
+typedef struct SpillFrame
+{
+    uint8_t *pMkvHdr;
+    size_t uMkvHdrLen;
+    uint8_t *pData;
+    size_t uDataLen;
+    uint64_t uTimestampMs;
+    TrackType_t xTrackType;
+    MkvClusterType_t xClusterType;
+} SpillFrame_t;
+
+typedef struct StreamSpill *StreamSpillHandle;
+
+/**
+ * @brief Create a spill which keeps data frames in append-only segment files on local storage
+ *
+ * Frames are appended to the newest segment file, and they are read back in the same order from a read-only memory
+ * mapping of each segment, so the backlog is never loaded into RAM. A segment file is removed once all its frames are
+ * read. Segment files of a previous run are not replayed.
+ *
+ * Segment files have unique names, so spills of many streams or processes can share a directory.
+ *
+ * The spill is not thread safe. The caller has to serialize all calls to it.
+ *
+ * @param[in] pcDir The directory of the segment files
+ * @param[in] uSegmentSize The size of each segment file
+ * @param[in] uMaxSize The maximum size of all segment files
+ * @return The spill handle on success, NULL otherwise
+ */
+StreamSpillHandle Kvs_streamSpillCreate(const char *pcDir, size_t uSegmentSize, size_t uMaxSize);
+
+/**
+ * @brief Terminate a spill and remove all its segment files
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ */
+void Kvs_streamSpillTerminate(StreamSpillHandle xStreamSpillHandle);
+
+/**
+ * @brief Append a data frame to a spill
+ *
+ * Only whole clusters are kept. A simple block is rejected unless the cluster it belongs to has been appended and its
+ * delta timestamp fits in that cluster. If a frame doesn't fit in the spill, the rest of its cluster is rejected too.
+ * The data is copied, so the data frame can be terminated after it's appended.
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ * @param[in] pxDataFrameIn The data frame to append
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamSpillAppend(StreamSpillHandle xStreamSpillHandle, DataFrameIn_t *pxDataFrameIn);
+
+/**
+ * @brief Read the oldest data frame from a spill
+ *
+ * The MKV header is built on read. The header and the data stay valid until the next call to Kvs_streamSpillRead,
+ * Kvs_streamSpillFlushToNextCluster or Kvs_streamSpillTerminate.
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ * @param[out] pxSpillFrame The data frame which is read
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamSpillRead(StreamSpillHandle xStreamSpillHandle, SpillFrame_t *pxSpillFrame);
+
+/**
+ * @brief Drop data frames from a spill until its oldest data frame is a cluster
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ * @return 0 if the spill starts with a cluster, non-zero value if the spill is empty
+ */
+int Kvs_streamSpillFlushToNextCluster(StreamSpillHandle xStreamSpillHandle);
+
+/**
+ * @brief Check if there is any data frame in a spill
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ * @return true if there is no data frame, false otherwise
+ */
+bool Kvs_streamSpillIsEmpty(StreamSpillHandle xStreamSpillHandle);
+
+/**
+ * @brief Get the number of data frames and their size in a spill
+ *
+ * @param[in] xStreamSpillHandle The spill handle
+ * @param[out] puFrameCnt The number of data frames which are not read
+ * @param[out] puSize The size of data frames which are not read, including their record headers
+ * @return 0 on success, non-zero value otherwise
+ */
+int Kvs_streamSpillStat(StreamSpillHandle xStreamSpillHandle, size_t *puFrameCnt, size_t *puSize);
+
+#endif /* KVS_STREAM_SPILL_H */
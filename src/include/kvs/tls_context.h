@@ -0,0 +1,89 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_TLS_CONTEXT_H
+#define KVS_TLS_CONTEXT_H
+
+#include <stddef.h>
+
+typedef struct TlsContext *TlsContextHandle;
+
+/**
+ * The AEAD whose cipher suites are offered first in the handshakes of a TLS context. The other cipher suites follow
+ * in the order of mbedTLS, so a server which doesn't support the preferred AEAD still negotiates another one.
+ */
+typedef enum TlsAead
+{
+    /* Cipher suites are offered in the order of mbedTLS. */
+    TLS_AEAD_DEFAULT = 0,
+
+    /* AES-GCM and ChaCha20-Poly1305 are measured before the first handshake, and the faster one is preferred. */
+    TLS_AEAD_FASTEST,
+
+    TLS_AEAD_AES_GCM,
+    TLS_AEAD_CHACHA20_POLY1305
+} TlsAead_t;
+
+/**
+ * @brief Create a TLS context, which is borrowed by connections so they don't seed a random generator and parse their
+ * X509 certificates every time. It holds a random generator seeded once, and the root CA and certificate parsed by the
+ * latest connection with X509. The next connection with the same PEMs reuses them, and different PEMs replace them.
+ * Every connection parses its own private key, because signing with a shared key isn't thread safe in mbedTLS.
+ *
+ * The random generator and the certificates are used under the lock of the context, or only read, so the context can
+ * be shared by the connections of any thread. It must outlive them.
+ *
+ * @return The context handle on success, NULL otherwise
+ */
+TlsContextHandle TlsContext_create(void);
+
+/**
+ * @brief Terminate a TLS context
+ *
+ * @param[in] xTlsContext The context handle
+ */
+void TlsContext_terminate(TlsContextHandle xTlsContext);
+
+/**
+ * @brief Set the AEAD preferred by the next handshakes of the connections borrowing the context. It's
+ * TLS_AEAD_DEFAULT after the context is created.
+ *
+ * @param[in] xTlsContext The context handle
+ * @param[in] xAead The preferred AEAD
+ * @return 0 on success, non-zero value otherwise
+ */
+int TlsContext_setAead(TlsContextHandle xTlsContext, TlsAead_t xAead);
+
+/**
+ * @brief Get the AEAD preferred by the next handshakes. If it's set to TLS_AEAD_FASTEST, the AEADs are measured unless
+ * they already are, and the faster one is returned.
+ *
+ * @param[in] xTlsContext The context handle
+ * @return The preferred AEAD, or TLS_AEAD_DEFAULT if mbedTLS has neither of them
+ */
+TlsAead_t TlsContext_getAead(TlsContextHandle xTlsContext);
+
+/**
+ * @brief Measure how fast an AEAD encrypts full-size TLS records, which is what TLS_AEAD_FASTEST compares. AES-GCM
+ * is measured with a 128 bit key.
+ *
+ * @param[in] xAead TLS_AEAD_AES_GCM or TLS_AEAD_CHACHA20_POLY1305
+ * @param[in] uLen The number of bytes to encrypt
+ * @param[out] pdBytesPerSec The encrypted bytes per second
+ * @return 0 on success, KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED if mbedTLS is built without the AEAD, or other non-zero value
+ */
+int TlsContext_measureAead(TlsAead_t xAead, size_t uLen, double *pdBytesPerSec);
+
+#endif /* KVS_TLS_CONTEXT_H */
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef KVS_TLS_SESSION_CACHE_H
+#define KVS_TLS_SESSION_CACHE_H
+
+#include <stddef.h>
+
+typedef struct TlsSessionCache *TlsSessionCacheHandle;
+
+/**
+ * @brief Create a cache of TLS sessions, so a reconnect to the same host and port resumes the previous session with an
+ * abbreviated handshake instead of a full one. It keeps the session tickets too if the server issues them.
+ *
+ * The cache is thread safe, and can be shared by all connections of the process.
+ *
+ * @param[in] uMaxHosts The maximum number of hosts. The least recently used host is evicted when it's full.
+ * @return The cache handle on success, NULL otherwise
+ */
+TlsSessionCacheHandle TlsSessionCache_create(size_t uMaxHosts);
+
+/**
+ * @brief Terminate a cache of TLS sessions
+ *
+ * @param[in] xTlsSessionCache The cache handle
+ */
+void TlsSessionCache_terminate(TlsSessionCacheHandle xTlsSessionCache);
+
+/**
+ * @brief Load the sessions saved by TlsSessionCache_save(). Sessions that can't be restored, for example saved by
+ * another mbedTLS version, are skipped.
+ *
+ * @param[in] xTlsSessionCache The cache handle
+ * @param[in] pcPath The path of the file
+ * @return 0 on success, non-zero value otherwise
+ */
+int TlsSessionCache_load(TlsSessionCacheHandle xTlsSessionCache, const char *pcPath);
+
+/**
+ * @brief Save the sessions to a file, so they can be resumed after a restart.
+ *
+ * The file holds the master secrets of the sessions, so it has to be kept as private as the credentials of the device. It's
+ * created readable by the owner only, and is replaced at once when the sessions are written, so a crash never leaves a
+ * partial file.
+ *
+ * @param[in] xTlsSessionCache The cache handle
+ * @param[in] pcPath The path of the file
+ * @return 0 on success, non-zero value otherwise
+ */
+int TlsSessionCache_save(TlsSessionCacheHandle xTlsSessionCache, const char *pcPath);
+
+#endif /* KVS_TLS_SESSION_CACHE_H */
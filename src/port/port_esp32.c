@@ -20,12 +20,21 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "kvs/errors.h"
 #include "kvs/port.h"
 
+#include "os/allocator.h"
+
 #define PAST_OLD_TIME_IN_EPOCH 1600000000
 
+typedef struct Wakeup
+{
+    /* A binary semaphore stays given until it's taken, so no signal is lost. */
+    SemaphoreHandle_t xSemaphore;
+} Wakeup_t;
+
 int platformInit(void)
 {
     int res = KVS_ERRNO_NONE;
@@ -80,4 +89,69 @@ uint8_t getRandomNumber(void)
 void sleepInMs(uint32_t ms)
 {
     vTaskDelay( ms / portTICK_PERIOD_MS );
+}
+
+WakeupHandle wakeupCreate(void)
+{
+    Wakeup_t *pxWakeup = NULL;
+
+    if ((pxWakeup = (Wakeup_t *)kvsMalloc(sizeof(Wakeup_t))) != NULL)
+    {
+        if ((pxWakeup->xSemaphore = xSemaphoreCreateBinary()) == NULL)
+        {
+            kvsFree(pxWakeup);
+            pxWakeup = NULL;
+        }
+    }
+
+    return pxWakeup;
+}
+
+void wakeupTerminate(WakeupHandle xWakeup)
+{
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+
+    if (pxWakeup != NULL)
+    {
+        vSemaphoreDelete(pxWakeup->xSemaphore);
+        kvsFree(pxWakeup);
+    }
+}
+
+void wakeupSignal(WakeupHandle xWakeup)
+{
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+
+    if (pxWakeup != NULL)
+    {
+        xSemaphoreGive(pxWakeup->xSemaphore);
+    }
+}
+
+int wakeupWait(WakeupHandle xWakeup, int xSockFd, uint32_t uTimeoutMs)
+{
+    int res = KVS_ERRNO_NONE;
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+
+    /* The socket isn't waited for, so incoming data is handled after a signal or the timeout. */
+    (void)xSockFd;
+
+    if (pxWakeup == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        xSemaphoreTake(pxWakeup->xSemaphore, pdMS_TO_TICKS(uTimeoutMs));
+    }
+
+    return res;
+}
+
+int wakeupGetFd(WakeupHandle xWakeup)
+{
+    /* A semaphore has no file descriptor. */
+    (void)xWakeup;
+
+    return -1;
 }
\ No newline at end of file
@@ -13,9 +13,12 @@
  * permissions and limitations under the License.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
@@ -23,8 +26,16 @@
 #include "kvs/errors.h"
 #include "kvs/port.h"
 
+#include "os/allocator.h"
+
 #define PAST_OLD_TIME_IN_EPOCH 1600000000
 
+typedef struct Wakeup
+{
+    /* The counter of an eventfd stays non-zero until it's read, so no signal is lost. */
+    int xEventFd;
+} Wakeup_t;
+
 int platformInit(void)
 {
     int res = KVS_ERRNO_NONE;
@@ -38,6 +49,7 @@ int getTimeInIso8601(char *pBuf, size_t uBufSize)
 {
     int res = KVS_ERRNO_NONE;
     time_t xTimeUtcNow = {0};
+    struct tm xTm = {0};
 
     if (pBuf == NULL || uBufSize < DATE_TIME_ISO_8601_FORMAT_STRING_SIZE)
     {
@@ -53,7 +65,8 @@ int getTimeInIso8601(char *pBuf, size_t uBufSize)
         }
         else
         {
-            strftime(pBuf, DATE_TIME_ISO_8601_FORMAT_STRING_SIZE, "%Y%m%dT%H%M%SZ", gmtime(&xTimeUtcNow));
+            /* Requests are signed in many threads, e.g. the setup threads of KvsApp_openAsync(), so gmtime_r is used. */
+            strftime(pBuf, DATE_TIME_ISO_8601_FORMAT_STRING_SIZE, "%Y%m%dT%H%M%SZ", gmtime_r(&xTimeUtcNow, &xTm));
         }
     }
 
@@ -79,4 +92,91 @@ uint8_t getRandomNumber(void)
 void sleepInMs(uint32_t ms)
 {
     usleep(ms * 1000);
+}
+
+WakeupHandle wakeupCreate(void)
+{
+    Wakeup_t *pxWakeup = NULL;
+
+    if ((pxWakeup = (Wakeup_t *)kvsMalloc(sizeof(Wakeup_t))) != NULL)
+    {
+        if ((pxWakeup->xEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        {
+            kvsFree(pxWakeup);
+            pxWakeup = NULL;
+        }
+    }
+
+    return pxWakeup;
+}
+
+void wakeupTerminate(WakeupHandle xWakeup)
+{
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+
+    if (pxWakeup != NULL)
+    {
+        close(pxWakeup->xEventFd);
+        kvsFree(pxWakeup);
+    }
+}
+
+void wakeupSignal(WakeupHandle xWakeup)
+{
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+    uint64_t uOne = 1;
+
+    if (pxWakeup != NULL && write(pxWakeup->xEventFd, &uOne, sizeof(uOne)) < 0)
+    {
+        /* The counter is saturated, so the waiter wakes up anyway. */
+    }
+}
+
+int wakeupWait(WakeupHandle xWakeup, int xSockFd, uint32_t uTimeoutMs)
+{
+    int res = KVS_ERRNO_NONE;
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+    struct pollfd xFds[2];
+    nfds_t uFdCnt = 1;
+    uint64_t uCnt = 0;
+
+    if (pxWakeup == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        xFds[0].fd = pxWakeup->xEventFd;
+        xFds[0].events = POLLIN;
+        xFds[0].revents = 0;
+        if (xSockFd >= 0)
+        {
+            xFds[1].fd = xSockFd;
+            xFds[1].events = POLLIN;
+            xFds[1].revents = 0;
+            uFdCnt = 2;
+        }
+
+        if (poll(xFds, uFdCnt, (int)uTimeoutMs) < 0 && errno != EINTR)
+        {
+            res = KVS_ERROR_WAKEUP_WAIT_FAILED;
+        }
+        else if ((xFds[0].revents & POLLIN) && read(pxWakeup->xEventFd, &uCnt, sizeof(uCnt)) < 0)
+        {
+            /* Another waiter has consumed the signals. */
+        }
+        else
+        {
+            /* nop */
+        }
+    }
+
+    return res;
+}
+
+int wakeupGetFd(WakeupHandle xWakeup)
+{
+    Wakeup_t *pxWakeup = (Wakeup_t *)xWakeup;
+
+    return (pxWakeup == NULL) ? -1 : pxWakeup->xEventFd;
 }
\ No newline at end of file
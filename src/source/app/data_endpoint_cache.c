@@ -0,0 +1,496 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Thirdparty headers */
+#include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/data_endpoint_cache.h"
+#include "kvs/errors.h"
+
+/* Platform dependent headers */
+#include "kvs/port.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "os/file_writer.h"
+
+/* The file starts with this line, and each of the following lines is "<expiry in epoch ms> <region> <stream> <endpoint>". */
+#define DATA_ENDPOINT_CACHE_FILE_MAGIC "KVSDEC1"
+
+typedef struct DataEndpointEntry
+{
+    DLIST_ENTRY xEntry;
+
+    uint64_t uExpireMs;
+
+    /* They point to the memory right after this structure. */
+    char *pcRegion;
+    char *pcStreamName;
+    char *pcEndpoint;
+} DataEndpointEntry_t;
+
+typedef struct DataEndpointCache
+{
+    LOCK_HANDLE xLock;
+
+    DLIST_ENTRY xEntries;
+} DataEndpointCache_t;
+
+static DataEndpointEntry_t *prvFindEntry(DataEndpointCache_t *pxCache, const char *pcRegion, const char *pcStreamName)
+{
+    PDLIST_ENTRY pxListHead = &(pxCache->xEntries);
+    PDLIST_ENTRY pxListItem = pxListHead->Flink;
+    DataEndpointEntry_t *pxEntry = NULL;
+
+    while (pxListItem != pxListHead)
+    {
+        pxEntry = containingRecord(pxListItem, DataEndpointEntry_t, xEntry);
+        if (strcmp(pxEntry->pcRegion, pcRegion) == 0 && strcmp(pxEntry->pcStreamName, pcStreamName) == 0)
+        {
+            return pxEntry;
+        }
+        pxListItem = pxListItem->Flink;
+    }
+
+    return NULL;
+}
+
+static void prvRemoveEntry(DataEndpointEntry_t *pxEntry)
+{
+    DList_RemoveEntryList(&(pxEntry->xEntry));
+    kvsFree(pxEntry);
+}
+
+/* Replace the entry of the stream. The caller holds the lock. */
+static int prvSetEntry(DataEndpointCache_t *pxCache, const char *pcRegion, const char *pcStreamName, const char *pcEndpoint, uint64_t uExpireMs)
+{
+    int res = KVS_ERRNO_NONE;
+    DataEndpointEntry_t *pxEntry = NULL;
+    DataEndpointEntry_t *pxOldEntry = NULL;
+    size_t uRegionLen = strlen(pcRegion);
+    size_t uStreamNameLen = strlen(pcStreamName);
+    size_t uEndpointLen = strlen(pcEndpoint);
+
+    if ((pxEntry = (DataEndpointEntry_t *)kvsMalloc(sizeof(DataEndpointEntry_t) + uRegionLen + uStreamNameLen + uEndpointLen + 3)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxEntry");
+    }
+    else
+    {
+        memset(pxEntry, 0, sizeof(DataEndpointEntry_t));
+        pxEntry->uExpireMs = uExpireMs;
+        pxEntry->pcRegion = (char *)(pxEntry + 1);
+        pxEntry->pcStreamName = pxEntry->pcRegion + uRegionLen + 1;
+        pxEntry->pcEndpoint = pxEntry->pcStreamName + uStreamNameLen + 1;
+        memcpy(pxEntry->pcRegion, pcRegion, uRegionLen + 1);
+        memcpy(pxEntry->pcStreamName, pcStreamName, uStreamNameLen + 1);
+        memcpy(pxEntry->pcEndpoint, pcEndpoint, uEndpointLen + 1);
+
+        if ((pxOldEntry = prvFindEntry(pxCache, pcRegion, pcStreamName)) != NULL)
+        {
+            prvRemoveEntry(pxOldEntry);
+        }
+        DList_InsertTailList(&(pxCache->xEntries), &(pxEntry->xEntry));
+    }
+
+    return res;
+}
+
+/* Return the next token separated by spaces, and terminate it. */
+static char *prvNextToken(char **ppcCursor)
+{
+    char *pcToken = *ppcCursor;
+    char *p = NULL;
+
+    while (*pcToken == ' ')
+    {
+        pcToken++;
+    }
+    if (*pcToken == '\0')
+    {
+        return NULL;
+    }
+
+    p = pcToken;
+    while (*p != ' ' && *p != '\0')
+    {
+        p++;
+    }
+    if (*p == ' ')
+    {
+        *p++ = '\0';
+    }
+    *ppcCursor = p;
+
+    return pcToken;
+}
+
+/* Parse the lines of the file in pcBuf, which is terminated. The caller holds the lock. */
+static int prvDataEndpointCacheParse(DataEndpointCache_t *pxCache, char *pcBuf)
+{
+    int res = KVS_ERRNO_NONE;
+    uint64_t uNowMs = getEpochTimestampInMs();
+    char *pcLine = pcBuf;
+    char *pcNextLine = NULL;
+    char *pcExpireMs = NULL;
+    char *pcRegion = NULL;
+    char *pcStreamName = NULL;
+    char *pcEndpoint = NULL;
+    uint64_t uExpireMs = 0;
+    bool bIsFirstLine = true;
+
+    while (pcLine != NULL && *pcLine != '\0' && res == KVS_ERRNO_NONE)
+    {
+        if ((pcNextLine = strchr(pcLine, '\n')) != NULL)
+        {
+            *pcNextLine++ = '\0';
+        }
+
+        if (bIsFirstLine)
+        {
+            if (strcmp(pcLine, DATA_ENDPOINT_CACHE_FILE_MAGIC) != 0)
+            {
+                res = KVS_ERROR_DATA_ENDPOINT_CACHE_INVALID_FILE;
+                LogError("Unknown data endpoint cache file");
+            }
+            bIsFirstLine = false;
+        }
+        else if (
+            (pcExpireMs = prvNextToken(&pcLine)) == NULL || (pcRegion = prvNextToken(&pcLine)) == NULL || (pcStreamName = prvNextToken(&pcLine)) == NULL ||
+            (pcEndpoint = prvNextToken(&pcLine)) == NULL)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_INVALID_FILE;
+            LogError("Invalid line in data endpoint cache file");
+        }
+        else if ((uExpireMs = strtoull(pcExpireMs, NULL, 10)) <= uNowMs)
+        {
+            /* It has expired. */
+        }
+        else
+        {
+            res = prvSetEntry(pxCache, pcRegion, pcStreamName, pcEndpoint, uExpireMs);
+        }
+
+        pcLine = pcNextLine;
+    }
+
+    return res;
+}
+
+DataEndpointCacheHandle DataEndpointCache_create(void)
+{
+    DataEndpointCache_t *pxCache = NULL;
+
+    if ((pxCache = (DataEndpointCache_t *)kvsMalloc(sizeof(DataEndpointCache_t))) == NULL)
+    {
+        LogError("OOM: pxCache");
+    }
+    else
+    {
+        memset(pxCache, 0, sizeof(DataEndpointCache_t));
+        DList_InitializeListHead(&(pxCache->xEntries));
+
+        if ((pxCache->xLock = Lock_Init()) == NULL)
+        {
+            LogError("Failed to initialize lock");
+            kvsFree(pxCache);
+            pxCache = NULL;
+        }
+    }
+
+    return (DataEndpointCacheHandle)pxCache;
+}
+
+void DataEndpointCache_terminate(DataEndpointCacheHandle xCache)
+{
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+
+    if (pxCache != NULL)
+    {
+        while (!DList_IsListEmpty(&(pxCache->xEntries)))
+        {
+            prvRemoveEntry(containingRecord(pxCache->xEntries.Flink, DataEndpointEntry_t, xEntry));
+        }
+        Lock_Deinit(pxCache->xLock);
+        kvsFree(pxCache);
+    }
+}
+
+int DataEndpointCache_get(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName, char **ppcEndpoint)
+{
+    int res = KVS_ERRNO_NONE;
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+    DataEndpointEntry_t *pxEntry = NULL;
+    size_t uEndpointLen = 0;
+    char *pcEndpoint = NULL;
+
+    if (pxCache == NULL || pcRegion == NULL || pcStreamName == NULL || ppcEndpoint == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        if ((pxEntry = prvFindEntry(pxCache, pcRegion, pcStreamName)) == NULL)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_MISS;
+        }
+        else if (pxEntry->uExpireMs <= getEpochTimestampInMs())
+        {
+            /* The entry is kept, so saving doesn't bring back the endpoint of another app that shares the file. */
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_MISS;
+        }
+        else if ((pcEndpoint = (char *)kvsMalloc((uEndpointLen = strlen(pxEntry->pcEndpoint)) + 1)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: pcEndpoint");
+        }
+        else
+        {
+            memcpy(pcEndpoint, pxEntry->pcEndpoint, uEndpointLen + 1);
+            *ppcEndpoint = pcEndpoint;
+        }
+        Unlock(pxCache->xLock);
+    }
+
+    return res;
+}
+
+int DataEndpointCache_set(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName, const char *pcEndpoint, uint32_t uTtlSec)
+{
+    int res = KVS_ERRNO_NONE;
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+
+    if (pxCache == NULL || pcRegion == NULL || pcStreamName == NULL || pcEndpoint == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (strchr(pcRegion, ' ') != NULL || strchr(pcStreamName, ' ') != NULL || strchr(pcEndpoint, ' ') != NULL)
+    {
+        /* Names of regions and streams, and host names, never have spaces, which separate them in the file. */
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        res = prvSetEntry(pxCache, pcRegion, pcStreamName, pcEndpoint, getEpochTimestampInMs() + (uint64_t)uTtlSec * 1000);
+        Unlock(pxCache->xLock);
+    }
+
+    return res;
+}
+
+void DataEndpointCache_remove(DataEndpointCacheHandle xCache, const char *pcRegion, const char *pcStreamName)
+{
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+    DataEndpointEntry_t *pxEntry = NULL;
+
+    if (pxCache != NULL && pcRegion != NULL && pcStreamName != NULL && Lock(pxCache->xLock) == LOCK_OK)
+    {
+        /* The entry expires instead of being removed, so saving doesn't bring back the endpoint from the file. */
+        if ((pxEntry = prvFindEntry(pxCache, pcRegion, pcStreamName)) != NULL)
+        {
+            pxEntry->uExpireMs = 0;
+        }
+        Unlock(pxCache->xLock);
+    }
+}
+
+/* Read the whole file into a terminated buffer, which is freed by the caller. */
+static int prvReadFile(const char *pcPath, char **ppcBuf)
+{
+    int res = KVS_ERRNO_NONE;
+    FILE *fp = NULL;
+    long xFileLen = 0;
+    char *pcBuf = NULL;
+
+    if ((fp = fopen(pcPath, "rb")) == NULL)
+    {
+        res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+        LogInfo("No data endpoint cache file %s", pcPath);
+    }
+    else if (fseek(fp, 0, SEEK_END) != 0 || (xFileLen = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+        LogError("Failed to get the size of %s", pcPath);
+    }
+    else if ((pcBuf = (char *)kvsMalloc((size_t)xFileLen + 1)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pcBuf");
+    }
+    else if (fread(pcBuf, 1, (size_t)xFileLen, fp) != (size_t)xFileLen)
+    {
+        res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+        LogError("Failed to read %s", pcPath);
+        kvsFree(pcBuf);
+    }
+    else
+    {
+        pcBuf[xFileLen] = '\0';
+        *ppcBuf = pcBuf;
+    }
+
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    return res;
+}
+
+static int prvWriteEntries(FILE *fp, PDLIST_ENTRY pxListHead, DataEndpointCache_t *pxSkipCache, uint64_t uNowMs)
+{
+    int res = KVS_ERRNO_NONE;
+    PDLIST_ENTRY pxListItem = pxListHead->Flink;
+    DataEndpointEntry_t *pxEntry = NULL;
+
+    while (pxListItem != pxListHead && res == KVS_ERRNO_NONE)
+    {
+        pxEntry = containingRecord(pxListItem, DataEndpointEntry_t, xEntry);
+        if (pxEntry->uExpireMs <= uNowMs || (pxSkipCache != NULL && prvFindEntry(pxSkipCache, pxEntry->pcRegion, pxEntry->pcStreamName) != NULL))
+        {
+            /* It has expired, or it's replaced by the entry of the cache. */
+        }
+        else if (fprintf(fp, "%" PRIu64 " %s %s %s\n", pxEntry->uExpireMs, pxEntry->pcRegion, pxEntry->pcStreamName, pxEntry->pcEndpoint) < 0)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+        }
+        else
+        {
+            /* nop */
+        }
+        pxListItem = pxListItem->Flink;
+    }
+
+    return res;
+}
+
+int DataEndpointCache_load(DataEndpointCacheHandle xCache, const char *pcPath)
+{
+    int res = KVS_ERRNO_NONE;
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+    char *pcBuf = NULL;
+
+    if (pxCache == NULL || pcPath == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if ((res = prvReadFile(pcPath, &pcBuf)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        res = prvDataEndpointCacheParse(pxCache, pcBuf);
+        Unlock(pxCache->xLock);
+    }
+
+    if (pcBuf != NULL)
+    {
+        kvsFree(pcBuf);
+    }
+
+    return res;
+}
+
+int DataEndpointCache_save(DataEndpointCacheHandle xCache, const char *pcPath)
+{
+    int res = KVS_ERRNO_NONE;
+    DataEndpointCache_t *pxCache = (DataEndpointCache_t *)xCache;
+    DataEndpointCache_t xFileCache = {0};
+    FileWriter_t xWriter = {0};
+    char *pcBuf = NULL;
+    uint64_t uNowMs = getEpochTimestampInMs();
+
+    DList_InitializeListHead(&(xFileCache.xEntries));
+
+    if (pxCache == NULL || pcPath == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        /* Other apps may share the file, so their endpoints in it are kept, unless this cache has the same streams. */
+        if (prvReadFile(pcPath, &pcBuf) == KVS_ERRNO_NONE && prvDataEndpointCacheParse(&xFileCache, pcBuf) != KVS_ERRNO_NONE)
+        {
+            LogInfo("Replace invalid data endpoint cache file %s", pcPath);
+        }
+
+        /* The file is replaced at once, so a crash or another app never reads a partial file. */
+        if (FileWriter_open(&xWriter, pcPath) != KVS_ERRNO_NONE)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+            LogError("Failed to write %s", pcPath);
+        }
+        else if (
+            fprintf(xWriter.fp, "%s\n", DATA_ENDPOINT_CACHE_FILE_MAGIC) < 0 || prvWriteEntries(xWriter.fp, &(xFileCache.xEntries), pxCache, uNowMs) != KVS_ERRNO_NONE ||
+            prvWriteEntries(xWriter.fp, &(pxCache->xEntries), NULL, uNowMs) != KVS_ERRNO_NONE)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+            LogError("Failed to write %s", pcPath);
+            FileWriter_abort(&xWriter);
+        }
+        else if (FileWriter_commit(&xWriter) != KVS_ERRNO_NONE)
+        {
+            res = KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR;
+            LogError("Failed to write %s", pcPath);
+        }
+        else
+        {
+            /* nop */
+        }
+        Unlock(pxCache->xLock);
+    }
+
+    while (!DList_IsListEmpty(&(xFileCache.xEntries)))
+    {
+        prvRemoveEntry(containingRecord(xFileCache.xEntries.Flink, DataEndpointEntry_t, xEntry));
+    }
+    if (pcBuf != NULL)
+    {
+        kvsFree(pcBuf);
+    }
+
+    return res;
+}
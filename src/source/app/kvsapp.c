@@ -13,27 +13,44 @@
  * permissions and limitations under the License.
  */
 
+#if defined(KVS_USE_SENDER_THREAD) && defined(__linux__)
+/* For the CPU affinity of the sender thread */
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <string.h>
 
+#ifdef KVS_USE_SENDER_THREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 /* Third-party headers */
 #include "azure_c_shared_utility/crt_abstractions.h"
 #include "azure_c_shared_utility/lock.h"
 #include "azure_c_shared_utility/xlogging.h"
 
 /* KVS headers */
+#include "kvs/control_plane_client.h"
+#include "kvs/data_endpoint_cache.h"
 #include "kvs/errors.h"
 #include "kvs/iot_credential_provider.h"
 #include "kvs/nalu.h"
 #include "kvs/port.h"
 #include "kvs/restapi.h"
 #include "kvs/stream.h"
+#include "kvs/stream_retention.h"
+#include "kvs/stream_spill.h"
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
 
 #include "kvs/kvsapp.h"
 #include "kvs/kvsapp_options.h"
 
 /* Internal headers */
 #include "os/allocator.h"
+#include "os/atomic.h"
 
 #define VIDEO_CODEC_NAME "V_MPEG4/ISO/AVC"
 #define VIDEO_TRACK_NAME "kvs video track"
@@ -44,9 +61,46 @@
 #define DEFAULT_PUT_MEDIA_SEND_TIMEOUT_MS (1 * 1000)
 #define DEFAULT_RING_BUFFER_MEM_LIMIT (1 * 1024 * 1024)
 
+/* Maximum number of frames evicted from the stream under one lock */
+#define STREAM_FLUSH_BATCH_SIZE (32)
+
+/* Expected average frame size, used to estimate how many data frame descriptors to preallocate */
+#define STREAM_POOL_AVERAGE_FRAME_SIZE (4 * 1024)
+
+/* Segment files of STREAM_POLICY_SPILL_RING_BUFFER */
+#define DEFAULT_STREAM_SPILL_DIR "."
+#define DEFAULT_STREAM_SPILL_MAX_SIZE (64 * 1024 * 1024)
+#define STREAM_SPILL_SEGMENT_SIZE (4 * 1024 * 1024)
+
+/* Limits of the frames sent in one write by DO_WORK_SEND_BATCH */
+#define SEND_BATCH_MAX_FRAME_CNT (64)
+#define SEND_BATCH_MAX_SIZE (128 * 1024)
+
+/* The longest time doWork waits for a frame or a fragment ACK when it has nothing to send */
+#define DO_WORK_MAX_WAIT_MS (1000)
+
+/* The time doWork waits before it tries the data which a non-blocking socket didn't take again */
+#define DO_WORK_SEND_PENDING_WAIT_MS (10)
+
+/* TLS sessions are kept for the IoT credential host, the KVS host and the data endpoint. */
+#define TLS_SESSION_CACHE_MAX_HOSTS (4)
+
+/* The data endpoint of a stream rarely changes, and a cached one is discovered again if PUT MEDIA fails on it. */
+#define DEFAULT_DATA_ENDPOINT_CACHE_TTL_SEC (24 * 60 * 60)
+
+/* Backoff of the sender thread before it reconnects, doubled on every failed open */
+#define SENDER_RECONNECT_MIN_BACKOFF_MS (1000)
+#define SENDER_RECONNECT_MAX_BACKOFF_MS (30 * 1000)
+
 typedef struct PolicyRingBufferParameter
 {
     size_t uMemLimit;
+
+    /* Only used by STREAM_POLICY_GOP_RING_BUFFER */
+    bool bKeepAudio;
+
+    /* Only used by STREAM_POLICY_SPILL_RING_BUFFER */
+    size_t uSpillMaxSize;
 } PolicyRingBufferParameter_t;
 
 typedef struct StreamStrategy
@@ -103,6 +157,44 @@ typedef struct KvsApp
     PutMediaHandle xPutMediaHandle;
     bool isEbmlHeaderUpdated;
     StreamStrategy_t xStrategy;
+    size_t uLockFreeQueueSize;
+
+    /* Limits of a fragment, or 0 if there is no limit */
+    unsigned int uFragmentDurationMs;
+    size_t uFragmentMaxSize;
+
+    /* GOPs spilled by STREAM_POLICY_SPILL_RING_BUFFER. xLock serializes the thread spilling them and the thread sending
+     * them, so no frame in the stream is sent before an older frame is spilled. */
+    StreamSpillHandle xSpillHandle;
+    char *pSpillDir;
+
+    /* Sent frames kept until their fragments are persisted, so they are replayed after a reconnect. It's only created
+     * if the limit of their size isn't 0. */
+    StreamRetentionHandle xRetention;
+    size_t uRetentionMemLimit;
+
+    /* TLS sessions resumed by the next connections, and the file where they are saved */
+    TlsSessionCacheHandle xTlsSessionCache;
+    char *pTlsSessionCacheFile;
+
+    /* The random generator and the parsed X509 credentials shared by all connections */
+    TlsContextHandle xTlsContext;
+
+    /* The largest TLS record the servers are asked to send, or 0 for full-size records */
+    unsigned int uTlsMaxFragmentLen;
+
+    /* The transport of the connections to the KVS service, or NULL for TLS with mbedTLS */
+    const struct NetIoTransport *pxNetIoTransport;
+
+    /* The kept-alive connections to the KVS service host and the IoT credential host */
+    ControlPlaneClientHandle xControlPlaneClient;
+    ControlPlaneClientHandle xIotControlPlaneClient;
+
+    /* Data endpoints used by KvsApp_open without discovering them, the file where they are saved, and how long they
+     * are used */
+    DataEndpointCacheHandle xDataEndpointCache;
+    char *pDataEndpointCacheFile;
+    uint32_t uDataEndpointCacheTtlSec;
 
     /* Track information */
     VideoTrackInfo_t *pVideoTrackInfo;
@@ -119,6 +211,29 @@ typedef struct KvsApp
 
     /* Session scope callbacks */
     OnMkvSentCallbackInfo_t onMkvSentCallbackInfo;
+
+    /* The buffer where DO_WORK_SEND_BATCH copies a batch of frames, so they are sent in one write */
+    uint8_t *pBatchBuf;
+    size_t uBatchBufSize;
+
+    /* The stream signals it when a frame is added, so doWork can wait for it instead of sleeping */
+    WakeupHandle xWakeup;
+
+#ifdef KVS_USE_SENDER_THREAD
+    /* The sender thread started by KvsApp_start() */
+    pthread_t xSenderTid;
+    bool bIsSenderRunning;
+    bool bStopSender;
+    SenderParameter_t xSenderPara;
+
+    /* The setup thread started by KvsApp_openAsync(). It's joined by the next call after it's done. bIsOpenDone is false
+     * only while it's setting up the connection. */
+    pthread_t xOpenTid;
+    bool bIsOpenRunning;
+    bool bIsOpenDone;
+    OnOpenCompleteCallback_t onOpenComplete;
+    void *pOpenAppData;
+#endif
 } KvsApp_t;
 
 typedef struct DataFrameUserData
@@ -275,10 +390,6 @@ static void prvStreamFlush(KvsApp_t *pKvs)
     {
         pDataFrameIn = (DataFrameIn_t *)xDataFrameHandle;
         prvCallOnDataFrameTerminate(pDataFrameIn);
-        if (pDataFrameIn->pUserData != NULL)
-        {
-            kvsFree(pDataFrameIn->pUserData);
-        }
         Kvs_dataFrameTerminate(xDataFrameHandle);
     }
 }
@@ -315,10 +426,6 @@ static int prvStreamFlushToNextCluster(KvsApp_t *pKvs)
                 xDataFrameHandle = Kvs_streamPop(xStreamHandle);
                 pDataFrameIn = (DataFrameIn_t *)xDataFrameHandle;
                 prvCallOnDataFrameTerminate(pDataFrameIn);
-                if (pDataFrameIn->pUserData != NULL)
-                {
-                    kvsFree(pDataFrameIn->pUserData);
-                }
                 Kvs_dataFrameTerminate(xDataFrameHandle);
             }
         }
@@ -330,20 +437,302 @@ static int prvStreamFlushToNextCluster(KvsApp_t *pKvs)
 static void prvStreamFlushHeadUntilMem(KvsApp_t *pKvs, size_t uMemLimit)
 {
     StreamHandle xStreamHandle = pKvs->xStreamHandle;
-    DataFrameHandle xDataFrameHandle = NULL;
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
     DataFrameIn_t *pDataFrameIn = NULL;
-    size_t uMemTotal = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
 
-    while (Kvs_streamMemStatTotal(xStreamHandle, &uMemTotal) == 0 && uMemTotal > uMemLimit && (xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+    do
     {
-        pDataFrameIn = (DataFrameIn_t *)xDataFrameHandle;
-        prvCallOnDataFrameTerminate(pDataFrameIn);
-        if (pDataFrameIn->pUserData != NULL)
+        if (Kvs_streamPopUntilMem(xStreamHandle, uMemLimit, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
         {
-            kvsFree(pDataFrameIn->pUserData);
+            break;
         }
-        Kvs_dataFrameTerminate(xDataFrameHandle);
+
+        /* Callbacks are invoked after the stream lock is released. */
+        for (i = 0; i < uCnt; i++)
+        {
+            pDataFrameIn = (DataFrameIn_t *)xDataFrameHandles[i];
+            prvCallOnDataFrameTerminate(pDataFrameIn);
+            Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+        }
+    } while (uCnt == STREAM_FLUSH_BATCH_SIZE);
+}
+
+static void prvStreamFlushGopUntilMem(KvsApp_t *pKvs, size_t uMemLimit, bool bKeepAudio)
+{
+    StreamHandle xStreamHandle = pKvs->xStreamHandle;
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
+    DataFrameIn_t *pDataFrameIn = NULL;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    do
+    {
+        if (Kvs_streamPopGopUntilMem(xStreamHandle, uMemLimit, bKeepAudio, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
+        {
+            break;
+        }
+
+        for (i = 0; i < uCnt; i++)
+        {
+            pDataFrameIn = (DataFrameIn_t *)xDataFrameHandles[i];
+            prvCallOnDataFrameTerminate(pDataFrameIn);
+            Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+        }
+    } while (uCnt > 0);
+}
+
+static void prvStreamFlushDroppableUntilMem(KvsApp_t *pKvs, size_t uMemLimit)
+{
+    StreamHandle xStreamHandle = pKvs->xStreamHandle;
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
+    DataFrameIn_t *pDataFrameIn = NULL;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    do
+    {
+        if (Kvs_streamPopDroppableUntilMem(xStreamHandle, uMemLimit, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
+        {
+            break;
+        }
+
+        for (i = 0; i < uCnt; i++)
+        {
+            pDataFrameIn = (DataFrameIn_t *)xDataFrameHandles[i];
+            prvCallOnDataFrameTerminate(pDataFrameIn);
+            Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+        }
+    } while (uCnt == STREAM_FLUSH_BATCH_SIZE);
+}
+
+#ifdef KVS_USE_STREAM_SPILL
+static void prvStreamSpillGopUntilMem(KvsApp_t *pKvs, size_t uMemLimit)
+{
+    StreamHandle xStreamHandle = pKvs->xStreamHandle;
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
+    DataFrameIn_t *pDataFrameIn = NULL;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    if (Lock(pKvs->xLock) != LOCK_OK)
+    {
+        LogError("Failed to lock");
+    }
+    else
+    {
+        do
+        {
+            if (Kvs_streamPopGopUntilMem(xStreamHandle, uMemLimit, false, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
+            {
+                break;
+            }
+
+            for (i = 0; i < uCnt; i++)
+            {
+                pDataFrameIn = (DataFrameIn_t *)xDataFrameHandles[i];
+
+                /* A frame which can't be spilled is dropped, as STREAM_POLICY_GOP_RING_BUFFER does. */
+                Kvs_streamSpillAppend(pKvs->xSpillHandle, pDataFrameIn);
+                prvCallOnDataFrameTerminate(pDataFrameIn);
+                Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+            }
+        } while (uCnt > 0);
+
+        Unlock(pKvs->xLock);
+    }
+}
+#endif /* KVS_USE_STREAM_SPILL */
+
+/* Read the oldest spilled frame. The caller must hold xLock if there is a spill. */
+static int prvStreamSpillRead(KvsApp_t *pKvs, SpillFrame_t *pxSpillFrame)
+{
+    int res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
+
+#ifdef KVS_USE_STREAM_SPILL
+    if (pKvs->xSpillHandle != NULL && !Kvs_streamSpillIsEmpty(pKvs->xSpillHandle))
+    {
+        res = Kvs_streamSpillRead(pKvs->xSpillHandle, pxSpillFrame);
+    }
+#endif
+
+    return res;
+}
+
+/* Drop spilled frames until the spill starts with a cluster. It fails if nothing is spilled. */
+static int prvStreamSpillFlushToNextCluster(KvsApp_t *pKvs)
+{
+    int res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
+
+#ifdef KVS_USE_STREAM_SPILL
+    if (pKvs->xSpillHandle == NULL)
+    {
+        /* Nothing is spilled. */
+    }
+    else if (Lock(pKvs->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        res = Kvs_streamSpillFlushToNextCluster(pKvs->xSpillHandle);
+        Unlock(pKvs->xLock);
+    }
+#endif
+
+    return res;
+}
+
+static int prvStreamSpillCreate(KvsApp_t *pKvs)
+{
+    int res = KVS_ERRNO_NONE;
+
+#ifdef KVS_USE_STREAM_SPILL
+    size_t uMaxSize = pKvs->xStrategy.xRingBufferPara.uSpillMaxSize;
+
+    if (pKvs->xStrategy.xPolicy == STREAM_POLICY_SPILL_RING_BUFFER && pKvs->xSpillHandle == NULL)
+    {
+        pKvs->xSpillHandle = Kvs_streamSpillCreate(
+            (pKvs->pSpillDir != NULL) ? pKvs->pSpillDir : DEFAULT_STREAM_SPILL_DIR, (uMaxSize < STREAM_SPILL_SEGMENT_SIZE) ? uMaxSize : STREAM_SPILL_SEGMENT_SIZE, uMaxSize);
+        if (pKvs->xSpillHandle == NULL)
+        {
+            res = KVS_ERROR_FAIL_TO_CREATE_STREAM_HANDLE;
+            LogError("Failed to create stream spill");
+        }
+        else
+        {
+            LogInfo("KVS stream spill created");
+        }
+    }
+#endif
+
+    return res;
+}
+
+static int prvStreamRetentionCreate(KvsApp_t *pKvs)
+{
+    int res = KVS_ERRNO_NONE;
+
+    if (pKvs->uRetentionMemLimit > 0 && pKvs->xRetention == NULL)
+    {
+        if ((pKvs->xRetention = Kvs_streamRetentionCreate(pKvs->uRetentionMemLimit)) == NULL)
+        {
+            res = KVS_ERROR_FAIL_TO_CREATE_STREAM_HANDLE;
+            LogError("Failed to create stream retention");
+        }
+        else
+        {
+            LogInfo("KVS stream retention created");
+        }
+    }
+
+    return res;
+}
+
+static void prvDataFramesTerminate(DataFrameHandle *pxDataFrameHandles, size_t uCnt)
+{
+    size_t i = 0;
+
+    for (i = 0; i < uCnt; i++)
+    {
+        prvCallOnDataFrameTerminate((DataFrameIn_t *)pxDataFrameHandles[i]);
+        Kvs_dataFrameTerminate(pxDataFrameHandles[i]);
+    }
+}
+
+/* Keep a sent frame until its fragment is persisted, and evict the oldest clusters beyond the limit. It returns false if
+ * the frame isn't kept, and the caller still has to terminate it. */
+static bool prvStreamRetentionKeep(KvsApp_t *pKvs, DataFrameHandle xDataFrameHandle)
+{
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
+    bool bIsRetained = false;
+    size_t uCnt = 0;
+
+    if (pKvs->xRetention != NULL && Kvs_streamRetentionAdd(pKvs->xRetention, xDataFrameHandle, &bIsRetained) == KVS_ERRNO_NONE && bIsRetained)
+    {
+        do
+        {
+            if (Kvs_streamRetentionPopUntilMem(pKvs->xRetention, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
+            {
+                break;
+            }
+            if (uCnt > 0)
+            {
+                LogInfo("Evict %zu unacknowledged frames", uCnt);
+            }
+            prvDataFramesTerminate(xDataFrameHandles, uCnt);
+        } while (uCnt > 0);
+    }
+
+    return bIsRetained;
+}
+
+/* Release the kept frames whose fragments are persisted. */
+static void prvStreamRetentionRelease(KvsApp_t *pKvs)
+{
+    DataFrameHandle xDataFrameHandles[STREAM_FLUSH_BATCH_SIZE];
+    uint64_t uFragmentTimecode = 0;
+    size_t uCnt = 0;
+
+    if (pKvs->xRetention != NULL && Kvs_putMediaGetPersistedTimecode(pKvs->xPutMediaHandle, &uFragmentTimecode) == KVS_ERRNO_NONE)
+    {
+        do
+        {
+            if (Kvs_streamRetentionPopPersisted(pKvs->xRetention, uFragmentTimecode, xDataFrameHandles, STREAM_FLUSH_BATCH_SIZE, &uCnt) != KVS_ERRNO_NONE)
+            {
+                break;
+            }
+            prvDataFramesTerminate(xDataFrameHandles, uCnt);
+        } while (uCnt > 0);
+    }
+}
+
+/* Replay the kept frames on a new connection. It returns true if there is any. */
+static bool prvStreamRetentionRewind(KvsApp_t *pKvs)
+{
+    bool bHasRetainedFrames = false;
+
+    if (pKvs->xRetention != NULL && !Kvs_streamRetentionIsEmpty(pKvs->xRetention))
+    {
+        Kvs_streamRetentionRewind(pKvs->xRetention);
+        bHasRetainedFrames = true;
+    }
+
+    return bHasRetainedFrames;
+}
+
+/* Policies which keep the stream under the memory limit of xRingBufferPara. */
+static bool prvIsRingBufferPolicy(KvsApp_streamPolicy_t xPolicy)
+{
+    return xPolicy == STREAM_POLICY_RING_BUFFER || xPolicy == STREAM_POLICY_GOP_RING_BUFFER || xPolicy == STREAM_POLICY_DROPPABLE_FIRST_RING_BUFFER ||
+           xPolicy == STREAM_POLICY_SPILL_RING_BUFFER;
+}
+
+/* Evict frames according to the stream policy. */
+static void prvStreamApplyPolicy(KvsApp_t *pKvs)
+{
+    if (pKvs->xStrategy.xPolicy == STREAM_POLICY_RING_BUFFER)
+    {
+        prvStreamFlushHeadUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit);
     }
+    else if (pKvs->xStrategy.xPolicy == STREAM_POLICY_GOP_RING_BUFFER)
+    {
+        prvStreamFlushGopUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit, pKvs->xStrategy.xRingBufferPara.bKeepAudio);
+    }
+    else if (pKvs->xStrategy.xPolicy == STREAM_POLICY_DROPPABLE_FIRST_RING_BUFFER)
+    {
+        /* Evicting a GOP is a no-op if the droppable frames are enough. */
+        prvStreamFlushDroppableUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit);
+        prvStreamFlushGopUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit, pKvs->xStrategy.xRingBufferPara.bKeepAudio);
+    }
+#ifdef KVS_USE_STREAM_SPILL
+    else if (pKvs->xStrategy.xPolicy == STREAM_POLICY_SPILL_RING_BUFFER)
+    {
+        prvStreamSpillGopUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit);
+    }
+#endif
 }
 
 static VideoTrackInfo_t *prvCopyVideoTrackInfo(VideoTrackInfo_t *pSrcVideoTrackInfo)
@@ -451,7 +840,11 @@ static void updateIotCredential(KvsApp_t *pKvs)
         .pThingName = pKvs->pIotThingName,
         .pRootCA = pKvs->pIotX509RootCa,
         .pCertificate = pKvs->pIotX509Certificate,
-        .pPrivateKey = pKvs->pIotX509PrivateKey};
+        .pPrivateKey = pKvs->pIotX509PrivateKey,
+        .xTlsSessionCache = pKvs->xTlsSessionCache,
+        .xTlsContext = pKvs->xTlsContext,
+        .uTlsMaxFragmentLen = pKvs->uTlsMaxFragmentLen,
+        .xControlPlaneClient = pKvs->xIotControlPlaneClient};
 
     if (isIotCertAvailable(pKvs))
     {
@@ -478,6 +871,11 @@ static int updateAndVerifyRestfulReqParameters(KvsApp_t *pKvs)
     pKvs->xServicePara.pcService = pKvs->pService;
     pKvs->xServicePara.uRecvTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
     pKvs->xServicePara.uSendTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
+    pKvs->xServicePara.xTlsSessionCache = pKvs->xTlsSessionCache;
+    pKvs->xServicePara.xTlsContext = pKvs->xTlsContext;
+    pKvs->xServicePara.uTlsMaxFragmentLen = pKvs->uTlsMaxFragmentLen;
+    pKvs->xServicePara.pxNetIoTransport = pKvs->pxNetIoTransport;
+    pKvs->xServicePara.xControlPlaneClient = pKvs->xControlPlaneClient;
 
     if (pKvs->pToken != NULL)
     {
@@ -518,11 +916,48 @@ static int updateAndVerifyRestfulReqParameters(KvsApp_t *pKvs)
     return res;
 }
 
-static int setupDataEndpoint(KvsApp_t *pKvs)
+/* Cache the discovered data endpoint, and save it to the file if there is one. */
+static void saveDataEndpoint(KvsApp_t *pKvs)
+{
+    if (DataEndpointCache_set(pKvs->xDataEndpointCache, pKvs->pRegion, pKvs->pStreamName, pKvs->pDataEndpoint, pKvs->uDataEndpointCacheTtlSec) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to cache data endpoint");
+    }
+    else if (pKvs->pDataEndpointCacheFile != NULL && DataEndpointCache_save(pKvs->xDataEndpointCache, pKvs->pDataEndpointCacheFile) != KVS_ERRNO_NONE)
+    {
+        /* It's only discovered again after a restart. */
+        LogError("Failed to save data endpoints to %s", pKvs->pDataEndpointCacheFile);
+    }
+    else
+    {
+        /* nop */
+    }
+}
+
+/* Forget the data endpoint, so the next setupDataEndpoint discovers it. The file is saved too, or a restart would load
+ * the stale endpoint again. */
+static void invalidateDataEndpoint(KvsApp_t *pKvs)
+{
+    DataEndpointCache_remove(pKvs->xDataEndpointCache, pKvs->pRegion, pKvs->pStreamName);
+    if (pKvs->pDataEndpointCacheFile != NULL && DataEndpointCache_save(pKvs->xDataEndpointCache, pKvs->pDataEndpointCacheFile) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to save data endpoints to %s", pKvs->pDataEndpointCacheFile);
+    }
+    if (pKvs->pDataEndpoint != NULL)
+    {
+        kvsFree(pKvs->pDataEndpoint);
+        pKvs->pDataEndpoint = NULL;
+    }
+    pKvs->xServicePara.pcPutMediaEndpoint = NULL;
+}
+
+static int setupDataEndpoint(KvsApp_t *pKvs, bool *pbIsCached)
 {
     int res = KVS_ERRNO_NONE;
     unsigned int uHttpStatusCode = 0;
 
+    *pbIsCached = false;
+
     if (pKvs == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
@@ -533,6 +968,12 @@ static int setupDataEndpoint(KvsApp_t *pKvs)
         {
             /* Since we already have the endpoint, we needn't update it again. */
         }
+        else if (DataEndpointCache_get(pKvs->xDataEndpointCache, pKvs->pRegion, pKvs->pStreamName, &(pKvs->pDataEndpoint)) == KVS_ERRNO_NONE)
+        {
+            LogInfo("Use the cached data endpoint");
+            pKvs->xServicePara.pcPutMediaEndpoint = pKvs->pDataEndpoint;
+            *pbIsCached = true;
+        }
         else
         {
             LogInfo("Try to describe stream");
@@ -574,6 +1015,7 @@ static int setupDataEndpoint(KvsApp_t *pKvs)
                 else
                 {
                     pKvs->xServicePara.pcPutMediaEndpoint = pKvs->pDataEndpoint;
+                    saveDataEndpoint(pKvs);
                 }
             }
         }
@@ -587,54 +1029,151 @@ static int setupDataEndpoint(KvsApp_t *pKvs)
     return res;
 }
 
-static int updateEbmlHeader(KvsApp_t *pKvs)
+static int startPutMedia(KvsApp_t *pKvs)
 {
     int res = KVS_ERRNO_NONE;
-    uint8_t *pEbmlSeg = NULL;
-    size_t uEbmlSegLen = 0;
+    unsigned int uHttpStatusCode = 0;
 
-    if (pKvs->xPutMediaHandle != NULL && !(pKvs->isEbmlHeaderUpdated))
+    if ((res = Kvs_putMediaStart(&(pKvs->xServicePara), &(pKvs->xPutMediaPara), &uHttpStatusCode, &(pKvs->xPutMediaHandle))) != KVS_ERRNO_NONE)
     {
-        LogInfo("Flush to next cluster");
-        if ((res = prvStreamFlushToNextCluster(pKvs)) != KVS_ERRNO_NONE)
-        {
-            LogInfo("No cluster frame is found");
-            /* Propagate the res error */
-        }
-        else if ((res = Kvs_streamGetMkvEbmlSegHdr(pKvs->xStreamHandle, &pEbmlSeg, &uEbmlSegLen)) != KVS_ERRNO_NONE ||
-                 (res = Kvs_putMediaUpdateRaw(pKvs->xPutMediaHandle, pEbmlSeg, uEbmlSegLen)) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed to update EBML header");
-            /* Propagate the res error */
-        }
-        else
-        {
-            pKvs->isEbmlHeaderUpdated = true;
-
-            if (pKvs->onMkvSentCallbackInfo.onMkvSentCallback != NULL)
-            {
-                /* FIXME: Handle the return value in a proper way. */
-                pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pEbmlSeg, uEbmlSegLen, pKvs->onMkvSentCallbackInfo.pAppData);
-            }
-        }
+        LogError("Failed to setup PUT MEDIA");
+        /* Propagate the res error */
+    }
+    else if (uHttpStatusCode != 200)
+    {
+        res = KVS_GENERATE_RESTFUL_ERROR(uHttpStatusCode);
+        LogError("PUT MEDIA http status code:%d\n", uHttpStatusCode);
+    }
+    else
+    {
+        /* nop */
     }
 
     return res;
 }
 
-static int createStream(KvsApp_t *pKvs)
+/* Setup everything of KvsApp_open() but the stream buffer, so it can run in the setup thread of KvsApp_openAsync(). */
+static int prvOpenPutMedia(KvsApp_t *pKvs)
 {
     int res = KVS_ERRNO_NONE;
-    VideoTrackInfo_t xVideoTrackInfo = {0};
-    uint8_t *pCodecPrivateData = NULL;
-    size_t uCodecPrivateDataLen = 0;
+    bool bIsDataEndpointCached = false;
 
-    if (pKvs->xStreamHandle == NULL)
+    updateIotCredential(pKvs);
+    if ((res = updateAndVerifyRestfulReqParameters(pKvs)) != KVS_ERRNO_NONE)
     {
-        if (pKvs->pVideoTrackInfo == NULL && pKvs->pSps != NULL && pKvs->pPps != NULL)
+        LogError("Failed to setup KVS");
+        /* Propagate the res error */
+    }
+    else if ((res = setupDataEndpoint(pKvs, &bIsDataEndpointCached)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to setup data endpoint");
+        /* Propagate the res error */
+    }
+    else
+    {
+        if ((res = startPutMedia(pKvs)) != KVS_ERRNO_NONE && bIsDataEndpointCached)
         {
-            /* We don't have video track info, but we have SPS & PPS to generate video track info from it. */
-            if ((res = NALU_getH264VideoResolutionFromSps(pKvs->pSps, pKvs->uSpsLen, &(xVideoTrackInfo.uWidth), &(xVideoTrackInfo.uHeight))) != KVS_ERRNO_NONE ||
+            LogInfo("PUT MEDIA failed on the cached data endpoint, discover it again");
+            invalidateDataEndpoint(pKvs);
+            if ((res = setupDataEndpoint(pKvs, &bIsDataEndpointCached)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to setup data endpoint");
+                /* Propagate the res error */
+            }
+            else
+            {
+                res = startPutMedia(pKvs);
+            }
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+        }
+        else if (pKvs->pTlsSessionCacheFile != NULL && TlsSessionCache_save(pKvs->xTlsSessionCache, pKvs->pTlsSessionCacheFile) != KVS_ERRNO_NONE)
+        {
+            /* It's still streaming. The sessions are only not resumed after a restart. */
+            LogError("Failed to save TLS sessions to %s", pKvs->pTlsSessionCacheFile);
+        }
+        else
+        {
+            /* nop */
+        }
+    }
+
+    return res;
+}
+
+static int updateEbmlHeader(KvsApp_t *pKvs)
+{
+    int res = KVS_ERRNO_NONE;
+    uint8_t *pEbmlSeg = NULL;
+    size_t uEbmlSegLen = 0;
+
+    if (pKvs->xPutMediaHandle != NULL && !(pKvs->isEbmlHeaderUpdated))
+    {
+        LogInfo("Flush to next cluster");
+        /* Kept frames are replayed first, and they start at a cluster which the other frames continue, so nothing is
+         * flushed if there are any. Spilled frames are sent next, so the stream is flushed only if nothing is spilled. */
+        if (!prvStreamRetentionRewind(pKvs) && prvStreamSpillFlushToNextCluster(pKvs) != KVS_ERRNO_NONE && (res = prvStreamFlushToNextCluster(pKvs)) != KVS_ERRNO_NONE)
+        {
+            if (res == KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME)
+            {
+                /* A new connection may come before the first key frame. The header is sent with it, so it's not an error. */
+                res = KVS_ERRNO_NONE;
+            }
+            else
+            {
+                LogInfo("No cluster frame is found");
+                /* Propagate the res error */
+            }
+        }
+        else if ((res = Kvs_streamGetMkvEbmlSegHdr(pKvs->xStreamHandle, &pEbmlSeg, &uEbmlSegLen)) != KVS_ERRNO_NONE ||
+                 (res = Kvs_putMediaUpdateRaw(pKvs->xPutMediaHandle, pEbmlSeg, uEbmlSegLen)) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to update EBML header");
+            /* Propagate the res error */
+        }
+        else
+        {
+            pKvs->isEbmlHeaderUpdated = true;
+
+            if (pKvs->onMkvSentCallbackInfo.onMkvSentCallback != NULL)
+            {
+                /* FIXME: Handle the return value in a proper way. */
+                pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pEbmlSeg, uEbmlSegLen, pKvs->onMkvSentCallbackInfo.pAppData);
+            }
+        }
+    }
+
+    return res;
+}
+
+static size_t prvStreamPoolCnt(KvsApp_t *pKvs)
+{
+    size_t uMemLimit = DEFAULT_RING_BUFFER_MEM_LIMIT;
+
+    if (prvIsRingBufferPolicy(pKvs->xStrategy.xPolicy))
+    {
+        uMemLimit = pKvs->xStrategy.xRingBufferPara.uMemLimit;
+    }
+
+    return uMemLimit / STREAM_POOL_AVERAGE_FRAME_SIZE;
+}
+
+static int createStream(KvsApp_t *pKvs)
+{
+    int res = KVS_ERRNO_NONE;
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    uint8_t *pCodecPrivateData = NULL;
+    size_t uCodecPrivateDataLen = 0;
+
+    if (pKvs->xStreamHandle == NULL)
+    {
+        if (pKvs->pVideoTrackInfo == NULL && pKvs->pSps != NULL && pKvs->pPps != NULL)
+        {
+            /* We don't have video track info, but we have SPS & PPS to generate video track info from it. */
+            if ((res = NALU_getH264VideoResolutionFromSps(pKvs->pSps, pKvs->uSpsLen, &(xVideoTrackInfo.uWidth), &(xVideoTrackInfo.uHeight))) != KVS_ERRNO_NONE ||
                 (res = Mkv_generateH264CodecPrivateDataFromSpsPps(pKvs->pSps, pKvs->uSpsLen, pKvs->pPps, pKvs->uPpsLen, &pCodecPrivateData, &uCodecPrivateDataLen)) != KVS_ERRNO_NONE)
             {
                 LogError("Failed to generate video track info");
@@ -657,10 +1196,29 @@ static int createStream(KvsApp_t *pKvs)
 
         if (pKvs->pVideoTrackInfo != NULL)
         {
-            if ((pKvs->xStreamHandle = Kvs_streamCreate(pKvs->pVideoTrackInfo, pKvs->pAudioTrackInfo)) == NULL)
+            if (pKvs->uLockFreeQueueSize > 0)
+            {
+                pKvs->xStreamHandle = Kvs_streamCreateLockFree(pKvs->pVideoTrackInfo, pKvs->pAudioTrackInfo, sizeof(DataFrameUserData_t), pKvs->uLockFreeQueueSize);
+            }
+            else
+            {
+                pKvs->xStreamHandle = Kvs_streamCreateWithPool(pKvs->pVideoTrackInfo, pKvs->pAudioTrackInfo, sizeof(DataFrameUserData_t), prvStreamPoolCnt(pKvs));
+            }
+
+            if (pKvs->xStreamHandle == NULL)
             {
                 res = KVS_ERROR_FAIL_TO_CREATE_STREAM_HANDLE;
             }
+            else if ((res = Kvs_streamSetClusterLimit(pKvs->xStreamHandle, pKvs->uFragmentDurationMs, pKvs->uFragmentMaxSize)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to set fragment limits");
+                /* Propagate the res error */
+            }
+            else if ((res = Kvs_streamSetWakeup(pKvs->xStreamHandle, pKvs->xWakeup)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to set stream wakeup");
+                /* Propagate the res error */
+            }
             else
             {
                 LogInfo("KVS stream buffer created");
@@ -670,6 +1228,11 @@ static int createStream(KvsApp_t *pKvs)
         }
     }
 
+    if (res == KVS_ERRNO_NONE && pKvs->xStreamHandle != NULL && (res = prvStreamSpillCreate(pKvs)) == KVS_ERRNO_NONE)
+    {
+        res = prvStreamRetentionCreate(pKvs);
+    }
+
     return res;
 }
 
@@ -751,29 +1314,151 @@ static int prvCheckOnDataFrameToBeSent(DataFrameHandle xDataFrameHandle)
     return res;
 }
 
-static int prvPutMediaSendData(KvsApp_t *pKvs, int *pxSendCnt, bool bForceSend)
+static int prvCallOnMkvSent(KvsApp_t *pKvs, uint8_t *pMkvHeader, size_t uMkvHeaderLen, uint8_t *pData, size_t uDataLen)
 {
     int res = KVS_ERRNO_NONE;
     int retVal = 0;
+
+    if (pKvs->onMkvSentCallbackInfo.onMkvSentCallback != NULL)
+    {
+        /* FIXME: Handle the return value in a proper way. */
+        if ((retVal = pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pMkvHeader, uMkvHeaderLen, pKvs->onMkvSentCallbackInfo.pAppData)) != 0)
+        {
+            res = KVS_GENERATE_CALLBACK_ERROR(retVal);
+        }
+        else if (uDataLen > 0 && (retVal = pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pData, uDataLen, pKvs->onMkvSentCallbackInfo.pAppData)) != 0)
+        {
+            res = KVS_GENERATE_CALLBACK_ERROR(retVal);
+        }
+        else
+        {
+            /* nop */
+        }
+    }
+
+    return res;
+}
+
+static int prvPutMediaSendSpilledData(KvsApp_t *pKvs, SpillFrame_t *pxSpillFrame)
+{
+    int res = KVS_ERRNO_NONE;
+
+    if ((res = Kvs_putMediaUpdate(pKvs->xPutMediaHandle, pxSpillFrame->pMkvHdr, pxSpillFrame->uMkvHdrLen, pxSpillFrame->pData, pxSpillFrame->uDataLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to update spilled frame");
+        /* Propagate the res error */
+    }
+    else
+    {
+        pKvs->uEarliestTimestamp = pxSpillFrame->uTimestampMs;
+        res = prvCallOnMkvSent(pKvs, pxSpillFrame->pMkvHdr, pxSpillFrame->uMkvHdrLen, pxSpillFrame->pData, pxSpillFrame->uDataLen);
+    }
+
+    return res;
+}
+
+static int prvPutMediaSendRetainedData(KvsApp_t *pKvs, DataFrameHandle xDataFrameHandle)
+{
+    int res = KVS_ERRNO_NONE;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+
+    /* The MKV header already has the tags it was sent with. */
+    if ((res = Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to get data and mkv header to replay");
+        /* Propagate the res error */
+    }
+    else if ((res = Kvs_putMediaUpdate(pKvs->xPutMediaHandle, pMkvHeader, uMkvHeaderLen, pData, uDataLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to replay");
+        /* Propagate the res error */
+    }
+    else
+    {
+        res = prvCallOnMkvSent(pKvs, pMkvHeader, uMkvHeaderLen, pData, uDataLen);
+    }
+
+    return res;
+}
+
+static int prvPutMediaSendData(KvsApp_t *pKvs, int *pxSendCnt, bool bForceSend)
+{
+    int res = KVS_ERRNO_NONE;
     DataFrameHandle xDataFrameHandle = NULL;
     DataFrameIn_t *pDataFrameIn = NULL;
+    SpillFrame_t xSpillFrame = {0};
+    bool bIsSpilled = false;
     uint8_t *pData = NULL;
     size_t uDataLen = 0;
     uint8_t *pMkvHeader = NULL;
     size_t uMkvHeaderLen = 0;
     int xSendCnt = 0;
+    DataFrameHandle xRetainedFrameHandle = NULL;
+    bool bIsRetainable = false;
 
-    if (pKvs->xStreamHandle != NULL &&
-        pKvs->isEbmlHeaderUpdated == true &&
-        Kvs_streamAvailOnTrack(pKvs->xStreamHandle, TRACK_VIDEO) &&
-        (!bForceSend || !pKvs->isAudioTrackPresent || Kvs_streamAvailOnTrack(pKvs->xStreamHandle, TRACK_AUDIO)))
+    if (pKvs->xStreamHandle != NULL && pKvs->isEbmlHeaderUpdated == true && (xRetainedFrameHandle = Kvs_streamRetentionNextReplay(pKvs->xRetention)) != NULL)
+    {
+        /* Frames kept from the previous connection go before any other frame. */
+    }
+    else if (pKvs->xStreamHandle != NULL && pKvs->isEbmlHeaderUpdated == true)
     {
-        if ((xDataFrameHandle = Kvs_streamPop(pKvs->xStreamHandle)) == NULL)
+        /* The spill is checked and the stream is popped under one lock, so no GOP is spilled in between. */
+        if (pKvs->xSpillHandle != NULL && Lock(pKvs->xLock) != LOCK_OK)
         {
-            res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
-            LogError("Failed to get data frame");
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to lock");
+        }
+        else
+        {
+            if ((res = prvStreamSpillRead(pKvs, &xSpillFrame)) == KVS_ERRNO_NONE)
+            {
+                bIsSpilled = true;
+            }
+            else if (res != KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME)
+            {
+                LogError("Failed to read spilled frame");
+                /* Propagate the res error */
+            }
+            else
+            {
+                res = KVS_ERRNO_NONE;
+                if (Kvs_streamAvailOnTrack(pKvs->xStreamHandle, TRACK_VIDEO) &&
+                    (!bForceSend || !pKvs->isAudioTrackPresent || Kvs_streamAvailOnTrack(pKvs->xStreamHandle, TRACK_AUDIO)) &&
+                    (xDataFrameHandle = Kvs_streamPop(pKvs->xStreamHandle)) == NULL)
+                {
+                    res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
+                    LogError("Failed to get data frame");
+                }
+            }
+
+            if (pKvs->xSpillHandle != NULL)
+            {
+                Unlock(pKvs->xLock);
+            }
+        }
+    }
+
+    if (xRetainedFrameHandle != NULL)
+    {
+        if ((res = prvPutMediaSendRetainedData(pKvs, xRetainedFrameHandle)) == KVS_ERRNO_NONE)
+        {
+            xSendCnt++;
         }
-        else if ((res = prvCheckOnDataFrameToBeSent(xDataFrameHandle)) != KVS_ERRNO_NONE)
+    }
+    else if (bIsSpilled)
+    {
+        /* The data stays in the mapping of the spill until the next frame is read from it. */
+        if ((res = prvPutMediaSendSpilledData(pKvs, &xSpillFrame)) == KVS_ERRNO_NONE)
+        {
+            xSendCnt++;
+        }
+    }
+    else if (xDataFrameHandle != NULL)
+    {
+        if ((res = prvCheckOnDataFrameToBeSent(xDataFrameHandle)) != KVS_ERRNO_NONE)
         {
             LogInfo("Failed to check OnDataFrameToBeSent");
             /* Propagate the res error */
@@ -793,6 +1478,9 @@ static int prvPutMediaSendData(KvsApp_t *pKvs, int *pxSendCnt, bool bForceSend)
         {
             LogError("Failed to update");
             /* Propagate the res error */
+
+            /* It may be partly sent, so it's replayed if it's kept. */
+            bIsRetainable = true;
         }
         else
         {
@@ -800,52 +1488,338 @@ static int prvPutMediaSendData(KvsApp_t *pKvs, int *pxSendCnt, bool bForceSend)
             pKvs->uEarliestTimestamp = pDataFrameIn->uTimestampMs;
 
             xSendCnt++;
+            bIsRetainable = true;
 
-            if (pKvs->onMkvSentCallbackInfo.onMkvSentCallback != NULL)
-            {
-                /* FIXME: Handle the return value in a proper way. */
-                if ((retVal = pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pMkvHeader, uMkvHeaderLen, pKvs->onMkvSentCallbackInfo.pAppData)) != 0)
-                {
-                    res = KVS_GENERATE_CALLBACK_ERROR(retVal);
-                }
-                else if ((retVal = pKvs->onMkvSentCallbackInfo.onMkvSentCallback(pData, uDataLen, pKvs->onMkvSentCallbackInfo.pAppData)) != 0)
-                {
-                    res = KVS_GENERATE_CALLBACK_ERROR(retVal);
-                }
-                else
-                {
-                    /* nop */
-                }
-            }
+            res = prvCallOnMkvSent(pKvs, pMkvHeader, uMkvHeaderLen, pData, uDataLen);
         }
 
-        if (xDataFrameHandle != NULL)
+        if (!bIsRetainable || !prvStreamRetentionKeep(pKvs, xDataFrameHandle))
         {
             pDataFrameIn = (DataFrameIn_t *)xDataFrameHandle;
             prvCallOnDataFrameTerminate(pDataFrameIn);
-            if (pDataFrameIn->pUserData != NULL)
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+        }
+    }
+
+    if (pxSendCnt != NULL)
+    {
+        *pxSendCnt = xSendCnt;
+    }
+
+    return res;
+}
+
+/* Get the MKV header and data of a popped frame, and copy them to the batch buffer. The frame is still owned by the
+ * caller. */
+static int prvBatchAppend(KvsApp_t *pKvs, DataFrameHandle xDataFrameHandle, size_t *puBatchLen)
+{
+    int res = KVS_ERRNO_NONE;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pBatchBuf = NULL;
+    size_t uBatchBufSize = 0;
+
+    if ((res = prvCheckOnDataFrameToBeSent(xDataFrameHandle)) != KVS_ERRNO_NONE)
+    {
+        LogInfo("Failed to check OnDataFrameToBeSent");
+        /* Propagate the res error */
+    }
+    else if ((res = Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to get data and mkv header to send");
+        /* Propagate the res error */
+    }
+    else if (
+        (((DataFrameIn_t *)xDataFrameHandle)->xClusterType == MKV_CLUSTER) && pKvs->tagsListLen > 0 &&
+        (res = Kvs_dataFrameAddTags(xDataFrameHandle, pKvs->tagsList, pKvs->tagsListLen, false, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to add tags");
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* The buffer only grows, so it settles at the size of the largest batch. */
+        uBatchBufSize = *puBatchLen + uMkvHeaderLen + uDataLen;
+        if (uBatchBufSize > pKvs->uBatchBufSize)
+        {
+            if ((pBatchBuf = (uint8_t *)kvsRealloc(pKvs->pBatchBuf, uBatchBufSize)) == NULL)
+            {
+                res = KVS_ERROR_OUT_OF_MEMORY;
+                LogError("OOM: pBatchBuf");
+            }
+            else
+            {
+                pKvs->pBatchBuf = pBatchBuf;
+                pKvs->uBatchBufSize = uBatchBufSize;
+            }
+        }
+
+        if (res == KVS_ERRNO_NONE)
+        {
+            memcpy(pKvs->pBatchBuf + *puBatchLen, pMkvHeader, uMkvHeaderLen);
+            memcpy(pKvs->pBatchBuf + *puBatchLen + uMkvHeaderLen, pData, uDataLen);
+            *puBatchLen += uMkvHeaderLen + uDataLen;
+        }
+    }
+
+    return res;
+}
+
+/* Pop a run of ready frames under one lock, and send them in one write. Spilled frames go first, one at a time. */
+static int prvPutMediaSendBatch(KvsApp_t *pKvs, int *pxSendCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    int xRes = KVS_ERRNO_NONE;
+    DataFrameHandle xDataFrameHandles[SEND_BATCH_MAX_FRAME_CNT];
+    bool bIsAppended[SEND_BATCH_MAX_FRAME_CNT];
+    DataFrameIn_t *pDataFrameIn = NULL;
+    uint64_t uLastTimestampMs = 0;
+    bool bIsSpilled = false;
+    bool bIsReplaying = false;
+    size_t uBatchLen = 0;
+    size_t uCnt = 0;
+    size_t uAppendedCnt = 0;
+    size_t i = 0;
+
+    if (pKvs->xStreamHandle != NULL && pKvs->isEbmlHeaderUpdated == true)
+    {
+        /* The spill is checked and the stream is popped under one lock, so no GOP is spilled in between. */
+        if (pKvs->xSpillHandle != NULL && Lock(pKvs->xLock) != LOCK_OK)
+        {
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to lock");
+        }
+        else
+        {
+            bIsReplaying = !Kvs_streamRetentionIsReplayDone(pKvs->xRetention);
+#ifdef KVS_USE_STREAM_SPILL
+            bIsSpilled = (pKvs->xSpillHandle != NULL && !Kvs_streamSpillIsEmpty(pKvs->xSpillHandle));
+#endif
+            if (!bIsReplaying && !bIsSpilled &&
+                (res = Kvs_streamPopBatch(pKvs->xStreamHandle, SEND_BATCH_MAX_FRAME_CNT, SEND_BATCH_MAX_SIZE, false, xDataFrameHandles, &uCnt)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to pop data frames");
+                /* Propagate the res error */
+            }
+
+            if (pKvs->xSpillHandle != NULL)
             {
-                kvsFree(pDataFrameIn->pUserData);
+                Unlock(pKvs->xLock);
+            }
+        }
+    }
+
+    if (bIsReplaying || bIsSpilled)
+    {
+        res = prvPutMediaSendData(pKvs, pxSendCnt, false);
+    }
+    else
+    {
+        /* A frame which fails its checks isn't sent, and the first error is returned after the rest are sent. */
+        for (i = 0; i < uCnt; i++)
+        {
+            bIsAppended[i] = false;
+            if ((xRes = prvBatchAppend(pKvs, xDataFrameHandles[i], &uBatchLen)) == KVS_ERRNO_NONE)
+            {
+                bIsAppended[i] = true;
+                uLastTimestampMs = ((DataFrameIn_t *)xDataFrameHandles[i])->uTimestampMs;
+                uAppendedCnt++;
+            }
+            else if (res == KVS_ERRNO_NONE)
+            {
+                res = xRes;
+            }
+        }
+
+        if (uBatchLen > 0 && (xRes = Kvs_putMediaUpdateRaw(pKvs->xPutMediaHandle, pKvs->pBatchBuf, uBatchLen)) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to update");
+            res = xRes;
+            uAppendedCnt = 0;
+        }
+        else if (uAppendedCnt > 0)
+        {
+            pKvs->uEarliestTimestamp = uLastTimestampMs;
+
+            /* The callback gets the same bytes as in the single frame mode, in one piece. */
+            if ((xRes = prvCallOnMkvSent(pKvs, pKvs->pBatchBuf, uBatchLen, NULL, 0)) != KVS_ERRNO_NONE && res == KVS_ERRNO_NONE)
+            {
+                res = xRes;
+            }
+        }
+
+        /* Appended frames are kept even if the write fails, since they may be partly sent. */
+        for (i = 0; i < uCnt; i++)
+        {
+            if (!bIsAppended[i] || !prvStreamRetentionKeep(pKvs, xDataFrameHandles[i]))
+            {
+                pDataFrameIn = (DataFrameIn_t *)xDataFrameHandles[i];
+                prvCallOnDataFrameTerminate(pDataFrameIn);
+                Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+            }
+        }
+
+        if (pxSendCnt != NULL)
+        {
+            *pxSendCnt = (int)uAppendedCnt;
+        }
+    }
+
+    return res;
+}
+
+/* Wait until a frame is added or a fragment ACK arrives. The coalesced frames are sent when their delay expires. */
+static void prvWaitForWork(KvsApp_t *pKvs)
+{
+    uint32_t uTimeoutMs = DO_WORK_MAX_WAIT_MS;
+
+    if (pKvs->xPutMediaPara.uCoalesceSize > 0 && pKvs->xPutMediaPara.uCoalesceDelayMs < uTimeoutMs)
+    {
+        uTimeoutMs = pKvs->xPutMediaPara.uCoalesceDelayMs;
+    }
+
+    /* It only waits for the socket to be readable, so the pending data is tried again soon. */
+    if (Kvs_putMediaIsSendPending(pKvs->xPutMediaHandle))
+    {
+        uTimeoutMs = DO_WORK_SEND_PENDING_WAIT_MS;
+    }
+
+    if (wakeupWait(pKvs->xWakeup, Kvs_putMediaGetSocket(pKvs->xPutMediaHandle), uTimeoutMs) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to wait for work");
+        sleepInMs(50);
+    }
+}
+
+/* Consume the signals before doWork, so a frame added in the meantime signals the wakeup again. */
+static void prvConsumeWakeup(KvsApp_t *pKvs, bool bNoWait)
+{
+    if (bNoWait && wakeupWait(pKvs->xWakeup, -1, 0) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to consume wakeup");
+    }
+}
+
+/* Wait for more work. With bNoWait, the wakeup is signalled instead if a frame is sent, so the event loop of the caller comes back for the rest. */
+static void prvWaitForWorkOrRearm(KvsApp_t *pKvs, int xSendCnt, bool bNoWait)
+{
+    if (!bNoWait)
+    {
+        if (xSendCnt == 0)
+        {
+            prvWaitForWork(pKvs);
+        }
+    }
+    else if (xSendCnt > 0)
+    {
+        wakeupSignal(pKvs->xWakeup);
+    }
+    else
+    {
+        /* nop */
+    }
+}
+
+static int prvPutMediaDoWorkDefault(KvsApp_t *pKvs, bool bNoWait)
+{
+    int res = KVS_ERRNO_NONE;
+    int xSendCnt = 0;
+
+    prvConsumeWakeup(pKvs, bNoWait);
+
+    do
+    {
+        /* The policy of a lock-free stream is applied by the consumer. */
+        if (pKvs->xStreamHandle != NULL && pKvs->uLockFreeQueueSize > 0)
+        {
+            prvStreamApplyPolicy(pKvs);
+        }
+
+        if ((res = updateEbmlHeader(pKvs)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+            break;
+        }
+
+        if ((res = Kvs_putMediaDoWork(pKvs->xPutMediaHandle)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+            break;
+        }
+        prvStreamRetentionRelease(pKvs);
+
+        /* Frames wait in the stream until a non-blocking socket takes the data sent before them. */
+        if (!Kvs_putMediaIsSendPending(pKvs->xPutMediaHandle) && (res = prvPutMediaSendData(pKvs, &xSendCnt, false)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+            break;
+        }
+    } while (false);
+
+    if (res == KVS_ERRNO_NONE)
+    {
+        prvWaitForWorkOrRearm(pKvs, xSendCnt, bNoWait);
+    }
+
+    return res;
+}
+
+static int prvPutMediaDoWorkSendEndOfFrames(KvsApp_t *pKvs)
+{
+    int res = KVS_ERRNO_NONE;
+    int xSendCnt = 0;
+
+    /* Nothing waits for a non-blocking socket to be writable here, so the rest is sent in the blocking mode. */
+    if (pKvs->xPutMediaPara.bNonBlocking && pKvs->xPutMediaHandle != NULL && (res = Kvs_putMediaUpdateNonBlocking(pKvs->xPutMediaHandle, false)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to send pending data");
+        /* Propagate the res error */
+    }
+    else
+    {
+        do
+        {
+            if ((res = updateEbmlHeader(pKvs)) != KVS_ERRNO_NONE)
+            {
+                /* Propagate the res error */
+                break;
+            }
+
+            if ((res = Kvs_putMediaDoWork(pKvs->xPutMediaHandle)) != KVS_ERRNO_NONE)
+            {
+                /* Propagate the res error */
+                break;
             }
-            Kvs_dataFrameTerminate(xDataFrameHandle);
-        }
-    }
+            prvStreamRetentionRelease(pKvs);
 
-    if (pxSendCnt != NULL)
-    {
-        *pxSendCnt = xSendCnt;
+            if ((res = prvPutMediaSendData(pKvs, &xSendCnt, true)) != KVS_ERRNO_NONE)
+            {
+                /* Propagate the res error */
+                break;
+            }
+        } while (xSendCnt > 0);
     }
 
     return res;
 }
 
-static int prvPutMediaDoWorkDefault(KvsApp_t *pKvs)
+static int prvPutMediaDoWorkSendBatch(KvsApp_t *pKvs, bool bNoWait)
 {
     int res = KVS_ERRNO_NONE;
     int xSendCnt = 0;
 
+    prvConsumeWakeup(pKvs, bNoWait);
+
     do
     {
+        /* The policy of a lock-free stream is applied by the consumer. */
+        if (pKvs->xStreamHandle != NULL && pKvs->uLockFreeQueueSize > 0)
+        {
+            prvStreamApplyPolicy(pKvs);
+        }
+
         if ((res = updateEbmlHeader(pKvs)) != KVS_ERRNO_NONE)
         {
             /* Propagate the res error */
@@ -857,51 +1831,203 @@ static int prvPutMediaDoWorkDefault(KvsApp_t *pKvs)
             /* Propagate the res error */
             break;
         }
+        prvStreamRetentionRelease(pKvs);
 
-        if ((res = prvPutMediaSendData(pKvs, &xSendCnt, false)) != KVS_ERRNO_NONE)
+        /* Frames wait in the stream until a non-blocking socket takes the data sent before them. */
+        if (!Kvs_putMediaIsSendPending(pKvs->xPutMediaHandle) && (res = prvPutMediaSendBatch(pKvs, &xSendCnt)) != KVS_ERRNO_NONE)
         {
             /* Propagate the res error */
             break;
         }
     } while (false);
 
-    if (xSendCnt == 0)
+    if (res == KVS_ERRNO_NONE)
     {
-        sleepInMs(50);
+        prvWaitForWorkOrRearm(pKvs, xSendCnt, bNoWait);
     }
 
     return res;
 }
 
-static int prvPutMediaDoWorkSendEndOfFrames(KvsApp_t *pKvs)
+#ifdef KVS_USE_SENDER_THREAD
+/* Deliver the pending fragment ACKs to the callback of the sender thread. */
+static void prvSenderDeliverFragmentAcks(KvsApp_t *pKvs)
+{
+    ePutMediaFragmentAckEventType eAckEventType = eUnknown;
+    uint64_t uFragmentTimecode = 0;
+    unsigned int uErrorId = 0;
+
+    while (KvsApp_readFragmentAck(pKvs, &eAckEventType, &uFragmentTimecode, &uErrorId) == KVS_ERRNO_NONE)
+    {
+        if (pKvs->xSenderPara.onFragmentAck != NULL)
+        {
+            pKvs->xSenderPara.onFragmentAck(eAckEventType, uFragmentTimecode, uErrorId, pKvs->xSenderPara.pAppData);
+        }
+    }
+}
+
+/* Wait for the backoff before reconnecting. It returns early if the sender thread is stopped. */
+static void prvSenderBackoff(KvsApp_t *pKvs, uint32_t uBackoffMs)
+{
+    uint64_t uDeadlineMs = getEpochTimestampInMs() + uBackoffMs;
+    uint64_t uNowMs = 0;
+
+    /* Added frames signal the wakeup too, so wait again until the deadline. */
+    while (!ATOMIC_LOAD_ACQUIRE(&(pKvs->bStopSender)) && (uNowMs = getEpochTimestampInMs()) < uDeadlineMs)
+    {
+        if (wakeupWait(pKvs->xWakeup, -1, (uint32_t)(uDeadlineMs - uNowMs)) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to wait for backoff");
+            sleepInMs(50);
+        }
+    }
+}
+
+static void *prvSenderThread(void *pArg)
 {
     int res = KVS_ERRNO_NONE;
-    int xSendCnt = 0;
+    KvsApp_t *pKvs = (KvsApp_t *)pArg;
+    DoWorkExParamter_t xDoWorkExPara = {0};
+    uint32_t uBackoffMs = SENDER_RECONNECT_MIN_BACKOFF_MS;
 
-    do
+    while (!ATOMIC_LOAD_ACQUIRE(&(pKvs->bStopSender)))
     {
-        if ((res = updateEbmlHeader(pKvs)) != KVS_ERRNO_NONE)
+        /* The connection set up by KvsApp_openAsync() is used if the sender is started in its callback. */
+        if (pKvs->xPutMediaHandle == NULL && (res = KvsApp_open(pKvs)) != KVS_ERRNO_NONE)
         {
-            /* Propagate the res error */
-            break;
+            LogError("Failed to open KVS app, err:-%X, retry in %u ms", -res, (unsigned int)uBackoffMs);
+            KvsApp_close(pKvs);
+            prvSenderBackoff(pKvs, uBackoffMs);
+            uBackoffMs = (uBackoffMs * 2 > SENDER_RECONNECT_MAX_BACKOFF_MS) ? SENDER_RECONNECT_MAX_BACKOFF_MS : uBackoffMs * 2;
         }
+        else
+        {
+            uBackoffMs = SENDER_RECONNECT_MIN_BACKOFF_MS;
 
-        if ((res = Kvs_putMediaDoWork(pKvs->xPutMediaHandle)) != KVS_ERRNO_NONE)
+            xDoWorkExPara.eType = pKvs->xSenderPara.eDoWorkType;
+            while (!ATOMIC_LOAD_ACQUIRE(&(pKvs->bStopSender)))
+            {
+                if ((res = KvsApp_doWorkEx(pKvs, &xDoWorkExPara)) != KVS_ERRNO_NONE)
+                {
+                    LogError("do work err:-%X", -res);
+                    break;
+                }
+
+                prvSenderDeliverFragmentAcks(pKvs);
+            }
+
+            xDoWorkExPara.eType = DO_WORK_SEND_END_OF_FRAMES;
+            KvsApp_doWorkEx(pKvs, &xDoWorkExPara);
+            prvSenderDeliverFragmentAcks(pKvs);
+            KvsApp_close(pKvs);
+
+            if (res != KVS_ERRNO_NONE)
+            {
+                prvSenderBackoff(pKvs, uBackoffMs);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Setup the CPU affinity and the scheduling of the sender thread. */
+static int prvSenderThreadAttrInit(pthread_attr_t *pxAttr, SenderParameter_t *pxPara)
+{
+    int res = KVS_ERRNO_NONE;
+    struct sched_param xSchedParam = {0};
+#ifdef __linux__
+    cpu_set_t xCpuSet;
+#endif
+
+    if (pthread_attr_init(pxAttr) != 0)
+    {
+        res = KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER;
+        LogError("Failed to init thread attribute");
+    }
+    else
+    {
+        if (pxPara->xCpuAffinity >= 0)
         {
-            /* Propagate the res error */
-            break;
+#ifdef __linux__
+            CPU_ZERO(&xCpuSet);
+            CPU_SET(pxPara->xCpuAffinity, &xCpuSet);
+            if (pthread_attr_setaffinity_np(pxAttr, sizeof(cpu_set_t), &xCpuSet) != 0)
+            {
+                res = KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER;
+                LogError("Failed to set CPU affinity %d", pxPara->xCpuAffinity);
+            }
+#else
+            res = KVS_ERROR_KVSAPP_SENDER_NOT_SUPPORTED;
+            LogError("CPU affinity is not supported");
+#endif
         }
 
-        if ((res = prvPutMediaSendData(pKvs, &xSendCnt, true)) != KVS_ERRNO_NONE)
+        if (res == KVS_ERRNO_NONE && pxPara->xPriority > 0)
         {
-            /* Propagate the res error */
-            break;
+            xSchedParam.sched_priority = pxPara->xPriority;
+            if (pthread_attr_setinheritsched(pxAttr, PTHREAD_EXPLICIT_SCHED) != 0 || pthread_attr_setschedpolicy(pxAttr, SCHED_FIFO) != 0 ||
+                pthread_attr_setschedparam(pxAttr, &xSchedParam) != 0)
+            {
+                res = KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER;
+                LogError("Failed to set priority %d", pxPara->xPriority);
+            }
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            pthread_attr_destroy(pxAttr);
         }
-    } while (xSendCnt > 0);
+    }
 
     return res;
 }
 
+static void *prvOpenThread(void *pArg)
+{
+    KvsApp_t *pKvs = (KvsApp_t *)pArg;
+    int res = prvOpenPutMedia(pKvs);
+
+    /* It's done before the callback, so the callback can go on with KvsApp_start or KvsApp_openAsync. */
+    ATOMIC_STORE_RELEASE(&(pKvs->bIsOpenDone), true);
+    if (pKvs->onOpenComplete != NULL)
+    {
+        pKvs->onOpenComplete(res, pKvs->pOpenAppData);
+    }
+
+    return NULL;
+}
+
+/* Wait for the setup thread of KvsApp_openAsync() if there is one. */
+static void prvOpenThreadJoin(KvsApp_t *pKvs)
+{
+    if (pKvs->bIsOpenRunning)
+    {
+        /* The callback runs in the setup thread, which can't join itself. */
+        if (pthread_equal(pthread_self(), pKvs->xOpenTid))
+        {
+            pthread_detach(pKvs->xOpenTid);
+        }
+        else
+        {
+            pthread_join(pKvs->xOpenTid, NULL);
+        }
+        pKvs->bIsOpenRunning = false;
+    }
+}
+#endif /* KVS_USE_SENDER_THREAD */
+
+/* Whether the setup thread of KvsApp_openAsync() is still setting up the connection. */
+static bool prvIsOpenRunning(KvsApp_t *pKvs)
+{
+#ifdef KVS_USE_SENDER_THREAD
+    return !ATOMIC_LOAD_ACQUIRE(&(pKvs->bIsOpenDone));
+#else
+    (void)pKvs;
+    return false;
+#endif /* KVS_USE_SENDER_THREAD */
+}
+
 static int setupTagsForSession(KvsApp_t *pKvs)
 {
     int res = KVS_ERRNO_NONE;
@@ -947,12 +2073,40 @@ KvsAppHandle KvsApp_create(const char *pcHost, const char *pcRegion, const char
     else
     {
         memset(pKvs, 0, sizeof(KvsApp_t));
+#ifdef KVS_USE_SENDER_THREAD
+        pKvs->bIsOpenDone = true;
+#endif
 
         if ((pKvs->xLock = Lock_Init()) == NULL)
         {
             res = KVS_ERROR_LOCK_ERROR;
             LogError("Failed to init lock");
         }
+        else if ((pKvs->xWakeup = wakeupCreate()) == NULL)
+        {
+            res = KVS_ERROR_FAIL_TO_CREATE_WAKEUP;
+            LogError("Failed to create wakeup");
+        }
+        else if ((pKvs->xTlsSessionCache = TlsSessionCache_create(TLS_SESSION_CACHE_MAX_HOSTS)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("Failed to create TLS session cache");
+        }
+        else if ((pKvs->xTlsContext = TlsContext_create()) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("Failed to create TLS context");
+        }
+        else if ((pKvs->xControlPlaneClient = ControlPlaneClient_create()) == NULL || (pKvs->xIotControlPlaneClient = ControlPlaneClient_create()) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("Failed to create control plane client");
+        }
+        else if ((pKvs->xDataEndpointCache = DataEndpointCache_create()) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("Failed to create data endpoint cache");
+        }
         else if (
             (res = prvMallocAndStrcpyHelper(&(pKvs->pHost), pcHost)) != KVS_ERRNO_NONE ||
             (res = prvMallocAndStrcpyHelper(&(pKvs->pRegion), pcRegion)) != KVS_ERRNO_NONE ||
@@ -965,6 +2119,7 @@ KvsAppHandle KvsApp_create(const char *pcHost, const char *pcRegion, const char
         else
         {
             pKvs->pDataEndpoint = NULL;
+            pKvs->uDataEndpointCacheTtlSec = DEFAULT_DATA_ENDPOINT_CACHE_TTL_SEC;
             pKvs->pAwsAccessKeyId = NULL;
             pKvs->pAwsSecretAccessKey = NULL;
             pKvs->pIotCredentialHost = NULL;
@@ -982,6 +2137,13 @@ KvsAppHandle KvsApp_create(const char *pcHost, const char *pcRegion, const char
             pKvs->xPutMediaHandle = NULL;
             pKvs->isEbmlHeaderUpdated = false;
             pKvs->xStrategy.xPolicy = STREAM_POLICY_NONE;
+            pKvs->uLockFreeQueueSize = 0;
+            pKvs->uFragmentDurationMs = 0;
+            pKvs->uFragmentMaxSize = 0;
+            pKvs->xSpillHandle = NULL;
+            pKvs->pSpillDir = NULL;
+            pKvs->pBatchBuf = NULL;
+            pKvs->uBatchBufSize = 0;
 
             pKvs->pVideoTrackInfo = NULL;
             pKvs->isAudioTrackPresent = false;
@@ -1007,15 +2169,100 @@ KvsAppHandle KvsApp_create(const char *pcHost, const char *pcRegion, const char
 void KvsApp_terminate(KvsAppHandle handle)
 {
     KvsApp_t *pKvs = (KvsApp_t *)handle;
+    DataFrameHandle xDataFrameHandle = NULL;
+
+#ifdef KVS_USE_SENDER_THREAD
+    if (pKvs != NULL && pKvs->bIsSenderRunning)
+    {
+        KvsApp_stop(pKvs);
+    }
+    if (pKvs != NULL)
+    {
+        prvOpenThreadJoin(pKvs);
+    }
+#endif
+    /* PUT MEDIA borrows the TLS context, so it's closed before the context is terminated. */
+    if (pKvs != NULL && pKvs->xPutMediaHandle != NULL)
+    {
+        KvsApp_close(pKvs);
+    }
 
     if (pKvs != NULL && Lock(pKvs->xLock) == LOCK_OK)
     {
+        if (pKvs->xRetention != NULL)
+        {
+            /* Kept frames may come from the pool of the stream, so they go first. */
+            while ((xDataFrameHandle = Kvs_streamRetentionPop(pKvs->xRetention)) != NULL)
+            {
+                prvCallOnDataFrameTerminate((DataFrameIn_t *)xDataFrameHandle);
+                Kvs_dataFrameTerminate(xDataFrameHandle);
+            }
+            Kvs_streamRetentionTerminate(pKvs->xRetention);
+            pKvs->xRetention = NULL;
+        }
         if (pKvs->xStreamHandle != NULL)
         {
             prvStreamFlush(pKvs);
             Kvs_streamTermintate(pKvs->xStreamHandle);
             pKvs->xStreamHandle = NULL;
         }
+#ifdef KVS_USE_STREAM_SPILL
+        if (pKvs->xSpillHandle != NULL)
+        {
+            Kvs_streamSpillTerminate(pKvs->xSpillHandle);
+            pKvs->xSpillHandle = NULL;
+        }
+#endif
+        if (pKvs->pSpillDir != NULL)
+        {
+            kvsFree(pKvs->pSpillDir);
+            pKvs->pSpillDir = NULL;
+        }
+        if (pKvs->pBatchBuf != NULL)
+        {
+            kvsFree(pKvs->pBatchBuf);
+            pKvs->pBatchBuf = NULL;
+        }
+        if (pKvs->xWakeup != NULL)
+        {
+            wakeupTerminate(pKvs->xWakeup);
+            pKvs->xWakeup = NULL;
+        }
+        if (pKvs->xDataEndpointCache != NULL)
+        {
+            DataEndpointCache_terminate(pKvs->xDataEndpointCache);
+            pKvs->xDataEndpointCache = NULL;
+        }
+        if (pKvs->pDataEndpointCacheFile != NULL)
+        {
+            kvsFree(pKvs->pDataEndpointCacheFile);
+            pKvs->pDataEndpointCacheFile = NULL;
+        }
+        if (pKvs->xControlPlaneClient != NULL)
+        {
+            ControlPlaneClient_terminate(pKvs->xControlPlaneClient);
+            pKvs->xControlPlaneClient = NULL;
+        }
+        if (pKvs->xIotControlPlaneClient != NULL)
+        {
+            ControlPlaneClient_terminate(pKvs->xIotControlPlaneClient);
+            pKvs->xIotControlPlaneClient = NULL;
+        }
+        if (pKvs->xTlsSessionCache != NULL)
+        {
+            TlsSessionCache_terminate(pKvs->xTlsSessionCache);
+            pKvs->xTlsSessionCache = NULL;
+        }
+        if (pKvs->pTlsSessionCacheFile != NULL)
+        {
+            kvsFree(pKvs->pTlsSessionCacheFile);
+            pKvs->pTlsSessionCacheFile = NULL;
+        }
+        if (pKvs->xTlsContext != NULL)
+        {
+            TlsContext_terminate(pKvs->xTlsContext);
+            pKvs->xTlsContext = NULL;
+        }
         if (pKvs->pHost != NULL)
         {
             kvsFree(pKvs->pHost);
@@ -1128,6 +2375,12 @@ int KvsApp_setoption(KvsAppHandle handle, const char *pcOptionName, const char *
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        /* The setup thread reads the options and sets up the connection. */
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
     else
     {
         if (strcmp(pcOptionName, (const char *)OPTION_AWS_ACCESS_KEY_ID) == 0)
@@ -1206,89 +2459,246 @@ int KvsApp_setoption(KvsAppHandle handle, const char *pcOptionName, const char *
         {
             if ((res = prvMallocAndStrcpyHelper(&(pKvs->pIotX509PrivateKey), pValue)) != 0)
             {
-                LogError("Failed to set pIotX509PrivateKey");
-                /* Propagate the res error */
+                LogError("Failed to set pIotX509PrivateKey");
+                /* Propagate the res error */
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_DATA_RETENTION_IN_HOURS) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value for KVS data retention in hours");
+            }
+            else
+            {
+                pKvs->uDataRetentionInHours = *((unsigned int *)(pValue));
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_DATA_ENDPOINT_CACHE_FILE) == 0)
+        {
+            if ((res = prvMallocAndStrcpyHelper(&(pKvs->pDataEndpointCacheFile), pValue)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to set data endpoint cache file");
+            }
+            else if (DataEndpointCache_load(pKvs->xDataEndpointCache, pKvs->pDataEndpointCacheFile) != KVS_ERRNO_NONE)
+            {
+                /* The file is created when the data endpoint is discovered. */
+                LogInfo("No data endpoint is loaded from %s", pKvs->pDataEndpointCacheFile);
+            }
+            else
+            {
+                /* nop */
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_DATA_ENDPOINT_CACHE_TTL) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to data endpoint cache TTL");
+            }
+            else
+            {
+                pKvs->uDataEndpointCacheTtlSec = *((uint32_t *)pValue);
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_VIDEO_TRACK_INFO) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to KVS video track info");
+            }
+            else if ((pKvs->pVideoTrackInfo = prvCopyVideoTrackInfo((VideoTrackInfo_t *)pValue)) == NULL)
+            {
+                res = KVS_ERROR_OUT_OF_MEMORY;
+                LogError("failed to copy video track info");
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_AUDIO_TRACK_INFO) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to KVS audio track info");
+            }
+            else if ((pKvs->pAudioTrackInfo = prvCopyAudioTrackInfo((AudioTrackInfo_t *)pValue)) == NULL)
+            {
+                res = KVS_ERROR_OUT_OF_MEMORY;
+                LogError("failed to copy audio track info");
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_POLICY) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to stream strategy");
+            }
+            else
+            {
+                KvsApp_streamPolicy_t xPolicy = *((KvsApp_streamPolicy_t *)pValue);
+                if (xPolicy < STREAM_POLICY_NONE || xPolicy >= STREAM_POLICY_MAX)
+                {
+                    LogError("Invalid policy val: %d", xPolicy);
+                    res = KVS_ERROR_INVALID_STREAM_POLICY;
+                }
+#ifndef KVS_USE_STREAM_SPILL
+                else if (xPolicy == STREAM_POLICY_SPILL_RING_BUFFER)
+                {
+                    LogError("Stream spill is not supported on this platform");
+                    res = KVS_ERROR_INVALID_STREAM_POLICY;
+                }
+#endif
+                else
+                {
+                    pKvs->xStrategy.xPolicy = xPolicy;
+                    if (prvIsRingBufferPolicy(pKvs->xStrategy.xPolicy))
+                    {
+                        pKvs->xStrategy.xRingBufferPara.uMemLimit = DEFAULT_RING_BUFFER_MEM_LIMIT;
+                        pKvs->xStrategy.xRingBufferPara.bKeepAudio = false;
+                        pKvs->xStrategy.xRingBufferPara.uSpillMaxSize = DEFAULT_STREAM_SPILL_MAX_SIZE;
+                    }
+                }
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_POLICY_RING_BUFFER_MEM_LIMIT) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to parameter of ring buffer policy");
+            }
+            else if (!prvIsRingBufferPolicy(pKvs->xStrategy.xPolicy))
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot set parameter to policy: %d ", (int)(pKvs->xStrategy.xPolicy));
+            }
+            else
+            {
+                size_t uMemLimit = *((size_t *)pValue);
+                pKvs->xStrategy.xRingBufferPara.uMemLimit = uMemLimit;
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_POLICY_GOP_KEEP_AUDIO) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to parameter of GOP ring buffer policy");
+            }
+            else if (pKvs->xStrategy.xPolicy != STREAM_POLICY_GOP_RING_BUFFER && pKvs->xStrategy.xPolicy != STREAM_POLICY_DROPPABLE_FIRST_RING_BUFFER)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot set parameter to policy: %d ", (int)(pKvs->xStrategy.xPolicy));
+            }
+            else
+            {
+                pKvs->xStrategy.xRingBufferPara.bKeepAudio = *((bool *)pValue);
             }
         }
-        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_DATA_RETENTION_IN_HOURS) == 0)
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_LOCK_FREE_QUEUE_SIZE) == 0)
         {
             if (pValue == NULL)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Invalid value for KVS data retention in hours");
+                LogError("Invalid value set to lock-free queue size");
+            }
+            else if (pKvs->xStreamHandle != NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot change the stream mode after the stream is created");
             }
             else
             {
-                pKvs->uDataRetentionInHours = *((unsigned int *)(pValue));
+                pKvs->uLockFreeQueueSize = *((size_t *)pValue);
             }
         }
-        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_VIDEO_TRACK_INFO) == 0)
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_SPILL_DIR) == 0)
         {
-            if (pValue == NULL)
+            if (pKvs->xStrategy.xPolicy != STREAM_POLICY_SPILL_RING_BUFFER)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Invalid value set to KVS video track info");
+                LogError("Cannot set parameter to policy: %d ", (int)(pKvs->xStrategy.xPolicy));
             }
-            else if ((pKvs->pVideoTrackInfo = prvCopyVideoTrackInfo((VideoTrackInfo_t *)pValue)) == NULL)
+            else if (pKvs->xSpillHandle != NULL)
             {
-                res = KVS_ERROR_OUT_OF_MEMORY;
-                LogError("failed to copy video track info");
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot change the spill after it's created");
+            }
+            else if ((res = prvMallocAndStrcpyHelper(&(pKvs->pSpillDir), pValue)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to set spill directory");
             }
         }
-        else if (strcmp(pcOptionName, (const char *)OPTION_KVS_AUDIO_TRACK_INFO) == 0)
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_SPILL_MAX_SIZE) == 0)
         {
             if (pValue == NULL)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Invalid value set to KVS audio track info");
+                LogError("Invalid value set to spill max size");
             }
-            else if ((pKvs->pAudioTrackInfo = prvCopyAudioTrackInfo((AudioTrackInfo_t *)pValue)) == NULL)
+            else if (pKvs->xStrategy.xPolicy != STREAM_POLICY_SPILL_RING_BUFFER)
             {
-                res = KVS_ERROR_OUT_OF_MEMORY;
-                LogError("failed to copy audio track info");
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot set parameter to policy: %d ", (int)(pKvs->xStrategy.xPolicy));
+            }
+            else if (pKvs->xSpillHandle != NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot change the spill after it's created");
+            }
+            else
+            {
+                pKvs->xStrategy.xRingBufferPara.uSpillMaxSize = *((size_t *)pValue);
             }
         }
-        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_POLICY) == 0)
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_RETENTION_MEM_LIMIT) == 0)
         {
             if (pValue == NULL)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Invalid value set to stream strategy");
+                LogError("Invalid value set to retention mem limit");
+            }
+            else if (pKvs->xRetention != NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Cannot change the retention after it's created");
             }
             else
             {
-                KvsApp_streamPolicy_t xPolicy = *((KvsApp_streamPolicy_t *)pValue);
-                if (xPolicy < STREAM_POLICY_NONE || xPolicy >= STREAM_POLICY_MAX)
-                {
-                    LogError("Invalid policy val: %d", xPolicy);
-                    res = KVS_ERROR_INVALID_STREAM_POLICY;
-                }
-                else
-                {
-                    pKvs->xStrategy.xPolicy = xPolicy;
-                    if (pKvs->xStrategy.xPolicy == STREAM_POLICY_RING_BUFFER)
-                    {
-                        pKvs->xStrategy.xRingBufferPara.uMemLimit = DEFAULT_RING_BUFFER_MEM_LIMIT;
-                    }
-                }
+                pKvs->uRetentionMemLimit = *((size_t *)pValue);
             }
         }
-        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_POLICY_RING_BUFFER_MEM_LIMIT) == 0)
+        else if (strcmp(pcOptionName, (const char *)OPTION_STREAM_FRAGMENT_DURATION) == 0 || strcmp(pcOptionName, (const char *)OPTION_STREAM_FRAGMENT_MAX_SIZE) == 0)
         {
             if (pValue == NULL)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Invalid value set to parameter of ring buffer policy");
+                LogError("Invalid value set to fragment limit");
             }
-            else if (pKvs->xStrategy.xPolicy != STREAM_POLICY_RING_BUFFER)
+            else if (pKvs->xStreamHandle != NULL && pKvs->uLockFreeQueueSize > 0)
             {
                 res = KVS_ERROR_INVALID_ARGUMENT;
-                LogError("Cannot set parameter to policy: %d ", (int)(pKvs->xStrategy.xPolicy));
+                LogError("Cannot change fragment limits of a lock-free stream after it's created");
             }
             else
             {
-                size_t uMemLimit = *((size_t *)pValue);
-                pKvs->xStrategy.xRingBufferPara.uMemLimit = uMemLimit;
+                if (strcmp(pcOptionName, (const char *)OPTION_STREAM_FRAGMENT_DURATION) == 0)
+                {
+                    pKvs->uFragmentDurationMs = *((unsigned int *)pValue);
+                }
+                else
+                {
+                    pKvs->uFragmentMaxSize = *((size_t *)pValue);
+                }
+
+                /* Try to update the limits if the stream is already created. */
+                if (pKvs->xStreamHandle != NULL)
+                {
+                    res = Kvs_streamSetClusterLimit(pKvs->xStreamHandle, pKvs->uFragmentDurationMs, pKvs->uFragmentMaxSize);
+                }
             }
         }
         else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_CONNECTION_TIMEOUT) == 0)
@@ -1337,6 +2747,95 @@ int KvsApp_setoption(KvsAppHandle handle, const char *pcOptionName, const char *
                 Kvs_putMediaUpdateSendTimeout(pKvs->xPutMediaHandle, uSendTimeoutMs);
             }
         }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_TLS_SESSION_CACHE_FILE) == 0)
+        {
+            if ((res = prvMallocAndStrcpyHelper(&(pKvs->pTlsSessionCacheFile), pValue)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to set TLS session cache file");
+            }
+            else if (TlsSessionCache_load(pKvs->xTlsSessionCache, pKvs->pTlsSessionCacheFile) != KVS_ERRNO_NONE)
+            {
+                /* The file is created by the first KvsApp_open. */
+                LogInfo("No TLS session is loaded from %s", pKvs->pTlsSessionCacheFile);
+            }
+            else
+            {
+                /* nop */
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_KTLS) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to kTLS");
+            }
+            else
+            {
+                pKvs->xPutMediaPara.bKtls = *((bool *)pValue);
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_NONBLOCKING) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to non-blocking mode");
+            }
+            else
+            {
+                pKvs->xPutMediaPara.bNonBlocking = *((bool *)pValue);
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_TLS_MAX_FRAGMENT_LEN) == 0)
+        {
+            if (pValue == NULL || (*((unsigned int *)pValue) != 0 && *((unsigned int *)pValue) != 512 && *((unsigned int *)pValue) != 1024 &&
+                                   *((unsigned int *)pValue) != 2048 && *((unsigned int *)pValue) != 4096))
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to TLS max fragment length");
+            }
+            else
+            {
+                pKvs->uTlsMaxFragmentLen = *((unsigned int *)pValue);
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_TLS_AEAD) == 0)
+        {
+            if (pValue == NULL || TlsContext_setAead(pKvs->xTlsContext, *((TlsAead_t *)pValue)) != KVS_ERRNO_NONE)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to TLS AEAD");
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_NETIO_TRANSPORT) == 0)
+        {
+            pKvs->pxNetIoTransport = (const struct NetIoTransport *)pValue;
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_PUT_MEDIA_COALESCE_SIZE) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to coalesce size");
+            }
+            else
+            {
+                pKvs->xPutMediaPara.uCoalesceSize = *((size_t *)pValue);
+            }
+        }
+        else if (strcmp(pcOptionName, (const char *)OPTION_PUT_MEDIA_COALESCE_DELAY) == 0)
+        {
+            if (pValue == NULL)
+            {
+                res = KVS_ERROR_INVALID_ARGUMENT;
+                LogError("Invalid value set to coalesce delay");
+            }
+            else
+            {
+                pKvs->xPutMediaPara.uCoalesceDelayMs = *((unsigned int *)pValue);
+            }
+        }
         else
         {
             /* TODO: Propagate this option to KVS stream. */
@@ -1350,44 +2849,85 @@ int KvsApp_open(KvsAppHandle handle)
 {
     int res = KVS_ERRNO_NONE;
     KvsApp_t *pKvs = (KvsApp_t *)handle;
-    unsigned int uHttpStatusCode = 0;
 
     if (pKvs == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
+    else if ((res = prvOpenPutMedia(pKvs)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if ((res = createStream(pKvs)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to setup KVS stream");
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
+int KvsApp_openAsync(KvsAppHandle handle, OnOpenCompleteCallback_t onOpenComplete, void *pAppData)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsApp_t *pKvs = (KvsApp_t *)handle;
+
+#ifdef KVS_USE_SENDER_THREAD
+    if (pKvs == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (pKvs->bIsSenderRunning)
+    {
+        res = KVS_ERROR_KVSAPP_SENDER_IS_RUNNING;
+        LogError("Sender thread opens the connection by itself");
+    }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is already running");
+    }
     else
     {
-        updateIotCredential(pKvs);
-        if ((res = updateAndVerifyRestfulReqParameters(pKvs)) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed to setup KVS");
-            /* Propagate the res error */
-        }
-        else if ((res = setupDataEndpoint(pKvs)) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed to setup data endpoint");
-            /* Propagate the res error */
-        }
-        else if ((res = Kvs_putMediaStart(&(pKvs->xServicePara), &(pKvs->xPutMediaPara), &uHttpStatusCode, &(pKvs->xPutMediaHandle))) != KVS_ERRNO_NONE)
+        prvOpenThreadJoin(pKvs);
+
+        /* The stream buffer is set up by the caller, so frames are added to it while the setup thread runs. */
+        if ((res = createStream(pKvs)) != KVS_ERRNO_NONE)
         {
-            LogError("Failed to setup PUT MEDIA");
+            LogError("Failed to setup KVS stream");
             /* Propagate the res error */
         }
-        else if (uHttpStatusCode != 200)
-        {
-            res = KVS_GENERATE_RESTFUL_ERROR(uHttpStatusCode);
-            LogError("PUT MEDIA http status code:%d\n", uHttpStatusCode);
-        }
         else
         {
-            if ((res = createStream(pKvs)) != KVS_ERRNO_NONE)
+            pKvs->onOpenComplete = onOpenComplete;
+            pKvs->pOpenAppData = pAppData;
+            pKvs->bIsOpenRunning = true;
+            ATOMIC_STORE_RELEASE(&(pKvs->bIsOpenDone), false);
+            if (pthread_create(&(pKvs->xOpenTid), NULL, prvOpenThread, pKvs) != 0)
             {
-                LogError("Failed to setup KVS stream");
-                /* Propagate the res error */
+                res = KVS_ERROR_KVSAPP_FAIL_TO_START_OPEN;
+                LogError("Failed to create setup thread");
+                pKvs->bIsOpenRunning = false;
+                ATOMIC_STORE_RELEASE(&(pKvs->bIsOpenDone), true);
             }
         }
     }
+#else
+    (void)pKvs;
+    (void)onOpenComplete;
+    (void)pAppData;
+    res = KVS_ERROR_KVSAPP_ASYNC_OPEN_NOT_SUPPORTED;
+    LogError("Async open is not supported");
+#endif /* KVS_USE_SENDER_THREAD */
 
     return res;
 }
@@ -1406,6 +2946,9 @@ int KvsApp_close(KvsAppHandle handle)
     }
     else
     {
+#ifdef KVS_USE_SENDER_THREAD
+        prvOpenThreadJoin(pKvs);
+#endif
         if (pKvs->xPutMediaHandle != NULL)
         {
             if (Lock(pKvs->xLock) != LOCK_OK)
@@ -1415,6 +2958,8 @@ int KvsApp_close(KvsAppHandle handle)
             }
             else
             {
+                /* Coalesced frames are sent if the connection still works. */
+                Kvs_putMediaFlush(pKvs->xPutMediaHandle);
                 Kvs_putMediaFinish(pKvs->xPutMediaHandle);
                 pKvs->xPutMediaHandle = NULL;
                 pKvs->isEbmlHeaderUpdated = false;
@@ -1437,7 +2982,7 @@ int KvsApp_addFrameWithCallbacks(KvsAppHandle handle, uint8_t *pData, size_t uDa
     int retVal = 0;
     KvsApp_t *pKvs = (KvsApp_t *)handle;
     DataFrameIn_t xDataFrameIn = {0};
-    DataFrameUserData_t *pUserData = NULL;
+    DataFrameUserData_t xUserData = {0};
 
     if (pKvs == NULL || pData == NULL || uDataLen == 0)
     {
@@ -1463,11 +3008,6 @@ int KvsApp_addFrameWithCallbacks(KvsAppHandle handle, uint8_t *pData, size_t uDa
     {
         res = KVS_ERROR_STREAM_NOT_READY;
     }
-    else if ((pUserData = (DataFrameUserData_t *)kvsMalloc(sizeof(DataFrameUserData_t))) == NULL)
-    {
-        res = KVS_ERROR_OUT_OF_MEMORY;
-        LogError("OOM: pUserData");
-    }
     else
     {
         xDataFrameIn.pData = (char *)pData;
@@ -1476,25 +3016,29 @@ int KvsApp_addFrameWithCallbacks(KvsAppHandle handle, uint8_t *pData, size_t uDa
         xDataFrameIn.uTimestampMs = uTimestamp;
         xDataFrameIn.xTrackType = xTrackType;
         xDataFrameIn.xClusterType = (xDataFrameIn.bIsKeyFrame) ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.xDropClass =
+            (xTrackType == TRACK_VIDEO && !xDataFrameIn.bIsKeyFrame && NALU_isNonReferenceFrame(pData, uDataLen)) ? DATA_FRAME_DROPPABLE : DATA_FRAME_REFERENCED;
 
-        memset(pUserData, 0, sizeof(DataFrameUserData_t));
         if (pCallbacks == NULL)
         {
             /* Assign default callbacks. */
-            pUserData->xCallbacks.onDataFrameTerminateInfo.onDataFrameTerminate = defaultOnDataFrameTerminate;
-            pUserData->xCallbacks.onDataFrameTerminateInfo.pAppData = NULL;
-            pUserData->xCallbacks.onDataFrameToBeSentInfo.onDataFrameToBeSent = NULL;
-            pUserData->xCallbacks.onDataFrameToBeSentInfo.pAppData = NULL;
+            xUserData.xCallbacks.onDataFrameTerminateInfo.onDataFrameTerminate = defaultOnDataFrameTerminate;
+            xUserData.xCallbacks.onDataFrameTerminateInfo.pAppData = NULL;
+            xUserData.xCallbacks.onDataFrameToBeSentInfo.onDataFrameToBeSent = NULL;
+            xUserData.xCallbacks.onDataFrameToBeSentInfo.pAppData = NULL;
         }
         else
         {
-            memcpy(&(pUserData->xCallbacks), pCallbacks, sizeof(DataFrameCallbacks_t));
+            memcpy(&(xUserData.xCallbacks), pCallbacks, sizeof(DataFrameCallbacks_t));
         }
-        xDataFrameIn.pUserData = pUserData;
 
-        if (pKvs->xStrategy.xPolicy == STREAM_POLICY_RING_BUFFER)
+        /* The stream copies the user data into the data frame descriptor. */
+        xDataFrameIn.pUserData = &xUserData;
+
+        /* Only the thread calling KvsApp_doWork can pop frames from a lock-free stream. */
+        if (pKvs->uLockFreeQueueSize == 0)
         {
-            prvStreamFlushHeadUntilMem(pKvs, pKvs->xStrategy.xRingBufferPara.uMemLimit);
+            prvStreamApplyPolicy(pKvs);
         }
 
         if (Kvs_streamAddDataFrame(pKvs->xStreamHandle, &xDataFrameIn) == NULL)
@@ -1521,10 +3065,6 @@ int KvsApp_addFrameWithCallbacks(KvsAppHandle handle, uint8_t *pData, size_t uDa
                 res = KVS_GENERATE_CALLBACK_ERROR(retVal);
             }
         }
-        if (pUserData != NULL)
-        {
-            kvsFree(pUserData);
-        }
     }
 
     return res;
@@ -1539,9 +3079,14 @@ int KvsApp_doWork(KvsAppHandle handle)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
     else
     {
-        res = prvPutMediaDoWorkDefault(pKvs);
+        res = prvPutMediaDoWorkDefault(pKvs, false);
     }
 
     return res;
@@ -1556,16 +3101,25 @@ int KvsApp_doWorkEx(KvsAppHandle handle, DoWorkExParamter_t *pPara)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
     else
     {
         if (pPara == NULL || pPara->eType == DO_WORK_DEFAULT)
         {
-            res = prvPutMediaDoWorkDefault(pKvs);
+            res = prvPutMediaDoWorkDefault(pKvs, pPara != NULL && pPara->bNoWait);
         }
         else if (pPara->eType == DO_WORK_SEND_END_OF_FRAMES)
         {
             res = prvPutMediaDoWorkSendEndOfFrames(pKvs);
         }
+        else if (pPara->eType == DO_WORK_SEND_BATCH)
+        {
+            res = prvPutMediaDoWorkSendBatch(pKvs, pPara->bNoWait);
+        }
         else
         {
             res = KVS_ERROR_KVSAPP_UNKNOWN_DO_WORK_TYPE;
@@ -1575,6 +3129,40 @@ int KvsApp_doWorkEx(KvsAppHandle handle, DoWorkExParamter_t *pPara)
     return res;
 }
 
+int KvsApp_getPollFds(KvsAppHandle handle, int *pxWakeupFd, int *pxSocketFd)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsApp_t *pKvs = (KvsApp_t *)handle;
+
+    if (pKvs == NULL || pxWakeupFd == NULL || pxSocketFd == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
+    else if ((*pxWakeupFd = wakeupGetFd(pKvs->xWakeup)) < 0)
+    {
+        res = KVS_ERROR_KVSAPP_NO_POLL_FD;
+        LogError("No file descriptor to poll on this platform");
+    }
+    else
+    {
+        *pxSocketFd = Kvs_putMediaGetSocket(pKvs->xPutMediaHandle);
+    }
+
+    return res;
+}
+
+bool KvsApp_isSendPending(KvsAppHandle handle)
+{
+    KvsApp_t *pKvs = (KvsApp_t *)handle;
+
+    return (pKvs != NULL && !prvIsOpenRunning(pKvs) && Kvs_putMediaIsSendPending(pKvs->xPutMediaHandle));
+}
+
 int KvsApp_readFragmentAck(KvsAppHandle handle, ePutMediaFragmentAckEventType *peAckEventType, uint64_t *puFragmentTimecode, unsigned int *puErrorId)
 {
     int res = KVS_ERRNO_NONE;
@@ -1584,6 +3172,11 @@ int KvsApp_readFragmentAck(KvsAppHandle handle, ePutMediaFragmentAckEventType *p
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
     else
     {
         res = Kvs_putMediaReadFragmentAck(pKvs->xPutMediaHandle, peAckEventType, puFragmentTimecode, puErrorId);
@@ -1596,9 +3189,16 @@ size_t KvsApp_getStreamMemStatTotal(KvsAppHandle handle)
 {
     size_t uMemTotal = 0;
     KvsApp_t *pKvs = (KvsApp_t *)handle;
+    size_t uRetainedCnt = 0;
+    size_t uRetainedSize = 0;
 
     if (pKvs != NULL && pKvs->xStreamHandle != NULL && Kvs_streamMemStatTotal(pKvs->xStreamHandle, &uMemTotal) == KVS_ERRNO_NONE)
     {
+        /* Frames kept until they are persisted still hold their memory. */
+        if (Kvs_streamRetentionStat(pKvs->xRetention, &uRetainedCnt, &uRetainedSize) == KVS_ERRNO_NONE)
+        {
+            uMemTotal += uRetainedSize;
+        }
         return uMemTotal;
     }
     else
@@ -1616,6 +3216,11 @@ int KvsApp_setOnMkvSentCallback(KvsAppHandle handle, OnMkvSentCallback_t onMkvSe
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
     else
     {
         pKvs->onMkvSentCallbackInfo.onMkvSentCallback = onMkvSentCallback;
@@ -1624,3 +3229,97 @@ int KvsApp_setOnMkvSentCallback(KvsAppHandle handle, OnMkvSentCallback_t onMkvSe
 
     return res;
 }
+
+int KvsApp_start(KvsAppHandle handle, SenderParameter_t *pPara)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsApp_t *pKvs = (KvsApp_t *)handle;
+#ifdef KVS_USE_SENDER_THREAD
+    SenderParameter_t xPara = {0};
+    pthread_attr_t xAttr;
+
+    if (pPara != NULL)
+    {
+        xPara = *pPara;
+    }
+    else
+    {
+        xPara.eDoWorkType = DO_WORK_DEFAULT;
+        xPara.xCpuAffinity = -1;
+        xPara.xPriority = 0;
+    }
+
+    if (pKvs == NULL || (xPara.eDoWorkType != DO_WORK_DEFAULT && xPara.eDoWorkType != DO_WORK_SEND_BATCH))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (pKvs->bIsSenderRunning)
+    {
+        res = KVS_ERROR_KVSAPP_SENDER_IS_RUNNING;
+        LogError("Sender thread is already running");
+    }
+    else if (prvIsOpenRunning(pKvs))
+    {
+        res = KVS_ERROR_KVSAPP_OPEN_IS_RUNNING;
+        LogError("Setup thread is running");
+    }
+    else if ((res = prvSenderThreadAttrInit(&xAttr, &xPara)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        pKvs->xSenderPara = xPara;
+        ATOMIC_STORE_RELEASE(&(pKvs->bStopSender), false);
+        if (pthread_create(&(pKvs->xSenderTid), &xAttr, prvSenderThread, pKvs) != 0)
+        {
+            res = KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER;
+            LogError("Failed to create sender thread");
+        }
+        else
+        {
+            pKvs->bIsSenderRunning = true;
+        }
+        pthread_attr_destroy(&xAttr);
+    }
+#else
+    (void)pKvs;
+    (void)pPara;
+    res = KVS_ERROR_KVSAPP_SENDER_NOT_SUPPORTED;
+    LogError("Sender thread is not supported");
+#endif /* KVS_USE_SENDER_THREAD */
+
+    return res;
+}
+
+int KvsApp_stop(KvsAppHandle handle)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsApp_t *pKvs = (KvsApp_t *)handle;
+
+#ifdef KVS_USE_SENDER_THREAD
+    if (pKvs == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (!pKvs->bIsSenderRunning)
+    {
+        res = KVS_ERROR_KVSAPP_SENDER_IS_NOT_RUNNING;
+        LogError("Sender thread is not running");
+    }
+    else
+    {
+        ATOMIC_STORE_RELEASE(&(pKvs->bStopSender), true);
+        wakeupSignal(pKvs->xWakeup);
+        pthread_join(pKvs->xSenderTid, NULL);
+        pKvs->bIsSenderRunning = false;
+    }
+#else
+    (void)pKvs;
+    res = KVS_ERROR_KVSAPP_SENDER_NOT_SUPPORTED;
+    LogError("Sender thread is not supported");
+#endif /* KVS_USE_SENDER_THREAD */
+
+    return res;
+}
@@ -0,0 +1,891 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+#include "kvs/kvsapp.h"
+#include "kvs/kvsapp_group.h"
+#include "kvs/kvsapp_options.h"
+#include "kvs/port.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "os/atomic.h"
+
+#define GROUP_MAX_EVENTS (64)
+#define GROUP_DEFAULT_MAX_WAIT_MS (1000)
+
+/* The time before a member whose transport has no socket tries its pending data again */
+#define GROUP_SEND_PENDING_RETRY_MS (10)
+
+/* Backoff of a member before it's reopened, doubled on every failed open */
+#define GROUP_RECONNECT_MIN_BACKOFF_MS (1000)
+#define GROUP_RECONNECT_MAX_BACKOFF_MS (30 * 1000)
+#define GROUP_NEXT_BACKOFF_MS(uBackoffMs) (((uBackoffMs) * 2 > GROUP_RECONNECT_MAX_BACKOFF_MS) ? GROUP_RECONNECT_MAX_BACKOFF_MS : (uBackoffMs) * 2)
+
+struct GroupWorker;
+
+/* The state of a member is only used by its worker thread, but for bRemove and bIsRemoved. */
+typedef struct GroupMember
+{
+    KvsAppHandle xKvsAppHandle;
+    KvsAppGroupMemberParameter_t xPara;
+    struct GroupWorker *pxWorker;
+
+    /* The file descriptors in the epoll set of the worker while the member is open. The socket is watched for EPOLLOUT
+     * too while bIsSendPending is set. */
+    int xWakeupFd;
+    int xSocketFd;
+    bool bIsSendPending;
+
+    /* The setup thread of KvsApp_openAsync() sets xOpenResult and bIsOpenDone, and wakes the worker up. */
+    bool bIsOpening;
+    bool bIsOpenDone;
+    int xOpenResult;
+
+    bool bIsOpen;
+    bool bIsReady;
+    uint64_t uNextWorkMs;
+    uint64_t uNextOpenMs;
+    uint32_t uBackoffMs;
+
+    /* KvsAppGroup_remove() sets bRemove under the lock of the worker, and waits until bIsRemoved is set under the remove
+     * lock of the group. */
+    bool bRemove;
+    bool bIsRemoved;
+
+    DLIST_ENTRY xMemberEntry;
+} GroupMember_t;
+
+typedef struct GroupWorker
+{
+    struct KvsAppGroup *pxGroup;
+    pthread_t xTid;
+    bool bIsStarted;
+    bool bStop;
+
+    int xEpollFd;
+
+    /* It wakes the worker up when a member is added or removed, or the group is terminated. */
+    WakeupHandle xWakeup;
+
+    /* It guards the member list, which other threads add to, and bRemove. The worker thread is the only one which
+     * unlinks members, so it runs a member without the lock. */
+    LOCK_HANDLE xLock;
+    DLIST_ENTRY xMembers;
+    size_t uMemberCnt;
+} GroupWorker_t;
+
+typedef struct KvsAppGroup
+{
+    GroupWorker_t *pxWorkers;
+    unsigned int uWorkerCnt;
+
+    /* KvsAppGroup_remove() waits on xRemoveCond until its member is removed, and frees the member. A member is removed by
+     * its worker, or by KvsAppGroup_terminate(), which then waits until no remove is waiting before the group is freed. */
+    pthread_mutex_t xRemoveLock;
+    pthread_cond_t xRemoveCond;
+    bool bIsRemoveLockInit;
+    unsigned int uRemoveWaiters;
+} KvsAppGroup_t;
+
+/* Deliver the pending fragment ACKs of a member to its callback. */
+static void prvMemberDeliverFragmentAcks(GroupMember_t *pxMember)
+{
+    ePutMediaFragmentAckEventType eAckEventType = eUnknown;
+    uint64_t uFragmentTimecode = 0;
+    unsigned int uErrorId = 0;
+
+    while (KvsApp_readFragmentAck(pxMember->xKvsAppHandle, &eAckEventType, &uFragmentTimecode, &uErrorId) == KVS_ERRNO_NONE)
+    {
+        if (pxMember->xPara.onFragmentAck != NULL)
+        {
+            pxMember->xPara.onFragmentAck(eAckEventType, uFragmentTimecode, uErrorId, pxMember->xPara.pAppData);
+        }
+    }
+}
+
+static int prvEpollAdd(GroupWorker_t *pxWorker, int xFd, void *pPtr)
+{
+    int res = KVS_ERRNO_NONE;
+    struct epoll_event xEvent = {0};
+
+    xEvent.events = EPOLLIN;
+    xEvent.data.ptr = pPtr;
+    if (epoll_ctl(pxWorker->xEpollFd, EPOLL_CTL_ADD, xFd, &xEvent) != 0)
+    {
+        res = KVS_ERROR_KVSAPP_GROUP_EPOLL_ERROR;
+        LogError("Failed to add fd %d to epoll, errno:%d", xFd, errno);
+    }
+
+    return res;
+}
+
+static int prvEpollMod(GroupWorker_t *pxWorker, int xFd, void *pPtr, uint32_t uEvents)
+{
+    int res = KVS_ERRNO_NONE;
+    struct epoll_event xEvent = {0};
+
+    xEvent.events = uEvents;
+    xEvent.data.ptr = pPtr;
+    if (epoll_ctl(pxWorker->xEpollFd, EPOLL_CTL_MOD, xFd, &xEvent) != 0)
+    {
+        res = KVS_ERROR_KVSAPP_GROUP_EPOLL_ERROR;
+        LogError("Failed to modify fd %d in epoll, errno:%d", xFd, errno);
+    }
+
+    return res;
+}
+
+static void prvEpollDel(GroupWorker_t *pxWorker, int xFd)
+{
+    if (xFd >= 0 && epoll_ctl(pxWorker->xEpollFd, EPOLL_CTL_DEL, xFd, NULL) != 0)
+    {
+        LogError("Failed to delete fd %d from epoll, errno:%d", xFd, errno);
+    }
+}
+
+/* Send the remaining frames and close the member, then leave it for the backoff before it's reopened. */
+static void prvMemberClose(GroupWorker_t *pxWorker, GroupMember_t *pxMember, uint64_t uNowMs)
+{
+    DoWorkExParamter_t xDoWorkExPara = {0};
+
+    prvEpollDel(pxWorker, pxMember->xWakeupFd);
+    prvEpollDel(pxWorker, pxMember->xSocketFd);
+    pxMember->xWakeupFd = -1;
+    pxMember->xSocketFd = -1;
+    pxMember->bIsSendPending = false;
+
+    /* It switches the socket back to blocking, so the rest is sent even if the socket is full. */
+    xDoWorkExPara.eType = DO_WORK_SEND_END_OF_FRAMES;
+    xDoWorkExPara.bNoWait = true;
+    KvsApp_doWorkEx(pxMember->xKvsAppHandle, &xDoWorkExPara);
+    prvMemberDeliverFragmentAcks(pxMember);
+    KvsApp_close(pxMember->xKvsAppHandle);
+
+    pxMember->bIsOpen = false;
+    pxMember->bIsReady = false;
+    pxMember->uNextOpenMs = uNowMs + pxMember->uBackoffMs;
+}
+
+/* It's called by the setup thread of KvsApp_openAsync(), so it only hands the result to the worker. */
+static void prvMemberOnOpenComplete(int xResult, void *pAppData)
+{
+    GroupMember_t *pxMember = (GroupMember_t *)pAppData;
+
+    pxMember->xOpenResult = xResult;
+    ATOMIC_STORE_RELEASE(&(pxMember->bIsOpenDone), true);
+    wakeupSignal(pxMember->pxWorker->xWakeup);
+}
+
+/* Start to open the member in the setup thread, so a slow endpoint doesn't block the other members of the worker. */
+static void prvMemberOpen(GroupMember_t *pxMember, uint64_t uNowMs)
+{
+    int res = KVS_ERRNO_NONE;
+
+    ATOMIC_STORE_RELEASE(&(pxMember->bIsOpenDone), false);
+    if ((res = KvsApp_openAsync(pxMember->xKvsAppHandle, prvMemberOnOpenComplete, pxMember)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to start opening KVS app, err:-%X, retry in %u ms", -res, (unsigned int)pxMember->uBackoffMs);
+        KvsApp_close(pxMember->xKvsAppHandle);
+        pxMember->uNextOpenMs = uNowMs + pxMember->uBackoffMs;
+        pxMember->uBackoffMs = GROUP_NEXT_BACKOFF_MS(pxMember->uBackoffMs);
+    }
+    else
+    {
+        pxMember->bIsOpening = true;
+    }
+}
+
+/* Add the member to the epoll set once its connection is set up, or leave it for the backoff before it's reopened. */
+static void prvMemberOpenComplete(GroupWorker_t *pxWorker, GroupMember_t *pxMember, uint64_t uNowMs)
+{
+    int res = pxMember->xOpenResult;
+    int xWakeupFd = -1;
+    int xSocketFd = -1;
+
+    pxMember->bIsOpening = false;
+
+    if (res != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to open KVS app, err:-%X, retry in %u ms", -res, (unsigned int)pxMember->uBackoffMs);
+        KvsApp_close(pxMember->xKvsAppHandle);
+        pxMember->uNextOpenMs = uNowMs + pxMember->uBackoffMs;
+        pxMember->uBackoffMs = GROUP_NEXT_BACKOFF_MS(pxMember->uBackoffMs);
+    }
+    else if ((res = KvsApp_getPollFds(pxMember->xKvsAppHandle, &xWakeupFd, &xSocketFd)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to get poll fds");
+        KvsApp_close(pxMember->xKvsAppHandle);
+        pxMember->uNextOpenMs = uNowMs + pxMember->uBackoffMs;
+        pxMember->uBackoffMs = GROUP_NEXT_BACKOFF_MS(pxMember->uBackoffMs);
+    }
+    else
+    {
+        pxMember->bIsOpen = true;
+        pxMember->uBackoffMs = GROUP_RECONNECT_MIN_BACKOFF_MS;
+
+        /* The file descriptors are kept only once they are in the epoll set, so close only deletes what was added. */
+        if ((res = prvEpollAdd(pxWorker, xWakeupFd, pxMember)) == KVS_ERRNO_NONE)
+        {
+            pxMember->xWakeupFd = xWakeupFd;
+            if (xSocketFd >= 0 && (res = prvEpollAdd(pxWorker, xSocketFd, pxMember)) == KVS_ERRNO_NONE)
+            {
+                pxMember->xSocketFd = xSocketFd;
+            }
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            prvMemberClose(pxWorker, pxMember, uNowMs);
+        }
+        else
+        {
+            /* Frames added while it was closed are sent right away. */
+            pxMember->bIsReady = true;
+        }
+    }
+}
+
+/* Watch the socket for EPOLLOUT while the data of the member waits for it, so the worker runs the other members
+ * meanwhile and comes back when the socket is writable. A transport without a socket is tried again after a while. */
+static int prvMemberWatchSendPending(GroupWorker_t *pxWorker, GroupMember_t *pxMember, uint64_t uNowMs)
+{
+    int res = KVS_ERRNO_NONE;
+    bool bIsSendPending = KvsApp_isSendPending(pxMember->xKvsAppHandle);
+
+    if (bIsSendPending != pxMember->bIsSendPending && pxMember->xSocketFd >= 0 &&
+        (res = prvEpollMod(pxWorker, pxMember->xSocketFd, pxMember, bIsSendPending ? (EPOLLIN | EPOLLOUT) : EPOLLIN)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        pxMember->bIsSendPending = bIsSendPending;
+        if (bIsSendPending && pxMember->xSocketFd < 0 && uNowMs + GROUP_SEND_PENDING_RETRY_MS < pxMember->uNextWorkMs)
+        {
+            pxMember->uNextWorkMs = uNowMs + GROUP_SEND_PENDING_RETRY_MS;
+        }
+    }
+
+    return res;
+}
+
+static void prvMemberDoWork(GroupWorker_t *pxWorker, GroupMember_t *pxMember, uint64_t uNowMs)
+{
+    int res = KVS_ERRNO_NONE;
+    DoWorkExParamter_t xDoWorkExPara = {0};
+
+    pxMember->bIsReady = false;
+    pxMember->uNextWorkMs = uNowMs + pxMember->xPara.uMaxWaitMs;
+
+    xDoWorkExPara.eType = pxMember->xPara.eDoWorkType;
+    xDoWorkExPara.bNoWait = true;
+    if ((res = KvsApp_doWorkEx(pxMember->xKvsAppHandle, &xDoWorkExPara)) != KVS_ERRNO_NONE)
+    {
+        LogError("do work err:-%X", -res);
+        prvMemberClose(pxWorker, pxMember, uNowMs);
+    }
+    else
+    {
+        prvMemberDeliverFragmentAcks(pxMember);
+        if (prvMemberWatchSendPending(pxWorker, pxMember, uNowMs) != KVS_ERRNO_NONE)
+        {
+            prvMemberClose(pxWorker, pxMember, uNowMs);
+        }
+    }
+}
+
+/* Run the member by its state. It returns true if the member is to be removed and is closed, so it can leave the worker. */
+static bool prvMemberRun(GroupWorker_t *pxWorker, GroupMember_t *pxMember, bool bRemove, uint64_t uNowMs)
+{
+    bool bIsClosed = false;
+
+    if (pxMember->bIsOpening && ATOMIC_LOAD_ACQUIRE(&(pxMember->bIsOpenDone)))
+    {
+        prvMemberOpenComplete(pxWorker, pxMember, uNowMs);
+    }
+
+    if (pxMember->bIsOpening)
+    {
+        /* The setup thread wakes the worker up when it's done, even if the member is to be removed. */
+    }
+    else if (bRemove)
+    {
+        if (pxMember->bIsOpen)
+        {
+            prvMemberClose(pxWorker, pxMember, uNowMs);
+        }
+        bIsClosed = true;
+    }
+    else if (!pxMember->bIsOpen)
+    {
+        if (uNowMs >= pxMember->uNextOpenMs)
+        {
+            prvMemberOpen(pxMember, uNowMs);
+        }
+    }
+    else if (pxMember->bIsReady || uNowMs >= pxMember->uNextWorkMs)
+    {
+        prvMemberDoWork(pxWorker, pxMember, uNowMs);
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return bIsClosed;
+}
+
+/* The members use non-blocking sockets while they are in the group, so the KVS app is given back in blocking mode. */
+static int prvMemberSetNonBlocking(KvsAppHandle xKvsAppHandle, bool bNonBlocking)
+{
+    return KvsApp_setoption(xKvsAppHandle, OPTION_NETIO_NONBLOCKING, (const char *)&bNonBlocking);
+}
+
+/* Tell KvsAppGroup_remove() the member has left the group, so it can free the member. */
+static void prvMemberSignalRemoved(KvsAppGroup_t *pxGroup, GroupMember_t *pxMember)
+{
+    prvMemberSetNonBlocking(pxMember->xKvsAppHandle, false);
+    pthread_mutex_lock(&(pxGroup->xRemoveLock));
+    pxMember->bIsRemoved = true;
+    pthread_cond_broadcast(&(pxGroup->xRemoveCond));
+    pthread_mutex_unlock(&(pxGroup->xRemoveLock));
+}
+
+/* Get the member after pxMember, or the first one if pxMember is NULL, and unlink pxMember if bUnlink is true. Only the
+ * worker thread unlinks members, so pxMember is still in the list. */
+static GroupMember_t *prvWorkerNextMember(GroupWorker_t *pxWorker, GroupMember_t *pxMember, bool bUnlink, bool *pbRemove)
+{
+    PDLIST_ENTRY pxListHead = &(pxWorker->xMembers);
+    PDLIST_ENTRY pxListItem = NULL;
+    GroupMember_t *pxNextMember = NULL;
+
+    if (Lock(pxWorker->xLock) != LOCK_OK)
+    {
+        LogError("Failed to lock");
+    }
+    else
+    {
+        pxListItem = (pxMember == NULL) ? pxListHead->Flink : pxMember->xMemberEntry.Flink;
+        if (pxListItem != pxListHead)
+        {
+            pxNextMember = containingRecord(pxListItem, GroupMember_t, xMemberEntry);
+            *pbRemove = pxNextMember->bRemove;
+        }
+
+        if (pxMember != NULL && bUnlink)
+        {
+            DList_RemoveEntryList(&(pxMember->xMemberEntry));
+            pxWorker->uMemberCnt--;
+        }
+
+        Unlock(pxWorker->xLock);
+    }
+
+    return pxNextMember;
+}
+
+/* The time until the earliest member needs doWork or a reopen. It's called with the lock of the worker. */
+static int prvWorkerTimeoutMs(GroupWorker_t *pxWorker)
+{
+    uint64_t uNowMs = getEpochTimestampInMs();
+    uint64_t uTimeoutMs = GROUP_DEFAULT_MAX_WAIT_MS;
+    uint64_t uDeadlineMs = 0;
+    PDLIST_ENTRY pxListHead = &(pxWorker->xMembers);
+    PDLIST_ENTRY pxListItem = pxListHead->Flink;
+    GroupMember_t *pxMember = NULL;
+
+    while (pxListItem != pxListHead)
+    {
+        pxMember = containingRecord(pxListItem, GroupMember_t, xMemberEntry);
+        uDeadlineMs = pxMember->bIsOpen ? pxMember->uNextWorkMs : pxMember->uNextOpenMs;
+        if (pxMember->bIsOpening)
+        {
+            /* The setup thread wakes the worker up when it's done. */
+        }
+        else if (pxMember->bRemove || pxMember->bIsReady || uDeadlineMs <= uNowMs)
+        {
+            uTimeoutMs = 0;
+            break;
+        }
+        else if (uDeadlineMs - uNowMs < uTimeoutMs)
+        {
+            uTimeoutMs = uDeadlineMs - uNowMs;
+        }
+        else
+        {
+            /* nop */
+        }
+        pxListItem = pxListItem->Flink;
+    }
+
+    return (int)uTimeoutMs;
+}
+
+static void *prvWorkerThread(void *pArg)
+{
+    GroupWorker_t *pxWorker = (GroupWorker_t *)pArg;
+    struct epoll_event xEvents[GROUP_MAX_EVENTS];
+    int xEventCnt = 0;
+    int xTimeoutMs = 0;
+    int i = 0;
+    uint64_t uNowMs = 0;
+    GroupMember_t *pxMember = NULL;
+    GroupMember_t *pxNextMember = NULL;
+    bool bRemove = false;
+    bool bIsClosed = false;
+
+    while (!ATOMIC_LOAD_ACQUIRE(&(pxWorker->bStop)))
+    {
+        if (Lock(pxWorker->xLock) != LOCK_OK)
+        {
+            LogError("Failed to lock");
+            sleepInMs(50);
+            continue;
+        }
+        xTimeoutMs = prvWorkerTimeoutMs(pxWorker);
+        Unlock(pxWorker->xLock);
+
+        if ((xEventCnt = epoll_wait(pxWorker->xEpollFd, xEvents, GROUP_MAX_EVENTS, xTimeoutMs)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                LogError("Failed to wait epoll, errno:%d", errno);
+                sleepInMs(50);
+            }
+            xEventCnt = 0;
+        }
+
+        for (i = 0; i < xEventCnt; i++)
+        {
+            if (xEvents[i].data.ptr == NULL)
+            {
+                /* Consume the signals of the worker. Members are checked below anyway. */
+                wakeupWait(pxWorker->xWakeup, -1, 0);
+            }
+            else
+            {
+                ((GroupMember_t *)xEvents[i].data.ptr)->bIsReady = true;
+            }
+        }
+
+        /* The network I/O of a member runs without the lock, so adding or removing members doesn't wait for it. */
+        uNowMs = getEpochTimestampInMs();
+        pxMember = prvWorkerNextMember(pxWorker, NULL, false, &bRemove);
+        while (pxMember != NULL && !ATOMIC_LOAD_ACQUIRE(&(pxWorker->bStop)))
+        {
+            bIsClosed = prvMemberRun(pxWorker, pxMember, bRemove, uNowMs);
+            pxNextMember = prvWorkerNextMember(pxWorker, pxMember, bIsClosed, &bRemove);
+            if (bIsClosed)
+            {
+                prvMemberSignalRemoved(pxWorker->pxGroup, pxMember);
+            }
+            pxMember = pxNextMember;
+        }
+    }
+
+    return NULL;
+}
+
+static void prvWorkerStop(GroupWorker_t *pxWorker)
+{
+    if (pxWorker->bIsStarted)
+    {
+        ATOMIC_STORE_RELEASE(&(pxWorker->bStop), true);
+        wakeupSignal(pxWorker->xWakeup);
+        pthread_join(pxWorker->xTid, NULL);
+        pxWorker->bIsStarted = false;
+    }
+}
+
+/* Close the members which are still in the group, since the worker has stopped. It's called with the remove lock of the
+ * group. A member which is being removed is freed by its KvsAppGroup_remove(), and the others are freed here. */
+static void prvWorkerTerminate(GroupWorker_t *pxWorker)
+{
+    GroupMember_t *pxMember = NULL;
+
+    if (pxWorker->xLock != NULL)
+    {
+        while (!DList_IsListEmpty(&(pxWorker->xMembers)))
+        {
+            pxMember = containingRecord(DList_RemoveHeadList(&(pxWorker->xMembers)), GroupMember_t, xMemberEntry);
+            if (pxMember->bIsOpening)
+            {
+                /* It waits for the setup thread. */
+                KvsApp_close(pxMember->xKvsAppHandle);
+            }
+            else if (pxMember->bIsOpen)
+            {
+                prvMemberClose(pxWorker, pxMember, getEpochTimestampInMs());
+            }
+            else
+            {
+                /* nop */
+            }
+            prvMemberSetNonBlocking(pxMember->xKvsAppHandle, false);
+
+            if (pxMember->bRemove)
+            {
+                pxMember->bIsRemoved = true;
+            }
+            else
+            {
+                kvsFree(pxMember);
+            }
+        }
+        Lock_Deinit(pxWorker->xLock);
+        pxWorker->xLock = NULL;
+    }
+
+    if (pxWorker->xWakeup != NULL)
+    {
+        wakeupTerminate(pxWorker->xWakeup);
+        pxWorker->xWakeup = NULL;
+    }
+
+    if (pxWorker->xEpollFd >= 0)
+    {
+        close(pxWorker->xEpollFd);
+        pxWorker->xEpollFd = -1;
+    }
+}
+
+static int prvWorkerInit(GroupWorker_t *pxWorker, KvsAppGroup_t *pxGroup)
+{
+    int res = KVS_ERRNO_NONE;
+
+    memset(pxWorker, 0, sizeof(GroupWorker_t));
+    pxWorker->pxGroup = pxGroup;
+    pxWorker->xEpollFd = -1;
+    DList_InitializeListHead(&(pxWorker->xMembers));
+
+    if ((pxWorker->xLock = Lock_Init()) == NULL)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to init lock");
+    }
+    else if ((pxWorker->xWakeup = wakeupCreate()) == NULL)
+    {
+        res = KVS_ERROR_FAIL_TO_CREATE_WAKEUP;
+        LogError("Failed to create wakeup");
+    }
+    else if ((pxWorker->xEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        res = KVS_ERROR_KVSAPP_GROUP_EPOLL_ERROR;
+        LogError("Failed to create epoll, errno:%d", errno);
+    }
+    else if ((res = prvEpollAdd(pxWorker, wakeupGetFd(pxWorker->xWakeup), NULL)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (pthread_create(&(pxWorker->xTid), NULL, prvWorkerThread, pxWorker) != 0)
+    {
+        res = KVS_ERROR_KVSAPP_FAIL_TO_START_SENDER;
+        LogError("Failed to create worker thread");
+    }
+    else
+    {
+        pxWorker->bIsStarted = true;
+    }
+
+    return res;
+}
+
+/* Find the member of a KVS application. It's called with the lock of the worker. */
+static GroupMember_t *prvWorkerFindMember(GroupWorker_t *pxWorker, KvsAppHandle xKvsAppHandle)
+{
+    PDLIST_ENTRY pxListHead = &(pxWorker->xMembers);
+    PDLIST_ENTRY pxListItem = pxListHead->Flink;
+    GroupMember_t *pxMember = NULL;
+
+    while (pxListItem != pxListHead)
+    {
+        pxMember = containingRecord(pxListItem, GroupMember_t, xMemberEntry);
+        if (pxMember->xKvsAppHandle == xKvsAppHandle && !pxMember->bRemove)
+        {
+            return pxMember;
+        }
+        pxListItem = pxListItem->Flink;
+    }
+
+    return NULL;
+}
+
+KvsAppGroupHandle KvsAppGroup_create(unsigned int uWorkerCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsAppGroup_t *pxGroup = NULL;
+    unsigned int i = 0;
+
+    if (uWorkerCnt == 0)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((pxGroup = (KvsAppGroup_t *)kvsMalloc(sizeof(KvsAppGroup_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxGroup");
+    }
+    else if ((pxGroup->pxWorkers = (GroupWorker_t *)kvsMalloc(sizeof(GroupWorker_t) * uWorkerCnt)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxWorkers");
+        kvsFree(pxGroup);
+        pxGroup = NULL;
+    }
+    else
+    {
+        pxGroup->uWorkerCnt = 0;
+        pxGroup->uRemoveWaiters = 0;
+        pxGroup->bIsRemoveLockInit = false;
+        if (pthread_mutex_init(&(pxGroup->xRemoveLock), NULL) != 0)
+        {
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to init remove lock");
+        }
+        else if (pthread_cond_init(&(pxGroup->xRemoveCond), NULL) != 0)
+        {
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to init remove condition");
+            pthread_mutex_destroy(&(pxGroup->xRemoveLock));
+        }
+        else
+        {
+            pxGroup->bIsRemoveLockInit = true;
+        }
+
+        for (i = 0; i < uWorkerCnt && res == KVS_ERRNO_NONE; i++)
+        {
+            res = prvWorkerInit(&(pxGroup->pxWorkers[i]), pxGroup);
+            pxGroup->uWorkerCnt++;
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            KvsAppGroup_terminate(pxGroup);
+            pxGroup = NULL;
+        }
+    }
+
+    return (KvsAppGroupHandle)pxGroup;
+}
+
+void KvsAppGroup_terminate(KvsAppGroupHandle xGroupHandle)
+{
+    KvsAppGroup_t *pxGroup = (KvsAppGroup_t *)xGroupHandle;
+    unsigned int i = 0;
+
+    if (pxGroup != NULL)
+    {
+        for (i = 0; i < pxGroup->uWorkerCnt; i++)
+        {
+            prvWorkerStop(&(pxGroup->pxWorkers[i]));
+        }
+
+        if (pxGroup->bIsRemoveLockInit)
+        {
+            pthread_mutex_lock(&(pxGroup->xRemoveLock));
+        }
+        for (i = 0; i < pxGroup->uWorkerCnt; i++)
+        {
+            prvWorkerTerminate(&(pxGroup->pxWorkers[i]));
+        }
+        if (pxGroup->bIsRemoveLockInit)
+        {
+            /* The waiting removes free their members, so the group is freed after they return. */
+            pthread_cond_broadcast(&(pxGroup->xRemoveCond));
+            while (pxGroup->uRemoveWaiters > 0)
+            {
+                pthread_cond_wait(&(pxGroup->xRemoveCond), &(pxGroup->xRemoveLock));
+            }
+            pthread_mutex_unlock(&(pxGroup->xRemoveLock));
+            pthread_cond_destroy(&(pxGroup->xRemoveCond));
+            pthread_mutex_destroy(&(pxGroup->xRemoveLock));
+        }
+
+        kvsFree(pxGroup->pxWorkers);
+        kvsFree(pxGroup);
+    }
+}
+
+int KvsAppGroup_add(KvsAppGroupHandle xGroupHandle, KvsAppHandle xKvsAppHandle, KvsAppGroupMemberParameter_t *pPara)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsAppGroup_t *pxGroup = (KvsAppGroup_t *)xGroupHandle;
+    GroupWorker_t *pxWorker = NULL;
+    GroupMember_t *pxMember = NULL;
+    int xWakeupFd = -1;
+    int xSocketFd = -1;
+    unsigned int i = 0;
+
+    if (pxGroup == NULL || xKvsAppHandle == NULL ||
+        (pPara != NULL && pPara->eDoWorkType != DO_WORK_DEFAULT && pPara->eDoWorkType != DO_WORK_SEND_BATCH))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((res = KvsApp_getPollFds(xKvsAppHandle, &xWakeupFd, &xSocketFd)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if ((pxMember = (GroupMember_t *)kvsMalloc(sizeof(GroupMember_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxMember");
+    }
+    else
+    {
+        memset(pxMember, 0, sizeof(GroupMember_t));
+        pxMember->xKvsAppHandle = xKvsAppHandle;
+        if (pPara != NULL)
+        {
+            pxMember->xPara = *pPara;
+        }
+        if (pxMember->xPara.uMaxWaitMs == 0)
+        {
+            pxMember->xPara.uMaxWaitMs = GROUP_DEFAULT_MAX_WAIT_MS;
+        }
+        pxMember->xWakeupFd = -1;
+        pxMember->xSocketFd = -1;
+        pxMember->uBackoffMs = GROUP_RECONNECT_MIN_BACKOFF_MS;
+        DList_InitializeListHead(&(pxMember->xMemberEntry));
+
+        for (i = 0; i < pxGroup->uWorkerCnt && res == KVS_ERRNO_NONE; i++)
+        {
+            if (Lock(pxGroup->pxWorkers[i].xLock) != LOCK_OK)
+            {
+                res = KVS_ERROR_LOCK_ERROR;
+                LogError("Failed to lock");
+            }
+            else
+            {
+                if (prvWorkerFindMember(&(pxGroup->pxWorkers[i]), xKvsAppHandle) != NULL)
+                {
+                    res = KVS_ERROR_INVALID_ARGUMENT;
+                    LogError("KVS app is already in the group");
+                }
+                else if (pxWorker == NULL || pxGroup->pxWorkers[i].uMemberCnt < pxWorker->uMemberCnt)
+                {
+                    pxWorker = &(pxGroup->pxWorkers[i]);
+                }
+                else
+                {
+                    /* nop */
+                }
+                Unlock(pxGroup->pxWorkers[i].xLock);
+            }
+        }
+
+        if (res == KVS_ERRNO_NONE)
+        {
+            if (Lock(pxWorker->xLock) != LOCK_OK)
+            {
+                res = KVS_ERROR_LOCK_ERROR;
+                LogError("Failed to lock");
+            }
+            else if ((res = prvMemberSetNonBlocking(xKvsAppHandle, true)) != KVS_ERRNO_NONE)
+            {
+                Unlock(pxWorker->xLock);
+            }
+            else
+            {
+                pxMember->pxWorker = pxWorker;
+                DList_InsertTailList(&(pxWorker->xMembers), &(pxMember->xMemberEntry));
+                pxWorker->uMemberCnt++;
+                Unlock(pxWorker->xLock);
+                wakeupSignal(pxWorker->xWakeup);
+            }
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            kvsFree(pxMember);
+        }
+    }
+
+    return res;
+}
+
+int KvsAppGroup_remove(KvsAppGroupHandle xGroupHandle, KvsAppHandle xKvsAppHandle)
+{
+    int res = KVS_ERROR_KVSAPP_NOT_IN_GROUP;
+    KvsAppGroup_t *pxGroup = (KvsAppGroup_t *)xGroupHandle;
+    GroupMember_t *pxMember = NULL;
+    unsigned int i = 0;
+
+    if (pxGroup == NULL || xKvsAppHandle == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (pthread_mutex_lock(&(pxGroup->xRemoveLock)) != 0)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        for (i = 0; i < pxGroup->uWorkerCnt && pxMember == NULL; i++)
+        {
+            if (Lock(pxGroup->pxWorkers[i].xLock) == LOCK_OK)
+            {
+                if ((pxMember = prvWorkerFindMember(&(pxGroup->pxWorkers[i]), xKvsAppHandle)) != NULL)
+                {
+                    pxMember->bRemove = true;
+                    wakeupSignal(pxGroup->pxWorkers[i].xWakeup);
+                }
+                Unlock(pxGroup->pxWorkers[i].xLock);
+            }
+        }
+
+        if (pxMember != NULL)
+        {
+            /* The worker, or KvsAppGroup_terminate(), sends the remaining frames and closes the member before it's
+             * freed. */
+            pxGroup->uRemoveWaiters++;
+            while (!pxMember->bIsRemoved)
+            {
+                pthread_cond_wait(&(pxGroup->xRemoveCond), &(pxGroup->xRemoveLock));
+            }
+            pxGroup->uRemoveWaiters--;
+            pthread_cond_broadcast(&(pxGroup->xRemoveCond));
+            res = KVS_ERRNO_NONE;
+        }
+        else
+        {
+            LogError("KVS app is not in the group");
+        }
+        pthread_mutex_unlock(&(pxGroup->xRemoveLock));
+
+        kvsFree(pxMember);
+    }
+
+    return res;
+}
@@ -62,6 +62,61 @@ bool isKeyFrame(uint8_t *pBuf, size_t uLen)
     return bIsKeyFrame;
 }
 
+/* Update the reference state of a frame with the header byte of one of its NALUs. */
+static void prvCheckNaluReference(uint8_t uNaluHdr, bool *pbHasVcl, bool *pbIsReferenced)
+{
+    uint8_t uNaluType = uNaluHdr & 0x1F;
+
+    if (uNaluType >= NALU_TYPE_NON_IDR_PICTURE && uNaluType <= NALU_TYPE_IFRAME)
+    {
+        *pbHasVcl = true;
+        if ((uNaluHdr & 0x60) != 0)
+        {
+            *pbIsReferenced = true;
+        }
+    }
+}
+
+bool NALU_isNonReferenceFrame(uint8_t *pBuf, size_t uLen)
+{
+    bool bHasVcl = false;
+    bool bIsReferenced = false;
+    size_t uIdx = 0;
+    uint32_t uNaluLen = 0;
+
+    if (pBuf != NULL && uLen >= 5)
+    {
+        if (NALU_isAnnexBFrame(pBuf, uLen))
+        {
+            /* Both 3 bytes and 4 bytes start codes end with 0x00 0x00 0x01. */
+            for (uIdx = 0; uIdx + 3 < uLen; uIdx++)
+            {
+                if (pBuf[uIdx] == 0x00 && pBuf[uIdx + 1] == 0x00 && pBuf[uIdx + 2] == 0x01)
+                {
+                    prvCheckNaluReference(pBuf[uIdx + 3], &bHasVcl, &bIsReferenced);
+                    uIdx += 3;
+                }
+            }
+        }
+        else
+        {
+            while (uIdx + 4 < uLen)
+            {
+                uNaluLen = (pBuf[uIdx] << 24) | (pBuf[uIdx + 1] << 16) | (pBuf[uIdx + 2] << 8) | pBuf[uIdx + 3];
+                uIdx += 4;
+                prvCheckNaluReference(pBuf[uIdx], &bHasVcl, &bIsReferenced);
+                if (uNaluLen > uLen - uIdx)
+                {
+                    break;
+                }
+                uIdx += uNaluLen;
+            }
+        }
+    }
+
+    return bHasVcl && !bIsReferenced;
+}
+
 int NALU_getNaluType(uint8_t *pBuf, size_t uLen)
 {
     int xNaluType = NALU_TYPE_UNKNOWN;
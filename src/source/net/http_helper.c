@@ -15,16 +15,22 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <string.h>
 
 /* Third party headers */
 #include "azure_c_shared_utility/buffer_.h"
 #include "azure_c_shared_utility/httpheaders.h"
+#include "azure_c_shared_utility/lock.h"
 #include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/xlogging.h"
 
 /* Public headers */
+#include "kvs/control_plane_client.h"
 #include "kvs/errors.h"
 
+/* Platform dependent headers */
+#include "kvs/port.h"
+
 /* Internal headers */
 #include "os/allocator.h"
 #include "net/http_helper.h"
@@ -33,6 +39,19 @@
 
 #define DEFAULT_HTTP_RECV_BUFSIZE 2048
 
+/* Servers close a connection which is idle for about a minute, so a connection idle longer than this isn't reused. */
+#define CONTROL_PLANE_IDLE_TIMEOUT_MS (50000)
+
+typedef struct ControlPlaneClient
+{
+    LOCK_HANDLE xLock;
+
+    /* The kept-alive connection to pcHost, or NULL if there is none. A request takes it out while using it. */
+    NetIoHandle xNetIoHandle;
+    char *pcHost;
+    uint64_t uLastUsedMs;
+} ControlPlaneClient_t;
+
 static int prvGenerateHttpReq(const char *pcHttpMethod, const char *pcUri, HTTP_HEADERS_HANDLE xHttpReqHeaders, const char *pcBody, STRING_HANDLE *pStringHandle)
 {
     int res = KVS_ERRNO_NONE;
@@ -162,7 +181,8 @@ int Http_recvHttpRsp(NetIoHandle xNetIoHandle, unsigned int *puHttpStatus, char
             }
             if ((res = NetIo_recv(xNetIoHandle, BUFFER_u_char(xBufRecv) + uBytesTotalReceived, BUFFER_length(xBufRecv) - uBytesTotalReceived, &uBytesReceived)) != KVS_ERRNO_NONE)
             {
-                /* Propagate the res error */
+                /* The connection is broken or closed by the server, so no more data will come. */
+                break;
             }
             /* It should be a timeout case. */
             else if (uBytesReceived == 0)
@@ -206,5 +226,188 @@ int Http_recvHttpRsp(NetIoHandle xNetIoHandle, unsigned int *puHttpStatus, char
 
     BUFFER_delete(xBufRecv);
 
+    return res;
+}
+
+static void prvCloseConnection(NetIoHandle xNetIoHandle)
+{
+    if (xNetIoHandle != NULL)
+    {
+        NetIo_disconnect(xNetIoHandle);
+        NetIo_terminate(xNetIoHandle);
+    }
+}
+
+/* Take the kept-alive connection if it's connected to the host and still usable, or return NULL. */
+static NetIoHandle prvTakeConnection(ControlPlaneClient_t *pxClient, const char *pcHost)
+{
+    NetIoHandle xNetIoHandle = NULL;
+
+    if (pxClient != NULL && Lock(pxClient->xLock) == LOCK_OK)
+    {
+        xNetIoHandle = pxClient->xNetIoHandle;
+        pxClient->xNetIoHandle = NULL;
+
+        if (xNetIoHandle == NULL)
+        {
+            /* nop */
+        }
+        else if (strcmp(pxClient->pcHost, pcHost) != 0 || getEpochTimestampInMs() - pxClient->uLastUsedMs > CONTROL_PLANE_IDLE_TIMEOUT_MS ||
+                 NetIo_isDataAvailable(xNetIoHandle))
+        {
+            /* An idle connection is only readable if the server has closed it or sent something unexpected. */
+            prvCloseConnection(xNetIoHandle);
+            xNetIoHandle = NULL;
+        }
+        else
+        {
+            /* nop */
+        }
+
+        Unlock(pxClient->xLock);
+    }
+
+    return xNetIoHandle;
+}
+
+/* Keep the connection in the client for the next request, or close it if the client can't keep it. */
+static void prvKeepConnection(ControlPlaneClient_t *pxClient, const char *pcHost, NetIoHandle xNetIoHandle)
+{
+    size_t uHostLen = strlen(pcHost);
+    char *pcHostCopy = NULL;
+
+    if (pxClient == NULL || Lock(pxClient->xLock) != LOCK_OK)
+    {
+        prvCloseConnection(xNetIoHandle);
+    }
+    else
+    {
+        if (pxClient->pcHost != NULL && strcmp(pxClient->pcHost, pcHost) == 0)
+        {
+            /* The host is the same, so the copy of it is reused. */
+        }
+        else if ((pcHostCopy = (char *)kvsMalloc(uHostLen + 1)) == NULL)
+        {
+            LogError("OOM: pcHost");
+            prvCloseConnection(xNetIoHandle);
+            xNetIoHandle = NULL;
+        }
+        else
+        {
+            memcpy(pcHostCopy, pcHost, uHostLen + 1);
+            kvsFree(pxClient->pcHost);
+            pxClient->pcHost = pcHostCopy;
+        }
+
+        if (xNetIoHandle != NULL)
+        {
+            /* A concurrent request may have kept its connection in the meantime. */
+            prvCloseConnection(pxClient->xNetIoHandle);
+            pxClient->xNetIoHandle = xNetIoHandle;
+            pxClient->uLastUsedMs = getEpochTimestampInMs();
+        }
+
+        Unlock(pxClient->xLock);
+    }
+}
+
+ControlPlaneClientHandle ControlPlaneClient_create(void)
+{
+    ControlPlaneClient_t *pxClient = NULL;
+
+    if ((pxClient = (ControlPlaneClient_t *)kvsMalloc(sizeof(ControlPlaneClient_t))) == NULL)
+    {
+        LogError("OOM: pxClient");
+    }
+    else
+    {
+        memset(pxClient, 0, sizeof(ControlPlaneClient_t));
+
+        if ((pxClient->xLock = Lock_Init()) == NULL)
+        {
+            LogError("Failed to initialize lock");
+            kvsFree(pxClient);
+            pxClient = NULL;
+        }
+    }
+
+    return (ControlPlaneClientHandle)pxClient;
+}
+
+void ControlPlaneClient_terminate(ControlPlaneClientHandle xClient)
+{
+    ControlPlaneClient_t *pxClient = (ControlPlaneClient_t *)xClient;
+
+    if (pxClient != NULL)
+    {
+        prvCloseConnection(pxClient->xNetIoHandle);
+        kvsFree(pxClient->pcHost);
+        Lock_Deinit(pxClient->xLock);
+        kvsFree(pxClient);
+    }
+}
+
+int Http_executeControlPlaneReq(ControlPlaneClientHandle xClient, const char *pcHost, HttpConnect_t xConnect, void *pConnectArg, const char *pcHttpMethod, const char *pcUri,
+                                HTTP_HEADERS_HANDLE xHttpReqHeaders, const char *pcBody, unsigned int *puHttpStatus, char **ppRspBody, size_t *puRspBodyLen)
+{
+    int res = KVS_ERRNO_NONE;
+    ControlPlaneClient_t *pxClient = (ControlPlaneClient_t *)xClient;
+    NetIoHandle xNetIoHandle = NULL;
+
+    if (pcHost == NULL || xConnect == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        if ((xNetIoHandle = prvTakeConnection(pxClient, pcHost)) != NULL)
+        {
+            if ((res = Http_executeHttpReq(xNetIoHandle, pcHttpMethod, pcUri, xHttpReqHeaders, pcBody)) != KVS_ERRNO_NONE ||
+                (res = Http_recvHttpRsp(xNetIoHandle, puHttpStatus, ppRspBody, puRspBodyLen)) != KVS_ERRNO_NONE)
+            {
+                LogInfo("Kept-alive connection to %s is broken, reconnect", pcHost);
+                prvCloseConnection(xNetIoHandle);
+                xNetIoHandle = NULL;
+            }
+        }
+
+        if (xNetIoHandle == NULL)
+        {
+            if ((xNetIoHandle = NetIo_create()) == NULL)
+            {
+                res = KVS_ERROR_FAIL_TO_CREATE_NETIO_HANDLE;
+                LogError("Failed to create NetIo handle");
+            }
+            else if ((res = xConnect(xNetIoHandle, pConnectArg)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to connect to %s", pcHost);
+                /* Propagate the res error */
+            }
+            else if ((res = Http_executeHttpReq(xNetIoHandle, pcHttpMethod, pcUri, xHttpReqHeaders, pcBody)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed send http request to %s", pcHost);
+                /* Propagate the res error */
+            }
+            else if ((res = Http_recvHttpRsp(xNetIoHandle, puHttpStatus, ppRspBody, puRspBodyLen)) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed recv http response from %s", pcHost);
+                /* Propagate the res error */
+            }
+            else
+            {
+                /* nop */
+            }
+        }
+
+        if (res == KVS_ERRNO_NONE)
+        {
+            prvKeepConnection(pxClient, pcHost, xNetIoHandle);
+        }
+        else
+        {
+            prvCloseConnection(xNetIoHandle);
+        }
+    }
+
     return res;
 }
\ No newline at end of file
@@ -18,6 +18,8 @@
 
 #include "azure_c_shared_utility/httpheaders.h"
 
+#include "kvs/control_plane_client.h"
+
 #include "netio.h"
 
 #define HTTP_METHOD_GET                 "GET"
@@ -76,4 +78,36 @@ int Http_executeHttpReq(NetIoHandle xNetIoHandle, const char *pcHttpMethod, cons
  */
 int Http_recvHttpRsp(NetIoHandle xNetIoHandle, unsigned int *puHttpStatus, char **ppRspBody, size_t *puRspBodyLen);
 
+/**
+ * @brief The callback that sets up a new network I/O handle and connects it to the host.
+ *
+ * @param[in] xNetIoHandle The network I/O handle
+ * @param[in] pConnectArg The argument passed to Http_executeControlPlaneReq
+ * @return 0 on success, non-zero value otherwise
+ */
+typedef int (*HttpConnect_t)(NetIoHandle xNetIoHandle, void *pConnectArg);
+
+/**
+ * @brief Execute HTTP request and receive its response on the kept-alive connection of a control plane client.
+ *
+ * If the client has no usable connection to the host, it makes a new one by xConnect. A kept-alive connection may have
+ * been closed by the server without being noticed, so a request failed on it is retried once on a new connection. The
+ * connection is kept in the client after a successful response.
+ *
+ * @param[in] xClient The control plane client. If it's NULL, the connection is closed after the response.
+ * @param[in] pcHost The host that the request is sent to
+ * @param[in] xConnect The callback to connect a new network I/O handle
+ * @param[in] pConnectArg The argument of xConnect
+ * @param[in] pcHttpMethod The HTTP method. (Ex. GET, PUT, POST)
+ * @param[in] pcUri The relative path of URI
+ * @param[in] xHttpReqHeaders The HTTP headers
+ * @param[in] pcBody The HTTP body
+ * @param[out] puHttpStatus The HTTP status code
+ * @param[out] ppRspBody The HTTP response body that is memory allocated and the callee has the responsible to free it.
+ * @param[out] puRspBodyLen The length of HTTP response body.
+ * @return 0 on success, non-zero value otherwise
+ */
+int Http_executeControlPlaneReq(ControlPlaneClientHandle xClient, const char *pcHost, HttpConnect_t xConnect, void *pConnectArg, const char *pcHttpMethod, const char *pcUri,
+                                HTTP_HEADERS_HANDLE xHttpReqHeaders, const char *pcBody, unsigned int *puHttpStatus, char **ppRspBody, size_t *puRspBodyLen);
+
 #endif /* HTTP_HELPER_H */
\ No newline at end of file
@@ -17,15 +17,8 @@
 #include <stdint.h>
 #include <string.h>
 
-#include <sys/time.h>
-#include <sys/socket.h>
-
 /* Third party headers */
 #include "azure_c_shared_utility/xlogging.h"
-#include "mbedtls/ctr_drbg.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/net.h"
-#include "mbedtls/net_sockets.h"
 
 /* Public headers */
 #include "kvs/errors.h"
@@ -33,150 +26,143 @@
 /* Internal headers */
 #include "os/allocator.h"
 #include "net/netio.h"
+#include "net/netio_transport.h"
 
 #define DEFAULT_CONNECTION_TIMEOUT_MS       (10 * 1000)
 
 typedef struct NetIo
 {
-    /* Basic ssl connection parameters */
-    mbedtls_net_context xFd;
-    mbedtls_ssl_context xSsl;
-    mbedtls_ssl_config xConf;
-    mbedtls_ctr_drbg_context xCtrDrbg;
-    mbedtls_entropy_context xEntropy;
-
-    /* Variables for IoT credential provider. It's optional feature so we declare them as pointers. */
-    mbedtls_x509_crt *pRootCA;
-    mbedtls_x509_crt *pCert;
-    mbedtls_pk_context *pPrivKey;
-
-    /* Options */
-    uint32_t uRecvTimeoutMs;
-    uint32_t uSendTimeoutMs;
+    const NetIoTransport_t *pxTransport;
+
+    /* The connection of the transport. It's NULL if it's not connected. */
+    void *pCtx;
+
+    NetIoOptions_t xOptions;
+
+    /* The data which isn't sent yet in the non-blocking mode. It's sent from uPendingOffset before any newer data. */
+    unsigned char *pPendingBuf;
+    size_t uPendingBufSize;
+    size_t uPendingOffset;
+    size_t uPendingLen;
 } NetIo_t;
 
-static int prvCreateX509Cert(NetIo_t *pxNet)
+static int prvConnect(NetIo_t *pxNet, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509)
 {
     int res = KVS_ERRNO_NONE;
 
-    if (pxNet == NULL)
+    if (pxNet == NULL || pcHost == NULL || pcPort == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
     }
-    else if ((pxNet->pRootCA = (mbedtls_x509_crt *)kvsMalloc(sizeof(mbedtls_x509_crt))) == NULL ||
-        (pxNet->pCert = (mbedtls_x509_crt *)kvsMalloc(sizeof(mbedtls_x509_crt))) == NULL ||
-        (pxNet->pPrivKey = (mbedtls_pk_context *)kvsMalloc(sizeof(mbedtls_pk_context))) == NULL)
+    else if (pxNet->pCtx != NULL)
     {
-        res = KVS_ERROR_OUT_OF_MEMORY;
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("%s is already connected", pxNet->pxTransport->pcName);
     }
     else
     {
-        mbedtls_x509_crt_init(pxNet->pRootCA);
-        mbedtls_x509_crt_init(pxNet->pCert);
-        mbedtls_pk_init(pxNet->pPrivKey);
+        res = pxNet->pxTransport->connect(&(pxNet->xOptions), pcHost, pcPort, pxX509, &(pxNet->pCtx));
     }
 
     return res;
 }
 
-static int prvInitConfig(NetIo_t *pxNet, const char *pcHost, const char *pcRootCA, const char *pcCert, const char *pcPrivKey)
+/* Apply the changed options if it's connected. */
+static int prvUpdateOptions(NetIo_t *pxNet)
 {
     int res = KVS_ERRNO_NONE;
-    int retVal = 0;
 
-    if (pxNet == NULL)
+    if (pxNet->pCtx != NULL && pxNet->pxTransport->updateOptions != NULL)
     {
-        res = KVS_ERROR_INVALID_ARGUMENT;
+        res = pxNet->pxTransport->updateOptions(pxNet->pCtx, &(pxNet->xOptions));
     }
-    else
+
+    return res;
+}
+
+/* Copy the buffers after the pending data. The buffer only grows, so it settles at the size of the largest backlog. */
+static int prvPendingAppend(NetIo_t *pxNet, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    unsigned char *pPendingBuf = NULL;
+    size_t uLen = 0;
+    size_t uBufSize = 0;
+    size_t i = 0;
+
+    if (pxNet->uPendingOffset > 0)
+    {
+        memmove(pxNet->pPendingBuf, pxNet->pPendingBuf + pxNet->uPendingOffset, pxNet->uPendingLen - pxNet->uPendingOffset);
+        pxNet->uPendingLen -= pxNet->uPendingOffset;
+        pxNet->uPendingOffset = 0;
+    }
+
+    uLen = pxNet->uPendingLen;
+    for (i = 0; i < uVecCnt; i++)
     {
-        mbedtls_ssl_set_bio(&(pxNet->xSsl), &(pxNet->xFd), mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+        uLen += (pxVecs[i].pBuffer == NULL) ? 0 : pxVecs[i].uLen;
+    }
 
-        if ((retVal = mbedtls_ssl_config_defaults(&(pxNet->xConf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
+    if (uLen > pxNet->uPendingBufSize)
+    {
+        uBufSize = (uLen > pxNet->uPendingBufSize * 2) ? uLen : (pxNet->uPendingBufSize * 2);
+        if ((pPendingBuf = (unsigned char *)kvsRealloc(pxNet->pPendingBuf, uBufSize)) == NULL)
         {
-            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-            LogError("Failed to config ssl (err:-%X)", -res);
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: pPendingBuf");
         }
         else
         {
-            mbedtls_ssl_conf_rng(&(pxNet->xConf), mbedtls_ctr_drbg_random, &(pxNet->xCtrDrbg));
-            mbedtls_ssl_set_hostname(&(pxNet->xSsl), pcHost);
-            mbedtls_ssl_conf_read_timeout(&(pxNet->xConf), pxNet->uRecvTimeoutMs);
-            NetIo_setSendTimeout(pxNet, pxNet->uSendTimeoutMs);
-
-            if (pcRootCA != NULL && pcCert != NULL && pcPrivKey != NULL)
-            {
-                if ((retVal = mbedtls_x509_crt_parse(pxNet->pRootCA, (void *)pcRootCA, strlen(pcRootCA) + 1)) != 0 ||
-                    (retVal = mbedtls_x509_crt_parse(pxNet->pCert, (void *)pcCert, strlen(pcCert) + 1)) != 0 ||
-                    (retVal = mbedtls_pk_parse_key(pxNet->pPrivKey, (void *)pcPrivKey, strlen(pcPrivKey) + 1, NULL, 0)) != 0)
-                {
-                    res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-                    LogError("Failed to parse x509 (err:-%X)", -res);
-                }
-                else
-                {
-                    mbedtls_ssl_conf_authmode(&(pxNet->xConf), MBEDTLS_SSL_VERIFY_REQUIRED);
-                    mbedtls_ssl_conf_ca_chain(&(pxNet->xConf), pxNet->pRootCA, NULL);
-
-                    if ((retVal = mbedtls_ssl_conf_own_cert(&(pxNet->xConf), pxNet->pCert, pxNet->pPrivKey)) != 0)
-                    {
-                        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-                        LogError("Failed to conf own cert (err:-%X)", -res);
-                    }
-                }
-            }
-            else
-            {
-                mbedtls_ssl_conf_authmode(&(pxNet->xConf), MBEDTLS_SSL_VERIFY_OPTIONAL);
-            }
+            pxNet->pPendingBuf = pPendingBuf;
+            pxNet->uPendingBufSize = uBufSize;
         }
     }
 
-    if (res == KVS_ERRNO_NONE)
+    for (i = 0; i < uVecCnt && res == KVS_ERRNO_NONE; i++)
     {
-        if ((retVal = mbedtls_ssl_setup(&(pxNet->xSsl), &(pxNet->xConf))) != 0)
+        if (pxVecs[i].pBuffer != NULL && pxVecs[i].uLen > 0)
         {
-            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-            LogError("Failed to setup ssl (err:-%X)", -res);
+            memcpy(pxNet->pPendingBuf + pxNet->uPendingLen, pxVecs[i].pBuffer, pxVecs[i].uLen);
+            pxNet->uPendingLen += pxVecs[i].uLen;
         }
     }
 
     return res;
 }
 
-static int prvConnect(NetIo_t *pxNet, const char *pcHost, const char *pcPort, const char *pcRootCA, const char *pcCert, const char *pcPrivKey)
+/* Send the pending data until the connection doesn't take more. In the blocking mode, a call which sends nothing has
+ * timed out. */
+static int prvPendingFlush(NetIo_t *pxNet)
 {
     int res = KVS_ERRNO_NONE;
-    int retVal = 0;
+    size_t uBytesSent = 0;
 
-    if (pxNet == NULL || pcHost == NULL || pcPort == NULL)
+    while (pxNet->uPendingOffset < pxNet->uPendingLen && res == KVS_ERRNO_NONE)
     {
-        res = KVS_ERROR_INVALID_ARGUMENT;
-        LogError("Invalid argument");
-    }
-    else if ((pcRootCA != NULL && pcCert != NULL && pcPrivKey != NULL) && (res = prvCreateX509Cert(pxNet)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed to init x509 (err:-%X)", -res);
-        /* Propagate the res error */
-    }
-    else if ((retVal = mbedtls_net_connect(&(pxNet->xFd), pcHost, pcPort, MBEDTLS_NET_PROTO_TCP)) != 0)
-    {
-        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-        LogError("Failed to connect to %s:%s (err:-%X)", pcHost, pcPort, -res);
-    }
-    else if ((res = prvInitConfig(pxNet, pcHost, pcRootCA, pcCert, pcPrivKey)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed to config ssl (err:-%X)", -res);
-        /* Propagate the res error */
-    }
-    else if ((retVal = mbedtls_ssl_handshake(&(pxNet->xSsl))) != 0)
-    {
-        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
-        LogError("ssl handshake err (-%X)", -res);
+        if ((res = pxNet->pxTransport->trySend(pxNet->pCtx, pxNet->pPendingBuf + pxNet->uPendingOffset, pxNet->uPendingLen - pxNet->uPendingOffset, &uBytesSent)) !=
+            KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+        }
+        else if (uBytesSent == 0 && !pxNet->xOptions.bNonBlocking)
+        {
+            res = KVS_ERROR_NETIO_SEND_FAILED;
+            LogError("%s send error: timeout", pxNet->pxTransport->pcName);
+        }
+        else if (uBytesSent == 0)
+        {
+            break;
+        }
+        else
+        {
+            pxNet->uPendingOffset += uBytesSent;
+        }
     }
-    else
+
+    if (pxNet->uPendingOffset == pxNet->uPendingLen)
     {
-        /* nop */
+        pxNet->uPendingOffset = 0;
+        pxNet->uPendingLen = 0;
     }
 
     return res;
@@ -190,20 +176,32 @@ NetIoHandle NetIo_create(void)
     {
         memset(pxNet, 0, sizeof(NetIo_t));
 
-        mbedtls_net_init(&(pxNet->xFd));
-        mbedtls_ssl_init(&(pxNet->xSsl));
-        mbedtls_ssl_config_init(&(pxNet->xConf));
-        mbedtls_ctr_drbg_init(&(pxNet->xCtrDrbg));
-        mbedtls_entropy_init(&(pxNet->xEntropy));
+        pxNet->pxTransport = NetIoTransport_getMbedtls();
+        pxNet->xOptions.uRecvTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
+        pxNet->xOptions.uSendTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
+    }
 
-        pxNet->uRecvTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
-        pxNet->uSendTimeoutMs = DEFAULT_CONNECTION_TIMEOUT_MS;
+    return pxNet;
+}
 
-        if (mbedtls_ctr_drbg_seed(&(pxNet->xCtrDrbg), mbedtls_entropy_func, &(pxNet->xEntropy), NULL, 0) != 0)
-        {
-            NetIo_terminate(pxNet);
-            pxNet = NULL;
-        }
+NetIoHandle NetIo_createConnected(const NetIoTransport_t *pxTransport, void *pCtx)
+{
+    NetIo_t *pxNet = NULL;
+
+    if (pxTransport == NULL || pCtx == NULL)
+    {
+        LogError("Invalid argument");
+    }
+    else if ((pxNet = (NetIo_t *)NetIo_create()) == NULL)
+    {
+        LogError("OOM: pxNet");
+        pxTransport->close(pCtx);
+    }
+    else
+    {
+        pxNet->pxTransport = pxTransport;
+        pxNet->pCtx = pCtx;
+        prvUpdateOptions(pxNet);
     }
 
     return pxNet;
@@ -215,88 +213,108 @@ void NetIo_terminate(NetIoHandle xNetIoHandle)
 
     if (pxNet != NULL)
     {
-        mbedtls_ctr_drbg_free(&(pxNet->xCtrDrbg));
-        mbedtls_entropy_free(&(pxNet->xEntropy));
-        mbedtls_net_free(&(pxNet->xFd));
-        mbedtls_ssl_free(&(pxNet->xSsl));
-        mbedtls_ssl_config_free(&(pxNet->xConf));
-
-        if (pxNet->pRootCA != NULL)
+        NetIo_disconnect(pxNet);
+        if (pxNet->pPendingBuf != NULL)
         {
-            mbedtls_x509_crt_free(pxNet->pRootCA);
-            kvsFree(pxNet->pRootCA);
-            pxNet->pRootCA = NULL;
+            kvsFree(pxNet->pPendingBuf);
         }
+        kvsFree(pxNet);
+    }
+}
 
-        if (pxNet->pCert != NULL)
-        {
-            mbedtls_x509_crt_free(pxNet->pCert);
-            kvsFree(pxNet->pCert);
-            pxNet->pCert = NULL;
-        }
+int NetIo_setTransport(NetIoHandle xNetIoHandle, const NetIoTransport_t *pxTransport)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
 
-        if (pxNet->pPrivKey != NULL)
-        {
-            mbedtls_pk_free(pxNet->pPrivKey);
-            kvsFree(pxNet->pPrivKey);
-            pxNet->pPrivKey = NULL;
-        }
-        kvsFree(pxNet);
+    if (pxNet == NULL || pxNet->pCtx != NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->pxTransport = (pxTransport == NULL) ? NetIoTransport_getMbedtls() : pxTransport;
     }
+
+    return res;
 }
 
 int NetIo_connect(NetIoHandle xNetIoHandle, const char *pcHost, const char *pcPort)
 {
-    return prvConnect(xNetIoHandle, pcHost, pcPort, NULL, NULL, NULL);
+    return prvConnect(xNetIoHandle, pcHost, pcPort, NULL);
 }
 
 int NetIo_connectWithX509(NetIoHandle xNetIoHandle, const char *pcHost, const char *pcPort, const char *pcRootCA, const char *pcCert, const char *pcPrivKey)
 {
-    return prvConnect(xNetIoHandle, pcHost, pcPort, pcRootCA, pcCert, pcPrivKey);
+    NetIoX509_t xX509 = {pcRootCA, pcCert, pcPrivKey};
+
+    return prvConnect(xNetIoHandle, pcHost, pcPort, (pcRootCA != NULL && pcCert != NULL && pcPrivKey != NULL) ? &xX509 : NULL);
 }
 
 void NetIo_disconnect(NetIoHandle xNetIoHandle)
 {
     NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
 
-    if (pxNet != NULL)
+    if (pxNet != NULL && pxNet->pCtx != NULL)
     {
-        mbedtls_ssl_close_notify(&(pxNet->xSsl));
+        pxNet->pxTransport->close(pxNet->pCtx);
+        pxNet->pCtx = NULL;
+        pxNet->uPendingOffset = 0;
+        pxNet->uPendingLen = 0;
     }
 }
 
 int NetIo_send(NetIoHandle xNetIoHandle, const unsigned char *pBuffer, size_t uBytesToSend)
 {
-    int n = 0;
     int res = KVS_ERRNO_NONE;
     NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
-    size_t uBytesRemaining = uBytesToSend;
-    char *pIndex = (char *)pBuffer;
+    NetIoVec_t xVec = {pBuffer, uBytesToSend};
 
     if (pxNet == NULL || pBuffer == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (pxNet->pCtx == NULL)
+    {
+        res = KVS_ERROR_NETIO_NOT_CONNECTED;
+    }
+    else if (pxNet->xOptions.bNonBlocking)
+    {
+        res = NetIo_sendv(pxNet, &xVec, 1);
+    }
     else
     {
-        do
-        {
-            n = mbedtls_ssl_write(&(pxNet->xSsl), (const unsigned char *)pIndex, uBytesRemaining);
-            if (n < 0)
-            {
-                res = KVS_GENERATE_MBEDTLS_ERROR(n);
-                LogError("SSL send error -%X", -res);
-                break;
-            }
-            else if (n > uBytesRemaining)
-            {
-                res = KVS_ERROR_NETIO_SEND_MORE_THAN_REMAINING_DATA;
-                LogError("SSL send error -%X", -res);
-                break;
-            }
-            uBytesRemaining -= n;
-            pIndex += n;
-        } while (uBytesRemaining > 0);
+        res = pxNet->pxTransport->send(pxNet->pCtx, pBuffer, uBytesToSend);
+    }
+
+    return res;
+}
+
+int NetIo_sendv(NetIoHandle xNetIoHandle, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL || (pxVecs == NULL && uVecCnt > 0))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (pxNet->pCtx == NULL)
+    {
+        res = KVS_ERROR_NETIO_NOT_CONNECTED;
+    }
+    else if (!pxNet->xOptions.bNonBlocking)
+    {
+        res = pxNet->pxTransport->sendv(pxNet->pCtx, pxVecs, uVecCnt);
+    }
+    else if ((res = prvPendingAppend(pxNet, pxVecs, uVecCnt)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* The data is queued, so small buffers are still sent in full-size records. */
+        res = prvPendingFlush(pxNet);
     }
 
     return res;
@@ -304,7 +322,6 @@ int NetIo_send(NetIoHandle xNetIoHandle, const unsigned char *pBuffer, size_t uB
 
 int NetIo_recv(NetIoHandle xNetIoHandle, unsigned char *pBuffer, size_t uBufferSize, size_t *puBytesReceived)
 {
-    int n;
     int res = KVS_ERRNO_NONE;
     NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
 
@@ -312,58 +329,36 @@ int NetIo_recv(NetIoHandle xNetIoHandle, unsigned char *pBuffer, size_t uBufferS
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
     }
+    else if (pxNet->pCtx == NULL)
+    {
+        res = KVS_ERROR_NETIO_NOT_CONNECTED;
+    }
     else
     {
-        n = mbedtls_ssl_read(&(pxNet->xSsl), pBuffer, uBufferSize);
-        if (n < 0)
-        {
-            res = KVS_GENERATE_MBEDTLS_ERROR(n);
-            LogError("SSL recv error -%X", -res);
-        }
-        else if (n > uBufferSize)
-        {
-            res = KVS_ERROR_NETIO_RECV_MORE_THAN_AVAILABLE_SPACE;
-            LogError("SSL recv error -%X", -res);
-        }
-        else
-        {
-            *puBytesReceived = n;
-        }
+        res = pxNet->pxTransport->recv(pxNet->pCtx, pBuffer, uBufferSize, puBytesReceived);
     }
 
     return res;
 }
 
-bool NetIo_isDataAvailable(NetIoHandle xNetIoHandle)
+int NetIo_getSocket(NetIoHandle xNetIoHandle)
 {
     NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
-    bool bDataAvailable = false;
-    struct timeval tv = {0};
-    fd_set read_fds = {0};
-    int fd = 0;
+    int fd = -1;
 
-    if (pxNet != NULL)
+    if (pxNet != NULL && pxNet->pCtx != NULL && pxNet->pxTransport->getSocket != NULL)
     {
-        fd = pxNet->xFd.fd;
-        if (fd >= 0)
-        {
-            FD_ZERO(&read_fds);
-            FD_SET(fd, &read_fds);
-
-            tv.tv_sec = 0;
-            tv.tv_usec = 0;
-
-            if (select(fd + 1, &read_fds, NULL, NULL, &tv) >= 0)
-            {
-                if (FD_ISSET(fd, &read_fds))
-                {
-                    bDataAvailable = true;
-                }
-            }
-        }
+        fd = pxNet->pxTransport->getSocket(pxNet->pCtx);
     }
 
-    return bDataAvailable;
+    return fd;
+}
+
+bool NetIo_isDataAvailable(NetIoHandle xNetIoHandle)
+{
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    return (pxNet != NULL && pxNet->pCtx != NULL && pxNet->pxTransport->poll(pxNet->pCtx, 0));
 }
 
 int NetIo_setRecvTimeout(NetIoHandle xNetIoHandle, unsigned int uRecvTimeoutMs)
@@ -377,8 +372,8 @@ int NetIo_setRecvTimeout(NetIoHandle xNetIoHandle, unsigned int uRecvTimeoutMs)
     }
     else
     {
-        pxNet->uRecvTimeoutMs = (uint32_t)uRecvTimeoutMs;
-        mbedtls_ssl_conf_read_timeout(&(pxNet->xConf), pxNet->uRecvTimeoutMs);
+        pxNet->xOptions.uRecvTimeoutMs = (uint32_t)uRecvTimeoutMs;
+        res = prvUpdateOptions(pxNet);
     }
 
     return res;
@@ -388,8 +383,6 @@ int NetIo_setSendTimeout(NetIoHandle xNetIoHandle, unsigned int uSendTimeoutMs)
 {
     int res = KVS_ERRNO_NONE;
     NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
-    int fd = 0;
-    struct timeval tv = {0};
 
     if (pxNet == NULL)
     {
@@ -397,18 +390,33 @@ int NetIo_setSendTimeout(NetIoHandle xNetIoHandle, unsigned int uSendTimeoutMs)
     }
     else
     {
-        pxNet->uSendTimeoutMs = (uint32_t)uSendTimeoutMs;
-        fd = pxNet->xFd.fd;
-        tv.tv_sec = uSendTimeoutMs / 1000;
-        tv.tv_usec = (uSendTimeoutMs % 1000) * 1000;
+        pxNet->xOptions.uSendTimeoutMs = (uint32_t)uSendTimeoutMs;
+        res = prvUpdateOptions(pxNet);
+    }
+
+    return res;
+}
 
-        if (fd < 0)
+int NetIo_setNonBlocking(NetIoHandle xNetIoHandle, bool bNonBlocking)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL || (bNonBlocking && pxNet->pxTransport->trySend == NULL))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->xOptions.bNonBlocking = bNonBlocking;
+        if ((res = prvUpdateOptions(pxNet)) != KVS_ERRNO_NONE)
         {
-            /* Do nothing when connection hasn't established. */
+            /* Propagate the res error */
         }
-        else if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(tv)) != 0)
+        else if (!bNonBlocking && pxNet->pCtx != NULL)
         {
-            res = KVS_ERROR_NETIO_UNABLE_TO_SET_SEND_TIMEOUT;
+            /* The pending data is sent before the blocking sends. */
+            res = prvPendingFlush(pxNet);
         }
         else
         {
@@ -418,3 +426,117 @@ int NetIo_setSendTimeout(NetIoHandle xNetIoHandle, unsigned int uSendTimeoutMs)
 
     return res;
 }
+
+int NetIo_flush(NetIoHandle xNetIoHandle)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (pxNet->uPendingOffset == pxNet->uPendingLen)
+    {
+        /* nop */
+    }
+    else if (pxNet->pCtx == NULL)
+    {
+        res = KVS_ERROR_NETIO_NOT_CONNECTED;
+    }
+    else
+    {
+        res = prvPendingFlush(pxNet);
+    }
+
+    return res;
+}
+
+bool NetIo_isSendPending(NetIoHandle xNetIoHandle)
+{
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    return (pxNet != NULL && pxNet->uPendingOffset < pxNet->uPendingLen);
+}
+
+int NetIo_setTlsSessionCache(NetIoHandle xNetIoHandle, TlsSessionCacheHandle xTlsSessionCache)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->xOptions.xTlsSessionCache = xTlsSessionCache;
+    }
+
+    return res;
+}
+
+int NetIo_setTlsContext(NetIoHandle xNetIoHandle, TlsContextHandle xTlsContext)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->xOptions.xTlsContext = xTlsContext;
+    }
+
+    return res;
+}
+
+int NetIo_setKtls(NetIoHandle xNetIoHandle, bool bEnable)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->xOptions.bKtls = bEnable;
+    }
+
+    return res;
+}
+
+bool NetIo_isKtlsActive(NetIoHandle xNetIoHandle)
+{
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    return (pxNet != NULL && pxNet->pCtx != NULL && pxNet->pxTransport->isKtlsActive != NULL && pxNet->pxTransport->isKtlsActive(pxNet->pCtx));
+}
+
+int NetIo_setMaxFragmentLen(NetIoHandle xNetIoHandle, unsigned int uMaxFragmentLen)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    if (pxNet == NULL || (uMaxFragmentLen != 0 && uMaxFragmentLen != 512 && uMaxFragmentLen != 1024 && uMaxFragmentLen != 2048 && uMaxFragmentLen != 4096))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        pxNet->xOptions.uMaxFragmentLen = (uint32_t)uMaxFragmentLen;
+    }
+
+    return res;
+}
+
+size_t NetIo_getSendRecordLen(NetIoHandle xNetIoHandle)
+{
+    NetIo_t *pxNet = (NetIo_t *)xNetIoHandle;
+
+    return (pxNet == NULL || pxNet->pCtx == NULL || pxNet->pxTransport->getSendRecordLen == NULL) ? 0 : pxNet->pxTransport->getSendRecordLen(pxNet->pCtx);
+}
@@ -18,6 +18,10 @@
 
 #include <stdbool.h>
 
+#include "kvs/netio_transport.h"
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
+
 typedef struct NetIo *NetIoHandle;
 
 /**
@@ -34,6 +38,15 @@ NetIoHandle NetIo_create(void);
  */
 void NetIo_terminate(NetIoHandle xNetIoHandle);
 
+/**
+ * @brief Set the transport which the connection runs on. The default one is TLS with mbedTLS over TCP.
+ *
+ * @param[in] xNetIoHandle The network I/O handle, which isn't connected
+ * @param[in] pxTransport The transport, or NULL for the default one
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setTransport(NetIoHandle xNetIoHandle, const struct NetIoTransport *pxTransport);
+
 /**
  * @brief Connect to a host with port
  *
@@ -74,6 +87,19 @@ void NetIo_disconnect(NetIoHandle xNetIoHandle);
  */
 int NetIo_send(NetIoHandle xNetIoHandle, const unsigned char *pBuffer, size_t uBytesToSend);
 
+/**
+ * @brief Send data from several buffers
+ *
+ * The buffers are sent in order as if they were one buffer. Small buffers are gathered into full-size TLS records,
+ * and full records of a large buffer are sent from it without copying.
+ *
+ * @param[in] xNetIoHandle The network I/O handle
+ * @param[in] pxVecs The data buffers
+ * @param[in] uVecCnt The number of data buffers
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_sendv(NetIoHandle xNetIoHandle, const NetIoVec_t *pxVecs, size_t uVecCnt);
+
 /**
  * @brief Receive data
  *
@@ -93,6 +119,14 @@ int NetIo_recv(NetIoHandle xNetIoHandle, unsigned char *pBuffer, size_t uBufferS
  */
 bool NetIo_isDataAvailable(NetIoHandle xNetIoHandle);
 
+/**
+ * @brief Get the socket of the connection, so the caller can wait until it's readable.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @return the socket, or -1 if it's not connected
+ */
+int NetIo_getSocket(NetIoHandle xNetIoHandle);
+
 /**
  * @brief Configure receive timeout.
  *
@@ -111,4 +145,96 @@ int NetIo_setRecvTimeout(NetIoHandle xNetIoHandle, unsigned int uRecvTimeoutMs);
  */
 int NetIo_setSendTimeout(NetIoHandle xNetIoHandle, unsigned int uSendTimeoutMs);
 
+/**
+ * @brief Make sends and receives return instead of waiting for the socket. It's applied to the connection right away.
+ *
+ * NetIo_send and NetIo_sendv queue the data which the socket doesn't take, and the queue is sent before newer data
+ * by the next send or NetIo_flush, so the caller can wait until the socket is writable while NetIo_isSendPending is
+ * true. The queue has no limit, so the caller should hold newer data back meanwhile. NetIo_recv fails with
+ * KVS_ERROR_NETIO_WOULD_BLOCK when nothing has arrived. Setting it back to blocking sends the queue first, and fails
+ * if it can't be sent within the send timeout. The transport has to support trySend.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @param bNonBlocking true for the non-blocking mode
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setNonBlocking(NetIoHandle xNetIoHandle, bool bNonBlocking);
+
+/**
+ * @brief Send the data queued in the non-blocking mode until the socket doesn't take more
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @return 0 on success even if some data is still queued, non-zero value otherwise
+ */
+int NetIo_flush(NetIoHandle xNetIoHandle);
+
+/**
+ * @brief Check if any data queued in the non-blocking mode isn't sent yet
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @return true if some data is queued, false otherwise
+ */
+bool NetIo_isSendPending(NetIoHandle xNetIoHandle);
+
+/**
+ * @brief Resume sessions from a cache when connecting, and keep the new sessions in it. It has to be set before connecting.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @param xTlsSessionCache The cache of TLS sessions, or NULL to always run a full handshake
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setTlsSessionCache(NetIoHandle xNetIoHandle, TlsSessionCacheHandle xTlsSessionCache);
+
+/**
+ * @brief Set the TLS context whose random generator and parsed X509 credentials are borrowed by the connection. It has
+ * to be set before connecting, and the context must outlive the connection.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @param xTlsContext The TLS context, or NULL to seed a random generator and parse the credentials for each connection
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setTlsContext(NetIoHandle xNetIoHandle, TlsContextHandle xTlsContext);
+
+/**
+ * @brief Let the kernel encrypt the records sent after the handshake (Linux kTLS). It has to be set before connecting.
+ *
+ * The handshake still runs in mbedTLS, and then its transmit keys are handed to the kernel, so NetIo_send and
+ * NetIo_sendv become plain socket writes. Received records are still decrypted by mbedTLS. If the library is built
+ * without kTLS, or the kernel or the negotiated cipher suite doesn't support it, mbedTLS keeps encrypting.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @param bEnable true to hand the keys to the kernel when it's possible
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setKtls(NetIoHandle xNetIoHandle, bool bEnable);
+
+/**
+ * @brief Check if the kernel encrypts the records sent on the connection
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @return true if kTLS is active, false otherwise
+ */
+bool NetIo_isKtlsActive(NetIoHandle xNetIoHandle);
+
+/**
+ * @brief Ask the server for records of at most this size (TLS max_fragment_length). It has to be set before connecting.
+ *
+ * Servers which don't support the extension keep sending full-size records. When it's negotiated, the records sent
+ * by the client are limited to it too, and mbedTLS built with MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH shrinks its record
+ * buffers to it after the handshake. kTLS isn't used with it, because the kernel sends full-size records.
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @param uMaxFragmentLen 512, 1024, 2048 or 4096, or 0 to not ask for it
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_setMaxFragmentLen(NetIoHandle xNetIoHandle, unsigned int uMaxFragmentLen);
+
+/**
+ * @brief Get the largest data sent in one record, so callers can size their writes to fill whole records
+ *
+ * @param xNetIoHandle The network I/O handle
+ * @return The length in bytes, or 0 if it's not connected or the transport doesn't send records
+ */
+size_t NetIo_getSendRecordLen(NetIoHandle xNetIoHandle);
+
 #endif /* NETIO_H */
\ No newline at end of file
@@ -0,0 +1,1893 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "mbedtls/chachapoly.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/net.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ssl_ciphersuites.h"
+#include "mbedtls/version.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+#include "kvs/tls_context.h"
+#include "kvs/tls_session_cache.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "os/file_writer.h"
+#include "net/netio.h"
+#include "net/netio_transport.h"
+
+/* The key of a cached session is "host:port". */
+#define TLS_SESSION_HOST_PORT_MAX           (256)
+
+/* A saved cache file starts with the magic, followed by records of a 2 bytes key length, the key, a 4 bytes session
+ * length and the session serialized by mbedtls_ssl_session_save(). Lengths are big endian. */
+#define TLS_SESSION_CACHE_FILE_MAGIC        "KVSTLSC1"
+#define TLS_SESSION_CACHE_FILE_MAGIC_LEN    (sizeof(TLS_SESSION_CACHE_FILE_MAGIC) - 1)
+
+/* The credentials of a TLS context are reused if the SHA-256 of their PEMs is the same. */
+#define TLS_X509_DIGEST_LEN                 (32)
+
+/* TLS_AEAD_FASTEST encrypts this many bytes in full-size records with each AEAD before the first handshake. Two records
+ * are enough to tell hardware AES from software AES, and take tens of microseconds with AES-NI or ARMv8 crypto. */
+#define TLS_AEAD_MEASURE_LEN                (2 * TLS_AEAD_RECORD_LEN)
+#define TLS_AEAD_RECORD_LEN                 (16 * 1024)
+
+/* The cipher suite lists which offer AES-GCM or ChaCha20-Poly1305 first */
+#define TLS_AEAD_LIST_CNT                   (2)
+
+/* Session serialization is available since mbedTLS 2.19.0. */
+#if defined(MBEDTLS_VERSION_NUMBER) && MBEDTLS_VERSION_NUMBER >= 0x02130000
+#define TLS_SESSION_CACHE_PERSISTENCE
+#endif
+
+/* kTLS needs the kernel headers of it, and the keys exported by mbedTLS after the handshake. */
+#if defined(KVS_USE_KTLS) && defined(MBEDTLS_SSL_EXPORT_KEYS)
+#define NETIO_KTLS
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef TCP_ULP
+#define TCP_ULP                             (31)
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS                             (282)
+#endif
+
+/* The longest key and fixed IV of the cipher suites that the kernel supports */
+#define KTLS_KEY_MAX_LEN                    (32)
+#define KTLS_IV_MAX_LEN                     (12)
+#endif
+
+typedef struct TlsSessionEntry
+{
+    char *pcHostPort;
+    mbedtls_ssl_session xSession;
+    DLIST_ENTRY xEntry;
+} TlsSessionEntry_t;
+
+typedef struct TlsSessionCache
+{
+    LOCK_HANDLE xLock;
+
+    /* The least recently used entry is at the head. */
+    DLIST_ENTRY xEntries;
+    size_t uEntryCnt;
+    size_t uMaxEntries;
+} TlsSessionCache_t;
+
+/* Certificates parsed from PEMs, which are shared by the connections made with the same PEMs. They are only read by
+ * handshakes. The private key isn't shared, because signing with an RSA key updates its blinding values, which isn't
+ * thread safe without MBEDTLS_THREADING_C. */
+typedef struct TlsX509
+{
+    unsigned char pDigest[TLS_X509_DIGEST_LEN];
+    mbedtls_x509_crt xRootCA;
+    mbedtls_x509_crt xCert;
+
+    /* A reference of each connection, and one of the context while they are its latest credentials */
+    size_t uRefCnt;
+} TlsX509_t;
+
+typedef struct TlsContext
+{
+    LOCK_HANDLE xLock;
+    mbedtls_entropy_context xEntropy;
+    mbedtls_ctr_drbg_context xCtrDrbg;
+
+    /* The credentials of the latest connection with X509. It's NULL if there is none. */
+    TlsX509_t *pxX509;
+
+    /* The preferred AEAD, and the faster one for TLS_AEAD_FASTEST. The latter is TLS_AEAD_FASTEST until it's measured. */
+    TlsAead_t xAead;
+    TlsAead_t xFastestAead;
+
+    /* Cipher suites which offer each AEAD first. They are made on first use and kept until the context is terminated,
+     * because the configurations of connections point to them. */
+    int *pCiphersuites[TLS_AEAD_LIST_CNT];
+} TlsContext_t;
+
+typedef struct NetIoMbedtls
+{
+    /* Basic ssl connection parameters */
+    mbedtls_net_context xFd;
+    mbedtls_ssl_context xSsl;
+    mbedtls_ssl_config xConf;
+
+    /* The random generator and the credentials are borrowed from the TLS context. A connection without a shared
+     * context owns a private one. */
+    TlsContext_t *pxTlsContext;
+    bool bOwnsTlsContext;
+
+    /* Credentials for IoT credential provider. It's NULL if the connection has no X509. */
+    TlsX509_t *pxX509;
+    mbedtls_pk_context xPrivKey;
+
+    /* Options copied from the network I/O handle */
+    uint32_t uRecvTimeoutMs;
+    uint32_t uSendTimeoutMs;
+    uint32_t uMaxFragmentLen;
+
+    /* Buffer where NetIo_sendv gathers small buffers into one record. It's allocated on the first call. */
+    unsigned char *pSendBuf;
+    size_t uSendBufSize;
+
+    /* The socket is non-blocking after the handshake. uHeldLen is the length of a record which mbedTLS has taken but
+     * not written to the socket yet, and the next trySend passes the same length to finish it. */
+    bool bNonBlocking;
+    size_t uHeldLen;
+
+    /* Sessions of previous connections, which are resumed when connecting to the same host again. It's optional. */
+    TlsSessionCacheHandle xTlsSessionCache;
+
+    /* The kernel encrypts the records after the handshake if it's requested and possible. */
+    bool bKtlsRequested;
+    bool bKtlsActive;
+#ifdef NETIO_KTLS
+    /* The transmit key and fixed IV of the client, exported by mbedTLS during the handshake */
+    unsigned char pKtlsKey[KTLS_KEY_MAX_LEN];
+    size_t uKtlsKeyLen;
+    unsigned char pKtlsIv[KTLS_IV_MAX_LEN];
+    size_t uKtlsIvLen;
+#endif
+} NetIoMbedtls_t;
+
+static void prvTlsSessionEntryTerminate(TlsSessionEntry_t *pxEntry)
+{
+    mbedtls_ssl_session_free(&(pxEntry->xSession));
+    kvsFree(pxEntry->pcHostPort);
+    kvsFree(pxEntry);
+}
+
+/* Find the entry of a host. It's called with the lock of the cache. */
+static TlsSessionEntry_t *prvTlsSessionCacheFind(TlsSessionCache_t *pxCache, const char *pcHostPort)
+{
+    PDLIST_ENTRY pxListHead = &(pxCache->xEntries);
+    PDLIST_ENTRY pxListItem = pxListHead->Flink;
+    TlsSessionEntry_t *pxEntry = NULL;
+
+    while (pxListItem != pxListHead)
+    {
+        pxEntry = containingRecord(pxListItem, TlsSessionEntry_t, xEntry);
+        if (strcmp(pxEntry->pcHostPort, pcHostPort) == 0)
+        {
+            return pxEntry;
+        }
+        pxListItem = pxListItem->Flink;
+    }
+
+    return NULL;
+}
+
+/* Find the entry of a host, or add an empty one and evict the least recently used one if the cache is full. The entry
+ * becomes the most recently used one. It's called with the lock of the cache. */
+static TlsSessionEntry_t *prvTlsSessionCacheFindOrAdd(TlsSessionCache_t *pxCache, const char *pcHostPort)
+{
+    TlsSessionEntry_t *pxEntry = NULL;
+    size_t uHostPortLen = strlen(pcHostPort);
+
+    if ((pxEntry = prvTlsSessionCacheFind(pxCache, pcHostPort)) != NULL)
+    {
+        DList_RemoveEntryList(&(pxEntry->xEntry));
+        DList_InsertTailList(&(pxCache->xEntries), &(pxEntry->xEntry));
+    }
+    else if ((pxEntry = (TlsSessionEntry_t *)kvsMalloc(sizeof(TlsSessionEntry_t))) == NULL)
+    {
+        LogError("OOM: pxEntry");
+    }
+    else if ((pxEntry->pcHostPort = (char *)kvsMalloc(uHostPortLen + 1)) == NULL)
+    {
+        LogError("OOM: pcHostPort");
+        kvsFree(pxEntry);
+        pxEntry = NULL;
+    }
+    else
+    {
+        memcpy(pxEntry->pcHostPort, pcHostPort, uHostPortLen + 1);
+        mbedtls_ssl_session_init(&(pxEntry->xSession));
+
+        if (pxCache->uEntryCnt >= pxCache->uMaxEntries)
+        {
+            prvTlsSessionEntryTerminate(containingRecord(DList_RemoveHeadList(&(pxCache->xEntries)), TlsSessionEntry_t, xEntry));
+            pxCache->uEntryCnt--;
+        }
+        DList_InsertTailList(&(pxCache->xEntries), &(pxEntry->xEntry));
+        pxCache->uEntryCnt++;
+    }
+
+    return pxEntry;
+}
+
+/* It's called with the lock of the cache. */
+static void prvTlsSessionCacheRemove(TlsSessionCache_t *pxCache, TlsSessionEntry_t *pxEntry)
+{
+    DList_RemoveEntryList(&(pxEntry->xEntry));
+    pxCache->uEntryCnt--;
+    prvTlsSessionEntryTerminate(pxEntry);
+}
+
+static bool prvTlsSessionHostPort(char *pcHostPort, const char *pcHost, const char *pcPort)
+{
+    int n = snprintf(pcHostPort, TLS_SESSION_HOST_PORT_MAX, "%s:%s", pcHost, pcPort);
+
+    return n > 0 && n < TLS_SESSION_HOST_PORT_MAX;
+}
+
+/* Offer the cached session of the host in the next handshake. The server falls back to a full handshake if it doesn't
+ * accept it. */
+static void prvTlsSessionResume(NetIoMbedtls_t *pxNet, const char *pcHost, const char *pcPort)
+{
+    TlsSessionCache_t *pxCache = (TlsSessionCache_t *)pxNet->xTlsSessionCache;
+    TlsSessionEntry_t *pxEntry = NULL;
+    char pcHostPort[TLS_SESSION_HOST_PORT_MAX];
+    int retVal = 0;
+
+    if (pxCache != NULL && prvTlsSessionHostPort(pcHostPort, pcHost, pcPort) && Lock(pxCache->xLock) == LOCK_OK)
+    {
+        if ((pxEntry = prvTlsSessionCacheFind(pxCache, pcHostPort)) != NULL &&
+            (retVal = mbedtls_ssl_set_session(&(pxNet->xSsl), &(pxEntry->xSession))) != 0)
+        {
+            LogInfo("Failed to resume session of %s (err:-%X)", pcHostPort, -retVal);
+        }
+        Unlock(pxCache->xLock);
+    }
+}
+
+/* Keep the session and the ticket of the host after a handshake, or forget them if it failed. */
+static void prvTlsSessionUpdate(NetIoMbedtls_t *pxNet, const char *pcHost, const char *pcPort, bool bIsConnected)
+{
+    TlsSessionCache_t *pxCache = (TlsSessionCache_t *)pxNet->xTlsSessionCache;
+    TlsSessionEntry_t *pxEntry = NULL;
+    char pcHostPort[TLS_SESSION_HOST_PORT_MAX];
+
+    if (pxCache != NULL && prvTlsSessionHostPort(pcHostPort, pcHost, pcPort) && Lock(pxCache->xLock) == LOCK_OK)
+    {
+        if (!bIsConnected)
+        {
+            if ((pxEntry = prvTlsSessionCacheFind(pxCache, pcHostPort)) != NULL)
+            {
+                prvTlsSessionCacheRemove(pxCache, pxEntry);
+            }
+        }
+        else if ((pxEntry = prvTlsSessionCacheFindOrAdd(pxCache, pcHostPort)) != NULL)
+        {
+            mbedtls_ssl_session_free(&(pxEntry->xSession));
+            mbedtls_ssl_session_init(&(pxEntry->xSession));
+            if (mbedtls_ssl_get_session(&(pxNet->xSsl), &(pxEntry->xSession)) != 0)
+            {
+                prvTlsSessionCacheRemove(pxCache, pxEntry);
+            }
+        }
+        else
+        {
+            /* nop */
+        }
+        Unlock(pxCache->xLock);
+    }
+}
+
+#ifdef NETIO_KTLS
+/* Keep the client write key and IV. The key block is the client and server MAC keys, the client and server keys, and
+ * the client and server IVs. Only AEAD cipher suites, which have no MAC key, can be handed to the kernel. */
+static int prvKtlsExportKeys(void *pParam, const unsigned char *pMasterSecret, const unsigned char *pKeyBlock, size_t uMacLen, size_t uKeyLen, size_t uIvLen)
+{
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pParam;
+
+    (void)pMasterSecret;
+
+    if (uMacLen == 0 && uKeyLen <= KTLS_KEY_MAX_LEN && uIvLen <= KTLS_IV_MAX_LEN)
+    {
+        memcpy(pxNet->pKtlsKey, pKeyBlock, uKeyLen);
+        memcpy(pxNet->pKtlsIv, pKeyBlock + 2 * uKeyLen, uIvLen);
+        pxNet->uKtlsKeyLen = uKeyLen;
+        pxNet->uKtlsIvLen = uIvLen;
+    }
+    else
+    {
+        pxNet->uKtlsKeyLen = 0;
+        pxNet->uKtlsIvLen = 0;
+    }
+
+    return 0;
+}
+
+/* mbedTLS can't write records once the kernel owns the transmit sequence, so an alert it tries to send fails. */
+static int prvKtlsBioSend(void *pCtx, const unsigned char *pBuffer, size_t uLen)
+{
+    (void)pCtx;
+    (void)pBuffer;
+    (void)uLen;
+
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+}
+#endif /* NETIO_KTLS */
+
+/* mbedtls_net_recv_timeout waits for the socket even if it's non-blocking, so a non-blocking socket is read by
+ * mbedtls_net_recv, which returns MBEDTLS_ERR_SSL_WANT_READ instead. */
+static void prvSetBio(NetIoMbedtls_t *pxNet)
+{
+    mbedtls_ssl_send_t *pxSend = mbedtls_net_send;
+
+#ifdef NETIO_KTLS
+    if (pxNet->bKtlsActive)
+    {
+        pxSend = prvKtlsBioSend;
+    }
+#endif
+    mbedtls_ssl_set_bio(&(pxNet->xSsl), &(pxNet->xFd), pxSend, pxNet->bNonBlocking ? mbedtls_net_recv : NULL, pxNet->bNonBlocking ? NULL : mbedtls_net_recv_timeout);
+}
+
+/* Hand the transmit key to the kernel after the handshake, so it encrypts the records written to the socket. */
+static void prvKtlsActivate(NetIoMbedtls_t *pxNet)
+{
+#ifdef NETIO_KTLS
+    const char *pcCiphersuite = mbedtls_ssl_get_ciphersuite(&(pxNet->xSsl));
+    const mbedtls_ssl_ciphersuite_t *pxCiphersuite = (pcCiphersuite == NULL) ? NULL : mbedtls_ssl_ciphersuite_from_string(pcCiphersuite);
+    union
+    {
+        struct tls12_crypto_info_aes_gcm_128 xAesGcm128;
+        struct tls12_crypto_info_aes_gcm_256 xAesGcm256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+        struct tls12_crypto_info_chacha20_poly1305 xChaChaPoly;
+#endif
+    } xCryptoInfo;
+    socklen_t uCryptoInfoLen = 0;
+
+    /* The explicit nonce of mbedTLS is the record sequence number, and cur_out_ctr is the one of the next record. */
+    memset(&xCryptoInfo, 0, sizeof(xCryptoInfo));
+    if (pxCiphersuite == NULL || strcmp(mbedtls_ssl_get_version(&(pxNet->xSsl)), "TLSv1.2") != 0)
+    {
+        /* nop */
+    }
+    else if (pxNet->uMaxFragmentLen > 0)
+    {
+        /* mbedTLS limits the records of a client to the length it asked for, but the kernel sends full-size records. */
+        pcCiphersuite = "a max fragment length";
+    }
+    else if (pxCiphersuite->cipher == MBEDTLS_CIPHER_AES_128_GCM && pxNet->uKtlsKeyLen == TLS_CIPHER_AES_GCM_128_KEY_SIZE &&
+             pxNet->uKtlsIvLen == TLS_CIPHER_AES_GCM_128_SALT_SIZE)
+    {
+        xCryptoInfo.xAesGcm128.info.version = TLS_1_2_VERSION;
+        xCryptoInfo.xAesGcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(xCryptoInfo.xAesGcm128.key, pxNet->pKtlsKey, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        memcpy(xCryptoInfo.xAesGcm128.salt, pxNet->pKtlsIv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        memcpy(xCryptoInfo.xAesGcm128.iv, pxNet->xSsl.cur_out_ctr, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        memcpy(xCryptoInfo.xAesGcm128.rec_seq, pxNet->xSsl.cur_out_ctr, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+        uCryptoInfoLen = sizeof(xCryptoInfo.xAesGcm128);
+    }
+    else if (pxCiphersuite->cipher == MBEDTLS_CIPHER_AES_256_GCM && pxNet->uKtlsKeyLen == TLS_CIPHER_AES_GCM_256_KEY_SIZE &&
+             pxNet->uKtlsIvLen == TLS_CIPHER_AES_GCM_256_SALT_SIZE)
+    {
+        xCryptoInfo.xAesGcm256.info.version = TLS_1_2_VERSION;
+        xCryptoInfo.xAesGcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(xCryptoInfo.xAesGcm256.key, pxNet->pKtlsKey, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+        memcpy(xCryptoInfo.xAesGcm256.salt, pxNet->pKtlsIv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        memcpy(xCryptoInfo.xAesGcm256.iv, pxNet->xSsl.cur_out_ctr, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        memcpy(xCryptoInfo.xAesGcm256.rec_seq, pxNet->xSsl.cur_out_ctr, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+        uCryptoInfoLen = sizeof(xCryptoInfo.xAesGcm256);
+    }
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    else if (pxCiphersuite->cipher == MBEDTLS_CIPHER_CHACHA20_POLY1305 && pxNet->uKtlsKeyLen == TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE &&
+             pxNet->uKtlsIvLen == TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE)
+    {
+        /* The whole nonce is the fixed IV, and the kernel XORs the sequence number into it. */
+        xCryptoInfo.xChaChaPoly.info.version = TLS_1_2_VERSION;
+        xCryptoInfo.xChaChaPoly.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(xCryptoInfo.xChaChaPoly.key, pxNet->pKtlsKey, TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE);
+        memcpy(xCryptoInfo.xChaChaPoly.iv, pxNet->pKtlsIv, TLS_CIPHER_CHACHA20_POLY1305_IV_SIZE);
+        memcpy(xCryptoInfo.xChaChaPoly.rec_seq, pxNet->xSsl.cur_out_ctr, TLS_CIPHER_CHACHA20_POLY1305_REC_SEQ_SIZE);
+        uCryptoInfoLen = sizeof(xCryptoInfo.xChaChaPoly);
+    }
+#endif
+    else
+    {
+        /* nop */
+    }
+
+    if (uCryptoInfoLen == 0)
+    {
+        LogInfo("kTLS doesn't support %s, mbedTLS encrypts the records", (pcCiphersuite == NULL) ? "the cipher suite" : pcCiphersuite);
+    }
+    else if (setsockopt(pxNet->xFd.fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) != 0)
+    {
+        LogInfo("kTLS isn't available in the kernel (errno:%d), mbedTLS encrypts the records", errno);
+    }
+    else if (setsockopt(pxNet->xFd.fd, SOL_TLS, TLS_TX, &xCryptoInfo, uCryptoInfoLen) != 0)
+    {
+        LogInfo("Failed to hand %s to kTLS (errno:%d), mbedTLS encrypts the records", pcCiphersuite, errno);
+    }
+    else
+    {
+        pxNet->bKtlsActive = true;
+        prvSetBio(pxNet);
+    }
+
+    mbedtls_platform_zeroize(&xCryptoInfo, sizeof(xCryptoInfo));
+    mbedtls_platform_zeroize(pxNet->pKtlsKey, sizeof(pxNet->pKtlsKey));
+    mbedtls_platform_zeroize(pxNet->pKtlsIv, sizeof(pxNet->pKtlsIv));
+    pxNet->uKtlsKeyLen = 0;
+    pxNet->uKtlsIvLen = 0;
+#else
+    (void)pxNet;
+    LogInfo("kTLS isn't built in, mbedTLS encrypts the records");
+#endif /* NETIO_KTLS */
+}
+
+/* The close_notify alert has to be a record of the kernel too, so its record type is given in a control message. */
+static void prvKtlsCloseNotify(NetIoMbedtls_t *pxNet)
+{
+#ifdef NETIO_KTLS
+    unsigned char pAlert[2] = {MBEDTLS_SSL_ALERT_LEVEL_WARNING, MBEDTLS_SSL_ALERT_MSG_CLOSE_NOTIFY};
+    union
+    {
+        char pBuf[CMSG_SPACE(sizeof(unsigned char))];
+        struct cmsghdr xAlign;
+    } xControl;
+    struct msghdr xMsg;
+    struct iovec xIov;
+    struct cmsghdr *pxCmsg = NULL;
+
+    memset(&xControl, 0, sizeof(xControl));
+    memset(&xMsg, 0, sizeof(xMsg));
+    xIov.iov_base = pAlert;
+    xIov.iov_len = sizeof(pAlert);
+    xMsg.msg_iov = &xIov;
+    xMsg.msg_iovlen = 1;
+    xMsg.msg_control = xControl.pBuf;
+    xMsg.msg_controllen = sizeof(xControl.pBuf);
+
+    pxCmsg = CMSG_FIRSTHDR(&xMsg);
+    pxCmsg->cmsg_level = SOL_TLS;
+    pxCmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    pxCmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(pxCmsg) = MBEDTLS_SSL_MSG_ALERT;
+
+    if (sendmsg(pxNet->xFd.fd, &xMsg, 0) < 0)
+    {
+        LogInfo("Failed to send close_notify (errno:%d)", errno);
+    }
+#else
+    (void)pxNet;
+#endif /* NETIO_KTLS */
+}
+
+/* The random generator of mbedTLS isn't thread safe without MBEDTLS_THREADING_C, so it's used with the lock. */
+static int prvTlsContextRandom(void *pParam, unsigned char *pOutput, size_t uLen)
+{
+    TlsContext_t *pxCtx = (TlsContext_t *)pParam;
+    int retVal = MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+
+    if (Lock(pxCtx->xLock) == LOCK_OK)
+    {
+        retVal = mbedtls_ctr_drbg_random(&(pxCtx->xCtrDrbg), pOutput, uLen);
+        Unlock(pxCtx->xLock);
+    }
+
+    return retVal;
+}
+
+static void prvTlsX509Terminate(TlsX509_t *pxX509)
+{
+    mbedtls_x509_crt_free(&(pxX509->xRootCA));
+    mbedtls_x509_crt_free(&(pxX509->xCert));
+    kvsFree(pxX509);
+}
+
+/* It's called with the lock of the context. */
+static void prvTlsX509Release(TlsX509_t *pxX509)
+{
+    if (--pxX509->uRefCnt == 0)
+    {
+        prvTlsX509Terminate(pxX509);
+    }
+}
+
+/* The terminating NULs of the PEMs are hashed too, so moving bytes from one PEM to the next changes the digest. */
+static int prvTlsX509Digest(const NetIoX509_t *pxX509, unsigned char *pDigest)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+    mbedtls_sha256_context xSha256;
+
+    mbedtls_sha256_init(&xSha256);
+    if ((retVal = mbedtls_sha256_starts_ret(&xSha256, 0)) != 0 ||
+        (retVal = mbedtls_sha256_update_ret(&xSha256, (const unsigned char *)pxX509->pcRootCA, strlen(pxX509->pcRootCA) + 1)) != 0 ||
+        (retVal = mbedtls_sha256_update_ret(&xSha256, (const unsigned char *)pxX509->pcCert, strlen(pxX509->pcCert) + 1)) != 0 ||
+        (retVal = mbedtls_sha256_update_ret(&xSha256, (const unsigned char *)pxX509->pcPrivKey, strlen(pxX509->pcPrivKey) + 1)) != 0 ||
+        (retVal = mbedtls_sha256_finish_ret(&xSha256, pDigest)) != 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+        LogError("Failed to hash x509 (err:-%X)", -res);
+    }
+    mbedtls_sha256_free(&xSha256);
+
+    return res;
+}
+
+static int prvTlsX509Parse(const NetIoX509_t *pxX509, const unsigned char *pDigest, TlsX509_t **ppxParsed)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+    TlsX509_t *pxParsed = NULL;
+
+    if ((pxParsed = (TlsX509_t *)kvsMalloc(sizeof(TlsX509_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxParsed");
+    }
+    else
+    {
+        memset(pxParsed, 0, sizeof(TlsX509_t));
+        memcpy(pxParsed->pDigest, pDigest, TLS_X509_DIGEST_LEN);
+        mbedtls_x509_crt_init(&(pxParsed->xRootCA));
+        mbedtls_x509_crt_init(&(pxParsed->xCert));
+        pxParsed->uRefCnt = 1;
+
+        if ((retVal = mbedtls_x509_crt_parse(&(pxParsed->xRootCA), (void *)pxX509->pcRootCA, strlen(pxX509->pcRootCA) + 1)) != 0 ||
+            (retVal = mbedtls_x509_crt_parse(&(pxParsed->xCert), (void *)pxX509->pcCert, strlen(pxX509->pcCert) + 1)) != 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+            LogError("Failed to parse x509 (err:-%X)", -res);
+            prvTlsX509Terminate(pxParsed);
+        }
+        else
+        {
+            *ppxParsed = pxParsed;
+        }
+    }
+
+    return res;
+}
+
+/* Get the credentials of the PEMs. They are parsed only if they aren't the latest ones of the context, and then they
+ * become the latest ones. */
+static int prvTlsContextAcquireX509(TlsContext_t *pxCtx, const NetIoX509_t *pxX509, TlsX509_t **ppxX509)
+{
+    int res = KVS_ERRNO_NONE;
+    unsigned char pDigest[TLS_X509_DIGEST_LEN];
+    TlsX509_t *pxParsed = NULL;
+
+    if ((res = prvTlsX509Digest(pxX509, pDigest)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (Lock(pxCtx->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        if (pxCtx->pxX509 != NULL && memcmp(pxCtx->pxX509->pDigest, pDigest, TLS_X509_DIGEST_LEN) == 0)
+        {
+            pxCtx->pxX509->uRefCnt++;
+            pxParsed = pxCtx->pxX509;
+        }
+        Unlock(pxCtx->xLock);
+
+        /* Parsing takes long, so other connections aren't blocked by it. */
+        if (pxParsed == NULL && (res = prvTlsX509Parse(pxX509, pDigest, &pxParsed)) == KVS_ERRNO_NONE && Lock(pxCtx->xLock) == LOCK_OK)
+        {
+            if (pxCtx->pxX509 != NULL)
+            {
+                prvTlsX509Release(pxCtx->pxX509);
+            }
+            pxParsed->uRefCnt++;
+            pxCtx->pxX509 = pxParsed;
+            Unlock(pxCtx->xLock);
+        }
+
+        *ppxX509 = pxParsed;
+    }
+
+    return res;
+}
+
+static void prvTlsContextReleaseX509(TlsContext_t *pxCtx, TlsX509_t *pxX509)
+{
+    if (Lock(pxCtx->xLock) == LOCK_OK)
+    {
+        prvTlsX509Release(pxX509);
+        Unlock(pxCtx->xLock);
+    }
+}
+
+/* Encrypt uLen bytes in records from the first half of pBuf to the second one. It returns the error of mbedTLS. */
+static int prvEncryptAesGcm(unsigned char *pBuf, size_t uLen)
+{
+#if defined(MBEDTLS_GCM_C) && defined(MBEDTLS_AES_C)
+    int retVal = 0;
+    mbedtls_gcm_context xGcm;
+    unsigned char pKey[16] = {0};
+    unsigned char pIv[12] = {0};
+    unsigned char pTag[16] = {0};
+    size_t uDone = 0;
+    size_t uRecordLen = 0;
+
+    mbedtls_gcm_init(&xGcm);
+    retVal = mbedtls_gcm_setkey(&xGcm, MBEDTLS_CIPHER_ID_AES, pKey, 128);
+    for (uDone = 0; uDone < uLen && retVal == 0; uDone += uRecordLen)
+    {
+        uRecordLen = (uLen - uDone < TLS_AEAD_RECORD_LEN) ? uLen - uDone : TLS_AEAD_RECORD_LEN;
+        retVal = mbedtls_gcm_crypt_and_tag(&xGcm, MBEDTLS_GCM_ENCRYPT, uRecordLen, pIv, sizeof(pIv), NULL, 0, pBuf, pBuf + TLS_AEAD_RECORD_LEN,
+                                           sizeof(pTag), pTag);
+    }
+    mbedtls_gcm_free(&xGcm);
+
+    return retVal;
+#else
+    (void)pBuf;
+    (void)uLen;
+
+    return KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED;
+#endif
+}
+
+static int prvEncryptChaChaPoly(unsigned char *pBuf, size_t uLen)
+{
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    int retVal = 0;
+    mbedtls_chachapoly_context xChaChaPoly;
+    unsigned char pKey[32] = {0};
+    unsigned char pNonce[12] = {0};
+    unsigned char pTag[16] = {0};
+    size_t uDone = 0;
+    size_t uRecordLen = 0;
+
+    mbedtls_chachapoly_init(&xChaChaPoly);
+    retVal = mbedtls_chachapoly_setkey(&xChaChaPoly, pKey);
+    for (uDone = 0; uDone < uLen && retVal == 0; uDone += uRecordLen)
+    {
+        uRecordLen = (uLen - uDone < TLS_AEAD_RECORD_LEN) ? uLen - uDone : TLS_AEAD_RECORD_LEN;
+        retVal = mbedtls_chachapoly_encrypt_and_tag(&xChaChaPoly, uRecordLen, pNonce, NULL, 0, pBuf, pBuf + TLS_AEAD_RECORD_LEN, pTag);
+    }
+    mbedtls_chachapoly_free(&xChaChaPoly);
+
+    return retVal;
+#else
+    (void)pBuf;
+    (void)uLen;
+
+    return KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED;
+#endif
+}
+
+static TlsAead_t prvMeasureFastestAead(void)
+{
+    TlsAead_t xFastestAead = TLS_AEAD_DEFAULT;
+    double dAesGcm = 0;
+    double dChaChaPoly = 0;
+
+    if (TlsContext_measureAead(TLS_AEAD_AES_GCM, TLS_AEAD_MEASURE_LEN, &dAesGcm) != KVS_ERRNO_NONE)
+    {
+        dAesGcm = 0;
+    }
+    if (TlsContext_measureAead(TLS_AEAD_CHACHA20_POLY1305, TLS_AEAD_MEASURE_LEN, &dChaChaPoly) != KVS_ERRNO_NONE)
+    {
+        dChaChaPoly = 0;
+    }
+
+    if (dAesGcm != 0 || dChaChaPoly != 0)
+    {
+        xFastestAead = (dChaChaPoly > dAesGcm) ? TLS_AEAD_CHACHA20_POLY1305 : TLS_AEAD_AES_GCM;
+    }
+    LogInfo("AES-GCM %.1f MB/s, ChaCha20-Poly1305 %.1f MB/s", dAesGcm / (1024 * 1024), dChaChaPoly / (1024 * 1024));
+
+    return xFastestAead;
+}
+
+/* Get the preferred AEAD, where TLS_AEAD_FASTEST is resolved to the faster one. The AEADs are measured once, without
+ * the lock of the context so other connections aren't blocked. Connections racing to the first measurement may each
+ * measure, and the first result is kept. */
+static TlsAead_t prvTlsContextResolveAead(TlsContext_t *pxCtx)
+{
+    TlsAead_t xAead = TLS_AEAD_DEFAULT;
+    TlsAead_t xFastestAead = TLS_AEAD_FASTEST;
+
+    if (Lock(pxCtx->xLock) == LOCK_OK)
+    {
+        xAead = pxCtx->xAead;
+        xFastestAead = pxCtx->xFastestAead;
+        Unlock(pxCtx->xLock);
+    }
+
+    if (xAead == TLS_AEAD_FASTEST)
+    {
+        if (xFastestAead == TLS_AEAD_FASTEST)
+        {
+            xFastestAead = prvMeasureFastestAead();
+            if (Lock(pxCtx->xLock) == LOCK_OK)
+            {
+                if (pxCtx->xFastestAead == TLS_AEAD_FASTEST)
+                {
+                    pxCtx->xFastestAead = xFastestAead;
+                }
+                xFastestAead = pxCtx->xFastestAead;
+                Unlock(pxCtx->xLock);
+            }
+        }
+        xAead = xFastestAead;
+    }
+
+    return xAead;
+}
+
+static bool prvIsCiphersuiteOfAead(int xCiphersuite, TlsAead_t xAead)
+{
+    const mbedtls_ssl_ciphersuite_t *pxCiphersuite = mbedtls_ssl_ciphersuite_from_id(xCiphersuite);
+
+    if (pxCiphersuite == NULL)
+    {
+        return false;
+    }
+    else if (xAead == TLS_AEAD_AES_GCM)
+    {
+        return pxCiphersuite->cipher == MBEDTLS_CIPHER_AES_128_GCM || pxCiphersuite->cipher == MBEDTLS_CIPHER_AES_192_GCM ||
+               pxCiphersuite->cipher == MBEDTLS_CIPHER_AES_256_GCM;
+    }
+    else
+    {
+        return pxCiphersuite->cipher == MBEDTLS_CIPHER_CHACHA20_POLY1305;
+    }
+}
+
+/* Make a list of the cipher suites of mbedTLS, where the ones of the AEAD come first and the others keep their order. */
+static int *prvCreateCiphersuites(TlsAead_t xAead)
+{
+    const int *pDefault = mbedtls_ssl_list_ciphersuites();
+    int *pCiphersuites = NULL;
+    size_t uCnt = 0;
+    size_t uIdx = 0;
+    size_t i = 0;
+
+    while (pDefault != NULL && pDefault[uCnt] != 0)
+    {
+        uCnt++;
+    }
+
+    if (uCnt == 0)
+    {
+        /* nop */
+    }
+    else if ((pCiphersuites = (int *)kvsMalloc((uCnt + 1) * sizeof(int))) == NULL)
+    {
+        LogError("OOM: pCiphersuites");
+    }
+    else
+    {
+        for (i = 0; i < uCnt; i++)
+        {
+            if (prvIsCiphersuiteOfAead(pDefault[i], xAead))
+            {
+                pCiphersuites[uIdx++] = pDefault[i];
+            }
+        }
+        for (i = 0; i < uCnt; i++)
+        {
+            if (!prvIsCiphersuiteOfAead(pDefault[i], xAead))
+            {
+                pCiphersuites[uIdx++] = pDefault[i];
+            }
+        }
+        pCiphersuites[uIdx] = 0;
+    }
+
+    return pCiphersuites;
+}
+
+/* Get the cipher suites of the preferred AEAD, or NULL to keep the ones of mbedTLS. */
+static const int *prvTlsContextGetCiphersuites(TlsContext_t *pxCtx)
+{
+    const int *pCiphersuites = NULL;
+    TlsAead_t xAead = prvTlsContextResolveAead(pxCtx);
+    size_t uIdx = 0;
+
+    if ((xAead == TLS_AEAD_AES_GCM || xAead == TLS_AEAD_CHACHA20_POLY1305) && Lock(pxCtx->xLock) == LOCK_OK)
+    {
+        uIdx = (size_t)(xAead - TLS_AEAD_AES_GCM);
+        if (pxCtx->pCiphersuites[uIdx] == NULL)
+        {
+            pxCtx->pCiphersuites[uIdx] = prvCreateCiphersuites(xAead);
+        }
+        pCiphersuites = pxCtx->pCiphersuites[uIdx];
+        Unlock(pxCtx->xLock);
+    }
+
+    return pCiphersuites;
+}
+
+static int prvSetSendTimeout(NetIoMbedtls_t *pxNet)
+{
+    int res = KVS_ERRNO_NONE;
+    struct timeval tv = {0};
+
+    tv.tv_sec = pxNet->uSendTimeoutMs / 1000;
+    tv.tv_usec = (pxNet->uSendTimeoutMs % 1000) * 1000;
+
+    if (pxNet->xFd.fd < 0)
+    {
+        /* Do nothing when connection hasn't established. */
+    }
+    else if (setsockopt(pxNet->xFd.fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(tv)) != 0)
+    {
+        res = KVS_ERROR_NETIO_UNABLE_TO_SET_SEND_TIMEOUT;
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
+/* The handshake runs on a blocking socket, so the mode is switched after it. */
+static int prvSetNonBlocking(NetIoMbedtls_t *pxNet, bool bNonBlocking)
+{
+    int res = KVS_ERRNO_NONE;
+
+    if (pxNet->xFd.fd < 0 || pxNet->bNonBlocking == bNonBlocking)
+    {
+        /* nop */
+    }
+    else if ((bNonBlocking ? mbedtls_net_set_nonblock(&(pxNet->xFd)) : mbedtls_net_set_block(&(pxNet->xFd))) != 0)
+    {
+        res = KVS_ERROR_NETIO_UNABLE_TO_SET_NONBLOCKING;
+        LogError("Failed to set O_NONBLOCK of socket (errno:%d)", errno);
+    }
+    else
+    {
+        pxNet->bNonBlocking = bNonBlocking;
+        prvSetBio(pxNet);
+    }
+
+    return res;
+}
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+static unsigned char prvMaxFragLenCode(uint32_t uMaxFragmentLen)
+{
+    unsigned char xCode = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+
+    switch (uMaxFragmentLen)
+    {
+        case 512:
+            xCode = MBEDTLS_SSL_MAX_FRAG_LEN_512;
+            break;
+        case 1024:
+            xCode = MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+            break;
+        case 2048:
+            xCode = MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+            break;
+        case 4096:
+            xCode = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+            break;
+        default:
+            break;
+    }
+
+    return xCode;
+}
+#endif
+
+static int prvInitConfig(NetIoMbedtls_t *pxNet, const char *pcHost)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+    const int *pCiphersuites = NULL;
+
+    if (pxNet == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        prvSetBio(pxNet);
+
+        if ((retVal = mbedtls_ssl_config_defaults(&(pxNet->xConf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+            LogError("Failed to config ssl (err:-%X)", -res);
+        }
+        else
+        {
+            mbedtls_ssl_conf_rng(&(pxNet->xConf), prvTlsContextRandom, pxNet->pxTlsContext);
+            if ((pCiphersuites = prvTlsContextGetCiphersuites(pxNet->pxTlsContext)) != NULL)
+            {
+                mbedtls_ssl_conf_ciphersuites(&(pxNet->xConf), pCiphersuites);
+            }
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+            if (pxNet->xTlsSessionCache != NULL)
+            {
+                /* Tickets let the session be resumed even if the server doesn't keep it. */
+                mbedtls_ssl_conf_session_tickets(&(pxNet->xConf), MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+            }
+#endif
+#ifdef NETIO_KTLS
+            if (pxNet->bKtlsRequested)
+            {
+                mbedtls_ssl_conf_export_keys_cb(&(pxNet->xConf), prvKtlsExportKeys, pxNet);
+            }
+#endif
+            mbedtls_ssl_set_hostname(&(pxNet->xSsl), pcHost);
+            mbedtls_ssl_conf_read_timeout(&(pxNet->xConf), pxNet->uRecvTimeoutMs);
+            prvSetSendTimeout(pxNet);
+
+            if (pxNet->pxX509 != NULL)
+            {
+                mbedtls_ssl_conf_authmode(&(pxNet->xConf), MBEDTLS_SSL_VERIFY_REQUIRED);
+                mbedtls_ssl_conf_ca_chain(&(pxNet->xConf), &(pxNet->pxX509->xRootCA), NULL);
+
+                if ((retVal = mbedtls_ssl_conf_own_cert(&(pxNet->xConf), &(pxNet->pxX509->xCert), &(pxNet->xPrivKey))) != 0)
+                {
+                    res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+                    LogError("Failed to conf own cert (err:-%X)", -res);
+                }
+            }
+            else
+            {
+                mbedtls_ssl_conf_authmode(&(pxNet->xConf), MBEDTLS_SSL_VERIFY_OPTIONAL);
+            }
+
+            if (res == KVS_ERRNO_NONE && pxNet->uMaxFragmentLen > 0)
+            {
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+                if ((retVal = mbedtls_ssl_conf_max_frag_len(&(pxNet->xConf), prvMaxFragLenCode(pxNet->uMaxFragmentLen))) != 0)
+                {
+                    res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+                    LogError("Failed to conf max fragment length (err:-%X)", -res);
+                }
+#else
+                LogInfo("mbedTLS is built without max fragment length, full-size records are used");
+#endif
+            }
+        }
+    }
+
+    if (res == KVS_ERRNO_NONE)
+    {
+        if ((retVal = mbedtls_ssl_setup(&(pxNet->xSsl), &(pxNet->xConf))) != 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+            LogError("Failed to setup ssl (err:-%X)", -res);
+        }
+    }
+
+    return res;
+}
+
+static int prvConnect(NetIoMbedtls_t *pxNet, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+
+    if (pxNet == NULL || pcHost == NULL || pcPort == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (pxX509 != NULL && (res = prvTlsContextAcquireX509(pxNet->pxTlsContext, pxX509, &(pxNet->pxX509))) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to init x509 (err:-%X)", -res);
+        /* Propagate the res error */
+    }
+    else if (pxX509 != NULL && (retVal = mbedtls_pk_parse_key(&(pxNet->xPrivKey), (void *)pxX509->pcPrivKey, strlen(pxX509->pcPrivKey) + 1, NULL, 0)) != 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+        LogError("Failed to parse private key (err:-%X)", -res);
+    }
+    else if ((retVal = mbedtls_net_connect(&(pxNet->xFd), pcHost, pcPort, MBEDTLS_NET_PROTO_TCP)) != 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+        LogError("Failed to connect to %s:%s (err:-%X)", pcHost, pcPort, -res);
+    }
+    else if ((res = prvInitConfig(pxNet, pcHost)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to config ssl (err:-%X)", -res);
+        /* Propagate the res error */
+    }
+    else
+    {
+        prvTlsSessionResume(pxNet, pcHost, pcPort);
+        if ((retVal = mbedtls_ssl_handshake(&(pxNet->xSsl))) != 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+            LogError("ssl handshake err (-%X)", -res);
+        }
+        prvTlsSessionUpdate(pxNet, pcHost, pcPort, res == KVS_ERRNO_NONE);
+
+        if (res == KVS_ERRNO_NONE && pxNet->bKtlsRequested)
+        {
+            prvKtlsActivate(pxNet);
+        }
+    }
+
+    return res;
+}
+
+static void prvMbedtlsTerminate(NetIoMbedtls_t *pxNet)
+{
+    if (pxNet != NULL)
+    {
+        mbedtls_net_free(&(pxNet->xFd));
+        mbedtls_ssl_free(&(pxNet->xSsl));
+        mbedtls_ssl_config_free(&(pxNet->xConf));
+        mbedtls_pk_free(&(pxNet->xPrivKey));
+#ifdef NETIO_KTLS
+        mbedtls_platform_zeroize(pxNet->pKtlsKey, sizeof(pxNet->pKtlsKey));
+        mbedtls_platform_zeroize(pxNet->pKtlsIv, sizeof(pxNet->pKtlsIv));
+#endif
+
+        if (pxNet->pxX509 != NULL)
+        {
+            prvTlsContextReleaseX509(pxNet->pxTlsContext, pxNet->pxX509);
+            pxNet->pxX509 = NULL;
+        }
+
+        if (pxNet->bOwnsTlsContext)
+        {
+            TlsContext_terminate(pxNet->pxTlsContext);
+            pxNet->pxTlsContext = NULL;
+        }
+
+        if (pxNet->pSendBuf != NULL)
+        {
+            kvsFree(pxNet->pSendBuf);
+            pxNet->pSendBuf = NULL;
+        }
+        kvsFree(pxNet);
+    }
+}
+
+static NetIoMbedtls_t *prvMbedtlsCreate(TlsContextHandle xTlsContext)
+{
+    NetIoMbedtls_t *pxNet = NULL;
+
+    if ((pxNet = (NetIoMbedtls_t *)kvsMalloc(sizeof(NetIoMbedtls_t))) != NULL)
+    {
+        memset(pxNet, 0, sizeof(NetIoMbedtls_t));
+
+        mbedtls_net_init(&(pxNet->xFd));
+        mbedtls_ssl_init(&(pxNet->xSsl));
+        mbedtls_ssl_config_init(&(pxNet->xConf));
+        mbedtls_pk_init(&(pxNet->xPrivKey));
+
+        pxNet->pxTlsContext = (TlsContext_t *)xTlsContext;
+        if (pxNet->pxTlsContext == NULL)
+        {
+            pxNet->pxTlsContext = (TlsContext_t *)TlsContext_create();
+            pxNet->bOwnsTlsContext = true;
+        }
+
+        if (pxNet->pxTlsContext == NULL)
+        {
+            prvMbedtlsTerminate(pxNet);
+            pxNet = NULL;
+        }
+    }
+
+    return pxNet;
+}
+
+static int prvMbedtlsConnect(const NetIoOptions_t *pxOptions, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509, void **ppCtx)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = NULL;
+
+    if ((pxNet = prvMbedtlsCreate(pxOptions->xTlsContext)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxNet");
+    }
+    else
+    {
+        pxNet->uRecvTimeoutMs = pxOptions->uRecvTimeoutMs;
+        pxNet->uSendTimeoutMs = pxOptions->uSendTimeoutMs;
+        pxNet->xTlsSessionCache = pxOptions->xTlsSessionCache;
+        pxNet->bKtlsRequested = pxOptions->bKtls;
+        pxNet->uMaxFragmentLen = pxOptions->uMaxFragmentLen;
+
+        if ((res = prvConnect(pxNet, pcHost, pcPort, pxX509)) != KVS_ERRNO_NONE ||
+            (res = prvSetNonBlocking(pxNet, pxOptions->bNonBlocking)) != KVS_ERRNO_NONE)
+        {
+            prvMbedtlsTerminate(pxNet);
+        }
+        else
+        {
+            *ppCtx = pxNet;
+        }
+    }
+
+    return res;
+}
+
+static void prvMbedtlsClose(void *pCtx)
+{
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+
+    if (pxNet->bKtlsActive)
+    {
+        prvKtlsCloseNotify(pxNet);
+    }
+    else
+    {
+        mbedtls_ssl_close_notify(&(pxNet->xSsl));
+    }
+    prvMbedtlsTerminate(pxNet);
+}
+
+/* Each call of mbedtls_ssl_write sends at most one record, so it's called until all data is sent. */
+static int prvSend(NetIoMbedtls_t *pxNet, const unsigned char *pBuffer, size_t uBytesToSend)
+{
+    int n = 0;
+    int res = KVS_ERRNO_NONE;
+    size_t uBytesRemaining = uBytesToSend;
+    char *pIndex = (char *)pBuffer;
+
+    do
+    {
+        n = mbedtls_ssl_write(&(pxNet->xSsl), (const unsigned char *)pIndex, uBytesRemaining);
+        if (n < 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(n);
+            LogError("SSL send error -%X", -res);
+            break;
+        }
+        else if (n > uBytesRemaining)
+        {
+            res = KVS_ERROR_NETIO_SEND_MORE_THAN_REMAINING_DATA;
+            LogError("SSL send error -%X", -res);
+            break;
+        }
+        uBytesRemaining -= n;
+        pIndex += n;
+    } while (uBytesRemaining > 0);
+
+    return res;
+}
+
+/* Make the gather buffer hold one record. The record size can change between connections. */
+static int prvSendBufReserve(NetIoMbedtls_t *pxNet, size_t uRecordLen)
+{
+    int res = KVS_ERRNO_NONE;
+    unsigned char *pSendBuf = NULL;
+
+    if (pxNet->uSendBufSize < uRecordLen)
+    {
+        if ((pSendBuf = (unsigned char *)kvsRealloc(pxNet->pSendBuf, uRecordLen)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: pSendBuf");
+        }
+        else
+        {
+            pxNet->pSendBuf = pSendBuf;
+            pxNet->uSendBufSize = uRecordLen;
+        }
+    }
+
+    return res;
+}
+
+static int prvMbedtlsSend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+
+    NetIoVec_t xVec = {pBuffer, uBytesToSend};
+
+    if (pxNet->bKtlsActive)
+    {
+        /* The kernel splits the data into full-size records. */
+        res = NetIo_socketSendv(pxNet->xFd.fd, &xVec, 1);
+    }
+    else
+    {
+        res = prvSend(pxNet, pBuffer, uBytesToSend);
+    }
+
+    return res;
+}
+
+static int prvMbedtlsSendv(void *pCtx, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+    int xRecordLen = 0;
+    size_t uRecordLen = 0;
+    size_t uBufLen = 0;
+    size_t uLen = 0;
+    size_t uBytesRemaining = 0;
+    const unsigned char *pIndex = NULL;
+    size_t i = 0;
+
+    if (pxNet->bKtlsActive)
+    {
+        /* The kernel splits the buffers into full-size records, so small buffers don't need to be gathered. */
+        res = NetIo_socketSendv(pxNet->xFd.fd, pxVecs, uVecCnt);
+    }
+    else if ((xRecordLen = mbedtls_ssl_get_max_out_record_payload(&(pxNet->xSsl))) <= 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(xRecordLen);
+        LogError("SSL record size error -%X", -res);
+    }
+    else if ((res = prvSendBufReserve(pxNet, (size_t)xRecordLen)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        uRecordLen = (size_t)xRecordLen;
+        for (i = 0; i < uVecCnt && res == KVS_ERRNO_NONE; i++)
+        {
+            pIndex = pxVecs[i].pBuffer;
+            uBytesRemaining = (pIndex == NULL) ? 0 : pxVecs[i].uLen;
+            while (uBytesRemaining > 0 && res == KVS_ERRNO_NONE)
+            {
+                if (uBufLen == 0 && uBytesRemaining >= uRecordLen)
+                {
+                    /* Full records are sent from the caller's buffer without copying. */
+                    uLen = uBytesRemaining - (uBytesRemaining % uRecordLen);
+                    res = prvSend(pxNet, pIndex, uLen);
+                }
+                else
+                {
+                    uLen = (uBytesRemaining < uRecordLen - uBufLen) ? uBytesRemaining : (uRecordLen - uBufLen);
+                    memcpy(pxNet->pSendBuf + uBufLen, pIndex, uLen);
+                    uBufLen += uLen;
+                    if (uBufLen == uRecordLen)
+                    {
+                        res = prvSend(pxNet, pxNet->pSendBuf, uBufLen);
+                        uBufLen = 0;
+                    }
+                }
+                pIndex += uLen;
+                uBytesRemaining -= uLen;
+            }
+        }
+
+        if (res == KVS_ERRNO_NONE && uBufLen > 0)
+        {
+            res = prvSend(pxNet, pxNet->pSendBuf, uBufLen);
+        }
+    }
+
+    return res;
+}
+
+/* It sends at most one record. If the socket takes the record partly, mbedTLS keeps the rest, and it has to be called
+ * again with the same length, so the record isn't reported sent until it's written. */
+static int prvMbedtlsTrySend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent)
+{
+    int n = 0;
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+    size_t uLen = (pxNet->uHeldLen > 0) ? pxNet->uHeldLen : uBytesToSend;
+
+    *puBytesSent = 0;
+
+    if (pxNet->bKtlsActive)
+    {
+        res = NetIo_socketTrySend(pxNet->xFd.fd, pBuffer, uBytesToSend, puBytesSent);
+    }
+    else if (uLen > uBytesToSend)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("The held record is longer than the data");
+    }
+    else if ((n = mbedtls_ssl_write(&(pxNet->xSsl), pBuffer, uLen)) == MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+        pxNet->uHeldLen = uLen;
+    }
+    else if (n < 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(n);
+        LogError("SSL send error -%X", -res);
+    }
+    else if (n > uLen)
+    {
+        res = KVS_ERROR_NETIO_SEND_MORE_THAN_REMAINING_DATA;
+        LogError("SSL send error -%X", -res);
+    }
+    else
+    {
+        pxNet->uHeldLen = 0;
+        *puBytesSent = (size_t)n;
+    }
+
+    return res;
+}
+
+static int prvMbedtlsRecv(void *pCtx, unsigned char *pBuffer, size_t uBufferSize, size_t *puBytesReceived)
+{
+    int n;
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+
+    n = mbedtls_ssl_read(&(pxNet->xSsl), pBuffer, uBufferSize);
+    if (n == MBEDTLS_ERR_SSL_WANT_READ && pxNet->bNonBlocking)
+    {
+        /* The rest of a record hasn't arrived yet. */
+        res = KVS_ERROR_NETIO_WOULD_BLOCK;
+    }
+    else if (n < 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(n);
+        LogError("SSL recv error -%X", -res);
+    }
+    else if (n > uBufferSize)
+    {
+        res = KVS_ERROR_NETIO_RECV_MORE_THAN_AVAILABLE_SPACE;
+        LogError("SSL recv error -%X", -res);
+    }
+    else
+    {
+        *puBytesReceived = n;
+    }
+
+    return res;
+}
+
+/* Decrypted bytes which are left in mbedTLS can be read even if the socket isn't readable. */
+static bool prvMbedtlsPoll(void *pCtx, uint32_t uTimeoutMs)
+{
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+
+    return mbedtls_ssl_get_bytes_avail(&(pxNet->xSsl)) > 0 || NetIo_socketPoll(pxNet->xFd.fd, uTimeoutMs);
+}
+
+static int prvMbedtlsGetSocket(void *pCtx)
+{
+    return ((NetIoMbedtls_t *)pCtx)->xFd.fd;
+}
+
+static int prvMbedtlsUpdateOptions(void *pCtx, const NetIoOptions_t *pxOptions)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+
+    pxNet->uRecvTimeoutMs = pxOptions->uRecvTimeoutMs;
+    pxNet->uSendTimeoutMs = pxOptions->uSendTimeoutMs;
+    mbedtls_ssl_conf_read_timeout(&(pxNet->xConf), pxNet->uRecvTimeoutMs);
+
+    if ((res = prvSetSendTimeout(pxNet)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        res = prvSetNonBlocking(pxNet, pxOptions->bNonBlocking);
+    }
+
+    return res;
+}
+
+static bool prvMbedtlsIsKtlsActive(void *pCtx)
+{
+    return ((NetIoMbedtls_t *)pCtx)->bKtlsActive;
+}
+
+static size_t prvMbedtlsGetSendRecordLen(void *pCtx)
+{
+    NetIoMbedtls_t *pxNet = (NetIoMbedtls_t *)pCtx;
+    int xRecordLen = 0;
+
+    if (pxNet->bKtlsActive)
+    {
+        /* The kernel fills records of the maximum size. */
+        xRecordLen = MBEDTLS_SSL_MAX_CONTENT_LEN;
+    }
+    else
+    {
+        xRecordLen = mbedtls_ssl_get_max_out_record_payload(&(pxNet->xSsl));
+    }
+
+    return (xRecordLen > 0) ? (size_t)xRecordLen : 0;
+}
+
+const NetIoTransport_t *NetIoTransport_getMbedtls(void)
+{
+    static const NetIoTransport_t xTransport = {
+        "mbedTLS",
+        prvMbedtlsConnect,
+        prvMbedtlsSend,
+        prvMbedtlsSendv,
+        prvMbedtlsRecv,
+        prvMbedtlsPoll,
+        prvMbedtlsClose,
+        prvMbedtlsGetSocket,
+        prvMbedtlsUpdateOptions,
+        prvMbedtlsIsKtlsActive,
+        prvMbedtlsGetSendRecordLen,
+        prvMbedtlsTrySend
+    };
+
+    return &xTransport;
+}
+
+TlsContextHandle TlsContext_create(void)
+{
+    TlsContext_t *pxCtx = NULL;
+    int retVal = 0;
+
+    if ((pxCtx = (TlsContext_t *)kvsMalloc(sizeof(TlsContext_t))) == NULL)
+    {
+        LogError("OOM: pxCtx");
+    }
+    else
+    {
+        memset(pxCtx, 0, sizeof(TlsContext_t));
+        pxCtx->xAead = TLS_AEAD_DEFAULT;
+        pxCtx->xFastestAead = TLS_AEAD_FASTEST;
+        mbedtls_entropy_init(&(pxCtx->xEntropy));
+        mbedtls_ctr_drbg_init(&(pxCtx->xCtrDrbg));
+
+        if ((pxCtx->xLock = Lock_Init()) == NULL)
+        {
+            LogError("Failed to init lock");
+            TlsContext_terminate(pxCtx);
+            pxCtx = NULL;
+        }
+        else if ((retVal = mbedtls_ctr_drbg_seed(&(pxCtx->xCtrDrbg), mbedtls_entropy_func, &(pxCtx->xEntropy), NULL, 0)) != 0)
+        {
+            LogError("Failed to seed ctr_drbg (err:-%X)", -retVal);
+            TlsContext_terminate(pxCtx);
+            pxCtx = NULL;
+        }
+        else
+        {
+            /* nop */
+        }
+    }
+
+    return (TlsContextHandle)pxCtx;
+}
+
+void TlsContext_terminate(TlsContextHandle xTlsContext)
+{
+    TlsContext_t *pxCtx = (TlsContext_t *)xTlsContext;
+    size_t i = 0;
+
+    if (pxCtx != NULL)
+    {
+        if (pxCtx->pxX509 != NULL)
+        {
+            prvTlsX509Release(pxCtx->pxX509);
+        }
+        for (i = 0; i < TLS_AEAD_LIST_CNT; i++)
+        {
+            if (pxCtx->pCiphersuites[i] != NULL)
+            {
+                kvsFree(pxCtx->pCiphersuites[i]);
+            }
+        }
+        mbedtls_ctr_drbg_free(&(pxCtx->xCtrDrbg));
+        mbedtls_entropy_free(&(pxCtx->xEntropy));
+        if (pxCtx->xLock != NULL)
+        {
+            Lock_Deinit(pxCtx->xLock);
+        }
+        kvsFree(pxCtx);
+    }
+}
+
+int TlsContext_setAead(TlsContextHandle xTlsContext, TlsAead_t xAead)
+{
+    int res = KVS_ERRNO_NONE;
+    TlsContext_t *pxCtx = (TlsContext_t *)xTlsContext;
+
+    if (pxCtx == NULL || (xAead != TLS_AEAD_DEFAULT && xAead != TLS_AEAD_FASTEST && xAead != TLS_AEAD_AES_GCM &&
+                          xAead != TLS_AEAD_CHACHA20_POLY1305))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (Lock(pxCtx->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        pxCtx->xAead = xAead;
+        Unlock(pxCtx->xLock);
+    }
+
+    return res;
+}
+
+TlsAead_t TlsContext_getAead(TlsContextHandle xTlsContext)
+{
+    TlsContext_t *pxCtx = (TlsContext_t *)xTlsContext;
+    TlsAead_t xAead = TLS_AEAD_DEFAULT;
+
+    if (pxCtx != NULL)
+    {
+        xAead = prvTlsContextResolveAead(pxCtx);
+    }
+
+    return xAead;
+}
+
+int TlsContext_measureAead(TlsAead_t xAead, size_t uLen, double *pdBytesPerSec)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+    unsigned char *pBuf = NULL;
+    struct timeval xStart = {0};
+    struct timeval xEnd = {0};
+    double dElapsedSec = 0;
+
+    if ((xAead != TLS_AEAD_AES_GCM && xAead != TLS_AEAD_CHACHA20_POLY1305) || uLen == 0 || pdBytesPerSec == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((pBuf = (unsigned char *)kvsMalloc(2 * TLS_AEAD_RECORD_LEN)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pBuf");
+    }
+    else
+    {
+        memset(pBuf, 0, 2 * TLS_AEAD_RECORD_LEN);
+        gettimeofday(&xStart, NULL);
+        retVal = (xAead == TLS_AEAD_AES_GCM) ? prvEncryptAesGcm(pBuf, uLen) : prvEncryptChaChaPoly(pBuf, uLen);
+        gettimeofday(&xEnd, NULL);
+
+        if (retVal == KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED)
+        {
+            res = retVal;
+        }
+        else if (retVal != 0)
+        {
+            res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+            LogError("Failed to encrypt with the AEAD (err:-%X)", -retVal);
+        }
+        else
+        {
+            /* A microsecond is counted at least, in case the clock is coarser than the measurement. */
+            dElapsedSec = (double)(xEnd.tv_sec - xStart.tv_sec) + (double)(xEnd.tv_usec - xStart.tv_usec) / 1000000;
+            *pdBytesPerSec = (double)uLen / ((dElapsedSec > 0.000001) ? dElapsedSec : 0.000001);
+        }
+
+        kvsFree(pBuf);
+    }
+
+    return res;
+}
+
+TlsSessionCacheHandle TlsSessionCache_create(size_t uMaxHosts)
+{
+    TlsSessionCache_t *pxCache = NULL;
+
+    if (uMaxHosts == 0)
+    {
+        LogError("Invalid argument");
+    }
+    else if ((pxCache = (TlsSessionCache_t *)kvsMalloc(sizeof(TlsSessionCache_t))) == NULL)
+    {
+        LogError("OOM: pxCache");
+    }
+    else
+    {
+        memset(pxCache, 0, sizeof(TlsSessionCache_t));
+        DList_InitializeListHead(&(pxCache->xEntries));
+        pxCache->uMaxEntries = uMaxHosts;
+
+        if ((pxCache->xLock = Lock_Init()) == NULL)
+        {
+            LogError("Failed to init lock");
+            kvsFree(pxCache);
+            pxCache = NULL;
+        }
+    }
+
+    return (TlsSessionCacheHandle)pxCache;
+}
+
+void TlsSessionCache_terminate(TlsSessionCacheHandle xTlsSessionCache)
+{
+    TlsSessionCache_t *pxCache = (TlsSessionCache_t *)xTlsSessionCache;
+
+    if (pxCache != NULL)
+    {
+        while (!DList_IsListEmpty(&(pxCache->xEntries)))
+        {
+            prvTlsSessionEntryTerminate(containingRecord(DList_RemoveHeadList(&(pxCache->xEntries)), TlsSessionEntry_t, xEntry));
+        }
+        Lock_Deinit(pxCache->xLock);
+        kvsFree(pxCache);
+    }
+}
+
+#ifdef TLS_SESSION_CACHE_PERSISTENCE
+static int prvTlsSessionEntrySave(TlsSessionEntry_t *pxEntry, FILE *fp)
+{
+    int res = KVS_ERRNO_NONE;
+    int retVal = 0;
+    size_t uHostPortLen = strlen(pxEntry->pcHostPort);
+    size_t uSessionLen = 0;
+    unsigned char *pSession = NULL;
+    unsigned char pLen[4];
+
+    mbedtls_ssl_session_save(&(pxEntry->xSession), NULL, 0, &uSessionLen);
+
+    if ((pSession = (unsigned char *)kvsMalloc(uSessionLen)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pSession");
+    }
+    else if ((retVal = mbedtls_ssl_session_save(&(pxEntry->xSession), pSession, uSessionLen, &uSessionLen)) != 0)
+    {
+        res = KVS_GENERATE_MBEDTLS_ERROR(retVal);
+        LogError("Failed to serialize session of %s (err:-%X)", pxEntry->pcHostPort, -res);
+    }
+    else
+    {
+        pLen[0] = (unsigned char)(uHostPortLen >> 8);
+        pLen[1] = (unsigned char)(uHostPortLen);
+        if (fwrite(pLen, 1, 2, fp) != 2 || fwrite(pxEntry->pcHostPort, 1, uHostPortLen, fp) != uHostPortLen)
+        {
+            res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+        }
+        else
+        {
+            pLen[0] = (unsigned char)(uSessionLen >> 24);
+            pLen[1] = (unsigned char)(uSessionLen >> 16);
+            pLen[2] = (unsigned char)(uSessionLen >> 8);
+            pLen[3] = (unsigned char)(uSessionLen);
+            if (fwrite(pLen, 1, 4, fp) != 4 || fwrite(pSession, 1, uSessionLen, fp) != uSessionLen)
+            {
+                res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+            }
+        }
+    }
+
+    if (pSession != NULL)
+    {
+        kvsFree(pSession);
+    }
+
+    return res;
+}
+
+/* Restore the records of a cache file. A record that can't be restored is skipped. */
+static int prvTlsSessionCacheParse(TlsSessionCache_t *pxCache, const unsigned char *pBuf, size_t uBufLen)
+{
+    int res = KVS_ERRNO_NONE;
+    size_t uIdx = TLS_SESSION_CACHE_FILE_MAGIC_LEN;
+    size_t uHostPortLen = 0;
+    size_t uSessionLen = 0;
+    char pcHostPort[TLS_SESSION_HOST_PORT_MAX];
+    TlsSessionEntry_t *pxEntry = NULL;
+
+    if (uBufLen < TLS_SESSION_CACHE_FILE_MAGIC_LEN || memcmp(pBuf, TLS_SESSION_CACHE_FILE_MAGIC, TLS_SESSION_CACHE_FILE_MAGIC_LEN) != 0)
+    {
+        res = KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE;
+        LogError("Invalid TLS session cache file");
+    }
+
+    while (res == KVS_ERRNO_NONE && uIdx < uBufLen)
+    {
+        if (uBufLen - uIdx < 2 || (uHostPortLen = ((size_t)pBuf[uIdx] << 8) | pBuf[uIdx + 1]) >= TLS_SESSION_HOST_PORT_MAX ||
+            uBufLen - uIdx - 2 < uHostPortLen + 4)
+        {
+            res = KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE;
+            LogError("Truncated TLS session cache file");
+            break;
+        }
+        memcpy(pcHostPort, pBuf + uIdx + 2, uHostPortLen);
+        pcHostPort[uHostPortLen] = '\0';
+        uIdx += 2 + uHostPortLen;
+
+        uSessionLen = ((size_t)pBuf[uIdx] << 24) | ((size_t)pBuf[uIdx + 1] << 16) | ((size_t)pBuf[uIdx + 2] << 8) | pBuf[uIdx + 3];
+        uIdx += 4;
+        if (uBufLen - uIdx < uSessionLen)
+        {
+            res = KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE;
+            LogError("Truncated TLS session cache file");
+            break;
+        }
+
+        if ((pxEntry = prvTlsSessionCacheFindOrAdd(pxCache, pcHostPort)) != NULL)
+        {
+            mbedtls_ssl_session_free(&(pxEntry->xSession));
+            mbedtls_ssl_session_init(&(pxEntry->xSession));
+            if (mbedtls_ssl_session_load(&(pxEntry->xSession), pBuf + uIdx, uSessionLen) != 0)
+            {
+                LogInfo("Skip the session of %s", pcHostPort);
+                prvTlsSessionCacheRemove(pxCache, pxEntry);
+            }
+        }
+        uIdx += uSessionLen;
+    }
+
+    return res;
+}
+#endif /* TLS_SESSION_CACHE_PERSISTENCE */
+
+int TlsSessionCache_load(TlsSessionCacheHandle xTlsSessionCache, const char *pcPath)
+{
+    int res = KVS_ERRNO_NONE;
+#ifdef TLS_SESSION_CACHE_PERSISTENCE
+    TlsSessionCache_t *pxCache = (TlsSessionCache_t *)xTlsSessionCache;
+    FILE *fp = NULL;
+    long xFileLen = 0;
+    unsigned char *pBuf = NULL;
+
+    if (pxCache == NULL || pcPath == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if ((fp = fopen(pcPath, "rb")) == NULL)
+    {
+        res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+        LogInfo("No TLS session cache file %s", pcPath);
+    }
+    else if (fseek(fp, 0, SEEK_END) != 0 || (xFileLen = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+        LogError("Failed to get the size of %s", pcPath);
+    }
+    else if ((pBuf = (unsigned char *)kvsMalloc((size_t)xFileLen + 1)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pBuf");
+    }
+    else if (fread(pBuf, 1, (size_t)xFileLen, fp) != (size_t)xFileLen)
+    {
+        res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+        LogError("Failed to read %s", pcPath);
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        res = prvTlsSessionCacheParse(pxCache, pBuf, (size_t)xFileLen);
+        Unlock(pxCache->xLock);
+    }
+
+    if (pBuf != NULL)
+    {
+        kvsFree(pBuf);
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+#else
+    (void)xTlsSessionCache;
+    (void)pcPath;
+    res = KVS_ERROR_TLS_SESSION_CACHE_NOT_SUPPORTED;
+    LogError("TLS session persistence needs mbedTLS 2.19.0 or later");
+#endif /* TLS_SESSION_CACHE_PERSISTENCE */
+
+    return res;
+}
+
+int TlsSessionCache_save(TlsSessionCacheHandle xTlsSessionCache, const char *pcPath)
+{
+    int res = KVS_ERRNO_NONE;
+#ifdef TLS_SESSION_CACHE_PERSISTENCE
+    TlsSessionCache_t *pxCache = (TlsSessionCache_t *)xTlsSessionCache;
+    FileWriter_t xWriter = {0};
+    PDLIST_ENTRY pxListHead = NULL;
+    PDLIST_ENTRY pxListItem = NULL;
+
+    if (pxCache == NULL || pcPath == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (Lock(pxCache->xLock) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to lock");
+    }
+    else
+    {
+        /* The sessions are written to a private temporary file which replaces the file once it's complete, so the
+         * master secrets are never readable by others, and a crash never leaves a truncated file behind. */
+        if (FileWriter_open(&xWriter, pcPath) != KVS_ERRNO_NONE)
+        {
+            res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+            LogError("Failed to write %s", pcPath);
+        }
+        else if (fwrite(TLS_SESSION_CACHE_FILE_MAGIC, 1, TLS_SESSION_CACHE_FILE_MAGIC_LEN, xWriter.fp) != TLS_SESSION_CACHE_FILE_MAGIC_LEN)
+        {
+            res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+            LogError("Failed to write %s", pcPath);
+            FileWriter_abort(&xWriter);
+        }
+        else
+        {
+            pxListHead = &(pxCache->xEntries);
+            pxListItem = pxListHead->Flink;
+            while (pxListItem != pxListHead && res == KVS_ERRNO_NONE)
+            {
+                res = prvTlsSessionEntrySave(containingRecord(pxListItem, TlsSessionEntry_t, xEntry), xWriter.fp);
+                pxListItem = pxListItem->Flink;
+            }
+
+            if (res != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to write %s", pcPath);
+                FileWriter_abort(&xWriter);
+            }
+            else if (FileWriter_commit(&xWriter) != KVS_ERRNO_NONE)
+            {
+                res = KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR;
+                LogError("Failed to write %s", pcPath);
+            }
+            else
+            {
+                /* nop */
+            }
+        }
+        Unlock(pxCache->xLock);
+    }
+#else
+    (void)xTlsSessionCache;
+    (void)pcPath;
+    res = KVS_ERROR_TLS_SESSION_CACHE_NOT_SUPPORTED;
+    LogError("TLS session persistence needs mbedTLS 2.19.0 or later");
+#endif /* TLS_SESSION_CACHE_PERSISTENCE */
+
+    return res;
+}
\ No newline at end of file
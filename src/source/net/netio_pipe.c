@@ -0,0 +1,568 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+#include "net/netio_transport.h"
+
+/* The bytes a direction of a pipe holds before the writer waits for the reader */
+#define NETIO_PIPE_CAPACITY                 (64 * 1024)
+
+/* The connections which wait to be accepted by a listener */
+#define NETIO_PIPE_BACKLOG                  (8)
+
+/* The key of a listener is "host:port". */
+#define NETIO_PIPE_HOST_PORT_MAX            (256)
+
+/* A ring buffer of one direction of a pipe */
+typedef struct PipeRing
+{
+    unsigned char pBuf[NETIO_PIPE_CAPACITY];
+    size_t uHead;
+    size_t uLen;
+
+    bool bWriterClosed;
+    bool bReaderClosed;
+} PipeRing_t;
+
+/* Both directions of a pipe, which are shared by both ends. The last end which closes frees it. */
+typedef struct PipeShared
+{
+    pthread_mutex_t xLock;
+    pthread_cond_t xCond;
+    PipeRing_t xRings[2];
+    int xRefCnt;
+} PipeShared_t;
+
+typedef struct NetIoPipe
+{
+    PipeShared_t *pxShared;
+    PipeRing_t *pxTx;
+    PipeRing_t *pxRx;
+
+    /* A timeout of 0 waits forever. */
+    uint32_t uRecvTimeoutMs;
+    uint32_t uSendTimeoutMs;
+
+    /* Receiving from an empty ring fails instead of waiting. */
+    bool bNonBlocking;
+} NetIoPipe_t;
+
+typedef struct NetIoPipeListener
+{
+    char pcHostPort[NETIO_PIPE_HOST_PORT_MAX];
+
+    /* Server ends of the connections which aren't accepted, the oldest first */
+    NetIoPipe_t *pxPending[NETIO_PIPE_BACKLOG];
+    size_t uPendingCnt;
+
+    struct NetIoPipeListener *pxNext;
+} NetIoPipeListener_t;
+
+/* Listeners of the process, and the condition signaled when a connection is queued to one of them */
+static pthread_mutex_t xListenersLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xListenersCond = PTHREAD_COND_INITIALIZER;
+static NetIoPipeListener_t *pxListeners = NULL;
+
+static bool prvHostPort(char *pcHostPort, const char *pcHost, const char *pcPort)
+{
+    int n = snprintf(pcHostPort, NETIO_PIPE_HOST_PORT_MAX, "%s:%s", pcHost, pcPort);
+
+    return n > 0 && n < NETIO_PIPE_HOST_PORT_MAX;
+}
+
+/* It's called with the lock of the listeners. */
+static NetIoPipeListener_t *prvListenerFind(const char *pcHostPort)
+{
+    NetIoPipeListener_t *pxListener = pxListeners;
+
+    while (pxListener != NULL && strcmp(pxListener->pcHostPort, pcHostPort) != 0)
+    {
+        pxListener = pxListener->pxNext;
+    }
+
+    return pxListener;
+}
+
+static void prvDeadline(uint32_t uTimeoutMs, struct timespec *pxDeadline)
+{
+    clock_gettime(CLOCK_REALTIME, pxDeadline);
+    pxDeadline->tv_sec += uTimeoutMs / 1000;
+    pxDeadline->tv_nsec += (long)(uTimeoutMs % 1000) * 1000000L;
+    if (pxDeadline->tv_nsec >= 1000000000L)
+    {
+        pxDeadline->tv_sec++;
+        pxDeadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Wait for a signal of the condition, and return false if the deadline passed. A NULL deadline waits forever. */
+static bool prvWait(pthread_cond_t *pxCond, pthread_mutex_t *pxLock, const struct timespec *pxDeadline)
+{
+    bool bSignaled = true;
+
+    if (pxDeadline == NULL)
+    {
+        pthread_cond_wait(pxCond, pxLock);
+    }
+    else if (pthread_cond_timedwait(pxCond, pxLock, pxDeadline) == ETIMEDOUT)
+    {
+        bSignaled = false;
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return bSignaled;
+}
+
+/* Create a pipe and return both ends of it. */
+static int prvPipeCreate(NetIoPipe_t **ppxClient, NetIoPipe_t **ppxServer)
+{
+    int res = KVS_ERRNO_NONE;
+    PipeShared_t *pxShared = NULL;
+    NetIoPipe_t *pxClient = NULL;
+    NetIoPipe_t *pxServer = NULL;
+
+    if ((pxShared = (PipeShared_t *)kvsMalloc(sizeof(PipeShared_t))) == NULL ||
+        (pxClient = (NetIoPipe_t *)kvsMalloc(sizeof(NetIoPipe_t))) == NULL ||
+        (pxServer = (NetIoPipe_t *)kvsMalloc(sizeof(NetIoPipe_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pipe");
+    }
+    else
+    {
+        memset(pxShared, 0, sizeof(PipeShared_t));
+        memset(pxClient, 0, sizeof(NetIoPipe_t));
+        memset(pxServer, 0, sizeof(NetIoPipe_t));
+
+        if (pthread_mutex_init(&(pxShared->xLock), NULL) != 0)
+        {
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to init lock");
+        }
+        else if (pthread_cond_init(&(pxShared->xCond), NULL) != 0)
+        {
+            res = KVS_ERROR_LOCK_ERROR;
+            LogError("Failed to init cond");
+            pthread_mutex_destroy(&(pxShared->xLock));
+        }
+        else
+        {
+            pxShared->xRefCnt = 2;
+
+            pxClient->pxShared = pxShared;
+            pxClient->pxTx = &(pxShared->xRings[0]);
+            pxClient->pxRx = &(pxShared->xRings[1]);
+
+            pxServer->pxShared = pxShared;
+            pxServer->pxTx = &(pxShared->xRings[1]);
+            pxServer->pxRx = &(pxShared->xRings[0]);
+
+            *ppxClient = pxClient;
+            *ppxServer = pxServer;
+        }
+    }
+
+    if (res != KVS_ERRNO_NONE)
+    {
+        kvsFree(pxServer);
+        kvsFree(pxClient);
+        kvsFree(pxShared);
+    }
+
+    return res;
+}
+
+/* Close an end. The peer reads the bytes left in the pipe, and then gets the closed connection. */
+static void prvPipeClose(void *pCtx)
+{
+    NetIoPipe_t *pxPipe = (NetIoPipe_t *)pCtx;
+    PipeShared_t *pxShared = pxPipe->pxShared;
+    bool bIsLast = false;
+
+    pthread_mutex_lock(&(pxShared->xLock));
+    pxPipe->pxTx->bWriterClosed = true;
+    pxPipe->pxRx->bReaderClosed = true;
+    bIsLast = (--pxShared->xRefCnt == 0);
+    pthread_cond_broadcast(&(pxShared->xCond));
+    pthread_mutex_unlock(&(pxShared->xLock));
+
+    if (bIsLast)
+    {
+        pthread_cond_destroy(&(pxShared->xCond));
+        pthread_mutex_destroy(&(pxShared->xLock));
+        kvsFree(pxShared);
+    }
+    kvsFree(pxPipe);
+}
+
+static int prvPipeConnect(const NetIoOptions_t *pxOptions, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509, void **ppCtx)
+{
+    int res = KVS_ERRNO_NONE;
+    char pcHostPort[NETIO_PIPE_HOST_PORT_MAX];
+    NetIoPipeListener_t *pxListener = NULL;
+    NetIoPipe_t *pxClient = NULL;
+    NetIoPipe_t *pxServer = NULL;
+
+    (void)pxX509;
+
+    if (!prvHostPort(pcHostPort, pcHost, pcPort))
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid host and port");
+    }
+    else if ((res = prvPipeCreate(&pxClient, &pxServer)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        pthread_mutex_lock(&xListenersLock);
+        if ((pxListener = prvListenerFind(pcHostPort)) == NULL || pxListener->uPendingCnt >= NETIO_PIPE_BACKLOG)
+        {
+            res = KVS_ERROR_NETIO_CONNECT_FAILED;
+            LogError("Failed to connect to %s", pcHostPort);
+        }
+        else
+        {
+            pxListener->pxPending[pxListener->uPendingCnt++] = pxServer;
+            pthread_cond_broadcast(&xListenersCond);
+        }
+        pthread_mutex_unlock(&xListenersLock);
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            prvPipeClose(pxServer);
+            prvPipeClose(pxClient);
+        }
+        else
+        {
+            pxClient->uRecvTimeoutMs = pxOptions->uRecvTimeoutMs;
+            pxClient->uSendTimeoutMs = pxOptions->uSendTimeoutMs;
+            pxClient->bNonBlocking = pxOptions->bNonBlocking;
+            *ppCtx = pxClient;
+        }
+    }
+
+    return res;
+}
+
+/* Copy bytes into the ring, and wait for the reader when it's full. Without bWait, it returns when the ring is full. */
+static int prvPipeWrite(NetIoPipe_t *pxPipe, const unsigned char *pBuffer, size_t uBytesToSend, bool bWait, size_t *puBytesSent)
+{
+    int res = KVS_ERRNO_NONE;
+    PipeShared_t *pxShared = pxPipe->pxShared;
+    PipeRing_t *pxRing = pxPipe->pxTx;
+    struct timespec xDeadline;
+    size_t uTail = 0;
+    size_t uLen = 0;
+    size_t uBytesSent = 0;
+
+    prvDeadline(pxPipe->uSendTimeoutMs, &xDeadline);
+
+    pthread_mutex_lock(&(pxShared->xLock));
+    while (uBytesToSend > 0 && res == KVS_ERRNO_NONE)
+    {
+        if (pxRing->bReaderClosed)
+        {
+            res = KVS_ERROR_NETIO_SEND_FAILED;
+            LogError("Pipe send error: peer closed");
+        }
+        else if (pxRing->uLen == NETIO_PIPE_CAPACITY && !bWait)
+        {
+            break;
+        }
+        else if (pxRing->uLen == NETIO_PIPE_CAPACITY)
+        {
+            if (!prvWait(&(pxShared->xCond), &(pxShared->xLock), (pxPipe->uSendTimeoutMs == 0) ? NULL : &xDeadline))
+            {
+                res = KVS_ERROR_NETIO_SEND_FAILED;
+                LogError("Pipe send error: timeout");
+            }
+        }
+        else
+        {
+            /* Fill the free space up to the end of the buffer, and the rest is written from its start next time. */
+            uTail = (pxRing->uHead + pxRing->uLen) % NETIO_PIPE_CAPACITY;
+            uLen = (uTail >= pxRing->uHead) ? (NETIO_PIPE_CAPACITY - uTail) : (pxRing->uHead - uTail);
+            uLen = (uLen < uBytesToSend) ? uLen : uBytesToSend;
+
+            memcpy(pxRing->pBuf + uTail, pBuffer, uLen);
+            pxRing->uLen += uLen;
+            pBuffer += uLen;
+            uBytesToSend -= uLen;
+            uBytesSent += uLen;
+            pthread_cond_broadcast(&(pxShared->xCond));
+        }
+    }
+    pthread_mutex_unlock(&(pxShared->xLock));
+
+    if (puBytesSent != NULL)
+    {
+        *puBytesSent = uBytesSent;
+    }
+
+    return res;
+}
+
+static int prvPipeSend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend)
+{
+    return prvPipeWrite((NetIoPipe_t *)pCtx, pBuffer, uBytesToSend, true, NULL);
+}
+
+static int prvPipeTrySend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent)
+{
+    NetIoPipe_t *pxPipe = (NetIoPipe_t *)pCtx;
+
+    return prvPipeWrite(pxPipe, pBuffer, uBytesToSend, !pxPipe->bNonBlocking, puBytesSent);
+}
+
+static int prvPipeSendv(void *pCtx, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    size_t i = 0;
+
+    for (i = 0; i < uVecCnt && res == KVS_ERRNO_NONE; i++)
+    {
+        if (pxVecs[i].pBuffer != NULL)
+        {
+            res = prvPipeWrite((NetIoPipe_t *)pCtx, pxVecs[i].pBuffer, pxVecs[i].uLen, true, NULL);
+        }
+    }
+
+    return res;
+}
+
+static int prvPipeRecv(void *pCtx, unsigned char *pBuffer, size_t uBufferSize, size_t *puBytesReceived)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoPipe_t *pxPipe = (NetIoPipe_t *)pCtx;
+    PipeShared_t *pxShared = pxPipe->pxShared;
+    PipeRing_t *pxRing = pxPipe->pxRx;
+    struct timespec xDeadline;
+    size_t uLen = 0;
+    size_t uCopied = 0;
+
+    prvDeadline(pxPipe->uRecvTimeoutMs, &xDeadline);
+
+    pthread_mutex_lock(&(pxShared->xLock));
+    while (pxRing->uLen == 0 && !pxRing->bWriterClosed && res == KVS_ERRNO_NONE)
+    {
+        if (pxPipe->bNonBlocking)
+        {
+            res = KVS_ERROR_NETIO_WOULD_BLOCK;
+        }
+        else if (!prvWait(&(pxShared->xCond), &(pxShared->xLock), (pxPipe->uRecvTimeoutMs == 0) ? NULL : &xDeadline))
+        {
+            res = KVS_ERROR_NETIO_RECV_TIMEOUT;
+        }
+    }
+
+    if (res != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (pxRing->uLen == 0)
+    {
+        res = KVS_ERROR_NETIO_CONNECTION_CLOSED;
+    }
+    else
+    {
+        /* The bytes can wrap around the end of the buffer, so they are copied in up to 2 parts. */
+        while (uCopied < uBufferSize && pxRing->uLen > 0)
+        {
+            uLen = NETIO_PIPE_CAPACITY - pxRing->uHead;
+            uLen = (uLen < pxRing->uLen) ? uLen : pxRing->uLen;
+            uLen = (uLen < uBufferSize - uCopied) ? uLen : (uBufferSize - uCopied);
+
+            memcpy(pBuffer + uCopied, pxRing->pBuf + pxRing->uHead, uLen);
+            pxRing->uHead = (pxRing->uHead + uLen) % NETIO_PIPE_CAPACITY;
+            pxRing->uLen -= uLen;
+            uCopied += uLen;
+        }
+        *puBytesReceived = uCopied;
+        pthread_cond_broadcast(&(pxShared->xCond));
+    }
+    pthread_mutex_unlock(&(pxShared->xLock));
+
+    return res;
+}
+
+/* An end is readable when the peer closed too, like a socket at the end of the stream. */
+static bool prvPipePoll(void *pCtx, uint32_t uTimeoutMs)
+{
+    NetIoPipe_t *pxPipe = (NetIoPipe_t *)pCtx;
+    PipeShared_t *pxShared = pxPipe->pxShared;
+    PipeRing_t *pxRing = pxPipe->pxRx;
+    struct timespec xDeadline;
+    bool bReadable = false;
+
+    prvDeadline(uTimeoutMs, &xDeadline);
+
+    pthread_mutex_lock(&(pxShared->xLock));
+    while (!(bReadable = (pxRing->uLen > 0 || pxRing->bWriterClosed)) && uTimeoutMs > 0 &&
+           prvWait(&(pxShared->xCond), &(pxShared->xLock), &xDeadline))
+    {
+        /* nop */
+    }
+    pthread_mutex_unlock(&(pxShared->xLock));
+
+    return bReadable;
+}
+
+static int prvPipeUpdateOptions(void *pCtx, const NetIoOptions_t *pxOptions)
+{
+    NetIoPipe_t *pxPipe = (NetIoPipe_t *)pCtx;
+
+    pthread_mutex_lock(&(pxPipe->pxShared->xLock));
+    pxPipe->uRecvTimeoutMs = pxOptions->uRecvTimeoutMs;
+    pxPipe->uSendTimeoutMs = pxOptions->uSendTimeoutMs;
+    pxPipe->bNonBlocking = pxOptions->bNonBlocking;
+    pthread_mutex_unlock(&(pxPipe->pxShared->xLock));
+
+    return KVS_ERRNO_NONE;
+}
+
+const NetIoTransport_t *NetIoTransport_getPipe(void)
+{
+    static const NetIoTransport_t xTransport = {
+        "pipe",
+        prvPipeConnect,
+        prvPipeSend,
+        prvPipeSendv,
+        prvPipeRecv,
+        prvPipePoll,
+        prvPipeClose,
+        NULL,
+        prvPipeUpdateOptions,
+        NULL,
+        NULL,
+        prvPipeTrySend
+    };
+
+    return &xTransport;
+}
+
+NetIoPipeListenerHandle NetIoPipe_listen(const char *pcHost, const char *pcPort)
+{
+    NetIoPipeListener_t *pxListener = NULL;
+
+    if (pcHost == NULL || pcPort == NULL)
+    {
+        LogError("Invalid argument");
+    }
+    else if ((pxListener = (NetIoPipeListener_t *)kvsMalloc(sizeof(NetIoPipeListener_t))) == NULL)
+    {
+        LogError("OOM: pxListener");
+    }
+    else
+    {
+        memset(pxListener, 0, sizeof(NetIoPipeListener_t));
+
+        pthread_mutex_lock(&xListenersLock);
+        if (!prvHostPort(pxListener->pcHostPort, pcHost, pcPort) || prvListenerFind(pxListener->pcHostPort) != NULL)
+        {
+            LogError("Failed to listen to %s:%s", pcHost, pcPort);
+            kvsFree(pxListener);
+            pxListener = NULL;
+        }
+        else
+        {
+            pxListener->pxNext = pxListeners;
+            pxListeners = pxListener;
+        }
+        pthread_mutex_unlock(&xListenersLock);
+    }
+
+    return pxListener;
+}
+
+NetIoHandle NetIoPipe_accept(NetIoPipeListenerHandle xListener, uint32_t uTimeoutMs)
+{
+    NetIoPipeListener_t *pxListener = (NetIoPipeListener_t *)xListener;
+    NetIoPipe_t *pxServer = NULL;
+    struct timespec xDeadline;
+
+    if (pxListener == NULL)
+    {
+        LogError("Invalid argument");
+    }
+    else
+    {
+        prvDeadline(uTimeoutMs, &xDeadline);
+
+        pthread_mutex_lock(&xListenersLock);
+        while (pxListener->uPendingCnt == 0 && prvWait(&xListenersCond, &xListenersLock, (uTimeoutMs == 0) ? NULL : &xDeadline))
+        {
+            /* nop */
+        }
+
+        if (pxListener->uPendingCnt > 0)
+        {
+            pxServer = pxListener->pxPending[0];
+            pxListener->uPendingCnt--;
+            memmove(&(pxListener->pxPending[0]), &(pxListener->pxPending[1]), pxListener->uPendingCnt * sizeof(NetIoPipe_t *));
+        }
+        pthread_mutex_unlock(&xListenersLock);
+    }
+
+    return (pxServer == NULL) ? NULL : NetIo_createConnected(NetIoTransport_getPipe(), pxServer);
+}
+
+void NetIoPipe_terminateListener(NetIoPipeListenerHandle xListener)
+{
+    NetIoPipeListener_t *pxListener = (NetIoPipeListener_t *)xListener;
+    NetIoPipeListener_t **ppxIndex = &pxListeners;
+    size_t i = 0;
+
+    if (pxListener != NULL)
+    {
+        pthread_mutex_lock(&xListenersLock);
+        while (*ppxIndex != NULL && *ppxIndex != pxListener)
+        {
+            ppxIndex = &((*ppxIndex)->pxNext);
+        }
+        if (*ppxIndex != NULL)
+        {
+            *ppxIndex = pxListener->pxNext;
+        }
+        pthread_mutex_unlock(&xListenersLock);
+
+        for (i = 0; i < pxListener->uPendingCnt; i++)
+        {
+            prvPipeClose(pxListener->pxPending[i]);
+        }
+        kvsFree(pxListener);
+    }
+}
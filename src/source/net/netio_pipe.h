@@ -0,0 +1,52 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef NETIO_PIPE_H
+#define NETIO_PIPE_H
+
+#include <stdint.h>
+
+#include "net/netio.h"
+
+typedef struct NetIoPipeListener *NetIoPipeListenerHandle;
+
+/**
+ * @brief Listen to a host and port in the process. Handles of the memory pipe transport which connect to them are
+ * accepted by NetIoPipe_accept().
+ *
+ * @param[in] pcHost The hostname
+ * @param[in] pcPort The port
+ * @return The listener handle, or NULL if the host and port are already listened or it's out of memory
+ */
+NetIoPipeListenerHandle NetIoPipe_listen(const char *pcHost, const char *pcPort);
+
+/**
+ * @brief Wait for a connection to a listener, and return the server end of it
+ *
+ * @param[in] xListener The listener handle
+ * @param[in] uTimeoutMs The longest time to wait, or 0 to wait forever
+ * @return The network I/O handle of the server end, or NULL if nothing connects within the timeout
+ */
+NetIoHandle NetIoPipe_accept(NetIoPipeListenerHandle xListener, uint32_t uTimeoutMs);
+
+/**
+ * @brief Stop listening, and close the connections which aren't accepted. It must not be called while another thread
+ * is waiting in NetIoPipe_accept().
+ *
+ * @param[in] xListener The listener handle
+ */
+void NetIoPipe_terminateListener(NetIoPipeListenerHandle xListener);
+
+#endif /* NETIO_PIPE_H */
@@ -0,0 +1,379 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "net/netio.h"
+#include "net/netio_transport.h"
+
+/* The number of buffers handed to writev() at once */
+#define NETIO_IOV_MAX                       (16)
+
+typedef struct NetIoTcp
+{
+    int xSockFd;
+    bool bNonBlocking;
+} NetIoTcp_t;
+
+static size_t prvVecLen(const NetIoVec_t *pxVec)
+{
+    return (pxVec->pBuffer == NULL) ? 0 : pxVec->uLen;
+}
+
+static void prvMsToTimeval(uint32_t uMs, struct timeval *pxTv)
+{
+    pxTv->tv_sec = uMs / 1000;
+    pxTv->tv_usec = (uMs % 1000) * 1000;
+}
+
+int NetIo_socketSendv(int xSockFd, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    struct iovec xIovs[NETIO_IOV_MAX];
+    int xIovCnt = 0;
+    size_t uVecIdx = 0;
+    size_t uOffset = 0;
+    size_t uLen = 0;
+    ssize_t xSent = 0;
+    size_t i = 0;
+
+    while (res == KVS_ERRNO_NONE && uVecIdx < uVecCnt)
+    {
+        xIovCnt = 0;
+        for (i = uVecIdx; i < uVecCnt && xIovCnt < NETIO_IOV_MAX; i++)
+        {
+            uLen = prvVecLen(&(pxVecs[i])) - ((i == uVecIdx) ? uOffset : 0);
+            if (uLen > 0)
+            {
+                xIovs[xIovCnt].iov_base = (void *)(pxVecs[i].pBuffer + ((i == uVecIdx) ? uOffset : 0));
+                xIovs[xIovCnt].iov_len = uLen;
+                xIovCnt++;
+            }
+        }
+
+        if (xIovCnt == 0)
+        {
+            break;
+        }
+        else if ((xSent = writev(xSockFd, xIovs, xIovCnt)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                res = KVS_ERROR_NETIO_SEND_FAILED;
+                LogError("Socket send error (errno:%d)", errno);
+            }
+        }
+        else
+        {
+            /* Skip the buffers which are sent, and remember how much of the next one is sent. */
+            while (xSent > 0 && uVecIdx < uVecCnt)
+            {
+                uLen = prvVecLen(&(pxVecs[uVecIdx])) - uOffset;
+                if ((size_t)xSent >= uLen)
+                {
+                    xSent -= uLen;
+                    uVecIdx++;
+                    uOffset = 0;
+                }
+                else
+                {
+                    uOffset += (size_t)xSent;
+                    xSent = 0;
+                }
+            }
+        }
+    }
+
+    return res;
+}
+
+int NetIo_socketTrySend(int xSockFd, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent)
+{
+    int res = KVS_ERRNO_NONE;
+    ssize_t xSent = 0;
+
+    do
+    {
+        xSent = send(xSockFd, pBuffer, uBytesToSend, 0);
+    } while (xSent < 0 && errno == EINTR);
+
+    if (xSent >= 0)
+    {
+        *puBytesSent = (size_t)xSent;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        *puBytesSent = 0;
+    }
+    else
+    {
+        res = KVS_ERROR_NETIO_SEND_FAILED;
+        LogError("Socket send error (errno:%d)", errno);
+    }
+
+    return res;
+}
+
+bool NetIo_socketPoll(int xSockFd, uint32_t uTimeoutMs)
+{
+    bool bDataAvailable = false;
+    struct timeval tv = {0};
+    fd_set read_fds;
+
+    if (xSockFd >= 0)
+    {
+        FD_ZERO(&read_fds);
+        FD_SET(xSockFd, &read_fds);
+        prvMsToTimeval(uTimeoutMs, &tv);
+
+        if (select(xSockFd + 1, &read_fds, NULL, NULL, &tv) > 0 && FD_ISSET(xSockFd, &read_fds))
+        {
+            bDataAvailable = true;
+        }
+    }
+
+    return bDataAvailable;
+}
+
+int NetIo_socketSetTimeouts(int xSockFd, const NetIoOptions_t *pxOptions)
+{
+    int res = KVS_ERRNO_NONE;
+    struct timeval xRecvTv = {0};
+    struct timeval xSendTv = {0};
+
+    prvMsToTimeval(pxOptions->uRecvTimeoutMs, &xRecvTv);
+    prvMsToTimeval(pxOptions->uSendTimeoutMs, &xSendTv);
+
+    if (setsockopt(xSockFd, SOL_SOCKET, SO_RCVTIMEO, (void *)&xRecvTv, sizeof(xRecvTv)) != 0 ||
+        setsockopt(xSockFd, SOL_SOCKET, SO_SNDTIMEO, (void *)&xSendTv, sizeof(xSendTv)) != 0)
+    {
+        res = KVS_ERROR_NETIO_UNABLE_TO_SET_SEND_TIMEOUT;
+        LogError("Failed to set socket timeouts (errno:%d)", errno);
+    }
+
+    return res;
+}
+
+int NetIo_socketSetNonBlocking(int xSockFd, const NetIoOptions_t *pxOptions)
+{
+    int res = KVS_ERRNO_NONE;
+    int xFlags = 0;
+
+    if ((xFlags = fcntl(xSockFd, F_GETFL)) < 0 ||
+        fcntl(xSockFd, F_SETFL, pxOptions->bNonBlocking ? (xFlags | O_NONBLOCK) : (xFlags & ~O_NONBLOCK)) < 0)
+    {
+        res = KVS_ERROR_NETIO_UNABLE_TO_SET_NONBLOCKING;
+        LogError("Failed to set O_NONBLOCK of socket (errno:%d)", errno);
+    }
+
+    return res;
+}
+
+/* Try the addresses of the host in order until one of them is connected. */
+static int prvTcpOpen(const char *pcHost, const char *pcPort)
+{
+    int xSockFd = -1;
+    struct addrinfo xHints;
+    struct addrinfo *pxAddrs = NULL;
+    struct addrinfo *pxAddr = NULL;
+
+    memset(&xHints, 0, sizeof(xHints));
+    xHints.ai_family = AF_UNSPEC;
+    xHints.ai_socktype = SOCK_STREAM;
+    xHints.ai_protocol = IPPROTO_TCP;
+
+    if (getaddrinfo(pcHost, pcPort, &xHints, &pxAddrs) != 0)
+    {
+        LogError("Failed to resolve %s:%s", pcHost, pcPort);
+    }
+    else
+    {
+        for (pxAddr = pxAddrs; pxAddr != NULL && xSockFd < 0; pxAddr = pxAddr->ai_next)
+        {
+            if ((xSockFd = socket(pxAddr->ai_family, pxAddr->ai_socktype, pxAddr->ai_protocol)) >= 0 &&
+                connect(xSockFd, pxAddr->ai_addr, pxAddr->ai_addrlen) != 0)
+            {
+                close(xSockFd);
+                xSockFd = -1;
+            }
+        }
+        freeaddrinfo(pxAddrs);
+    }
+
+    return xSockFd;
+}
+
+static int prvTcpUpdateOptions(void *pCtx, const NetIoOptions_t *pxOptions)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoTcp_t *pxTcp = (NetIoTcp_t *)pCtx;
+
+    if ((res = NetIo_socketSetTimeouts(pxTcp->xSockFd, pxOptions)) != KVS_ERRNO_NONE ||
+        (res = NetIo_socketSetNonBlocking(pxTcp->xSockFd, pxOptions)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        pxTcp->bNonBlocking = pxOptions->bNonBlocking;
+    }
+
+    return res;
+}
+
+static int prvTcpConnect(const NetIoOptions_t *pxOptions, const char *pcHost, const char *pcPort, const NetIoX509_t *pxX509, void **ppCtx)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoTcp_t *pxTcp = NULL;
+
+    (void)pxX509;
+
+    if ((pxTcp = (NetIoTcp_t *)kvsMalloc(sizeof(NetIoTcp_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxTcp");
+    }
+    else if ((pxTcp->xSockFd = prvTcpOpen(pcHost, pcPort)) < 0)
+    {
+        res = KVS_ERROR_NETIO_CONNECT_FAILED;
+        LogError("Failed to connect to %s:%s", pcHost, pcPort);
+    }
+    else if ((res = prvTcpUpdateOptions(pxTcp, pxOptions)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        *ppCtx = pxTcp;
+    }
+
+    if (res != KVS_ERRNO_NONE && pxTcp != NULL)
+    {
+        if (pxTcp->xSockFd >= 0)
+        {
+            close(pxTcp->xSockFd);
+        }
+        kvsFree(pxTcp);
+    }
+
+    return res;
+}
+
+static int prvTcpSend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend)
+{
+    NetIoVec_t xVec = {pBuffer, uBytesToSend};
+
+    return NetIo_socketSendv(((NetIoTcp_t *)pCtx)->xSockFd, &xVec, 1);
+}
+
+static int prvTcpSendv(void *pCtx, const NetIoVec_t *pxVecs, size_t uVecCnt)
+{
+    return NetIo_socketSendv(((NetIoTcp_t *)pCtx)->xSockFd, pxVecs, uVecCnt);
+}
+
+static int prvTcpRecv(void *pCtx, unsigned char *pBuffer, size_t uBufferSize, size_t *puBytesReceived)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoTcp_t *pxTcp = (NetIoTcp_t *)pCtx;
+    ssize_t n = 0;
+
+    do
+    {
+        n = recv(pxTcp->xSockFd, pBuffer, uBufferSize, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0)
+    {
+        *puBytesReceived = (size_t)n;
+    }
+    else if (n == 0)
+    {
+        res = KVS_ERROR_NETIO_CONNECTION_CLOSED;
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        res = pxTcp->bNonBlocking ? KVS_ERROR_NETIO_WOULD_BLOCK : KVS_ERROR_NETIO_RECV_TIMEOUT;
+    }
+    else
+    {
+        res = KVS_ERROR_NETIO_RECV_FAILED;
+        LogError("Socket recv error (errno:%d)", errno);
+    }
+
+    return res;
+}
+
+static int prvTcpTrySend(void *pCtx, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent)
+{
+    return NetIo_socketTrySend(((NetIoTcp_t *)pCtx)->xSockFd, pBuffer, uBytesToSend, puBytesSent);
+}
+
+static bool prvTcpPoll(void *pCtx, uint32_t uTimeoutMs)
+{
+    return NetIo_socketPoll(((NetIoTcp_t *)pCtx)->xSockFd, uTimeoutMs);
+}
+
+static void prvTcpClose(void *pCtx)
+{
+    NetIoTcp_t *pxTcp = (NetIoTcp_t *)pCtx;
+
+    close(pxTcp->xSockFd);
+    kvsFree(pxTcp);
+}
+
+static int prvTcpGetSocket(void *pCtx)
+{
+    return ((NetIoTcp_t *)pCtx)->xSockFd;
+}
+
+const NetIoTransport_t *NetIoTransport_getTcp(void)
+{
+    static const NetIoTransport_t xTransport = {
+        "TCP",
+        prvTcpConnect,
+        prvTcpSend,
+        prvTcpSendv,
+        prvTcpRecv,
+        prvTcpPoll,
+        prvTcpClose,
+        prvTcpGetSocket,
+        prvTcpUpdateOptions,
+        NULL,
+        NULL,
+        prvTcpTrySend
+    };
+
+    return &xTransport;
+}
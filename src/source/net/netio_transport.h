@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef NETIO_TRANSPORT_H
+#define NETIO_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The transports, their options and operations are public, so apps can set their own. The helpers of the transports in
+ * this tree are declared here. */
+#include "kvs/netio_transport.h"
+#include "net/netio.h"
+
+/**
+ * @brief Create a network I/O handle of a connection which is already made, like the server end of a memory pipe
+ *
+ * @param[in] pxTransport The transport of the connection
+ * @param[in] pCtx The connection, which is closed by NetIo_disconnect() or NetIo_terminate()
+ * @return The network I/O handle, or NULL if it fails. The connection is closed in that case.
+ */
+NetIoHandle NetIo_createConnected(const NetIoTransport_t *pxTransport, void *pCtx);
+
+/**
+ * @brief Write buffers to a socket until all of them are written. It's shared by the transports whose records are
+ * made by the kernel.
+ *
+ * @param[in] xSockFd The socket
+ * @param[in] pxVecs The data buffers
+ * @param[in] uVecCnt The number of data buffers
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_socketSendv(int xSockFd, const NetIoVec_t *pxVecs, size_t uVecCnt);
+
+/**
+ * @brief Write a buffer to a socket without waiting. It's the trySend of the transports whose records are made by the
+ * kernel.
+ *
+ * @param[in] xSockFd The socket, which is non-blocking
+ * @param[in] pBuffer The data buffer
+ * @param[in] uBytesToSend The length of data
+ * @param[out] puBytesSent The bytes written, or 0 if the socket is full
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_socketTrySend(int xSockFd, const unsigned char *pBuffer, size_t uBytesToSend, size_t *puBytesSent);
+
+/**
+ * @brief Wait until a socket is readable
+ *
+ * @param[in] xSockFd The socket
+ * @param[in] uTimeoutMs The longest time to wait, or 0 to check without waiting
+ * @return true if it's readable, false otherwise
+ */
+bool NetIo_socketPoll(int xSockFd, uint32_t uTimeoutMs);
+
+/**
+ * @brief Set the receive and send timeouts of a socket. A timeout of 0 waits forever.
+ *
+ * @param[in] xSockFd The socket
+ * @param[in] pxOptions The options which have the timeouts
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_socketSetTimeouts(int xSockFd, const NetIoOptions_t *pxOptions);
+
+/**
+ * @brief Set or clear O_NONBLOCK of a socket by the non-blocking option
+ *
+ * @param[in] xSockFd The socket
+ * @param[in] pxOptions The options which have the non-blocking mode
+ * @return 0 on success, non-zero value otherwise
+ */
+int NetIo_socketSetNonBlocking(int xSockFd, const NetIoOptions_t *pxOptions);
+
+#endif /* NETIO_TRANSPORT_H */
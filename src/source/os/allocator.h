@@ -16,6 +16,8 @@
 #ifndef ALLOCATOR_H
 #define ALLOCATOR_H
 
+#include <stddef.h>
+
 /**
  * KVS memory allocation.
  *
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+#include "os/atomic.h"
+#include "os/file_writer.h"
+
+/* The suffix of a temporary file is ".tmp.<pid>.<sequence>". */
+#define FILE_WRITER_TMP_SUFFIX_MAX (32)
+
+/* A temporary file left by a crashed process of the same pid is skipped, and the next sequence is tried. */
+#define FILE_WRITER_OPEN_RETRIES (4)
+
+static unsigned int uTmpSequence = 0;
+
+static void prvFileWriterFree(FileWriter_t *pxWriter)
+{
+    if (pxWriter->pcPath != NULL)
+    {
+        kvsFree(pxWriter->pcPath);
+        pxWriter->pcPath = NULL;
+    }
+    if (pxWriter->pcTmpPath != NULL)
+    {
+        kvsFree(pxWriter->pcTmpPath);
+        pxWriter->pcTmpPath = NULL;
+    }
+}
+
+int FileWriter_open(FileWriter_t *pxWriter, const char *pcPath)
+{
+    int res = KVS_ERRNO_FAIL;
+    size_t uPathLen = 0;
+    int xFd = -1;
+    int i = 0;
+
+    if (pxWriter == NULL || pcPath == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        memset(pxWriter, 0, sizeof(FileWriter_t));
+        uPathLen = strlen(pcPath);
+        if ((pxWriter->pcPath = (char *)kvsMalloc(uPathLen + 1)) == NULL ||
+            (pxWriter->pcTmpPath = (char *)kvsMalloc(uPathLen + FILE_WRITER_TMP_SUFFIX_MAX)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: pcTmpPath");
+        }
+        else
+        {
+            memcpy(pxWriter->pcPath, pcPath, uPathLen + 1);
+            for (i = 0; i < FILE_WRITER_OPEN_RETRIES && xFd < 0; i++)
+            {
+                snprintf(pxWriter->pcTmpPath, uPathLen + FILE_WRITER_TMP_SUFFIX_MAX, "%s.tmp.%ld.%u", pcPath, (long)getpid(), ATOMIC_FETCH_ADD(&uTmpSequence, 1));
+                if ((xFd = open(pxWriter->pcTmpPath, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR)) < 0 && errno != EEXIST)
+                {
+                    break;
+                }
+            }
+
+            if (xFd < 0)
+            {
+                LogError("Failed to create %s, errno:%d", pxWriter->pcTmpPath, errno);
+            }
+            else if ((pxWriter->fp = fdopen(xFd, "wb")) == NULL)
+            {
+                LogError("Failed to open %s, errno:%d", pxWriter->pcTmpPath, errno);
+                close(xFd);
+                unlink(pxWriter->pcTmpPath);
+            }
+            else
+            {
+                res = KVS_ERRNO_NONE;
+            }
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            prvFileWriterFree(pxWriter);
+        }
+    }
+
+    return res;
+}
+
+int FileWriter_commit(FileWriter_t *pxWriter)
+{
+    int res = KVS_ERRNO_FAIL;
+
+    if (pxWriter == NULL || pxWriter->fp == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        if (fflush(pxWriter->fp) != 0 || fsync(fileno(pxWriter->fp)) != 0)
+        {
+            LogError("Failed to flush %s, errno:%d", pxWriter->pcTmpPath, errno);
+            fclose(pxWriter->fp);
+        }
+        else if (fclose(pxWriter->fp) != 0)
+        {
+            LogError("Failed to close %s, errno:%d", pxWriter->pcTmpPath, errno);
+        }
+        else if (rename(pxWriter->pcTmpPath, pxWriter->pcPath) != 0)
+        {
+            LogError("Failed to rename %s to %s, errno:%d", pxWriter->pcTmpPath, pxWriter->pcPath, errno);
+        }
+        else
+        {
+            res = KVS_ERRNO_NONE;
+        }
+        pxWriter->fp = NULL;
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            unlink(pxWriter->pcTmpPath);
+        }
+        prvFileWriterFree(pxWriter);
+    }
+
+    return res;
+}
+
+void FileWriter_abort(FileWriter_t *pxWriter)
+{
+    if (pxWriter != NULL && pxWriter->fp != NULL)
+    {
+        fclose(pxWriter->fp);
+        pxWriter->fp = NULL;
+        unlink(pxWriter->pcTmpPath);
+        prvFileWriterFree(pxWriter);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <stdio.h>
+
+/* A file which is written to a temporary file next to it, and replaces it only when it's complete. A reader sees the
+ * previous content or the new one, but never a partial write, even if the device loses power in the middle. */
+typedef struct FileWriter
+{
+    FILE *fp;
+    char *pcPath;
+    char *pcTmpPath;
+} FileWriter_t;
+
+/**
+ * @brief Create the temporary file. It's only readable and writable by the owner, since it may hold secrets.
+ *
+ * @param[out] pxWriter The writer, whose fp is written by the caller
+ * @param[in] pcPath The path of the file to replace
+ * @return 0 on success, non-zero value otherwise
+ */
+int FileWriter_open(FileWriter_t *pxWriter, const char *pcPath);
+
+/**
+ * @brief Flush the temporary file to the storage, and rename it to the path of the file. The writer is closed even if it
+ * fails, and the temporary file is removed then.
+ *
+ * @param[in] pxWriter The writer
+ * @return 0 on success, non-zero value otherwise
+ */
+int FileWriter_commit(FileWriter_t *pxWriter);
+
+/**
+ * @brief Close the writer and remove the temporary file. The file at the path is kept as it was.
+ *
+ * @param[in] pxWriter The writer
+ */
+void FileWriter_abort(FileWriter_t *pxWriter);
+
+#endif /* FILE_WRITER_H */
@@ -78,6 +78,38 @@ static int parseIoTCredential(const char *pcJsonSrc, size_t uJsonSrcLen, IotCred
     return res;
 }
 
+static int prvConnectCredentialHost(NetIoHandle xNetIoHandle, void *pConnectArg)
+{
+    int res = KVS_ERRNO_NONE;
+    IotCredentialRequest_t *pReq = (IotCredentialRequest_t *)pConnectArg;
+
+    if ((res = NetIo_setTlsSessionCache(xNetIoHandle, pReq->xTlsSessionCache)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to set TLS session cache");
+        /* Propagate the res error */
+    }
+    else if ((res = NetIo_setTlsContext(xNetIoHandle, pReq->xTlsContext)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to set TLS context");
+        /* Propagate the res error */
+    }
+    else if ((res = NetIo_setMaxFragmentLen(xNetIoHandle, pReq->uTlsMaxFragmentLen)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to set TLS max fragment length");
+        /* Propagate the res error */
+    }
+    else if ((res = NetIo_connectWithX509(xNetIoHandle, pReq->pCredentialHost, "443", pReq->pRootCA, pReq->pCertificate, pReq->pPrivateKey)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
 IotCredentialToken_t *Iot_getCredential(IotCredentialRequest_t *pReq)
 {
     int res = KVS_ERRNO_NONE;
@@ -90,8 +122,6 @@ IotCredentialToken_t *Iot_getCredential(IotCredentialRequest_t *pReq)
     char *pRspBody = NULL;
     size_t uRspBodyLen = 0;
 
-    NetIoHandle xNetIoHandle = NULL;
-
     if (pReq == NULL || pReq->pCredentialHost == NULL || pReq->pRoleAlias == NULL || pReq->pThingName == NULL || pReq->pRootCA == NULL || pReq->pCertificate == NULL ||
         pReq->pPrivateKey == NULL)
     {
@@ -111,24 +141,10 @@ IotCredentialToken_t *Iot_getCredential(IotCredentialRequest_t *pReq)
         res = KVS_ERROR_FAIL_TO_GENERATE_HTTP_HEADERS;
         LogError("Failed to generate HTTP headers");
     }
-    else if ((xNetIoHandle = NetIo_create()) == NULL)
-    {
-        res = KVS_ERROR_FAIL_TO_CREATE_NETIO_HANDLE;
-        LogError("Failed to create netio handle");
-    }
-    else if ((res = NetIo_connectWithX509(xNetIoHandle, pReq->pCredentialHost, "443", pReq->pRootCA, pReq->pCertificate, pReq->pPrivateKey)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed to connect to %s\r\n", pReq->pCredentialHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_executeHttpReq(xNetIoHandle, HTTP_METHOD_GET, STRING_c_str(xStUri), xHttpReqHeaders, HTTP_BODY_EMPTY)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed send http request to %s", pReq->pCredentialHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_recvHttpRsp(xNetIoHandle, &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
+    else if ((res = Http_executeControlPlaneReq(pReq->xControlPlaneClient, pReq->pCredentialHost, prvConnectCredentialHost, pReq, HTTP_METHOD_GET, STRING_c_str(xStUri),
+                                                xHttpReqHeaders, HTTP_BODY_EMPTY, &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
     {
-        LogError("Failed recv http response from %s", pReq->pCredentialHost);
+        LogError("Failed to request %s", pReq->pCredentialHost);
         /* Propagate the res error */
     }
     else
@@ -168,8 +184,6 @@ IotCredentialToken_t *Iot_getCredential(IotCredentialRequest_t *pReq)
         kvsFree(pRspBody);
     }
 
-    NetIo_disconnect(xNetIoHandle);
-    NetIo_terminate(xNetIoHandle);
     HTTPHeaders_Free(xHttpReqHeaders);
     STRING_delete(xStUri);
 
@@ -51,6 +51,9 @@
 
 #define DEFAULT_RECV_BUFSIZE (1024)
 
+/* The maximum number of data buffers in one HTTP chunk, which are the MKV header and the frame data. */
+#define PUT_MEDIA_CHUNK_DATA_VEC_MAX (2)
+
 #define PORT_HTTPS "443"
 
 /*-----------------------------------------------------------*/
@@ -85,6 +88,22 @@ typedef struct PutMedia
 
     NetIoHandle xNetIoHandle;
     DLIST_ENTRY xPendingFragmentAcks;
+
+    /* The newest fragment timecode with a persisted ACK. It's kept even after the ACK is read or flushed. */
+    bool bHasPersistedFragment;
+    uint64_t uPersistedFragmentTimecode;
+
+    /* Consecutive frames are copied into pCoalesceBuf and sent as one chunk when it's full or uCoalesceDelayMs after
+     * uCoalesceStartMs. */
+    size_t uCoalesceSize;
+    unsigned int uCoalesceDelayMs;
+    uint8_t *pCoalesceBuf;
+    size_t uCoalesceBufSize;
+    size_t uCoalesceLen;
+    uint64_t uCoalesceStartMs;
+
+    /* The largest data sent in one TLS record, or 0 if the connection doesn't send records */
+    size_t uRecordLen;
 } PutMedia_t;
 
 #define JSON_KEY_EVENT_TYPE "EventType"
@@ -621,6 +640,45 @@ static int prvPushFragmentAck(PutMedia_t *pPutMedia, FragmentAck_t *pFragmentAck
     return res;
 }
 
+static size_t prvHexDigits(size_t uValue)
+{
+    size_t uDigits = 1;
+
+    while (uValue >= 16)
+    {
+        uValue /= 16;
+        uDigits++;
+    }
+
+    return uDigits;
+}
+
+/* A chunk is sent as its size in hex and CRLF, the data, and CRLF. The coalesced chunk size is shrunk so a full chunk
+ * fills whole records, and a size smaller than one record is kept. */
+static size_t prvAlignChunkSize(size_t uChunkSize, size_t uRecordLen)
+{
+    size_t uAligned = uChunkSize;
+    size_t uWireLen = 0;
+    size_t uDigits = 0;
+
+    if (uChunkSize > 0 && uRecordLen > 0 && (uWireLen = prvHexDigits(uChunkSize) + uChunkSize + 4) >= uRecordLen)
+    {
+        uWireLen -= uWireLen % uRecordLen;
+
+        /* The size line may get shorter with the data, so it's tried from the longest one. */
+        for (uDigits = prvHexDigits(uChunkSize); uDigits > 0; uDigits--)
+        {
+            if (uWireLen > uDigits + 4 && prvHexDigits(uWireLen - uDigits - 4) == uDigits)
+            {
+                uAligned = uWireLen - uDigits - 4;
+                break;
+            }
+        }
+    }
+
+    return uAligned;
+}
+
 static PutMedia_t *prvCreateDefaultPutMediaHandle()
 {
     int res = KVS_ERRNO_NONE;
@@ -692,6 +750,25 @@ static void prvFlushFragmentAck(PutMedia_t *pPutMedia)
     }
 }
 
+static int prvConnectControlPlane(NetIoHandle xNetIoHandle, void *pConnectArg)
+{
+    int res = KVS_ERRNO_NONE;
+    KvsServiceParameter_t *pServPara = (KvsServiceParameter_t *)pConnectArg;
+
+    if ((res = NetIo_setTransport(xNetIoHandle, pServPara->pxNetIoTransport)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setRecvTimeout(xNetIoHandle, pServPara->uRecvTimeoutMs)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setSendTimeout(xNetIoHandle, pServPara->uSendTimeoutMs)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setTlsSessionCache(xNetIoHandle, pServPara->xTlsSessionCache)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setTlsContext(xNetIoHandle, pServPara->xTlsContext)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setMaxFragmentLen(xNetIoHandle, pServPara->uTlsMaxFragmentLen)) != KVS_ERRNO_NONE ||
+        (res = NetIo_connect(xNetIoHandle, pServPara->pcHost, PORT_HTTPS)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+
+    return res;
+}
+
 int Kvs_describeStream(KvsServiceParameter_t *pServPara, KvsDescribeStreamParameter_t *pDescPara, unsigned int *puHttpStatusCode)
 {
     int res = KVS_ERRNO_NONE;
@@ -707,8 +784,6 @@ int Kvs_describeStream(KvsServiceParameter_t *pServPara, KvsDescribeStreamParame
     char *pRspBody = NULL;
     size_t uRspBodyLen = 0;
 
-    NetIoHandle xNetIoHandle = NULL;
-
     if (puHttpStatusCode != NULL)
     {
         *puHttpStatusCode = 0; /* Set to zero to avoid misuse from the previous value. */
@@ -756,27 +831,10 @@ int Kvs_describeStream(KvsServiceParameter_t *pServPara, KvsDescribeStreamParame
             res = KVS_ERROR_FAIL_TO_SIGN_HTTP_REQ;
             LogError("Failed to sign");
         }
-        else if ((xNetIoHandle = NetIo_create()) == NULL)
+        else if ((res = Http_executeControlPlaneReq(pServPara->xControlPlaneClient, pServPara->pcHost, prvConnectControlPlane, pServPara, HTTP_METHOD_POST, KVS_URI_DESCRIBE_STREAM, xHttpReqHeaders,
+                                                       STRING_c_str(xStHttpBody), &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
         {
-            res = KVS_ERROR_FAIL_TO_CREATE_NETIO_HANDLE;
-            LogError("Failed to create NetIo handle");
-        }
-        else if (
-            (res = NetIo_setRecvTimeout(xNetIoHandle, pServPara->uRecvTimeoutMs)) != KVS_ERRNO_NONE ||
-            (res = NetIo_setSendTimeout(xNetIoHandle, pServPara->uSendTimeoutMs)) != KVS_ERRNO_NONE ||
-            (res = NetIo_connect(xNetIoHandle, pServPara->pcHost, PORT_HTTPS)) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed to connect to %s", pServPara->pcHost);
-            /* Propagate the res error */
-        }
-        else if ((res = Http_executeHttpReq(xNetIoHandle, HTTP_METHOD_POST, KVS_URI_DESCRIBE_STREAM, xHttpReqHeaders, STRING_c_str(xStHttpBody))) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed send http request to %s", pServPara->pcHost);
-            /* Propagate the res error */
-        }
-        else if ((res = Http_recvHttpRsp(xNetIoHandle, &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
-        {
-            LogError("Failed recv http response from %s", pServPara->pcHost);
+            LogError("Failed to request %s", pServPara->pcHost);
             /* Propagate the res error */
         }
         else
@@ -793,8 +851,6 @@ int Kvs_describeStream(KvsServiceParameter_t *pServPara, KvsDescribeStreamParame
             }
         }
 
-        NetIo_disconnect(xNetIoHandle);
-        NetIo_terminate(xNetIoHandle);
         SAFE_FREE(pRspBody);
         HTTPHeaders_Free(xHttpReqHeaders);
         AwsSigV4_Terminate(xAwsSigV4Handle);
@@ -819,8 +875,6 @@ int Kvs_createStream(KvsServiceParameter_t *pServPara, KvsCreateStreamParameter_
     char *pRspBody = NULL;
     size_t uRspBodyLen = 0;
 
-    NetIoHandle xNetIoHandle = NULL;
-
     if (puHttpStatusCode != NULL)
     {
         *puHttpStatusCode = 0; /* Set to zero to avoid misuse from previous value. */
@@ -864,27 +918,10 @@ int Kvs_createStream(KvsServiceParameter_t *pServPara, KvsCreateStreamParameter_
         LogError("Failed to sign");
         res = KVS_ERROR_FAIL_TO_SIGN_HTTP_REQ;
     }
-    else if ((xNetIoHandle = NetIo_create()) == NULL)
-    {
-        res = KVS_ERROR_FAIL_TO_CREATE_NETIO_HANDLE;
-        LogError("Failed to create NetIo handle");
-    }
-    else if (
-        (res = NetIo_setRecvTimeout(xNetIoHandle, pServPara->uRecvTimeoutMs)) != KVS_ERRNO_NONE ||
-        (res = NetIo_setSendTimeout(xNetIoHandle, pServPara->uSendTimeoutMs)) != KVS_ERRNO_NONE ||
-        (res = NetIo_connect(xNetIoHandle, pServPara->pcHost, PORT_HTTPS)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed to connect to %s", pServPara->pcHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_executeHttpReq(xNetIoHandle, HTTP_METHOD_POST, KVS_URI_CREATE_STREAM, xHttpReqHeaders, STRING_c_str(xStHttpBody))) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed send http request to %s", pServPara->pcHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_recvHttpRsp(xNetIoHandle, &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
+    else if ((res = Http_executeControlPlaneReq(pServPara->xControlPlaneClient, pServPara->pcHost, prvConnectControlPlane, pServPara, HTTP_METHOD_POST, KVS_URI_CREATE_STREAM, xHttpReqHeaders,
+                                                   STRING_c_str(xStHttpBody), &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
     {
-        LogError("Failed recv http response from %s", pServPara->pcHost);
+        LogError("Failed to request %s", pServPara->pcHost);
         /* Propagate the res error */
     }
     else
@@ -901,8 +938,6 @@ int Kvs_createStream(KvsServiceParameter_t *pServPara, KvsCreateStreamParameter_
         }
     }
 
-    NetIo_disconnect(xNetIoHandle);
-    NetIo_terminate(xNetIoHandle);
     SAFE_FREE(pRspBody);
     HTTPHeaders_Free(xHttpReqHeaders);
     AwsSigV4_Terminate(xAwsSigV4Handle);
@@ -927,8 +962,6 @@ int Kvs_getDataEndpoint(KvsServiceParameter_t *pServPara, KvsGetDataEndpointPara
     char *pRspBody = NULL;
     size_t uRspBodyLen = 0;
 
-    NetIoHandle xNetIoHandle = NULL;
-
     if (puHttpStatusCode != NULL)
     {
         *puHttpStatusCode = 0; /* Set to zero to avoid misuse from previous value. */
@@ -972,27 +1005,10 @@ int Kvs_getDataEndpoint(KvsServiceParameter_t *pServPara, KvsGetDataEndpointPara
         res = KVS_ERROR_FAIL_TO_SIGN_HTTP_REQ;
         LogError("Failed to sign");
     }
-    else if ((xNetIoHandle = NetIo_create()) == NULL)
+    else if ((res = Http_executeControlPlaneReq(pServPara->xControlPlaneClient, pServPara->pcHost, prvConnectControlPlane, pServPara, HTTP_METHOD_POST, KVS_URI_GET_DATA_ENDPOINT, xHttpReqHeaders,
+                                                   STRING_c_str(xStHttpBody), &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
     {
-        res = KVS_ERROR_FAIL_TO_CREATE_NETIO_HANDLE;
-        LogError("Failed to create NetIo handle");
-    }
-    else if (
-        (res = NetIo_setRecvTimeout(xNetIoHandle, pServPara->uRecvTimeoutMs)) != KVS_ERRNO_NONE ||
-        (res = NetIo_setSendTimeout(xNetIoHandle, pServPara->uSendTimeoutMs)) != KVS_ERRNO_NONE ||
-        (res = NetIo_connect(xNetIoHandle, pServPara->pcHost, PORT_HTTPS)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed to connect to %s", pServPara->pcHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_executeHttpReq(xNetIoHandle, HTTP_METHOD_POST, KVS_URI_GET_DATA_ENDPOINT, xHttpReqHeaders, STRING_c_str(xStHttpBody))) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed send http request to %s", pServPara->pcHost);
-        /* Propagate the res error */
-    }
-    else if ((res = Http_recvHttpRsp(xNetIoHandle, &uHttpStatusCode, &pRspBody, &uRspBodyLen)) != KVS_ERRNO_NONE)
-    {
-        LogError("Failed recv http response from %s", pServPara->pcHost);
+        LogError("Failed to request %s", pServPara->pcHost);
         /* Propagate the res error */
     }
     else
@@ -1017,8 +1033,6 @@ int Kvs_getDataEndpoint(KvsServiceParameter_t *pServPara, KvsGetDataEndpointPara
         }
     }
 
-    NetIo_disconnect(xNetIoHandle);
-    NetIo_terminate(xNetIoHandle);
     SAFE_FREE(pRspBody);
     HTTPHeaders_Free(xHttpReqHeaders);
     AwsSigV4_Terminate(xAwsSigV4Handle);
@@ -1105,8 +1119,13 @@ int Kvs_putMediaStart(KvsServiceParameter_t *pServPara, KvsPutMediaParameter_t *
         LogError("Failed to create NetIo handle");
     }
     else if (
+        (res = NetIo_setTransport(xNetIoHandle, pServPara->pxNetIoTransport)) != KVS_ERRNO_NONE ||
         (res = NetIo_setRecvTimeout(xNetIoHandle, pServPara->uRecvTimeoutMs)) != KVS_ERRNO_NONE ||
         (res = NetIo_setSendTimeout(xNetIoHandle, pServPara->uSendTimeoutMs)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setTlsSessionCache(xNetIoHandle, pServPara->xTlsSessionCache)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setTlsContext(xNetIoHandle, pServPara->xTlsContext)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setMaxFragmentLen(xNetIoHandle, pServPara->uTlsMaxFragmentLen)) != KVS_ERRNO_NONE ||
+        (res = NetIo_setKtls(xNetIoHandle, pPutMediaPara->bKtls)) != KVS_ERRNO_NONE ||
         (res = NetIo_connect(xNetIoHandle, pServPara->pcPutMediaEndpoint, PORT_HTTPS)) != KVS_ERRNO_NONE)
     {
         LogError("Failed to connect to %s", pServPara->pcPutMediaEndpoint);
@@ -1146,8 +1165,15 @@ int Kvs_putMediaStart(KvsServiceParameter_t *pServPara, KvsPutMediaParameter_t *
                 /* Change network I/O receiving timeout for streaming purpose. */
                 NetIo_setRecvTimeout(xNetIoHandle, pPutMediaPara->uRecvTimeoutMs);
                 NetIo_setSendTimeout(xNetIoHandle, pPutMediaPara->uSendTimeoutMs);
+                if (pPutMediaPara->bNonBlocking && NetIo_setNonBlocking(xNetIoHandle, true) != KVS_ERRNO_NONE)
+                {
+                    LogInfo("Failed to set non-blocking mode, PUT MEDIA sends in blocking mode");
+                }
 
                 pPutMedia->xNetIoHandle = xNetIoHandle;
+                pPutMedia->uRecordLen = NetIo_getSendRecordLen(xNetIoHandle);
+                pPutMedia->uCoalesceSize = prvAlignChunkSize(pPutMediaPara->uCoalesceSize, pPutMedia->uRecordLen);
+                pPutMedia->uCoalesceDelayMs = pPutMediaPara->uCoalesceDelayMs;
                 *pPutMediaHandle = pPutMedia;
                 bKeepNetIo = true;
             }
@@ -1171,27 +1197,31 @@ int Kvs_putMediaStart(KvsServiceParameter_t *pServPara, KvsPutMediaParameter_t *
 static int g_mkvDumpCounter = 0;
 #endif
 
-int Kvs_putMediaUpdate(PutMediaHandle xPutMediaHandle, uint8_t *pMkvHeader, size_t uMkvHeaderLen, uint8_t *pData, size_t uDataLen)
+/* Send the buffers as one HTTP chunk. */
+static int prvSendChunk(PutMedia_t *pPutMedia, const NetIoVec_t *pxData, size_t uDataCnt)
 {
     int res = KVS_ERRNO_NONE;
-    PutMedia_t *pPutMedia = xPutMediaHandle;
     int xChunkedHeaderLen = 0;
     char pcChunkedHeader[sizeof(size_t) * 2 + 3];
     const char *pcChunkedEnd = "\r\n";
+    NetIoVec_t xVecs[PUT_MEDIA_CHUNK_DATA_VEC_MAX + 2];
+    size_t uChunkLen = 0;
+    size_t i = 0;
 
-    if (pData == NULL)
-    {
-        uDataLen = 0;
-    }
-
-    if (pPutMedia == NULL || pMkvHeader == NULL || uMkvHeaderLen == 0)
+    if (uDataCnt > PUT_MEDIA_CHUNK_DATA_VEC_MAX)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
         LogError("Invalid argument");
     }
     else
     {
-        xChunkedHeaderLen = snprintf(pcChunkedHeader, sizeof(pcChunkedHeader), "%lx\r\n", (unsigned long)(uMkvHeaderLen + uDataLen));
+        for (i = 0; i < uDataCnt; i++)
+        {
+            xVecs[i + 1] = pxData[i];
+            uChunkLen += pxData[i].uLen;
+        }
+
+        xChunkedHeaderLen = snprintf(pcChunkedHeader, sizeof(pcChunkedHeader), "%lx\r\n", (unsigned long)uChunkLen);
         if (xChunkedHeaderLen <= 0)
         {
             res = KVS_ERROR_C_UTIL_STRING_ERROR;
@@ -1199,38 +1229,267 @@ int Kvs_putMediaUpdate(PutMediaHandle xPutMediaHandle, uint8_t *pMkvHeader, size
         }
         else
         {
-            if ((res = NetIo_send(pPutMedia->xNetIoHandle, (const unsigned char *)pcChunkedHeader, (size_t)xChunkedHeaderLen)) != KVS_ERRNO_NONE ||
-                (res = NetIo_send(pPutMedia->xNetIoHandle, pMkvHeader, uMkvHeaderLen)) != KVS_ERRNO_NONE ||
-                (pData != NULL && uDataLen > 0 && (res = NetIo_send(pPutMedia->xNetIoHandle, pData, uDataLen)) != KVS_ERRNO_NONE) ||
-                (res = NetIo_send(pPutMedia->xNetIoHandle, (const unsigned char *)pcChunkedEnd, strlen(pcChunkedEnd))) != KVS_ERRNO_NONE)
+            /* The chunk is sent in one call, so it's packed into as few TLS records as possible. */
+            xVecs[0].pBuffer = (const unsigned char *)pcChunkedHeader;
+            xVecs[0].uLen = (size_t)xChunkedHeaderLen;
+            xVecs[uDataCnt + 1].pBuffer = (const unsigned char *)pcChunkedEnd;
+            xVecs[uDataCnt + 1].uLen = strlen(pcChunkedEnd);
+
+            if ((res = NetIo_sendv(pPutMedia->xNetIoHandle, xVecs, uDataCnt + 2)) != KVS_ERRNO_NONE)
             {
                 LogError("Failed to send data frame");
                 /* Propagate the res error */
             }
-            else
+        }
+    }
+
+    return res;
+}
+
+/* Send the coalesced frames as one chunk. They are dropped on failure, because the connection can't be used anymore. */
+static int prvCoalesceFlush(PutMedia_t *pPutMedia)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoVec_t xVec;
+
+    if (pPutMedia->uCoalesceLen > 0)
+    {
+        xVec.pBuffer = pPutMedia->pCoalesceBuf;
+        xVec.uLen = pPutMedia->uCoalesceLen;
+        res = prvSendChunk(pPutMedia, &xVec, 1);
+        pPutMedia->uCoalesceLen = 0;
+    }
+
+    return res;
+}
+
+/* Copy a frame into the coalescing buffer. The caller makes sure it fits in uCoalesceSize. */
+static int prvCoalesceAppend(PutMedia_t *pPutMedia, const NetIoVec_t *pxFrame, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    uint8_t *pCoalesceBuf = NULL;
+    size_t i = 0;
+
+    if (pPutMedia->uCoalesceBufSize < pPutMedia->uCoalesceSize)
+    {
+        if ((pCoalesceBuf = (uint8_t *)kvsRealloc(pPutMedia->pCoalesceBuf, pPutMedia->uCoalesceSize)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: pCoalesceBuf");
+        }
+        else
+        {
+            pPutMedia->pCoalesceBuf = pCoalesceBuf;
+            pPutMedia->uCoalesceBufSize = pPutMedia->uCoalesceSize;
+        }
+    }
+
+    if (res == KVS_ERRNO_NONE)
+    {
+        if (pPutMedia->uCoalesceLen == 0)
+        {
+            pPutMedia->uCoalesceStartMs = getEpochTimestampInMs();
+        }
+
+        for (i = 0; i < uVecCnt; i++)
+        {
+            if (pxFrame[i].pBuffer != NULL && pxFrame[i].uLen > 0)
             {
-                /* nop */
+                memcpy(pPutMedia->pCoalesceBuf + pPutMedia->uCoalesceLen, pxFrame[i].pBuffer, pxFrame[i].uLen);
+                pPutMedia->uCoalesceLen += pxFrame[i].uLen;
+            }
+        }
+    }
 
-#ifdef ENABLE_MKV_DUMP
-                char filename[256];
-                snprintf(filename, sizeof(filename), "dumped_output.mkv");
+    return res;
+}
 
-                // Open in append mode
-                FILE *fpMkvDump = fopen(filename, "ab");
-                if (!fpMkvDump) {
-                    printf("Failed to open MKV dump file.\n");
-                } else {
-                    if (pMkvHeader && uMkvHeaderLen > 0) {
-                        fwrite(pMkvHeader, 1, uMkvHeaderLen, fpMkvDump);
-                    }
-                    if (pData && uDataLen > 0) {
-                        fwrite(pData, 1, uDataLen, fpMkvDump);
-                    }
-                    fclose(fpMkvDump);
-                    printf("MKV data dumped to %s\n", filename);
+static bool prvIsCoalesceExpired(PutMedia_t *pPutMedia)
+{
+    return pPutMedia->uCoalesceLen > 0 && getEpochTimestampInMs() - pPutMedia->uCoalesceStartMs >= pPutMedia->uCoalesceDelayMs;
+}
+
+/* Take the next uLen bytes of a frame from the cursor of *puVecIdx and *puVecOffset. They are returned in pxPart as
+ * buffers pointing into the frame, and the number of buffers is returned. */
+static size_t prvFrameTake(const NetIoVec_t *pxFrame, size_t uVecCnt, size_t *puVecIdx, size_t *puVecOffset, size_t uLen, NetIoVec_t *pxPart)
+{
+    size_t uPartCnt = 0;
+    size_t uTakeLen = 0;
+
+    while (uLen > 0 && *puVecIdx < uVecCnt)
+    {
+        uTakeLen = pxFrame[*puVecIdx].uLen - *puVecOffset;
+        if (uTakeLen > uLen)
+        {
+            uTakeLen = uLen;
+        }
+
+        if (uTakeLen > 0)
+        {
+            pxPart[uPartCnt].pBuffer = pxFrame[*puVecIdx].pBuffer + *puVecOffset;
+            pxPart[uPartCnt].uLen = uTakeLen;
+            uPartCnt++;
+            *puVecOffset += uTakeLen;
+            uLen -= uTakeLen;
+        }
+
+        if (*puVecOffset == pxFrame[*puVecIdx].uLen)
+        {
+            (*puVecIdx)++;
+            *puVecOffset = 0;
+        }
+    }
+
+    return uPartCnt;
+}
+
+/* Coalesce a frame into chunks of exactly uCoalesceSize, which fill whole records. The frame is cut where a chunk is
+ * full, and the rest of it starts the next chunk. A full chunk taken from the frame alone is sent without copying. */
+static int prvSendFrameAligned(PutMedia_t *pPutMedia, const NetIoVec_t *pxFrame, size_t uVecCnt, size_t uFrameLen)
+{
+    int res = KVS_ERRNO_NONE;
+    NetIoVec_t xPart[PUT_MEDIA_CHUNK_DATA_VEC_MAX];
+    size_t uPartCnt = 0;
+    size_t uPartLen = 0;
+    size_t uVecIdx = 0;
+    size_t uVecOffset = 0;
+
+    if (uVecCnt > PUT_MEDIA_CHUNK_DATA_VEC_MAX)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+
+    while (res == KVS_ERRNO_NONE && uFrameLen > 0)
+    {
+        uPartLen = pPutMedia->uCoalesceSize - pPutMedia->uCoalesceLen;
+        if (uPartLen > uFrameLen)
+        {
+            uPartLen = uFrameLen;
+        }
+        uPartCnt = prvFrameTake(pxFrame, uVecCnt, &uVecIdx, &uVecOffset, uPartLen, xPart);
+        uFrameLen -= uPartLen;
+
+        if (uPartLen == pPutMedia->uCoalesceSize)
+        {
+            res = prvSendChunk(pPutMedia, xPart, uPartCnt);
+        }
+        else if ((res = prvCoalesceAppend(pPutMedia, xPart, uPartCnt)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+        }
+        else if (pPutMedia->uCoalesceLen == pPutMedia->uCoalesceSize)
+        {
+            res = prvCoalesceFlush(pPutMedia);
+        }
+        else
+        {
+            /* nop */
+        }
+    }
+
+    if (res == KVS_ERRNO_NONE && prvIsCoalesceExpired(pPutMedia))
+    {
+        res = prvCoalesceFlush(pPutMedia);
+    }
+
+    return res;
+}
+
+/* Send a frame in its own chunk, or coalesce it with the frames after it. Frames are kept whole unless the connection
+ * sends records, whose chunks are aligned to them. */
+static int prvSendFrame(PutMedia_t *pPutMedia, const NetIoVec_t *pxFrame, size_t uVecCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    size_t uFrameLen = 0;
+    size_t i = 0;
+
+    for (i = 0; i < uVecCnt; i++)
+    {
+        uFrameLen += pxFrame[i].uLen;
+    }
+
+    if (pPutMedia->uRecordLen > 0 && pPutMedia->uCoalesceSize > 0)
+    {
+        res = prvSendFrameAligned(pPutMedia, pxFrame, uVecCnt, uFrameLen);
+    }
+    else if (pPutMedia->uCoalesceLen > 0 && pPutMedia->uCoalesceLen + uFrameLen > pPutMedia->uCoalesceSize &&
+        (res = prvCoalesceFlush(pPutMedia)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (uFrameLen >= pPutMedia->uCoalesceSize)
+    {
+        /* Nothing is coalesced here, and a frame which fills a chunk is sent without copying. */
+        res = prvSendChunk(pPutMedia, pxFrame, uVecCnt);
+    }
+    else if ((res = prvCoalesceAppend(pPutMedia, pxFrame, uVecCnt)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else if (pPutMedia->uCoalesceLen == pPutMedia->uCoalesceSize || prvIsCoalesceExpired(pPutMedia))
+    {
+        res = prvCoalesceFlush(pPutMedia);
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
+int Kvs_putMediaUpdate(PutMediaHandle xPutMediaHandle, uint8_t *pMkvHeader, size_t uMkvHeaderLen, uint8_t *pData, size_t uDataLen)
+{
+    int res = KVS_ERRNO_NONE;
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+    NetIoVec_t xVecs[2];
+
+    if (pData == NULL)
+    {
+        uDataLen = 0;
+    }
+
+    if (pPutMedia == NULL || pMkvHeader == NULL || uMkvHeaderLen == 0)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else
+    {
+        xVecs[0].pBuffer = pMkvHeader;
+        xVecs[0].uLen = uMkvHeaderLen;
+        xVecs[1].pBuffer = pData;
+        xVecs[1].uLen = uDataLen;
+
+        if ((res = prvSendFrame(pPutMedia, xVecs, sizeof(xVecs) / sizeof(xVecs[0]))) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to send data frame");
+            /* Propagate the res error */
+        }
+        else
+        {
+            /* nop */
+
+#ifdef ENABLE_MKV_DUMP
+            char filename[256];
+            snprintf(filename, sizeof(filename), "dumped_output.mkv");
+
+            // Open in append mode
+            FILE *fpMkvDump = fopen(filename, "ab");
+            if (!fpMkvDump) {
+                printf("Failed to open MKV dump file.\n");
+            } else {
+                if (pMkvHeader && uMkvHeaderLen > 0) {
+                    fwrite(pMkvHeader, 1, uMkvHeaderLen, fpMkvDump);
                 }
-#endif
+                if (pData && uDataLen > 0) {
+                    fwrite(pData, 1, uDataLen, fpMkvDump);
+                }
+                fclose(fpMkvDump);
+                printf("MKV data dumped to %s\n", filename);
             }
+#endif
         }
     }
 
@@ -1241,9 +1500,7 @@ int Kvs_putMediaUpdateRaw(PutMediaHandle xPutMediaHandle, uint8_t *pBuf, size_t
 {
     int res = KVS_ERRNO_NONE;
     PutMedia_t *pPutMedia = xPutMediaHandle;
-    int xChunkedHeaderLen = 0;
-    char pcChunkedHeader[sizeof(size_t) * 2 + 3];
-    const char *pcChunkedEnd = "\r\n";
+    NetIoVec_t xVec;
 
     if (pPutMedia == NULL || pBuf == NULL || uLen == 0)
     {
@@ -1252,58 +1509,74 @@ int Kvs_putMediaUpdateRaw(PutMediaHandle xPutMediaHandle, uint8_t *pBuf, size_t
     }
     else
     {
-        xChunkedHeaderLen = snprintf(pcChunkedHeader, sizeof(pcChunkedHeader), "%lx\r\n", (unsigned long)uLen);
-        if (xChunkedHeaderLen <= 0)
+        xVec.pBuffer = pBuf;
+        xVec.uLen = uLen;
+
+        if ((res = prvCoalesceFlush(pPutMedia)) != KVS_ERRNO_NONE ||
+            (res = prvSendChunk(pPutMedia, &xVec, 1)) != KVS_ERRNO_NONE)
         {
-            res = KVS_ERROR_C_UTIL_STRING_ERROR;
-            LogError("Failed to init chunk size");
+            LogError("Failed to send data frame");
+            /* Propagate the res error */
         }
         else
         {
-            if ((res = NetIo_send(pPutMedia->xNetIoHandle, (const unsigned char *)pcChunkedHeader, (size_t)xChunkedHeaderLen)) != KVS_ERRNO_NONE ||
-                (res = NetIo_send(pPutMedia->xNetIoHandle, pBuf, uLen)) != KVS_ERRNO_NONE ||
-                (res = NetIo_send(pPutMedia->xNetIoHandle, (const unsigned char *)pcChunkedEnd, strlen(pcChunkedEnd))) != KVS_ERRNO_NONE)
-            {
-                LogError("Failed to send data frame");
-                /* Propagate the res error */
-            }
-            else
-            {
-                /* nop */
+            /* nop */
 
 #ifdef ENABLE_MKV_DUMP
-                char filename[256];
-                snprintf(filename, sizeof(filename), "dumped_output.mkv");
-
-                // Reset the file if it's the first frame
-                if (g_mkvDumpCounter == 0) {
-                    FILE *fpReset = fopen(filename, "wb");
-                    if (!fpReset) {
-                        printf("Failed to reset MKV dump file.\n");
-                    } else {
-                        printf("MKV dump file reset.\n");
-                        fclose(fpReset);
-                    }
-                }
-                g_mkvDumpCounter++;
-
-                // Open file in append mode for writing raw data
-                FILE *fpMkvDump = fopen(filename, "ab");
-                if (!fpMkvDump) {
-                    printf("Failed to open MKV dump file.\n");
+            char filename[256];
+            snprintf(filename, sizeof(filename), "dumped_output.mkv");
+
+            // Reset the file if it's the first frame
+            if (g_mkvDumpCounter == 0) {
+                FILE *fpReset = fopen(filename, "wb");
+                if (!fpReset) {
+                    printf("Failed to reset MKV dump file.\n");
                 } else {
-                    fwrite(pBuf, 1, uLen, fpMkvDump);
-                    fclose(fpMkvDump);
-                    printf("Raw MKV data dumped to dumped_output.mkv\n");
+                    printf("MKV dump file reset.\n");
+                    fclose(fpReset);
                 }
-#endif
             }
+            g_mkvDumpCounter++;
+
+            // Open file in append mode for writing raw data
+            FILE *fpMkvDump = fopen(filename, "ab");
+            if (!fpMkvDump) {
+                printf("Failed to open MKV dump file.\n");
+            } else {
+                fwrite(pBuf, 1, uLen, fpMkvDump);
+                fclose(fpMkvDump);
+                printf("Raw MKV data dumped to dumped_output.mkv\n");
+            }
+#endif
         }
     }
 
     return res;
 }
 
+int Kvs_putMediaFlush(PutMediaHandle xPutMediaHandle)
+{
+    int res = KVS_ERRNO_NONE;
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+
+    if (pPutMedia == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((res = prvCoalesceFlush(pPutMedia)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to send coalesced frames");
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
 int Kvs_putMediaDoWork(PutMediaHandle xPutMediaHandle)
 {
     int res = KVS_ERRNO_NONE;
@@ -1319,6 +1592,16 @@ int Kvs_putMediaDoWork(PutMediaHandle xPutMediaHandle)
         res = KVS_ERROR_INVALID_ARGUMENT;
         LogError("Invalid argument");
     }
+    else if ((res = NetIo_flush(pPutMedia->xNetIoHandle)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to send pending data");
+        /* Propagate the res error */
+    }
+    else if (prvIsCoalesceExpired(pPutMedia) && (res = prvCoalesceFlush(pPutMedia)) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to send coalesced frames");
+        /* Propagate the res error */
+    }
     else
     {
         if (NetIo_isDataAvailable(pPutMedia->xNetIoHandle))
@@ -1340,7 +1623,13 @@ int Kvs_putMediaDoWork(PutMediaHandle xPutMediaHandle)
                         break;
                     }
 
-                    if ((res = NetIo_recv(pPutMedia->xNetIoHandle, BUFFER_u_char(xBufRecv) + uBytesTotalReceived, BUFFER_length(xBufRecv) - uBytesTotalReceived, &uBytesReceived)) !=KVS_ERRNO_NONE)
+                    if ((res = NetIo_recv(pPutMedia->xNetIoHandle, BUFFER_u_char(xBufRecv) + uBytesTotalReceived, BUFFER_length(xBufRecv) - uBytesTotalReceived, &uBytesReceived)) == KVS_ERROR_NETIO_WOULD_BLOCK)
+                    {
+                        /* The rest of a TLS record is read next time in the non-blocking mode. */
+                        res = KVS_ERRNO_NONE;
+                        break;
+                    }
+                    else if (res != KVS_ERRNO_NONE)
                     {
                         LogError("Failed to receive");
                         /* Propagate the res error */
@@ -1365,6 +1654,12 @@ int Kvs_putMediaDoWork(PutMediaHandle xPutMediaHandle)
                         {
                             prvLogFragmentAck(&xFragmentAck);
                             prvPushFragmentAck(pPutMedia, &xFragmentAck);
+                            if (xFragmentAck.eventType == ePersisted &&
+                                (!pPutMedia->bHasPersistedFragment || xFragmentAck.uFragmentTimecode > pPutMedia->uPersistedFragmentTimecode))
+                            {
+                                pPutMedia->bHasPersistedFragment = true;
+                                pPutMedia->uPersistedFragmentTimecode = xFragmentAck.uFragmentTimecode;
+                            }
                             if (xFragmentAck.eventType == eError)
                             {
                                 res = KVS_GENERATE_PUTMEDIA_ERROR(xFragmentAck.uErrorId);
@@ -1394,9 +1689,27 @@ void Kvs_putMediaFinish(PutMediaHandle xPutMediaHandle)
         Lock_Deinit(pPutMedia->xLock);
         if (pPutMedia->xNetIoHandle != NULL)
         {
+            /* It sends the data queued in the non-blocking mode, and then the coalesced frames while the connection is
+             * still alive. */
+            if (NetIo_setNonBlocking(pPutMedia->xNetIoHandle, false) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to send pending data");
+            }
+            else if (prvCoalesceFlush(pPutMedia) != KVS_ERRNO_NONE)
+            {
+                LogError("Failed to send coalesced frames");
+            }
+            else
+            {
+                /* nop */
+            }
             NetIo_disconnect(pPutMedia->xNetIoHandle);
             NetIo_terminate(pPutMedia->xNetIoHandle);
         }
+        if (pPutMedia->pCoalesceBuf != NULL)
+        {
+            kvsFree(pPutMedia->pCoalesceBuf);
+        }
         kvsFree(pPutMedia);
     }
 }
@@ -1443,6 +1756,56 @@ int Kvs_putMediaUpdateSendTimeout(PutMediaHandle xPutMediaHandle, unsigned int u
     return res;
 }
 
+int Kvs_putMediaUpdateCoalescing(PutMediaHandle xPutMediaHandle, size_t uCoalesceSize, unsigned int uCoalesceDelayMs)
+{
+    int res = KVS_ERRNO_NONE;
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+
+    if (pPutMedia == NULL || pPutMedia->xNetIoHandle == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if ((res = prvCoalesceFlush(pPutMedia)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        pPutMedia->uCoalesceSize = prvAlignChunkSize(uCoalesceSize, pPutMedia->uRecordLen);
+        pPutMedia->uCoalesceDelayMs = uCoalesceDelayMs;
+    }
+
+    return res;
+}
+
+int Kvs_putMediaUpdateNonBlocking(PutMediaHandle xPutMediaHandle, bool bNonBlocking)
+{
+    int res = KVS_ERRNO_NONE;
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+
+    if (pPutMedia == NULL || pPutMedia->xNetIoHandle == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if ((res = NetIo_setNonBlocking(pPutMedia->xNetIoHandle, bNonBlocking)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+    else
+    {
+        /* nop */
+    }
+
+    return res;
+}
+
+bool Kvs_putMediaIsSendPending(PutMediaHandle xPutMediaHandle)
+{
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+
+    return (pPutMedia != NULL && NetIo_isSendPending(pPutMedia->xNetIoHandle));
+}
+
 int Kvs_putMediaReadFragmentAck(PutMediaHandle xPutMediaHandle, ePutMediaFragmentAckEventType *peAckEventType, uint64_t *puFragmentTimecode, unsigned int *puErrorId)
 {
     int res = KVS_ERRNO_NONE;
@@ -1476,3 +1839,37 @@ int Kvs_putMediaReadFragmentAck(PutMediaHandle xPutMediaHandle, ePutMediaFragmen
 
     return res;
 }
+
+int Kvs_putMediaGetPersistedTimecode(PutMediaHandle xPutMediaHandle, uint64_t *puFragmentTimecode)
+{
+    int res = KVS_ERRNO_NONE;
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+
+    if (pPutMedia == NULL || puFragmentTimecode == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else if (!pPutMedia->bHasPersistedFragment)
+    {
+        res = KVS_ERROR_NO_PUTMEDIA_FRAGMENT_ACK_AVAILABLE;
+    }
+    else
+    {
+        *puFragmentTimecode = pPutMedia->uPersistedFragmentTimecode;
+    }
+
+    return res;
+}
+
+int Kvs_putMediaGetSocket(PutMediaHandle xPutMediaHandle)
+{
+    PutMedia_t *pPutMedia = xPutMediaHandle;
+    int xSockFd = -1;
+
+    if (pPutMedia != NULL)
+    {
+        xSockFd = NetIo_getSocket(pPutMedia->xNetIoHandle);
+    }
+
+    return xSockFd;
+}
@@ -24,22 +24,61 @@
 /* Public headers */
 #include "kvs/errors.h"
 #include "kvs/mkv_generator.h"
+#include "kvs/port.h"
 #include "kvs/stream.h"
 
 /* Internal headers */
 #include "os/allocator.h"
+#include "os/atomic.h"
+
+/* Track types start from 1, and they are used as the index of the per-track queues. */
+#define TRACK_QUEUE_INDEX(xTrackType) ((size_t)(xTrackType) - (size_t)TRACK_VIDEO)
+#define TRACK_QUEUE_COUNT (TRACK_QUEUE_INDEX(TRACK_MAX) + 1)
+
+/* Number of descriptors added to the pool when it runs out of free descriptors */
+#define DATA_FRAME_POOL_GROW_CNT (32)
+
+/* Alignment of each part of a pooled descriptor */
+#define DATA_FRAME_POOL_ALIGN(x) (((x) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/* The delta timestamp of a simple block is a signed 16 bits value. */
+#define MKV_DELTA_TIMESTAMP_MAX (INT16_MAX)
 
 typedef struct DataFrame
 {
     DataFrameIn_t xDataFrameIn;
 
     DLIST_ENTRY xClusterEntry;
+
+    /* Entry of the queue of its track */
     DLIST_ENTRY xDataFrameEntry;
 
     size_t uMkvHdrLen;
     char *pMkvHdr;
+
+    /* The stream whose pool this descriptor comes from, or NULL if it's allocated from heap */
+    struct Stream *pxPoolOwner;
 } DataFrame_t;
 
+typedef struct TrackStat
+{
+    size_t uFrameCnt;
+    size_t uMemTotal;
+} TrackStat_t;
+
+/* Bounded single-producer/single-consumer ring of data frame descriptors. The capacity is a power of two. */
+typedef struct SpscRing
+{
+    DataFrame_t **ppxSlots;
+    size_t uCapacity;
+
+    /* Index of the next slot to read. It's only written by the consumer. */
+    size_t uHead;
+
+    /* Index of the next slot to write. It's only written by the producer. */
+    size_t uTail;
+} SpscRing_t;
+
 typedef struct Stream
 {
     LOCK_HANDLE xLock;
@@ -48,24 +87,740 @@ typedef struct Stream
     size_t uMkvEbmlSegLen;
 
     uint64_t uEarliestClusterTimestamp;
+
+    /* Cluster heads in the order they are popped, used as bookmarks when inserting frames. */
     DLIST_ENTRY xClusterPending;
-    DLIST_ENTRY xDataFramePending;
+
+    /* One FIFO per track. Frames are popped by merging the heads of these queues by timestamp. */
+    DLIST_ENTRY xDataFramePending[TRACK_QUEUE_COUNT];
+
+    /* Running counters of the pending frames, updated on add and pop. */
+    TrackStat_t xTrackStat[TRACK_QUEUE_COUNT];
+
+    /* Number of pending droppable frames, so the search is skipped if there is none. It's not used in lock-free mode. */
+    size_t uDroppableCnt;
+
+    /* Frames of evicted GOPs. They're no longer pending, and they're handed out in batches. */
+    DLIST_ENTRY xDataFrameEvicted;
 
     bool bHasVideoTrack;
     bool bHasAudioTrack;
+
+    /* Preallocated data frame descriptors. Free descriptors are linked by their xDataFrameEntry. */
+    bool bUsePool;
+    DLIST_ENTRY xDataFramePool;
+    DLIST_ENTRY xDataFramePoolChunks;
+    size_t uDataFramePoolSlotSize;
+    size_t uUserDataSize;
+
+    /* Lock-free mode. Each track has a ring of pending frames and a ring of free descriptors, and the lock isn't used. */
+    bool bLockFree;
+    SpscRing_t xPendingRing[TRACK_QUEUE_COUNT];
+    SpscRing_t xFreeRing[TRACK_QUEUE_COUNT];
+
+    /* Limits of a cluster, or 0 if there is no limit. A video frame which exceeds them starts a new cluster. */
+    uint32_t uClusterDurationMs;
+    size_t uClusterSizeLimit;
+
+    /* The newest video cluster which was added. It's only used by the video producer. */
+    bool bHasVideoCluster;
+    uint64_t uVideoClusterTimestamp;
+    size_t uVideoClusterSize;
+
+    /* It's signalled when a frame is added, so the consumer doesn't have to poll. */
+    WakeupHandle xWakeup;
 } Stream_t;
 
+/* Frames are sorted by timestamp, and a video frame goes before any other frame with the same timestamp. */
+static bool prvIsPlacedAfter(DataFrame_t *pxDataFrame, DataFrame_t *pxDataFrameExisting)
+{
+    return (pxDataFrame->xDataFrameIn.uTimestampMs > pxDataFrameExisting->xDataFrameIn.uTimestampMs) ||
+           ((pxDataFrame->xDataFrameIn.uTimestampMs == pxDataFrameExisting->xDataFrameIn.uTimestampMs) && (pxDataFrame->xDataFrameIn.xTrackType != TRACK_VIDEO));
+}
+
+static void prvInitializeClusterHdr(DataFrame_t *pxDataFrame, uint64_t uClusterTimestamp)
+{
+    Mkv_initializeClusterHdr(
+        (uint8_t *)(pxDataFrame->pMkvHdr),
+        pxDataFrame->uMkvHdrLen,
+        pxDataFrame->xDataFrameIn.xClusterType,
+        pxDataFrame->xDataFrameIn.uDataLen,
+        pxDataFrame->xDataFrameIn.xTrackType,
+        pxDataFrame->xDataFrameIn.bIsKeyFrame,
+        pxDataFrame->xDataFrameIn.uTimestampMs,
+        (uint16_t)(pxDataFrame->xDataFrameIn.uTimestampMs - uClusterTimestamp));
+}
+
+static int prvDataFramePoolGrow(Stream_t *pxStream, size_t uCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    PDLIST_ENTRY pxChunk = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    size_t i = 0;
+
+    if ((pxChunk = (PDLIST_ENTRY)kvsMalloc(DATA_FRAME_POOL_ALIGN(sizeof(DLIST_ENTRY)) + uCnt * pxStream->uDataFramePoolSlotSize)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: data frame pool");
+    }
+    else
+    {
+        DList_InsertTailList(&(pxStream->xDataFramePoolChunks), pxChunk);
+        for (i = 0; i < uCnt; i++)
+        {
+            pxDataFrame = (DataFrame_t *)((char *)pxChunk + DATA_FRAME_POOL_ALIGN(sizeof(DLIST_ENTRY)) + i * pxStream->uDataFramePoolSlotSize);
+            DList_InsertTailList(&(pxStream->xDataFramePool), &(pxDataFrame->xDataFrameEntry));
+        }
+    }
+
+    return res;
+}
+
+/* Get a data frame descriptor. The stream lock must be held by the caller if the stream uses a pool. */
+static DataFrame_t *prvDataFrameAlloc(Stream_t *pxStream, size_t uMkvHdrLen)
+{
+    DataFrame_t *pxDataFrame = NULL;
+
+    if (!pxStream->bUsePool)
+    {
+        if ((pxDataFrame = (DataFrame_t *)kvsMalloc(sizeof(DataFrame_t) + uMkvHdrLen)) == NULL)
+        {
+            LogError("OOM: pxDataFrame");
+        }
+        else
+        {
+            memset(pxDataFrame, 0, sizeof(DataFrame_t));
+        }
+    }
+    else if (DList_IsListEmpty(&(pxStream->xDataFramePool)) && prvDataFramePoolGrow(pxStream, DATA_FRAME_POOL_GROW_CNT) != KVS_ERRNO_NONE)
+    {
+        LogError("Failed to grow data frame pool");
+    }
+    else
+    {
+        pxDataFrame = containingRecord(DList_RemoveHeadList(&(pxStream->xDataFramePool)), DataFrame_t, xDataFrameEntry);
+        memset(pxDataFrame, 0, sizeof(DataFrame_t));
+        pxDataFrame->pxPoolOwner = pxStream;
+    }
+
+    return pxDataFrame;
+}
+
+/* Memory used by a data frame, including its handle, MKV header and data. */
+static size_t prvDataFrameMemSize(DataFrame_t *pxDataFrame)
+{
+    return sizeof(DataFrame_t) + pxDataFrame->uMkvHdrLen + pxDataFrame->xDataFrameIn.uDataLen;
+}
+
+static size_t prvStreamMemTotal(Stream_t *pxStream)
+{
+    size_t uMemTotal = sizeof(Stream_t) + pxStream->uMkvEbmlSegLen;
+    size_t i = 0;
+
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        uMemTotal += ATOMIC_LOAD_RELAXED(&(pxStream->xTrackStat[i].uMemTotal));
+    }
+
+    return uMemTotal;
+}
+
+/* Fill a newly allocated descriptor with the frame, and keep the user data in the pooled descriptor. */
+static void prvDataFrameInit(Stream_t *pxStream, DataFrame_t *pxDataFrame, DataFrameIn_t *pxDataFrameIn, size_t uMkvHdrLen)
+{
+    memcpy(pxDataFrame, pxDataFrameIn, sizeof(DataFrameIn_t));
+    DList_InitializeListHead(&(pxDataFrame->xClusterEntry));
+    DList_InitializeListHead(&(pxDataFrame->xDataFrameEntry));
+    pxDataFrame->uMkvHdrLen = uMkvHdrLen;
+    pxDataFrame->pMkvHdr = (char *)pxDataFrame + sizeof(DataFrame_t);
+
+    /* The user data is kept in the pooled descriptor, so the caller doesn't have to allocate it. */
+    if (pxStream->bUsePool && pxStream->uUserDataSize > 0 && pxDataFrameIn->pUserData != NULL)
+    {
+        pxDataFrame->xDataFrameIn.pUserData = (char *)pxDataFrame + pxStream->uDataFramePoolSlotSize - DATA_FRAME_POOL_ALIGN(pxStream->uUserDataSize);
+        memcpy(pxDataFrame->xDataFrameIn.pUserData, pxDataFrameIn->pUserData, pxStream->uUserDataSize);
+    }
+}
+
+/* Make a video simple block start a new cluster if it would exceed the limits of the newest video cluster, or if its
+ * delta timestamp would overflow. Only the video producer calls this. */
+static void prvSplitCluster(Stream_t *pxStream, DataFrameIn_t *pxDataFrameIn)
+{
+    uint64_t uDeltaTimestampMs = 0;
+
+    if (pxDataFrameIn->xTrackType == TRACK_VIDEO && pxDataFrameIn->xClusterType == MKV_SIMPLE_BLOCK && pxStream->bHasVideoCluster &&
+        pxDataFrameIn->uTimestampMs >= pxStream->uVideoClusterTimestamp)
+    {
+        uDeltaTimestampMs = pxDataFrameIn->uTimestampMs - pxStream->uVideoClusterTimestamp;
+        if (uDeltaTimestampMs > MKV_DELTA_TIMESTAMP_MAX || (pxStream->uClusterDurationMs > 0 && uDeltaTimestampMs >= pxStream->uClusterDurationMs) ||
+            (pxStream->uClusterSizeLimit > 0 && pxStream->uVideoClusterSize + pxDataFrameIn->uDataLen > pxStream->uClusterSizeLimit))
+        {
+            pxDataFrameIn->xClusterType = MKV_CLUSTER;
+        }
+    }
+}
+
+/* Account a video frame which has been added to the newest video cluster, or which starts a new one. */
+static void prvUpdateVideoCluster(Stream_t *pxStream, DataFrameIn_t *pxDataFrameIn)
+{
+    if (pxDataFrameIn->xTrackType != TRACK_VIDEO)
+    {
+        /* Audio frames are not counted. */
+    }
+    else if (pxDataFrameIn->xClusterType == MKV_CLUSTER)
+    {
+        pxStream->bHasVideoCluster = true;
+        pxStream->uVideoClusterTimestamp = pxDataFrameIn->uTimestampMs;
+        pxStream->uVideoClusterSize = pxDataFrameIn->uDataLen;
+    }
+    else
+    {
+        pxStream->uVideoClusterSize += pxDataFrameIn->uDataLen;
+    }
+}
+
+/* A lock-free stream never takes its lock. */
+static LOCK_RESULT prvStreamLock(Stream_t *pxStream)
+{
+    return pxStream->bLockFree ? LOCK_OK : Lock(pxStream->xLock);
+}
+
+static void prvStreamUnlock(Stream_t *pxStream)
+{
+    if (!pxStream->bLockFree)
+    {
+        Unlock(pxStream->xLock);
+    }
+}
+
+/* Only the producer of a ring calls this. It returns false if the ring is full. */
+static bool prvSpscRingPush(SpscRing_t *pxRing, DataFrame_t *pxDataFrame)
+{
+    bool bRes = false;
+    size_t uTail = ATOMIC_LOAD_RELAXED(&(pxRing->uTail));
+
+    if (uTail - ATOMIC_LOAD_ACQUIRE(&(pxRing->uHead)) < pxRing->uCapacity)
+    {
+        pxRing->ppxSlots[uTail & (pxRing->uCapacity - 1)] = pxDataFrame;
+        ATOMIC_STORE_RELEASE(&(pxRing->uTail), uTail + 1);
+        bRes = true;
+    }
+
+    return bRes;
+}
+
+/* Only the consumer of a ring calls this. It returns NULL if the ring is empty. */
+static DataFrame_t *prvSpscRingFront(SpscRing_t *pxRing)
+{
+    DataFrame_t *pxDataFrame = NULL;
+    size_t uHead = ATOMIC_LOAD_RELAXED(&(pxRing->uHead));
+
+    if (uHead != ATOMIC_LOAD_ACQUIRE(&(pxRing->uTail)))
+    {
+        pxDataFrame = pxRing->ppxSlots[uHead & (pxRing->uCapacity - 1)];
+    }
+
+    return pxDataFrame;
+}
+
+/* Only the consumer of a ring calls this, after prvSpscRingFront returned a descriptor. */
+static void prvSpscRingPopFront(SpscRing_t *pxRing)
+{
+    ATOMIC_STORE_RELEASE(&(pxRing->uHead), ATOMIC_LOAD_RELAXED(&(pxRing->uHead)) + 1);
+}
+
+/* Preallocate the rings and the descriptors of a track in lock-free mode. All descriptors start in the free ring. */
+static int prvLockFreeTrackInit(Stream_t *pxStream, size_t uTrackIdx, size_t uCapacity)
+{
+    int res = KVS_ERRNO_NONE;
+    PDLIST_ENTRY pxChunk = NULL;
+    char *pDataFrames = NULL;
+    SpscRing_t *pxPendingRing = &(pxStream->xPendingRing[uTrackIdx]);
+    SpscRing_t *pxFreeRing = &(pxStream->xFreeRing[uTrackIdx]);
+    size_t uSlotsSize = DATA_FRAME_POOL_ALIGN(2 * uCapacity * sizeof(DataFrame_t *));
+    size_t i = 0;
+
+    if ((pxChunk = (PDLIST_ENTRY)kvsMalloc(DATA_FRAME_POOL_ALIGN(sizeof(DLIST_ENTRY)) + uSlotsSize + uCapacity * pxStream->uDataFramePoolSlotSize)) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: lock-free track queue");
+    }
+    else
+    {
+        DList_InsertTailList(&(pxStream->xDataFramePoolChunks), pxChunk);
+        pxPendingRing->ppxSlots = (DataFrame_t **)((char *)pxChunk + DATA_FRAME_POOL_ALIGN(sizeof(DLIST_ENTRY)));
+        pxPendingRing->uCapacity = uCapacity;
+        pxFreeRing->ppxSlots = pxPendingRing->ppxSlots + uCapacity;
+        pxFreeRing->uCapacity = uCapacity;
+
+        pDataFrames = (char *)pxChunk + DATA_FRAME_POOL_ALIGN(sizeof(DLIST_ENTRY)) + uSlotsSize;
+        for (i = 0; i < uCapacity; i++)
+        {
+            pxFreeRing->ppxSlots[i] = (DataFrame_t *)(pDataFrames + i * pxStream->uDataFramePoolSlotSize);
+        }
+        pxFreeRing->uTail = uCapacity;
+    }
+
+    return res;
+}
+
+/* Called by the producer of a track. The free ring is empty when all descriptors are pending or not terminated yet. */
+static DataFrame_t *prvLockFreeAddDataFrame(Stream_t *pxStream, DataFrameIn_t *pxDataFrameIn, size_t uMkvHdrLen)
+{
+    size_t uTrackIdx = TRACK_QUEUE_INDEX(pxDataFrameIn->xTrackType);
+    DataFrame_t *pxDataFrame = NULL;
+
+    if ((pxDataFrame = prvSpscRingFront(&(pxStream->xFreeRing[uTrackIdx]))) == NULL)
+    {
+        LogError("Queue of track %d is full", (int)(pxDataFrameIn->xTrackType));
+    }
+    else
+    {
+        prvSpscRingPopFront(&(pxStream->xFreeRing[uTrackIdx]));
+        memset(pxDataFrame, 0, sizeof(DataFrame_t));
+        pxDataFrame->pxPoolOwner = pxStream;
+        prvDataFrameInit(pxStream, pxDataFrame, pxDataFrameIn, uMkvHdrLen);
+
+        /* Count the frame before it's visible to the consumer, so the counters never go below zero. */
+        ATOMIC_FETCH_ADD(&(pxStream->xTrackStat[uTrackIdx].uFrameCnt), 1);
+        ATOMIC_FETCH_ADD(&(pxStream->xTrackStat[uTrackIdx].uMemTotal), prvDataFrameMemSize(pxDataFrame));
+
+        /* There are as many pending slots as descriptors, so it never fails. */
+        prvSpscRingPush(&(pxStream->xPendingRing[uTrackIdx]), pxDataFrame);
+    }
+
+    return pxDataFrame;
+}
+
+/* Get the track queue whose head is the next frame to be sent, or NULL if all queues are empty. */
+static PDLIST_ENTRY prvGetNextTrackQueue(Stream_t *pxStream)
+{
+    PDLIST_ENTRY pxNextListHead = NULL;
+    PDLIST_ENTRY pxListHead = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    DataFrame_t *pxNextDataFrame = NULL;
+    size_t i = 0;
+
+    /* Video track is the first queue, so it wins when timestamps are the same. */
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        pxListHead = &(pxStream->xDataFramePending[i]);
+        if (!DList_IsListEmpty(pxListHead))
+        {
+            pxDataFrame = containingRecord(pxListHead->Flink, DataFrame_t, xDataFrameEntry);
+            if (pxNextDataFrame == NULL || pxDataFrame->xDataFrameIn.uTimestampMs < pxNextDataFrame->xDataFrameIn.uTimestampMs)
+            {
+                pxNextDataFrame = pxDataFrame;
+                pxNextListHead = pxListHead;
+            }
+        }
+    }
+
+    return pxNextListHead;
+}
+
+/* Update the delta timestamp of the frames which belong to a newly inserted cluster. */
+static void prvCorrectDeltaTimestamp(Stream_t *pxStream, DataFrame_t *pxCluster)
+{
+    DataFrame_t *pxNextCluster = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    PDLIST_ENTRY pxListHead = NULL;
+    PDLIST_ENTRY pxListItem = NULL;
+    size_t i = 0;
+
+    if (pxCluster->xClusterEntry.Flink != &(pxStream->xClusterPending))
+    {
+        pxNextCluster = containingRecord(pxCluster->xClusterEntry.Flink, DataFrame_t, xClusterEntry);
+    }
+
+    /* On the track of the cluster, these are the frames between the cluster and the next cluster head. */
+    pxListHead = &(pxStream->xDataFramePending[TRACK_QUEUE_INDEX(pxCluster->xDataFrameIn.xTrackType)]);
+    pxListItem = pxCluster->xDataFrameEntry.Flink;
+    while (pxListItem != pxListHead)
+    {
+        pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
+        if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+        {
+            break;
+        }
+        prvInitializeClusterHdr(pxDataFrame, pxCluster->xDataFrameIn.uTimestampMs);
+        pxListItem = pxListItem->Flink;
+    }
+
+    /* On the other tracks, they are searched from the tail, and most of the time only a few frames are newer than the cluster. */
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        if (i == TRACK_QUEUE_INDEX(pxCluster->xDataFrameIn.xTrackType))
+        {
+            continue;
+        }
+
+        pxListHead = &(pxStream->xDataFramePending[i]);
+        pxListItem = pxListHead->Blink;
+        while (pxListItem != pxListHead)
+        {
+            pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
+            if (!prvIsPlacedAfter(pxDataFrame, pxCluster))
+            {
+                break;
+            }
+            if (pxNextCluster == NULL || !prvIsPlacedAfter(pxDataFrame, pxNextCluster))
+            {
+                prvInitializeClusterHdr(pxDataFrame, pxCluster->xDataFrameIn.uTimestampMs);
+            }
+            pxListItem = pxListItem->Blink;
+        }
+    }
+}
+
+/* Insert a new data frame into the queue of its track, and build its MKV header. The stream lock must be held by the
+ * caller. */
+static void prvInsertDataFrame(Stream_t *pxStream, DataFrame_t *pxDataFrame)
+{
+    PDLIST_ENTRY pxListHead = NULL;
+    PDLIST_ENTRY pxListItem = NULL;
+    PDLIST_ENTRY pxClusterItem = NULL;
+    uint64_t uClusterTimestamp = 0;
+    size_t uTrackIdx = TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType);
+
+    /* Frames of a track almost always arrive in timestamp order, so search the insertion point backward from the tail. */
+    pxListHead = &(pxStream->xDataFramePending[uTrackIdx]);
+    pxListItem = pxListHead->Blink;
+    while (pxListItem != pxListHead && !prvIsPlacedAfter(pxDataFrame, containingRecord(pxListItem, DataFrame_t, xDataFrameEntry)))
+    {
+        pxListItem = pxListItem->Blink;
+    }
+    DList_InsertHeadList(pxListItem, &(pxDataFrame->xDataFrameEntry));
+    ATOMIC_FETCH_ADD(&(pxStream->xTrackStat[uTrackIdx].uFrameCnt), 1);
+    ATOMIC_FETCH_ADD(&(pxStream->xTrackStat[uTrackIdx].uMemTotal), prvDataFrameMemSize(pxDataFrame));
+    if (pxDataFrame->xDataFrameIn.xDropClass == DATA_FRAME_DROPPABLE)
+    {
+        pxStream->uDroppableCnt++;
+    }
+
+    /* The cluster bookmarks are sorted in the same order, so the owning cluster is also found from the tail. */
+    pxClusterItem = pxStream->xClusterPending.Blink;
+    while (pxClusterItem != &(pxStream->xClusterPending) &&
+           !prvIsPlacedAfter(pxDataFrame, containingRecord(pxClusterItem, DataFrame_t, xClusterEntry)))
+    {
+        pxClusterItem = pxClusterItem->Blink;
+    }
+
+    if (pxClusterItem == &(pxStream->xClusterPending))
+    {
+        uClusterTimestamp = pxStream->uEarliestClusterTimestamp;
+    }
+    else
+    {
+        uClusterTimestamp = containingRecord(pxClusterItem, DataFrame_t, xClusterEntry)->xDataFrameIn.uTimestampMs;
+    }
+
+    prvInitializeClusterHdr(pxDataFrame, uClusterTimestamp);
+
+    if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+    {
+        DList_InsertHeadList(pxClusterItem, &(pxDataFrame->xClusterEntry));
+
+        /* Only the frames between this cluster head and the next one need their delta timestamp updated. */
+        prvCorrectDeltaTimestamp(pxStream, pxDataFrame);
+    }
+}
+
+/* Remove the next data frame from the stream. The stream lock must be held by the caller. */
+static DataFrame_t *prvPopDataFrame(Stream_t *pxStream, PDLIST_ENTRY pxListHead)
+{
+    DataFrame_t *pxDataFrame = containingRecord(DList_RemoveHeadList(pxListHead), DataFrame_t, xDataFrameEntry);
+    TrackStat_t *pxTrackStat = &(pxStream->xTrackStat[TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType)]);
+
+    ATOMIC_FETCH_SUB(&(pxTrackStat->uFrameCnt), 1);
+    ATOMIC_FETCH_SUB(&(pxTrackStat->uMemTotal), prvDataFrameMemSize(pxDataFrame));
+
+    if (pxDataFrame->xDataFrameIn.xDropClass == DATA_FRAME_DROPPABLE)
+    {
+        pxStream->uDroppableCnt--;
+    }
+
+    if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+    {
+        DList_RemoveEntryList(&(pxDataFrame->xClusterEntry));
+        pxStream->uEarliestClusterTimestamp = pxDataFrame->xDataFrameIn.uTimestampMs;
+    }
+
+    return pxDataFrame;
+}
+
+/* Get the ring whose head is the next frame to be sent, or NULL if all rings are empty. Only the consumer calls this. */
+static SpscRing_t *prvGetNextTrackRing(Stream_t *pxStream)
+{
+    SpscRing_t *pxNextRing = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    DataFrame_t *pxNextDataFrame = NULL;
+    size_t i = 0;
+
+    /* Video track is the first ring, so it wins when timestamps are the same. */
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        if ((pxDataFrame = prvSpscRingFront(&(pxStream->xPendingRing[i]))) != NULL &&
+            (pxNextDataFrame == NULL || pxDataFrame->xDataFrameIn.uTimestampMs < pxNextDataFrame->xDataFrameIn.uTimestampMs))
+        {
+            pxNextDataFrame = pxDataFrame;
+            pxNextRing = &(pxStream->xPendingRing[i]);
+        }
+    }
+
+    return pxNextRing;
+}
+
+/* The producers never touch the cluster order in lock-free mode, so the MKV header is built when the frame is taken
+ * out. The owning cluster of a frame is the last popped cluster. */
+static DataFrame_t *prvLockFreeGetDataFrame(Stream_t *pxStream, SpscRing_t *pxRing, bool bPeek)
+{
+    DataFrame_t *pxDataFrame = prvSpscRingFront(pxRing);
+    TrackStat_t *pxTrackStat = &(pxStream->xTrackStat[TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType)]);
+
+    if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+    {
+        prvInitializeClusterHdr(pxDataFrame, pxDataFrame->xDataFrameIn.uTimestampMs);
+    }
+    else
+    {
+        prvInitializeClusterHdr(pxDataFrame, pxStream->uEarliestClusterTimestamp);
+    }
+
+    if (!bPeek)
+    {
+        prvSpscRingPopFront(pxRing);
+
+        ATOMIC_FETCH_SUB(&(pxTrackStat->uFrameCnt), 1);
+        ATOMIC_FETCH_SUB(&(pxTrackStat->uMemTotal), prvDataFrameMemSize(pxDataFrame));
+
+        if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+        {
+            pxStream->uEarliestClusterTimestamp = pxDataFrame->xDataFrameIn.uTimestampMs;
+        }
+    }
+
+    return pxDataFrame;
+}
+
+/* The next frame is ready to be sent if there is a video frame, and also an audio frame if bAllTracks is set, so it
+ * can't be overtaken by a late frame of the other track. The stream lock must be held unless it's lock-free. */
+static bool prvIsReadyToPop(Stream_t *pxStream, bool bAllTracks)
+{
+    bool bHasVideo = false;
+    bool bHasAudio = false;
+
+    if (pxStream->bLockFree)
+    {
+        bHasVideo = (prvSpscRingFront(&(pxStream->xPendingRing[TRACK_QUEUE_INDEX(TRACK_VIDEO)])) != NULL);
+        bHasAudio = (prvSpscRingFront(&(pxStream->xPendingRing[TRACK_QUEUE_INDEX(TRACK_AUDIO)])) != NULL);
+    }
+    else
+    {
+        bHasVideo = !DList_IsListEmpty(&(pxStream->xDataFramePending[TRACK_QUEUE_INDEX(TRACK_VIDEO)]));
+        bHasAudio = !DList_IsListEmpty(&(pxStream->xDataFramePending[TRACK_QUEUE_INDEX(TRACK_AUDIO)]));
+    }
+
+    return bHasVideo && (!bAllTracks || !pxStream->bHasAudioTrack || bHasAudio);
+}
+
+/* Get the cluster which ends the oldest GOP, or NULL if the oldest GOP is the newest one. The stream lock must be held. */
+static DataFrame_t *prvGetGopEnd(Stream_t *pxStream)
+{
+    PDLIST_ENTRY pxVideoListHead = &(pxStream->xDataFramePending[TRACK_QUEUE_INDEX(TRACK_VIDEO)]);
+    PDLIST_ENTRY pxClusterItem = pxStream->xClusterPending.Flink;
+    DataFrame_t *pxCluster = NULL;
+    DataFrame_t *pxGopEnd = NULL;
+
+    /* If the video queue starts with a cluster, the oldest GOP starts there and ends at the next key frame cluster.
+     * Otherwise the oldest GOP is the rest of the GOP being sent. Clusters which are split from a long GOP don't start a
+     * GOP, because their frames refer to the frames before them. */
+    for (; pxClusterItem != &(pxStream->xClusterPending); pxClusterItem = pxClusterItem->Flink)
+    {
+        pxCluster = containingRecord(pxClusterItem, DataFrame_t, xClusterEntry);
+        if (pxCluster->xDataFrameIn.bIsKeyFrame && pxVideoListHead->Flink != &(pxCluster->xDataFrameEntry))
+        {
+            pxGopEnd = pxCluster;
+            break;
+        }
+    }
+
+    return pxGopEnd;
+}
+
+/* Move a pending data frame to the evicted list. The stream lock must be held by the caller. */
+static void prvEvictDataFrame(Stream_t *pxStream, DataFrame_t *pxDataFrame)
+{
+    TrackStat_t *pxTrackStat = &(pxStream->xTrackStat[TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType)]);
+
+    DList_RemoveEntryList(&(pxDataFrame->xDataFrameEntry));
+    ATOMIC_FETCH_SUB(&(pxTrackStat->uFrameCnt), 1);
+    ATOMIC_FETCH_SUB(&(pxTrackStat->uMemTotal), prvDataFrameMemSize(pxDataFrame));
+
+    if (pxDataFrame->xDataFrameIn.xDropClass == DATA_FRAME_DROPPABLE)
+    {
+        pxStream->uDroppableCnt--;
+    }
+
+    if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
+    {
+        DList_RemoveEntryList(&(pxDataFrame->xClusterEntry));
+    }
+
+    DList_InsertTailList(&(pxStream->xDataFrameEvicted), &(pxDataFrame->xDataFrameEntry));
+}
+
+/* The audio frames of an evicted GOP can be kept if they fit in the last cluster which was popped. */
+static bool prvIsKeptAfterEviction(Stream_t *pxStream, DataFrame_t *pxDataFrame, bool bKeepAudio)
+{
+    return bKeepAudio && pxDataFrame->xDataFrameIn.xTrackType != TRACK_VIDEO &&
+           pxDataFrame->xDataFrameIn.uTimestampMs >= pxStream->uEarliestClusterTimestamp &&
+           pxDataFrame->xDataFrameIn.uTimestampMs - pxStream->uEarliestClusterTimestamp <= MKV_DELTA_TIMESTAMP_MAX;
+}
+
+/* Evict all frames placed before the end of the oldest GOP. The stream lock must be held by the caller. */
+static void prvEvictGop(Stream_t *pxStream, DataFrame_t *pxGopEnd, bool bKeepAudio)
+{
+    PDLIST_ENTRY pxListHead = NULL;
+    PDLIST_ENTRY pxListItem = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        pxListHead = &(pxStream->xDataFramePending[i]);
+        pxListItem = pxListHead->Flink;
+        while (pxListItem != pxListHead)
+        {
+            pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
+            pxListItem = pxListItem->Flink;
+
+            if (pxDataFrame == pxGopEnd || !prvIsPlacedAfter(pxGopEnd, pxDataFrame))
+            {
+                break;
+            }
+            else if (prvIsKeptAfterEviction(pxStream, pxDataFrame, bKeepAudio))
+            {
+                /* Its cluster is evicted, so it moves to the last cluster which was popped. */
+                prvInitializeClusterHdr(pxDataFrame, pxStream->uEarliestClusterTimestamp);
+            }
+            else
+            {
+                prvEvictDataFrame(pxStream, pxDataFrame);
+            }
+        }
+    }
+}
+
+/* Lock-free version of prvGetGopEnd. Only the consumer calls this. */
+static DataFrame_t *prvLockFreeGetGopEnd(Stream_t *pxStream)
+{
+    SpscRing_t *pxRing = &(pxStream->xPendingRing[TRACK_QUEUE_INDEX(TRACK_VIDEO)]);
+    size_t uHead = ATOMIC_LOAD_RELAXED(&(pxRing->uHead));
+    size_t uTail = ATOMIC_LOAD_ACQUIRE(&(pxRing->uTail));
+    DataFrame_t *pxDataFrame = NULL;
+    DataFrame_t *pxGopEnd = NULL;
+    size_t i = 0;
+
+    /* The first key frame cluster after the head ends the oldest GOP, whether or not the head is a cluster. */
+    for (i = uHead + 1; uHead != uTail && i != uTail; i++)
+    {
+        pxDataFrame = pxRing->ppxSlots[i & (pxRing->uCapacity - 1)];
+        if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER && pxDataFrame->xDataFrameIn.bIsKeyFrame)
+        {
+            pxGopEnd = pxDataFrame;
+            break;
+        }
+    }
+
+    return pxGopEnd;
+}
+
+/* Lock-free version of prvEvictGop. Only frames at the front of the rings can be evicted. */
+static void prvLockFreeEvictGop(Stream_t *pxStream, DataFrame_t *pxGopEnd, bool bKeepAudio)
+{
+    SpscRing_t *pxRing = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    TrackStat_t *pxTrackStat = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        pxRing = &(pxStream->xPendingRing[i]);
+        pxTrackStat = &(pxStream->xTrackStat[i]);
+
+        /* MKV headers are built on pop, so the audio frames which are kept need no update. */
+        while ((pxDataFrame = prvSpscRingFront(pxRing)) != NULL && pxDataFrame != pxGopEnd && prvIsPlacedAfter(pxGopEnd, pxDataFrame) &&
+               !prvIsKeptAfterEviction(pxStream, pxDataFrame, bKeepAudio))
+        {
+            prvSpscRingPopFront(pxRing);
+            ATOMIC_FETCH_SUB(&(pxTrackStat->uFrameCnt), 1);
+            ATOMIC_FETCH_SUB(&(pxTrackStat->uMemTotal), prvDataFrameMemSize(pxDataFrame));
+            DList_InsertTailList(&(pxStream->xDataFrameEvicted), &(pxDataFrame->xDataFrameEntry));
+        }
+    }
+}
+
+/* The evicted list holds the frames of one track after another. Reorder it into the order they would be popped. */
+static void prvSortEvicted(Stream_t *pxStream)
+{
+    DLIST_ENTRY xTrackEvicted[TRACK_QUEUE_COUNT];
+    DataFrame_t *pxDataFrame = NULL;
+    DataFrame_t *pxNext = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+    {
+        DList_InitializeListHead(&(xTrackEvicted[i]));
+    }
+
+    while (!DList_IsListEmpty(&(pxStream->xDataFrameEvicted)))
+    {
+        pxDataFrame = containingRecord(DList_RemoveHeadList(&(pxStream->xDataFrameEvicted)), DataFrame_t, xDataFrameEntry);
+        DList_InsertTailList(&(xTrackEvicted[TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType)]), &(pxDataFrame->xDataFrameEntry));
+    }
+
+    do
+    {
+        pxNext = NULL;
+        for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+        {
+            if (!DList_IsListEmpty(&(xTrackEvicted[i])))
+            {
+                pxDataFrame = containingRecord(xTrackEvicted[i].Flink, DataFrame_t, xDataFrameEntry);
+                if (pxNext == NULL || prvIsPlacedAfter(pxNext, pxDataFrame))
+                {
+                    pxNext = pxDataFrame;
+                }
+            }
+        }
+
+        if (pxNext != NULL)
+        {
+            DList_RemoveEntryList(&(pxNext->xDataFrameEntry));
+            DList_InsertTailList(&(pxStream->xDataFrameEvicted), &(pxNext->xDataFrameEntry));
+        }
+    } while (pxNext != NULL);
+}
+
 static DataFrameHandle prvStreamPop(StreamHandle xStreamHandle, bool bPeek)
 {
     Stream_t *pxStream = xStreamHandle;
     DataFrame_t *pxDataFrame = NULL;
     PDLIST_ENTRY pxListHead = NULL;
-    PDLIST_ENTRY pxListItem = NULL;
+    SpscRing_t *pxRing = NULL;
 
     if (pxStream == NULL)
     {
         LogError("invalid argument");
     }
+    else if (pxStream->bLockFree)
+    {
+        if ((pxRing = prvGetNextTrackRing(pxStream)) != NULL)
+        {
+            pxDataFrame = prvLockFreeGetDataFrame(pxStream, pxRing, bPeek);
+        }
+    }
     else
     {
         if (Lock(pxStream->xLock) != LOCK_OK)
@@ -74,31 +829,17 @@ static DataFrameHandle prvStreamPop(StreamHandle xStreamHandle, bool bPeek)
         }
         else
         {
-            if (DList_IsListEmpty(&(pxStream->xDataFramePending)))
+            if ((pxListHead = prvGetNextTrackQueue(pxStream)) == NULL)
             {
                 /* LogInfo("No data frame to pop"); */
             }
+            else if (!bPeek)
+            {
+                pxDataFrame = prvPopDataFrame(pxStream, pxListHead);
+            }
             else
             {
-                pxListHead = &(pxStream->xDataFramePending);
-
-                if (!bPeek)
-                {
-                    pxListItem = DList_RemoveHeadList(pxListHead);
-                }
-                else
-                {
-                    pxListItem = pxListHead->Flink;
-                }
-                pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
-
-                if (!bPeek)
-                {
-                    if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
-                    {
-                        pxStream->uEarliestClusterTimestamp = pxDataFrame->xDataFrameIn.uTimestampMs;
-                    }
-                }
+                pxDataFrame = containingRecord(pxListHead->Flink, DataFrame_t, xDataFrameEntry);
             }
 
             Unlock(pxStream->xLock);
@@ -112,6 +853,7 @@ StreamHandle Kvs_streamCreate(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_
 {
     Stream_t *pxStream = NULL;
     MkvHeader_t xMkvHeader = {0};
+    size_t i = 0;
 
     if (pVideoTrackInfo == NULL)
     {
@@ -126,7 +868,13 @@ StreamHandle Kvs_streamCreate(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_
         memset(pxStream, 0, sizeof(Stream_t));
 
         DList_InitializeListHead(&(pxStream->xClusterPending));
-        DList_InitializeListHead(&(pxStream->xDataFramePending));
+        for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+        {
+            DList_InitializeListHead(&(pxStream->xDataFramePending[i]));
+        }
+        DList_InitializeListHead(&(pxStream->xDataFrameEvicted));
+        DList_InitializeListHead(&(pxStream->xDataFramePool));
+        DList_InitializeListHead(&(pxStream->xDataFramePoolChunks));
 
         if (Mkv_initializeHeaders(&xMkvHeader, pVideoTrackInfo, pAudioTrackInfo) != KVS_ERRNO_NONE)
         {
@@ -148,41 +896,163 @@ StreamHandle Kvs_streamCreate(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_
             pxStream->bHasAudioTrack = (pAudioTrackInfo == NULL) ? false : true;
         }
     }
-
-    return pxStream;
-}
-
-void Kvs_streamTermintate(StreamHandle xStreamHandle)
-{
-    Stream_t *pxStream = xStreamHandle;
-
-    if (pxStream != NULL)
+
+    return pxStream;
+}
+
+StreamHandle Kvs_streamCreateWithPool(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_t *pAudioTrackInfo, size_t uUserDataSize, size_t uPoolCnt)
+{
+    Stream_t *pxStream = NULL;
+    size_t uMkvHdrLenMax = Mkv_getClusterHdrLen(MKV_CLUSTER);
+
+    if (Mkv_getClusterHdrLen(MKV_SIMPLE_BLOCK) > uMkvHdrLenMax)
+    {
+        uMkvHdrLenMax = Mkv_getClusterHdrLen(MKV_SIMPLE_BLOCK);
+    }
+
+    if ((pxStream = Kvs_streamCreate(pVideoTrackInfo, pAudioTrackInfo)) == NULL)
+    {
+        LogError("Failed to create stream");
+    }
+    else
+    {
+        /* A pooled descriptor has a slot for the largest MKV header and a slot for the user data. */
+        pxStream->bUsePool = true;
+        pxStream->uUserDataSize = uUserDataSize;
+        pxStream->uDataFramePoolSlotSize = DATA_FRAME_POOL_ALIGN(sizeof(DataFrame_t) + uMkvHdrLenMax) + DATA_FRAME_POOL_ALIGN(uUserDataSize);
+
+        if (uPoolCnt > 0 && prvDataFramePoolGrow(pxStream, uPoolCnt) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to preallocate data frame pool");
+            Kvs_streamTermintate(pxStream);
+            pxStream = NULL;
+        }
+    }
+
+    return pxStream;
+}
+
+StreamHandle Kvs_streamCreateLockFree(VideoTrackInfo_t *pVideoTrackInfo, AudioTrackInfo_t *pAudioTrackInfo, size_t uUserDataSize, size_t uQueueSize)
+{
+    Stream_t *pxStream = NULL;
+    size_t uCapacity = 1;
+
+    /* Ring indexes are masked, so the capacity is rounded up to a power of two. */
+    while (uCapacity < uQueueSize)
+    {
+        uCapacity <<= 1;
+    }
+
+    if (uQueueSize == 0)
+    {
+        LogError("Invalid argument");
+    }
+    else if ((pxStream = Kvs_streamCreateWithPool(pVideoTrackInfo, pAudioTrackInfo, uUserDataSize, 0)) == NULL)
+    {
+        LogError("Failed to create stream");
+    }
+    else
+    {
+        pxStream->bLockFree = true;
+
+        if (prvLockFreeTrackInit(pxStream, TRACK_QUEUE_INDEX(TRACK_VIDEO), uCapacity) != KVS_ERRNO_NONE ||
+            (pxStream->bHasAudioTrack && prvLockFreeTrackInit(pxStream, TRACK_QUEUE_INDEX(TRACK_AUDIO), uCapacity) != KVS_ERRNO_NONE))
+        {
+            LogError("Failed to preallocate lock-free track queues");
+            Kvs_streamTermintate(pxStream);
+            pxStream = NULL;
+        }
+    }
+
+    return pxStream;
+}
+
+void Kvs_streamTermintate(StreamHandle xStreamHandle)
+{
+    Stream_t *pxStream = xStreamHandle;
+
+    if (pxStream != NULL)
+    {
+        while (!DList_IsListEmpty(&(pxStream->xDataFramePoolChunks)))
+        {
+            kvsFree(DList_RemoveHeadList(&(pxStream->xDataFramePoolChunks)));
+        }
+        kvsFree(pxStream->pMkvEbmlSeg);
+        Lock_Deinit(pxStream->xLock);
+        kvsFree(pxStream);
+    }
+}
+
+int Kvs_streamGetMkvEbmlSegHdr(StreamHandle xStreamHandle, uint8_t **ppMkvHeader, size_t *puMkvHeaderLen)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+
+    if (pxStream == NULL || ppMkvHeader == NULL || puMkvHeaderLen == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (pxStream->pMkvEbmlSeg == NULL || pxStream->uMkvEbmlSegLen == 0)
+    {
+        res = KVS_ERROR_STREAM_MKV_IS_NOT_INITIALIZED;
+        LogError("Mkv EBML and segment are not initialized");
+    }
+    else
+    {
+        *ppMkvHeader = (uint8_t *)(pxStream->pMkvEbmlSeg);
+        *puMkvHeaderLen = pxStream->uMkvEbmlSegLen;
+    }
+
+    return res;
+}
+
+int Kvs_streamSetClusterLimit(StreamHandle xStreamHandle, uint32_t uDurationMs, size_t uSize)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+
+    if (pxStream == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
     {
-        kvsFree(pxStream->pMkvEbmlSeg);
-        Lock_Deinit(pxStream->xLock);
-        kvsFree(pxStream);
+        pxStream->uClusterDurationMs = uDurationMs;
+        pxStream->uClusterSizeLimit = uSize;
+
+        prvStreamUnlock(pxStream);
     }
+
+    return res;
 }
 
-int Kvs_streamGetMkvEbmlSegHdr(StreamHandle xStreamHandle, uint8_t **ppMkvHeader, size_t *puMkvHeaderLen)
+int Kvs_streamSetWakeup(StreamHandle xStreamHandle, WakeupHandle xWakeup)
 {
     int res = KVS_ERRNO_NONE;
     Stream_t *pxStream = xStreamHandle;
 
-    if (pxStream == NULL || ppMkvHeader == NULL || puMkvHeaderLen == NULL)
+    if (pxStream == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
         LogError("Invalid argument");
     }
-    else if (pxStream->pMkvEbmlSeg == NULL || pxStream->uMkvEbmlSegLen == 0)
+    else if (prvStreamLock(pxStream) != LOCK_OK)
     {
-        res = KVS_ERROR_STREAM_MKV_IS_NOT_INITIALIZED;
-        LogError("Mkv EBML and segment are not initialized");
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
     }
     else
     {
-        *ppMkvHeader = (uint8_t *)(pxStream->pMkvEbmlSeg);
-        *puMkvHeaderLen = pxStream->uMkvEbmlSegLen;
+        pxStream->xWakeup = xWakeup;
+
+        prvStreamUnlock(pxStream);
     }
 
     return res;
@@ -190,131 +1060,50 @@ int Kvs_streamGetMkvEbmlSegHdr(StreamHandle xStreamHandle, uint8_t **ppMkvHeader
 
 DataFrameHandle Kvs_streamAddDataFrame(StreamHandle xStreamHandle, DataFrameIn_t *pxDataFrameIn)
 {
-    int res = KVS_ERRNO_NONE;
     Stream_t *pxStream = xStreamHandle;
     DataFrame_t *pxDataFrame = NULL;
+    DataFrameIn_t xDataFrameIn = {0};
     size_t uMkvHdrLen = 0;
-    DataFrame_t *pxDataFrameCurrent = NULL;
-    PDLIST_ENTRY pxListHead = NULL;
-    PDLIST_ENTRY pxListItem = NULL;
-    bool bListAdded = false;
-    bool bNeedCorrectDeltaTimestamp = false;
-    bool bCorrectDeltaTimestampStarted = false;
-    uint64_t uClusterTimestamp = 0;
-    uint16_t uDeltaTimestampMs = 0;
 
-    if (pxStream == NULL || pxDataFrameIn == NULL)
+    if (pxStream == NULL || pxDataFrameIn == NULL || pxDataFrameIn->xTrackType < TRACK_VIDEO || pxDataFrameIn->xTrackType > TRACK_MAX)
     {
-        res = KVS_ERROR_INVALID_ARGUMENT;
         LogError("Invalid argument");
     }
-    else if ((uMkvHdrLen = Mkv_getClusterHdrLen(pxDataFrameIn->xClusterType)) == 0)
+    else if (Mkv_getClusterHdrLen(pxDataFrameIn->xClusterType) == 0)
     {
-        res = KVS_ERROR_INVALID_CLUSTER_HDR_LEN;
         LogError("Invalid cluster len");
     }
-    else if ((pxDataFrame = (DataFrame_t *)kvsMalloc(sizeof(DataFrame_t) + uMkvHdrLen)) == NULL)
+    else if (prvStreamLock(pxStream) != LOCK_OK)
     {
-        res = KVS_ERROR_OUT_OF_MEMORY;
-        LogError("OOM: pxDataFrame");
-    }
-    else if (Lock(pxStream->xLock) != LOCK_OK)
-    {
-        res = KVS_ERROR_LOCK_ERROR;
         LogError("Failed to Lock");
     }
     else
     {
-        memset(pxDataFrame, 0, sizeof(DataFrame_t));
-        memcpy(pxDataFrame, pxDataFrameIn, sizeof(DataFrameIn_t));
-        DList_InitializeListHead(&(pxDataFrame->xClusterEntry));
-        DList_InitializeListHead(&(pxDataFrame->xDataFrameEntry));
-        pxDataFrame->uMkvHdrLen = uMkvHdrLen;
-        pxDataFrame->pMkvHdr = (char *)pxDataFrame + sizeof(DataFrame_t);
-        uClusterTimestamp = pxStream->uEarliestClusterTimestamp;
+        memcpy(&xDataFrameIn, pxDataFrameIn, sizeof(DataFrameIn_t));
+        prvSplitCluster(pxStream, &xDataFrameIn);
+        uMkvHdrLen = Mkv_getClusterHdrLen(xDataFrameIn.xClusterType);
 
-        pxListHead = &(pxStream->xDataFramePending);
-        pxListItem = pxListHead->Flink;
-        while (pxListItem != pxListHead)
+        if (pxStream->bLockFree)
         {
-            pxDataFrameCurrent = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
-            if (pxDataFrame->xDataFrameIn.uTimestampMs < pxDataFrameCurrent->xDataFrameIn.uTimestampMs ||
-                ((pxDataFrame->xDataFrameIn.uTimestampMs == pxDataFrameCurrent->xDataFrameIn.uTimestampMs) && (pxDataFrame->xDataFrameIn.xTrackType == TRACK_VIDEO)))
-            {
-                DList_InsertTailList(pxListItem, &(pxDataFrame->xDataFrameEntry));
-                uDeltaTimestampMs = (uint16_t)(pxDataFrame->xDataFrameIn.uTimestampMs - uClusterTimestamp);
-                if (pxDataFrame->xDataFrameIn.xClusterType == MKV_CLUSTER)
-                {
-                    uDeltaTimestampMs = 0;
-
-                    /* If we insert a cluster head, then the following frames's delta timestamp needs updates. */
-                    bNeedCorrectDeltaTimestamp = true;
-                }
-                bListAdded = true;
-                break;
-            }
-            if (pxDataFrameCurrent->xDataFrameIn.xClusterType == MKV_CLUSTER)
-            {
-                uClusterTimestamp = pxDataFrameCurrent->xDataFrameIn.uTimestampMs;
-            }
-            pxListItem = pxListItem->Flink;
+            pxDataFrame = prvLockFreeAddDataFrame(pxStream, &xDataFrameIn, uMkvHdrLen);
         }
-        if (!bListAdded)
+        else if ((pxDataFrame = prvDataFrameAlloc(pxStream, uMkvHdrLen)) != NULL)
         {
-            uDeltaTimestampMs = (uint16_t)(pxDataFrame->xDataFrameIn.uTimestampMs - uClusterTimestamp);
-            DList_InsertTailList(&(pxStream->xDataFramePending), &(pxDataFrame->xDataFrameEntry));
-            bListAdded = true;
+            prvDataFrameInit(pxStream, pxDataFrame, &xDataFrameIn, uMkvHdrLen);
+            prvInsertDataFrame(pxStream, pxDataFrame);
         }
 
-        Mkv_initializeClusterHdr(
-            (uint8_t *)(pxDataFrame->pMkvHdr),
-            pxDataFrame->uMkvHdrLen,
-            pxDataFrameIn->xClusterType,
-            pxDataFrameIn->uDataLen,
-            pxDataFrameIn->xTrackType,
-            pxDataFrameIn->bIsKeyFrame,
-            pxDataFrameIn->uTimestampMs,
-            uDeltaTimestampMs);
-
-        if (bNeedCorrectDeltaTimestamp)
+        /* A lock-free descriptor belongs to the consumer once it's pushed, so the copy is accounted instead. */
+        if (pxDataFrame != NULL)
         {
-            bCorrectDeltaTimestampStarted = false;
-            pxListHead = &(pxStream->xDataFramePending);
-            pxListItem = pxListHead->Flink;
-            while (pxListItem != pxListHead)
-            {
-                pxDataFrameCurrent = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
-                if (pxDataFrameCurrent->xDataFrameIn.xClusterType == MKV_CLUSTER)
-                {
-                    uClusterTimestamp = pxDataFrameCurrent->xDataFrameIn.uTimestampMs;
-                    bCorrectDeltaTimestampStarted = true;
-                }
-                if (bCorrectDeltaTimestampStarted)
-                {
-                    uDeltaTimestampMs = (uint16_t)(pxDataFrameCurrent->xDataFrameIn.uTimestampMs - uClusterTimestamp);
-                    Mkv_initializeClusterHdr(
-                        (uint8_t *)(pxDataFrameCurrent->pMkvHdr),
-                        pxDataFrameCurrent->uMkvHdrLen,
-                        pxDataFrameCurrent->xDataFrameIn.xClusterType,
-                        pxDataFrameCurrent->xDataFrameIn.uDataLen,
-                        pxDataFrameCurrent->xDataFrameIn.xTrackType,
-                        pxDataFrameCurrent->xDataFrameIn.bIsKeyFrame,
-                        pxDataFrameCurrent->xDataFrameIn.uTimestampMs,
-                        uDeltaTimestampMs);
-                }
-                pxListItem = pxListItem->Flink;
-            }
+            prvUpdateVideoCluster(pxStream, &xDataFrameIn);
         }
 
-        Unlock(pxStream->xLock);
-    }
+        prvStreamUnlock(pxStream);
 
-    if (res != KVS_ERRNO_NONE)
-    {
-        if (pxDataFrame != NULL)
+        if (pxDataFrame != NULL && pxStream->xWakeup != NULL)
         {
-            kvsFree(pxDataFrame);
-            pxDataFrame = NULL;
+            wakeupSignal(pxStream->xWakeup);
         }
     }
 
@@ -338,17 +1127,17 @@ bool Kvs_streamIsEmpty(StreamHandle xStreamHandle)
 
     if (pxStream != NULL)
     {
-        if (Lock(pxStream->xLock) != LOCK_OK)
+        if (prvStreamLock(pxStream) != LOCK_OK)
         {
             LogError("Failed to Lock");
         }
         else
         {
-            if (!DList_IsListEmpty(&(pxStream->xDataFramePending)))
+            if ((pxStream->bLockFree && prvGetNextTrackRing(pxStream) != NULL) || (!pxStream->bLockFree && prvGetNextTrackQueue(pxStream) != NULL))
             {
                 bRes = false;
             }
-            Unlock(pxStream->xLock);
+            prvStreamUnlock(pxStream);
         }
     }
 
@@ -359,33 +1148,25 @@ bool Kvs_streamAvailOnTrack(StreamHandle xStreamHandle, TrackType_t xTrackType)
 {
     bool bRes = false;
     Stream_t *pxStream = xStreamHandle;
-    PDLIST_ENTRY pxListHead = NULL;
-    PDLIST_ENTRY pxListItem = NULL;
-    DataFrame_t *pxDataFrame = NULL;
 
-    if (pxStream != NULL)
+    if (pxStream != NULL && xTrackType >= TRACK_VIDEO && xTrackType <= TRACK_MAX)
     {
-        if (Lock(pxStream->xLock) != LOCK_OK)
+        if (prvStreamLock(pxStream) != LOCK_OK)
         {
             LogError("Failed to Lock");
         }
         else
         {
-            pxListHead = &(pxStream->xDataFramePending);
-            pxListItem = pxListHead->Flink;
-            while (pxListItem != pxListHead)
+            if (pxStream->bLockFree)
             {
-                pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
-                if (pxDataFrame->xDataFrameIn.xTrackType == xTrackType)
-                {
-                    bRes = true;
-                    break;
-                }
-
-                pxListItem = pxListItem->Flink;
+                bRes = (prvSpscRingFront(&(pxStream->xPendingRing[TRACK_QUEUE_INDEX(xTrackType)])) != NULL);
+            }
+            else if (!DList_IsListEmpty(&(pxStream->xDataFramePending[TRACK_QUEUE_INDEX(xTrackType)])))
+            {
+                bRes = true;
             }
 
-            Unlock(pxStream->xLock);
+            prvStreamUnlock(pxStream);
         }
     }
 
@@ -396,37 +1177,270 @@ int Kvs_streamMemStatTotal(StreamHandle xStreamHandle, size_t *puMemTotal)
 {
     int res = KVS_ERRNO_NONE;
     Stream_t *pxStream = xStreamHandle;
-    DataFrame_t *pxDataFrame = NULL;
-    PDLIST_ENTRY pxListHead = NULL;
-    PDLIST_ENTRY pxListItem = NULL;
-    size_t uMemTotal = 0;
 
     if (pxStream == NULL || puMemTotal == NULL)
     {
         res = KVS_ERROR_INVALID_ARGUMENT;
         LogError("Invalid argument");
     }
-    else if (Lock(pxStream->xLock) != LOCK_OK)
+    else if (prvStreamLock(pxStream) != LOCK_OK)
     {
         res = KVS_ERROR_LOCK_ERROR;
         LogError("Failed to Lock");
     }
     else
     {
-        uMemTotal += sizeof(Stream_t) + pxStream->uMkvEbmlSegLen;
+        *puMemTotal = prvStreamMemTotal(pxStream);
+        prvStreamUnlock(pxStream);
+    }
 
-        pxListHead = &(pxStream->xDataFramePending);
-        pxListItem = pxListHead->Flink;
-        while (pxListItem != pxListHead)
+    return res;
+}
+
+int Kvs_streamStatOnTrack(StreamHandle xStreamHandle, TrackType_t xTrackType, size_t *puFrameCnt, size_t *puMemTotal)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+
+    if (pxStream == NULL || xTrackType < TRACK_VIDEO || xTrackType > TRACK_MAX || puFrameCnt == NULL || puMemTotal == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
+    {
+        *puFrameCnt = ATOMIC_LOAD_RELAXED(&(pxStream->xTrackStat[TRACK_QUEUE_INDEX(xTrackType)].uFrameCnt));
+        *puMemTotal = ATOMIC_LOAD_RELAXED(&(pxStream->xTrackStat[TRACK_QUEUE_INDEX(xTrackType)].uMemTotal));
+        prvStreamUnlock(pxStream);
+    }
+
+    return res;
+}
+
+int Kvs_streamPopUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+    PDLIST_ENTRY pxListHead = NULL;
+    SpscRing_t *pxRing = NULL;
+    size_t uCnt = 0;
+
+    if (pxStream == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
+    {
+        while (uCnt < uMaxCnt && prvStreamMemTotal(pxStream) > uMemLimit)
         {
-            pxDataFrame = containingRecord(pxListItem, DataFrame_t, xDataFrameEntry);
-            uMemTotal += pxDataFrame->xDataFrameIn.uDataLen;
-            uMemTotal += sizeof(DataFrame_t) + pxDataFrame->uMkvHdrLen;
-            pxListItem = pxListItem->Flink;
+            if (pxStream->bLockFree && (pxRing = prvGetNextTrackRing(pxStream)) != NULL)
+            {
+                pxDataFrameHandles[uCnt++] = prvLockFreeGetDataFrame(pxStream, pxRing, false);
+            }
+            else if (!pxStream->bLockFree && (pxListHead = prvGetNextTrackQueue(pxStream)) != NULL)
+            {
+                pxDataFrameHandles[uCnt++] = prvPopDataFrame(pxStream, pxListHead);
+            }
+            else
+            {
+                break;
+            }
         }
 
-        *puMemTotal = uMemTotal;
-        Unlock(pxStream->xLock);
+        *puCnt = uCnt;
+        prvStreamUnlock(pxStream);
+    }
+
+    return res;
+}
+
+int Kvs_streamPopBatch(StreamHandle xStreamHandle, size_t uMaxCnt, size_t uMaxBytes, bool bAllTracks, DataFrameHandle *pxDataFrameHandles, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+    PDLIST_ENTRY pxListHead = NULL;
+    SpscRing_t *pxRing = NULL;
+    DataFrame_t *pxDataFrame = NULL;
+    size_t uBytes = 0;
+    size_t uCnt = 0;
+
+    if (pxStream == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
+    {
+        while (uCnt < uMaxCnt && prvIsReadyToPop(pxStream, bAllTracks))
+        {
+            if (pxStream->bLockFree)
+            {
+                pxRing = prvGetNextTrackRing(pxStream);
+                pxDataFrame = prvSpscRingFront(pxRing);
+            }
+            else
+            {
+                pxListHead = prvGetNextTrackQueue(pxStream);
+                pxDataFrame = containingRecord(pxListHead->Flink, DataFrame_t, xDataFrameEntry);
+            }
+
+            /* The first frame is always popped, even if it's larger than the limit. */
+            if (uCnt > 0 && uBytes + pxDataFrame->uMkvHdrLen + pxDataFrame->xDataFrameIn.uDataLen > uMaxBytes)
+            {
+                break;
+            }
+            uBytes += pxDataFrame->uMkvHdrLen + pxDataFrame->xDataFrameIn.uDataLen;
+
+            if (pxStream->bLockFree)
+            {
+                pxDataFrameHandles[uCnt++] = prvLockFreeGetDataFrame(pxStream, pxRing, false);
+            }
+            else
+            {
+                pxDataFrameHandles[uCnt++] = prvPopDataFrame(pxStream, pxListHead);
+            }
+        }
+
+        *puCnt = uCnt;
+        prvStreamUnlock(pxStream);
+    }
+
+    return res;
+}
+
+int Kvs_streamPopGopUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, bool bKeepAudio, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+    DataFrame_t *pxGopEnd = NULL;
+    size_t uCnt = 0;
+
+    if (pxStream == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
+    {
+        /* A GOP is evicted as a whole, and the next one is considered only after all its frames are handed out. */
+        if (DList_IsListEmpty(&(pxStream->xDataFrameEvicted)) && prvStreamMemTotal(pxStream) > uMemLimit)
+        {
+            if (pxStream->bLockFree && (pxGopEnd = prvLockFreeGetGopEnd(pxStream)) != NULL)
+            {
+                prvLockFreeEvictGop(pxStream, pxGopEnd, bKeepAudio);
+            }
+            else if (!pxStream->bLockFree && (pxGopEnd = prvGetGopEnd(pxStream)) != NULL)
+            {
+                prvEvictGop(pxStream, pxGopEnd, bKeepAudio);
+            }
+            prvSortEvicted(pxStream);
+        }
+
+        while (uCnt < uMaxCnt && !DList_IsListEmpty(&(pxStream->xDataFrameEvicted)))
+        {
+            pxDataFrameHandles[uCnt++] = containingRecord(DList_RemoveHeadList(&(pxStream->xDataFrameEvicted)), DataFrame_t, xDataFrameEntry);
+        }
+
+        *puCnt = uCnt;
+        prvStreamUnlock(pxStream);
+    }
+
+    return res;
+}
+
+/* Whether the frame can be dropped: nothing refers to it, and the delta timestamps of the other frames don't depend on it. */
+static bool prvDataFrameIsDroppable(DataFrame_t *pxDataFrame)
+{
+    return pxDataFrame->xDataFrameIn.xDropClass == DATA_FRAME_DROPPABLE && pxDataFrame->xDataFrameIn.xClusterType != MKV_CLUSTER;
+}
+
+int Kvs_streamPopDroppableUntilMem(StreamHandle xStreamHandle, size_t uMemLimit, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    Stream_t *pxStream = xStreamHandle;
+    PDLIST_ENTRY pxListItems[TRACK_QUEUE_COUNT] = {NULL};
+    DataFrame_t *pxDataFrame = NULL;
+    DataFrame_t *pxOldest = NULL;
+    size_t uOldestIdx = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    if (pxStream == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if (prvStreamLock(pxStream) != LOCK_OK)
+    {
+        res = KVS_ERROR_LOCK_ERROR;
+        LogError("Failed to Lock");
+    }
+    else
+    {
+        for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+        {
+            pxListItems[i] = pxStream->xDataFramePending[i].Flink;
+        }
+
+        /* Merge the droppable frames of the queues by timestamp, so the oldest one is popped first whatever its track is. */
+        while (!pxStream->bLockFree && uCnt < uMaxCnt && pxStream->uDroppableCnt > 0 && prvStreamMemTotal(pxStream) > uMemLimit)
+        {
+            pxOldest = NULL;
+            for (i = 0; i < TRACK_QUEUE_COUNT; i++)
+            {
+                while (pxListItems[i] != &(pxStream->xDataFramePending[i]) &&
+                       !prvDataFrameIsDroppable(containingRecord(pxListItems[i], DataFrame_t, xDataFrameEntry)))
+                {
+                    pxListItems[i] = pxListItems[i]->Flink;
+                }
+
+                if (pxListItems[i] != &(pxStream->xDataFramePending[i]))
+                {
+                    pxDataFrame = containingRecord(pxListItems[i], DataFrame_t, xDataFrameEntry);
+                    if (pxOldest == NULL || pxDataFrame->xDataFrameIn.uTimestampMs < pxOldest->xDataFrameIn.uTimestampMs)
+                    {
+                        pxOldest = pxDataFrame;
+                        uOldestIdx = i;
+                    }
+                }
+            }
+
+            if (pxOldest == NULL)
+            {
+                break;
+            }
+
+            pxListItems[uOldestIdx] = pxListItems[uOldestIdx]->Flink;
+            DList_RemoveEntryList(&(pxOldest->xDataFrameEntry));
+            ATOMIC_FETCH_SUB(&(pxStream->xTrackStat[uOldestIdx].uFrameCnt), 1);
+            ATOMIC_FETCH_SUB(&(pxStream->xTrackStat[uOldestIdx].uMemTotal), prvDataFrameMemSize(pxOldest));
+            pxStream->uDroppableCnt--;
+            pxDataFrameHandles[uCnt++] = pxOldest;
+        }
+
+        *puCnt = uCnt;
+        prvStreamUnlock(pxStream);
     }
 
     return res;
@@ -532,7 +1546,7 @@ int Kvs_dataFrameAddTags(DataFrameHandle xDataFrameHandle, MkvTag_t* tagsList, s
 
         // Allocate and create new combined header
         size_t newHeaderLen = tagsBuffer.size + originalHeaderLen;
-        uint8_t *newHeader = (uint8_t *)malloc(newHeaderLen);
+        uint8_t *newHeader = (uint8_t *)kvsMalloc(newHeaderLen);
         if (newHeader == NULL)
         {
             free(tagsBuffer.buffer);
@@ -564,9 +1578,33 @@ int Kvs_dataFrameAddTags(DataFrameHandle xDataFrameHandle, MkvTag_t* tagsList, s
 void Kvs_dataFrameTerminate(DataFrameHandle xDataFrameHandle)
 {
     DataFrame_t *pxDataFrame = xDataFrameHandle;
+    Stream_t *pxStream = NULL;
 
     if (pxDataFrame != NULL)
     {
-        kvsFree(pxDataFrame);
+        /* The MKV header has been replaced if tags were added. */
+        if (pxDataFrame->pMkvHdr != (char *)pxDataFrame + sizeof(DataFrame_t))
+        {
+            kvsFree(pxDataFrame->pMkvHdr);
+        }
+
+        if ((pxStream = pxDataFrame->pxPoolOwner) == NULL)
+        {
+            kvsFree(pxDataFrame);
+        }
+        else if (pxStream->bLockFree)
+        {
+            /* Frames of a lock-free stream are terminated by its consumer, which is the only producer of the free ring. */
+            prvSpscRingPush(&(pxStream->xFreeRing[TRACK_QUEUE_INDEX(pxDataFrame->xDataFrameIn.xTrackType)]), pxDataFrame);
+        }
+        else if (Lock(pxStream->xLock) != LOCK_OK)
+        {
+            LogError("Failed to Lock");
+        }
+        else
+        {
+            DList_InsertHeadList(&(pxStream->xDataFramePool), &(pxDataFrame->xDataFrameEntry));
+            Unlock(pxStream->xLock);
+        }
     }
 }
@@ -0,0 +1,320 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+#include "kvs/mkv_generator.h"
+#include "kvs/stream_retention.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+
+/* Initial number of slots, doubled whenever the window is full */
+#define RETENTION_INITIAL_CAPACITY (64)
+
+typedef struct RetainedFrame
+{
+    DataFrameHandle xDataFrameHandle;
+    uint64_t uClusterTimestampMs;
+    size_t uSize;
+} RetainedFrame_t;
+
+typedef struct StreamRetention
+{
+    size_t uMemLimit;
+
+    /* Ring of kept frames from the oldest to the newest */
+    RetainedFrame_t *pxFrames;
+    size_t uCapacity;
+    size_t uHead;
+    size_t uCnt;
+    size_t uSize;
+
+    /* Number of kept frames from the head which are sent on the current connection */
+    size_t uReplayCnt;
+
+    /* The cluster of the newest kept frame */
+    uint64_t uClusterTimestampMs;
+} StreamRetention_t;
+
+static RetainedFrame_t *prvRetainedFrameAt(StreamRetention_t *pxRetention, size_t uIdx)
+{
+    return &(pxRetention->pxFrames[(pxRetention->uHead + uIdx) % pxRetention->uCapacity]);
+}
+
+static bool prvIsClusterFrame(DataFrameHandle xDataFrameHandle)
+{
+    return ((DataFrameIn_t *)xDataFrameHandle)->xClusterType == MKV_CLUSTER;
+}
+
+/* Double the ring, and move the kept frames to the start of the new one. */
+static int prvRetentionGrow(StreamRetention_t *pxRetention)
+{
+    int res = KVS_ERRNO_NONE;
+    size_t uCapacity = (pxRetention->uCapacity == 0) ? RETENTION_INITIAL_CAPACITY : pxRetention->uCapacity * 2;
+    RetainedFrame_t *pxFrames = NULL;
+    size_t i = 0;
+
+    if ((pxFrames = (RetainedFrame_t *)kvsMalloc(uCapacity * sizeof(RetainedFrame_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxFrames");
+    }
+    else
+    {
+        for (i = 0; i < pxRetention->uCnt; i++)
+        {
+            pxFrames[i] = *prvRetainedFrameAt(pxRetention, i);
+        }
+        if (pxRetention->pxFrames != NULL)
+        {
+            kvsFree(pxRetention->pxFrames);
+        }
+        pxRetention->pxFrames = pxFrames;
+        pxRetention->uCapacity = uCapacity;
+        pxRetention->uHead = 0;
+    }
+
+    return res;
+}
+
+static DataFrameHandle prvRetentionPopHead(StreamRetention_t *pxRetention)
+{
+    RetainedFrame_t *pxFrame = prvRetainedFrameAt(pxRetention, 0);
+
+    pxRetention->uHead = (pxRetention->uHead + 1) % pxRetention->uCapacity;
+    pxRetention->uCnt--;
+    pxRetention->uSize -= pxFrame->uSize;
+    if (pxRetention->uReplayCnt > 0)
+    {
+        pxRetention->uReplayCnt--;
+    }
+
+    return pxFrame->xDataFrameHandle;
+}
+
+StreamRetentionHandle Kvs_streamRetentionCreate(size_t uMemLimit)
+{
+    StreamRetention_t *pxRetention = NULL;
+
+    if ((pxRetention = (StreamRetention_t *)kvsMalloc(sizeof(StreamRetention_t))) == NULL)
+    {
+        LogError("OOM: pxRetention");
+    }
+    else
+    {
+        memset(pxRetention, 0, sizeof(StreamRetention_t));
+        pxRetention->uMemLimit = uMemLimit;
+    }
+
+    return pxRetention;
+}
+
+void Kvs_streamRetentionTerminate(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+
+    if (pxRetention != NULL)
+    {
+        if (pxRetention->uCnt > 0)
+        {
+            LogError("%zu retained frames are not terminated", pxRetention->uCnt);
+        }
+        if (pxRetention->pxFrames != NULL)
+        {
+            kvsFree(pxRetention->pxFrames);
+        }
+        kvsFree(pxRetention);
+    }
+}
+
+int Kvs_streamRetentionAdd(StreamRetentionHandle xStreamRetentionHandle, DataFrameHandle xDataFrameHandle, bool *pbIsRetained)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+    RetainedFrame_t *pxFrame = NULL;
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+
+    if (pxRetention == NULL || xDataFrameHandle == NULL || pbIsRetained == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        *pbIsRetained = false;
+
+        if (pxRetention->uCnt == 0 && !prvIsClusterFrame(xDataFrameHandle))
+        {
+            /* The rest of a cluster whose head isn't kept can't be replayed. */
+        }
+        else if ((res = Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen)) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to get data frame content");
+            /* Propagate the res error */
+        }
+        else if (pxRetention->uCnt == pxRetention->uCapacity && (res = prvRetentionGrow(pxRetention)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+        }
+        else
+        {
+            if (prvIsClusterFrame(xDataFrameHandle))
+            {
+                pxRetention->uClusterTimestampMs = ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs;
+            }
+
+            pxFrame = prvRetainedFrameAt(pxRetention, pxRetention->uCnt);
+            pxFrame->xDataFrameHandle = xDataFrameHandle;
+            pxFrame->uClusterTimestampMs = pxRetention->uClusterTimestampMs;
+            pxFrame->uSize = uMkvHeaderLen + uDataLen;
+
+            /* It has been sent, so it's not replayed on the current connection. */
+            if (pxRetention->uReplayCnt == pxRetention->uCnt)
+            {
+                pxRetention->uReplayCnt++;
+            }
+            pxRetention->uCnt++;
+            pxRetention->uSize += pxFrame->uSize;
+            *pbIsRetained = true;
+        }
+    }
+
+    return res;
+}
+
+void Kvs_streamRetentionRewind(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+
+    if (pxRetention != NULL)
+    {
+        pxRetention->uReplayCnt = 0;
+    }
+}
+
+DataFrameHandle Kvs_streamRetentionNextReplay(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    if (pxRetention != NULL && pxRetention->uReplayCnt < pxRetention->uCnt)
+    {
+        xDataFrameHandle = prvRetainedFrameAt(pxRetention, pxRetention->uReplayCnt)->xDataFrameHandle;
+        pxRetention->uReplayCnt++;
+    }
+
+    return xDataFrameHandle;
+}
+
+bool Kvs_streamRetentionIsReplayDone(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+
+    return (pxRetention == NULL || pxRetention->uReplayCnt == pxRetention->uCnt);
+}
+
+int Kvs_streamRetentionPopPersisted(StreamRetentionHandle xStreamRetentionHandle, uint64_t uFragmentTimecode, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+    size_t uCnt = 0;
+
+    if (pxRetention == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        /* Fragments are persisted in order, so every older cluster is persisted too. */
+        while (uCnt < uMaxCnt && pxRetention->uCnt > 0 && prvRetainedFrameAt(pxRetention, 0)->uClusterTimestampMs <= uFragmentTimecode)
+        {
+            pxDataFrameHandles[uCnt++] = prvRetentionPopHead(pxRetention);
+        }
+        *puCnt = uCnt;
+    }
+
+    return res;
+}
+
+int Kvs_streamRetentionPopUntilMem(StreamRetentionHandle xStreamRetentionHandle, DataFrameHandle *pxDataFrameHandles, size_t uMaxCnt, size_t *puCnt)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+    size_t uCnt = 0;
+
+    if (pxRetention == NULL || pxDataFrameHandles == NULL || puCnt == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        /* The rest of an evicted cluster is evicted too, so the window still starts at a cluster. */
+        while (uCnt < uMaxCnt && pxRetention->uCnt > 0 &&
+               (pxRetention->uSize > pxRetention->uMemLimit || !prvIsClusterFrame(prvRetainedFrameAt(pxRetention, 0)->xDataFrameHandle)))
+        {
+            pxDataFrameHandles[uCnt++] = prvRetentionPopHead(pxRetention);
+        }
+        *puCnt = uCnt;
+    }
+
+    return res;
+}
+
+DataFrameHandle Kvs_streamRetentionPop(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    if (pxRetention != NULL && pxRetention->uCnt > 0)
+    {
+        xDataFrameHandle = prvRetentionPopHead(pxRetention);
+    }
+
+    return xDataFrameHandle;
+}
+
+bool Kvs_streamRetentionIsEmpty(StreamRetentionHandle xStreamRetentionHandle)
+{
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+
+    return (pxRetention == NULL || pxRetention->uCnt == 0);
+}
+
+int Kvs_streamRetentionStat(StreamRetentionHandle xStreamRetentionHandle, size_t *puFrameCnt, size_t *puSize)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamRetention_t *pxRetention = xStreamRetentionHandle;
+
+    if (pxRetention == NULL || puFrameCnt == NULL || puSize == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+    }
+    else
+    {
+        *puFrameCnt = pxRetention->uCnt;
+        *puSize = pxRetention->uSize;
+    }
+
+    return res;
+}
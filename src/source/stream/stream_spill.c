@@ -0,0 +1,475 @@
+/*
+ * Copyright 2021 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Third party headers */
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/doublylinkedlist.h"
+#include "azure_c_shared_utility/xlogging.h"
+
+/* Public headers */
+#include "kvs/errors.h"
+#include "kvs/mkv_generator.h"
+#include "kvs/stream_spill.h"
+
+/* Internal headers */
+#include "os/allocator.h"
+
+/* Records are aligned so the record headers in the mapping can be accessed directly. */
+#define SPILL_RECORD_ALIGN(x) (((x) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+/* The delta timestamp of a simple block is a signed 16 bits value. */
+#define MKV_DELTA_TIMESTAMP_MAX (INT16_MAX)
+
+#define SPILL_SEGMENT_PATH_MAX (256)
+
+typedef struct SpillRecordHdr
+{
+    uint64_t uTimestampMs;
+    uint32_t uDataLen;
+    uint8_t uTrackType;
+    uint8_t uClusterType;
+    uint8_t bIsKeyFrame;
+    uint8_t uReserved;
+} SpillRecordHdr_t;
+
+typedef struct SpillSegment
+{
+    DLIST_ENTRY xSegmentEntry;
+
+    char pcPath[SPILL_SEGMENT_PATH_MAX];
+    int xFd;
+
+    /* Read-only mapping of the whole segment. Records are written with pwrite(), and read from the mapping. */
+    uint8_t *pMap;
+    size_t uMapSize;
+
+    size_t uWriteOffset;
+    size_t uReadOffset;
+} SpillSegment_t;
+
+typedef struct StreamSpill
+{
+    char *pcDir;
+    size_t uSegmentSize;
+    size_t uMaxSegmentCnt;
+    unsigned int uSegmentSeq;
+
+    /* Segments from the oldest to the newest. Frames are read from the head and appended to the tail. */
+    DLIST_ENTRY xSegments;
+    size_t uSegmentCnt;
+
+    /* Frames which are not read yet */
+    size_t uFrameCnt;
+    size_t uSize;
+
+    /* Simple blocks are appended only if the cluster they belong to is in the spill. */
+    bool bClusterOpen;
+    uint64_t uAppendClusterTimestamp;
+
+    /* The MKV header of the frame which is read last */
+    uint64_t uReadClusterTimestamp;
+    uint8_t *pMkvHdr;
+    size_t uMkvHdrSize;
+} StreamSpill_t;
+
+static void prvSpillSegmentTerminate(SpillSegment_t *pxSegment)
+{
+    if (pxSegment->pMap != NULL)
+    {
+        munmap(pxSegment->pMap, pxSegment->uMapSize);
+    }
+    if (pxSegment->xFd >= 0)
+    {
+        close(pxSegment->xFd);
+        unlink(pxSegment->pcPath);
+    }
+    kvsFree(pxSegment);
+}
+
+/* Create a new segment file at the tail of the spill. Its name is made unique by mkstemp(), which creates it with
+ * O_EXCL, so spills of other streams or processes in the same directory never open the same file. */
+static int prvSpillSegmentCreate(StreamSpill_t *pxSpill)
+{
+    int res = KVS_ERRNO_NONE;
+    SpillSegment_t *pxSegment = NULL;
+    void *pMap = NULL;
+
+    if (pxSpill->uSegmentCnt >= pxSpill->uMaxSegmentCnt)
+    {
+        res = KVS_ERROR_STREAM_SPILL_IS_FULL;
+    }
+    else if ((pxSegment = (SpillSegment_t *)kvsMalloc(sizeof(SpillSegment_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: spill segment");
+    }
+    else
+    {
+        memset(pxSegment, 0, sizeof(SpillSegment_t));
+        pxSegment->xFd = -1;
+        pxSegment->uMapSize = pxSpill->uSegmentSize;
+
+        if (snprintf(pxSegment->pcPath, SPILL_SEGMENT_PATH_MAX, "%s/kvs_spill_%ld_%u_XXXXXX", pxSpill->pcDir, (long)getpid(), pxSpill->uSegmentSeq) >=
+            SPILL_SEGMENT_PATH_MAX)
+        {
+            res = KVS_ERROR_INVALID_ARGUMENT;
+            LogError("Spill directory is too long");
+        }
+        else if ((pxSegment->xFd = mkstemp(pxSegment->pcPath)) < 0)
+        {
+            res = KVS_ERROR_STREAM_SPILL_IO_ERROR;
+            LogError("Failed to open %s", pxSegment->pcPath);
+        }
+        /* The file has its full size before it's mapped, so no page of the mapping is beyond the end of file. */
+        else if (ftruncate(pxSegment->xFd, (off_t)(pxSegment->uMapSize)) != 0 ||
+                 (pMap = mmap(NULL, pxSegment->uMapSize, PROT_READ, MAP_SHARED, pxSegment->xFd, 0)) == MAP_FAILED)
+        {
+            res = KVS_ERROR_STREAM_SPILL_IO_ERROR;
+            LogError("Failed to map %s", pxSegment->pcPath);
+        }
+        else
+        {
+            pxSegment->pMap = (uint8_t *)pMap;
+            DList_InsertTailList(&(pxSpill->xSegments), &(pxSegment->xSegmentEntry));
+            pxSpill->uSegmentCnt++;
+            pxSpill->uSegmentSeq++;
+        }
+    }
+
+    if (res != KVS_ERRNO_NONE && pxSegment != NULL)
+    {
+        prvSpillSegmentTerminate(pxSegment);
+    }
+
+    return res;
+}
+
+/* Write a record at the end of a segment. */
+static int prvSpillSegmentWrite(SpillSegment_t *pxSegment, SpillRecordHdr_t *pxRecordHdr, const char *pData, size_t uRecordLen)
+{
+    int res = KVS_ERRNO_NONE;
+    off_t xOffset = (off_t)(pxSegment->uWriteOffset);
+
+    if (pwrite(pxSegment->xFd, pxRecordHdr, sizeof(SpillRecordHdr_t), xOffset) != (ssize_t)sizeof(SpillRecordHdr_t) ||
+        pwrite(pxSegment->xFd, pData, pxRecordHdr->uDataLen, xOffset + (off_t)sizeof(SpillRecordHdr_t)) != (ssize_t)(pxRecordHdr->uDataLen))
+    {
+        res = KVS_ERROR_STREAM_SPILL_IO_ERROR;
+        LogError("Failed to write %s", pxSegment->pcPath);
+    }
+    else
+    {
+        pxSegment->uWriteOffset += uRecordLen;
+    }
+
+    return res;
+}
+
+/* Get the oldest record which is not read. Segments which are fully read and written are removed first. */
+static SpillRecordHdr_t *prvSpillPeekRecord(StreamSpill_t *pxSpill)
+{
+    SpillSegment_t *pxSegment = NULL;
+    SpillRecordHdr_t *pxRecordHdr = NULL;
+
+    while (!DList_IsListEmpty(&(pxSpill->xSegments)))
+    {
+        pxSegment = containingRecord(pxSpill->xSegments.Flink, SpillSegment_t, xSegmentEntry);
+        if (pxSegment->uReadOffset < pxSegment->uWriteOffset)
+        {
+            pxRecordHdr = (SpillRecordHdr_t *)(pxSegment->pMap + pxSegment->uReadOffset);
+            break;
+        }
+        else if (pxSegment->xSegmentEntry.Flink == &(pxSpill->xSegments))
+        {
+            /* The newest segment is still written. */
+            break;
+        }
+        else
+        {
+            DList_RemoveEntryList(&(pxSegment->xSegmentEntry));
+            pxSpill->uSegmentCnt--;
+            prvSpillSegmentTerminate(pxSegment);
+        }
+    }
+
+    return pxRecordHdr;
+}
+
+/* Mark the record returned by prvSpillPeekRecord as read. */
+static void prvSpillConsumeRecord(StreamSpill_t *pxSpill, SpillRecordHdr_t *pxRecordHdr)
+{
+    SpillSegment_t *pxSegment = containingRecord(pxSpill->xSegments.Flink, SpillSegment_t, xSegmentEntry);
+    size_t uRecordLen = SPILL_RECORD_ALIGN(sizeof(SpillRecordHdr_t) + pxRecordHdr->uDataLen);
+
+    pxSegment->uReadOffset += uRecordLen;
+    pxSpill->uFrameCnt--;
+    pxSpill->uSize -= uRecordLen;
+
+    /* Once everything is read, the next frame appended has to start a new cluster. */
+    if (pxSpill->uFrameCnt == 0)
+    {
+        pxSpill->bClusterOpen = false;
+    }
+}
+
+StreamSpillHandle Kvs_streamSpillCreate(const char *pcDir, size_t uSegmentSize, size_t uMaxSize)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamSpill_t *pxSpill = NULL;
+
+    if (pcDir == NULL || uSegmentSize == 0 || uSegmentSize > UINT32_MAX || uMaxSize < uSegmentSize)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((pxSpill = (StreamSpill_t *)kvsMalloc(sizeof(StreamSpill_t))) == NULL)
+    {
+        res = KVS_ERROR_OUT_OF_MEMORY;
+        LogError("OOM: pxSpill");
+    }
+    else
+    {
+        memset(pxSpill, 0, sizeof(StreamSpill_t));
+        DList_InitializeListHead(&(pxSpill->xSegments));
+        pxSpill->uSegmentSize = SPILL_RECORD_ALIGN(uSegmentSize);
+        pxSpill->uMaxSegmentCnt = uMaxSize / uSegmentSize;
+        pxSpill->uMkvHdrSize = Mkv_getClusterHdrLen(MKV_CLUSTER);
+
+        if (mallocAndStrcpy_s(&(pxSpill->pcDir), pcDir) != 0)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: spill directory");
+        }
+        else if ((pxSpill->pMkvHdr = (uint8_t *)kvsMalloc(pxSpill->uMkvHdrSize)) == NULL)
+        {
+            res = KVS_ERROR_OUT_OF_MEMORY;
+            LogError("OOM: spill MKV header");
+        }
+    }
+
+    if (res != KVS_ERRNO_NONE)
+    {
+        Kvs_streamSpillTerminate(pxSpill);
+        pxSpill = NULL;
+    }
+
+    return pxSpill;
+}
+
+void Kvs_streamSpillTerminate(StreamSpillHandle xStreamSpillHandle)
+{
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+
+    if (pxSpill != NULL)
+    {
+        while (!DList_IsListEmpty(&(pxSpill->xSegments)))
+        {
+            prvSpillSegmentTerminate(containingRecord(DList_RemoveHeadList(&(pxSpill->xSegments)), SpillSegment_t, xSegmentEntry));
+        }
+        if (pxSpill->pcDir != NULL)
+        {
+            kvsFree(pxSpill->pcDir);
+        }
+        if (pxSpill->pMkvHdr != NULL)
+        {
+            kvsFree(pxSpill->pMkvHdr);
+        }
+        kvsFree(pxSpill);
+    }
+}
+
+int Kvs_streamSpillAppend(StreamSpillHandle xStreamSpillHandle, DataFrameIn_t *pxDataFrameIn)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+    SpillSegment_t *pxSegment = NULL;
+    SpillRecordHdr_t xRecordHdr = {0};
+    size_t uRecordLen = 0;
+
+    if (pxSpill == NULL || pxDataFrameIn == NULL || pxDataFrameIn->pData == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((uRecordLen = SPILL_RECORD_ALIGN(sizeof(SpillRecordHdr_t) + pxDataFrameIn->uDataLen)) > pxSpill->uSegmentSize)
+    {
+        pxSpill->bClusterOpen = false;
+        res = KVS_ERROR_STREAM_SPILL_IS_FULL;
+        LogError("Frame is larger than a spill segment");
+    }
+    else if (pxDataFrameIn->xClusterType != MKV_CLUSTER &&
+             (!pxSpill->bClusterOpen || pxDataFrameIn->uTimestampMs < pxSpill->uAppendClusterTimestamp ||
+              pxDataFrameIn->uTimestampMs - pxSpill->uAppendClusterTimestamp > MKV_DELTA_TIMESTAMP_MAX))
+    {
+        res = KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER;
+    }
+    else
+    {
+        xRecordHdr.uTimestampMs = pxDataFrameIn->uTimestampMs;
+        xRecordHdr.uDataLen = (uint32_t)(pxDataFrameIn->uDataLen);
+        xRecordHdr.uTrackType = (uint8_t)(pxDataFrameIn->xTrackType);
+        xRecordHdr.uClusterType = (uint8_t)(pxDataFrameIn->xClusterType);
+        xRecordHdr.bIsKeyFrame = pxDataFrameIn->bIsKeyFrame ? 1 : 0;
+
+        if (!DList_IsListEmpty(&(pxSpill->xSegments)))
+        {
+            pxSegment = containingRecord(pxSpill->xSegments.Blink, SpillSegment_t, xSegmentEntry);
+        }
+
+        if ((pxSegment == NULL || pxSegment->uWriteOffset + uRecordLen > pxSegment->uMapSize) &&
+            (res = prvSpillSegmentCreate(pxSpill)) != KVS_ERRNO_NONE)
+        {
+            /* Propagate the res error */
+        }
+        else
+        {
+            pxSegment = containingRecord(pxSpill->xSegments.Blink, SpillSegment_t, xSegmentEntry);
+            res = prvSpillSegmentWrite(pxSegment, &xRecordHdr, pxDataFrameIn->pData, uRecordLen);
+        }
+
+        if (res != KVS_ERRNO_NONE)
+        {
+            /* The rest of the cluster would be broken without this frame. */
+            pxSpill->bClusterOpen = false;
+        }
+        else
+        {
+            pxSpill->uFrameCnt++;
+            pxSpill->uSize += uRecordLen;
+
+            if (pxDataFrameIn->xClusterType == MKV_CLUSTER)
+            {
+                pxSpill->bClusterOpen = true;
+                pxSpill->uAppendClusterTimestamp = pxDataFrameIn->uTimestampMs;
+            }
+        }
+    }
+
+    return res;
+}
+
+int Kvs_streamSpillRead(StreamSpillHandle xStreamSpillHandle, SpillFrame_t *pxSpillFrame)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+    SpillRecordHdr_t *pxRecordHdr = NULL;
+    MkvClusterType_t xClusterType = MKV_SIMPLE_BLOCK;
+
+    if (pxSpill == NULL || pxSpillFrame == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else if ((pxRecordHdr = prvSpillPeekRecord(pxSpill)) == NULL)
+    {
+        res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
+    }
+    else
+    {
+        xClusterType = (MkvClusterType_t)(pxRecordHdr->uClusterType);
+        if (xClusterType == MKV_CLUSTER)
+        {
+            pxSpill->uReadClusterTimestamp = pxRecordHdr->uTimestampMs;
+        }
+
+        if ((res = Mkv_initializeClusterHdr(
+                 pxSpill->pMkvHdr,
+                 pxSpill->uMkvHdrSize,
+                 xClusterType,
+                 pxRecordHdr->uDataLen,
+                 (TrackType_t)(pxRecordHdr->uTrackType),
+                 pxRecordHdr->bIsKeyFrame != 0,
+                 pxRecordHdr->uTimestampMs,
+                 (uint16_t)(pxRecordHdr->uTimestampMs - pxSpill->uReadClusterTimestamp))) != KVS_ERRNO_NONE)
+        {
+            LogError("Failed to initialize MKV header of spilled frame");
+            /* Propagate the res error */
+        }
+        else
+        {
+            pxSpillFrame->pMkvHdr = pxSpill->pMkvHdr;
+            pxSpillFrame->uMkvHdrLen = Mkv_getClusterHdrLen(xClusterType);
+            pxSpillFrame->pData = (uint8_t *)pxRecordHdr + sizeof(SpillRecordHdr_t);
+            pxSpillFrame->uDataLen = pxRecordHdr->uDataLen;
+            pxSpillFrame->uTimestampMs = pxRecordHdr->uTimestampMs;
+            pxSpillFrame->xTrackType = (TrackType_t)(pxRecordHdr->uTrackType);
+            pxSpillFrame->xClusterType = xClusterType;
+        }
+
+        /* A record which can't be read is dropped, so the spill doesn't get stuck on it. */
+        prvSpillConsumeRecord(pxSpill, pxRecordHdr);
+    }
+
+    return res;
+}
+
+int Kvs_streamSpillFlushToNextCluster(StreamSpillHandle xStreamSpillHandle)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+    SpillRecordHdr_t *pxRecordHdr = NULL;
+
+    if (pxSpill == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else
+    {
+        while ((pxRecordHdr = prvSpillPeekRecord(pxSpill)) != NULL && pxRecordHdr->uClusterType != MKV_CLUSTER)
+        {
+            prvSpillConsumeRecord(pxSpill, pxRecordHdr);
+        }
+
+        if (pxRecordHdr == NULL)
+        {
+            res = KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME;
+        }
+    }
+
+    return res;
+}
+
+bool Kvs_streamSpillIsEmpty(StreamSpillHandle xStreamSpillHandle)
+{
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+
+    return pxSpill == NULL || pxSpill->uFrameCnt == 0;
+}
+
+int Kvs_streamSpillStat(StreamSpillHandle xStreamSpillHandle, size_t *puFrameCnt, size_t *puSize)
+{
+    int res = KVS_ERRNO_NONE;
+    StreamSpill_t *pxSpill = xStreamSpillHandle;
+
+    if (pxSpill == NULL || puFrameCnt == NULL || puSize == NULL)
+    {
+        res = KVS_ERROR_INVALID_ARGUMENT;
+        LogError("Invalid argument");
+    }
+    else
+    {
+        *puFrameCnt = pxSpill->uFrameCnt;
+        *puSize = pxSpill->uSize;
+    }
+
+    return res;
+}
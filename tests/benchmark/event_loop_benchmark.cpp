@@ -0,0 +1,311 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/port.h"
+#include "kvs/stream.h"
+}
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define LOOPBACK_STREAM_CNT (32)
+#define LOOPBACK_WORKER_CNT (2)
+#define LOOPBACK_FRAME_SIZE (8 * 1024)
+#define LOOPBACK_FRAME_INTERVAL_MS (33)
+#define LOOPBACK_FRAMES_PER_CLUSTER (30)
+#define LOOPBACK_DURATION_MS (3000)
+
+/* The longest wait of doWork, as in KvsApp */
+#define MAX_WAIT_MS (1000)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+static char pFrameData[LOOPBACK_FRAME_SIZE];
+
+/* A stream whose frames are sent to a loopback socket, the way doWork sends them to PUT MEDIA */
+typedef struct LoopbackStream
+{
+    StreamHandle xStreamHandle;
+    WakeupHandle xWakeup;
+    int xSockFds[2];
+} LoopbackStream_t;
+
+typedef struct Usage
+{
+    double dCpuMs;
+    long lRssKb;
+    size_t uSentCnt;
+} Usage_t;
+
+static long getRssKb(void)
+{
+    FILE *fp = fopen("/proc/self/status", "r");
+    char pcLine[128];
+    long lRssKb = 0;
+
+    if (fp != NULL)
+    {
+        while (fgets(pcLine, sizeof(pcLine), fp) != NULL)
+        {
+            if (sscanf(pcLine, "VmRSS: %ld kB", &lRssKb) == 1)
+            {
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    return lRssKb;
+}
+
+static double getCpuMs(void)
+{
+    struct rusage xUsage;
+
+    getrusage(RUSAGE_SELF, &xUsage);
+
+    return (xUsage.ru_utime.tv_sec + xUsage.ru_stime.tv_sec) * 1000.0 + (xUsage.ru_utime.tv_usec + xUsage.ru_stime.tv_usec) / 1000.0;
+}
+
+static void createStreams(std::vector<LoopbackStream_t> &xStreams)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    int xSndBufSize = 4 * 1024 * 1024;
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    for (size_t i = 0; i < xStreams.size(); i++)
+    {
+        ASSERT_TRUE((xStreams[i].xStreamHandle = Kvs_streamCreate(&xVideoTrackInfo, NULL)) != NULL);
+        ASSERT_TRUE((xStreams[i].xWakeup = wakeupCreate()) != NULL);
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSetWakeup(xStreams[i].xStreamHandle, xStreams[i].xWakeup));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, xStreams[i].xSockFds));
+        setsockopt(xStreams[i].xSockFds[0], SOL_SOCKET, SO_SNDBUF, &xSndBufSize, sizeof(xSndBufSize));
+    }
+}
+
+static void terminateStreams(std::vector<LoopbackStream_t> &xStreams)
+{
+    for (size_t i = 0; i < xStreams.size(); i++)
+    {
+        Kvs_streamTermintate(xStreams[i].xStreamHandle);
+        wakeupTerminate(xStreams[i].xWakeup);
+        close(xStreams[i].xSockFds[0]);
+        close(xStreams[i].xSockFds[1]);
+    }
+}
+
+/* Send one frame of a stream to its loopback socket. It returns false if there is no frame. */
+static bool sendFrame(LoopbackStream_t *pxStream, size_t *puSentCnt)
+{
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    struct iovec xIov[2];
+
+    if ((xDataFrameHandle = Kvs_streamPop(pxStream->xStreamHandle)) == NULL)
+    {
+        return false;
+    }
+
+    if (Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen) == KVS_ERRNO_NONE)
+    {
+        xIov[0].iov_base = pMkvHeader;
+        xIov[0].iov_len = uMkvHeaderLen;
+        xIov[1].iov_base = pData;
+        xIov[1].iov_len = uDataLen;
+        if (writev(pxStream->xSockFds[0], xIov, 2) > 0)
+        {
+            (*puSentCnt)++;
+        }
+    }
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    return true;
+}
+
+/* The receiving end of all loopback sockets, like the server of PUT MEDIA */
+static void runSink(std::vector<LoopbackStream_t> *pxStreams, std::atomic<bool> *pbStop)
+{
+    int xEpollFd = epoll_create1(0);
+    struct epoll_event xEvent = {};
+    struct epoll_event xEvents[64];
+    std::vector<char> xBuf(64 * 1024);
+    int xEventCnt = 0;
+
+    for (size_t i = 0; i < pxStreams->size(); i++)
+    {
+        xEvent.events = EPOLLIN;
+        xEvent.data.fd = (*pxStreams)[i].xSockFds[1];
+        epoll_ctl(xEpollFd, EPOLL_CTL_ADD, xEvent.data.fd, &xEvent);
+    }
+
+    while (!pbStop->load())
+    {
+        xEventCnt = epoll_wait(xEpollFd, xEvents, 64, 100);
+        for (int i = 0; i < xEventCnt; i++)
+        {
+            if (read(xEvents[i].data.fd, xBuf.data(), xBuf.size()) < 0)
+            {
+                /* nop */
+            }
+        }
+    }
+    close(xEpollFd);
+}
+
+/* The doWork thread of one stream, which waits for its wakeup and sends frames. */
+static void runStreamThread(LoopbackStream_t *pxStream, std::atomic<bool> *pbStop, std::atomic<size_t> *puSentCnt)
+{
+    size_t uSentCnt = 0;
+
+    while (!pbStop->load())
+    {
+        if (!sendFrame(pxStream, &uSentCnt))
+        {
+            wakeupWait(pxStream->xWakeup, -1, MAX_WAIT_MS);
+        }
+    }
+    *puSentCnt += uSentCnt;
+}
+
+/* A worker which waits for the wakeups of its streams in one epoll set, as KvsAppGroup does. */
+static void runWorker(LoopbackStream_t *pxStreams, size_t uStreamCnt, std::atomic<bool> *pbStop, std::atomic<size_t> *puSentCnt)
+{
+    int xEpollFd = epoll_create1(0);
+    struct epoll_event xEvent = {};
+    struct epoll_event xEvents[64];
+    int xEventCnt = 0;
+    size_t uSentCnt = 0;
+    LoopbackStream_t *pxStream = NULL;
+
+    for (size_t i = 0; i < uStreamCnt; i++)
+    {
+        xEvent.events = EPOLLIN;
+        xEvent.data.ptr = &(pxStreams[i]);
+        epoll_ctl(xEpollFd, EPOLL_CTL_ADD, wakeupGetFd(pxStreams[i].xWakeup), &xEvent);
+    }
+
+    while (!pbStop->load())
+    {
+        xEventCnt = epoll_wait(xEpollFd, xEvents, 64, 100);
+        for (int i = 0; i < xEventCnt; i++)
+        {
+            /* Consume the signals, then send one frame and signal again if there may be more, like doWork with bNoWait. */
+            pxStream = (LoopbackStream_t *)xEvents[i].data.ptr;
+            wakeupWait(pxStream->xWakeup, -1, 0);
+            if (sendFrame(pxStream, &uSentCnt))
+            {
+                wakeupSignal(pxStream->xWakeup);
+            }
+        }
+    }
+    close(xEpollFd);
+    *puSentCnt += uSentCnt;
+}
+
+/* A camera adds a frame to every stream each frame interval, while the streams are sent in threads or workers. */
+static void measureUsage(bool bUseWorkers, Usage_t *pxUsage)
+{
+    std::vector<LoopbackStream_t> xStreams(LOOPBACK_STREAM_CNT);
+    std::vector<std::thread> xThreads;
+    std::atomic<bool> bStop(false);
+    std::atomic<bool> bSinkStop(false);
+    std::atomic<size_t> uSentCnt(0);
+    DataFrameIn_t xDataFrameIn = {};
+    size_t uStreamsPerWorker = LOOPBACK_STREAM_CNT / LOOPBACK_WORKER_CNT;
+
+    createStreams(xStreams);
+    std::thread xSink(runSink, &xStreams, &bSinkStop);
+
+    long lRssStartKb = getRssKb();
+    double dCpuStartMs = getCpuMs();
+
+    if (bUseWorkers)
+    {
+        for (size_t i = 0; i < LOOPBACK_WORKER_CNT; i++)
+        {
+            xThreads.push_back(std::thread(runWorker, &(xStreams[i * uStreamsPerWorker]), uStreamsPerWorker, &bStop, &uSentCnt));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < LOOPBACK_STREAM_CNT; i++)
+        {
+            xThreads.push_back(std::thread(runStreamThread, &(xStreams[i]), &bStop, &uSentCnt));
+        }
+    }
+
+    for (size_t uFrame = 0; uFrame < LOOPBACK_DURATION_MS / LOOPBACK_FRAME_INTERVAL_MS; uFrame++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOOPBACK_FRAME_INTERVAL_MS));
+        xDataFrameIn.bIsKeyFrame = (uFrame % LOOPBACK_FRAMES_PER_CLUSTER) == 0;
+        xDataFrameIn.xClusterType = xDataFrameIn.bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.pData = pFrameData;
+        xDataFrameIn.uDataLen = LOOPBACK_FRAME_SIZE;
+        xDataFrameIn.uTimestampMs = uFrame * LOOPBACK_FRAME_INTERVAL_MS;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        for (size_t i = 0; i < LOOPBACK_STREAM_CNT; i++)
+        {
+            Kvs_streamAddDataFrame(xStreams[i].xStreamHandle, &xDataFrameIn);
+        }
+    }
+
+    /* Let the senders catch up before sampling. */
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    pxUsage->lRssKb = getRssKb() - lRssStartKb;
+    bStop = true;
+    for (size_t i = 0; i < LOOPBACK_STREAM_CNT; i++)
+    {
+        wakeupSignal(xStreams[i].xWakeup);
+    }
+    for (size_t i = 0; i < xThreads.size(); i++)
+    {
+        xThreads[i].join();
+    }
+    pxUsage->dCpuMs = getCpuMs() - dCpuStartMs;
+    pxUsage->uSentCnt = uSentCnt;
+
+    bSinkStop = true;
+    xSink.join();
+    terminateStreams(xStreams);
+}
+
+TEST(EventLoopBenchmark, thread_per_stream_vs_epoll_workers)
+{
+    Usage_t xThreads = {};
+    Usage_t xWorkers = {};
+    size_t uFrameCnt = (size_t)LOOPBACK_STREAM_CNT * (LOOPBACK_DURATION_MS / LOOPBACK_FRAME_INTERVAL_MS);
+
+    measureUsage(false, &xThreads);
+    measureUsage(true, &xWorkers);
+
+    printf("%d loopback streams of %d byte frames every %d ms for %d ms:\n", LOOPBACK_STREAM_CNT, LOOPBACK_FRAME_SIZE, LOOPBACK_FRAME_INTERVAL_MS, LOOPBACK_DURATION_MS);
+    printf("  thread per stream (%3d threads): CPU %7.2f ms/stream, RSS %6.1f kB/stream, %zu/%zu frames sent\n", LOOPBACK_STREAM_CNT,
+           xThreads.dCpuMs / LOOPBACK_STREAM_CNT, (double)xThreads.lRssKb / LOOPBACK_STREAM_CNT, xThreads.uSentCnt, uFrameCnt);
+    printf("  epoll workers     (%3d threads): CPU %7.2f ms/stream, RSS %6.1f kB/stream, %zu/%zu frames sent\n", LOOPBACK_WORKER_CNT,
+           xWorkers.dCpuMs / LOOPBACK_STREAM_CNT, (double)xWorkers.lRssKb / LOOPBACK_STREAM_CNT, xWorkers.uSentCnt, uFrameCnt);
+
+    EXPECT_EQ(uFrameCnt, xThreads.uSentCnt);
+    EXPECT_EQ(uFrameCnt, xWorkers.uSentCnt);
+}
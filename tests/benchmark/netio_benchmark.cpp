@@ -0,0 +1,178 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/netio_transport.h"
+#include "kvs/stream.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+}
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#define PIPE_HOST "kinesisvideo.local"
+#define PIPE_PORT "443"
+#define LOOPBACK_HOST "127.0.0.1"
+
+#define THROUGHPUT_FRAME_COUNT (3000)
+#define THROUGHPUT_FRAME_SIZE (64 * 1024)
+#define THROUGHPUT_FRAMES_PER_CLUSTER (30)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+static uint8_t pFrameData[THROUGHPUT_FRAME_SIZE];
+
+/* Add frames to a stream and send their MKV headers and data with NetIo_sendv, the way PUT MEDIA sends them without
+ * the HTTP chunks. It returns the bytes sent per second. */
+static double streamFrames(NetIoHandle xNetIoHandle)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    StreamHandle xStreamHandle = NULL;
+    DataFrameIn_t xDataFrameIn = {};
+    DataFrameHandle xDataFrameHandle = NULL;
+    NetIoVec_t xVecs[2];
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    size_t uSentBytes = 0;
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+    EXPECT_TRUE((xStreamHandle = Kvs_streamCreate(&xVideoTrackInfo, NULL)) != NULL);
+
+    auto xStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < THROUGHPUT_FRAME_COUNT; i++)
+    {
+        xDataFrameIn.bIsKeyFrame = (i % THROUGHPUT_FRAMES_PER_CLUSTER) == 0;
+        xDataFrameIn.xClusterType = xDataFrameIn.bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.pData = (char *)pFrameData;
+        xDataFrameIn.uDataLen = sizeof(pFrameData);
+        xDataFrameIn.uTimestampMs = i * 33;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn);
+
+        if ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+        {
+            if (Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen) == KVS_ERRNO_NONE)
+            {
+                xVecs[0].pBuffer = pMkvHeader;
+                xVecs[0].uLen = uMkvHeaderLen;
+                xVecs[1].pBuffer = pData;
+                xVecs[1].uLen = uDataLen;
+                EXPECT_EQ(KVS_ERRNO_NONE, NetIo_sendv(xNetIoHandle, xVecs, 2));
+                uSentBytes += uMkvHeaderLen + uDataLen;
+            }
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+        }
+    }
+    auto xElapsed = std::chrono::steady_clock::now() - xStart;
+
+    Kvs_streamTermintate(xStreamHandle);
+
+    return uSentBytes / std::chrono::duration<double>(xElapsed).count();
+}
+
+/* Drain a handle until the peer closes it. */
+static void drain(NetIoHandle xNetIoHandle)
+{
+    unsigned char pBuf[16 * 1024];
+    size_t uLen = 0;
+
+    while (NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) == KVS_ERRNO_NONE)
+    {
+        /* nop */
+    }
+}
+
+static double measurePipe(void)
+{
+    NetIoPipeListenerHandle xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT);
+    NetIoHandle xClient = NetIo_create();
+    NetIoHandle xServer = NULL;
+    double dBytesPerSec = 0;
+
+    EXPECT_TRUE(xListener != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setTransport(xClient, NetIoTransport_getPipe()));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, PIPE_HOST, PIPE_PORT));
+    EXPECT_TRUE((xServer = NetIoPipe_accept(xListener, 1000)) != NULL);
+
+    std::thread xReader(drain, xServer);
+    dBytesPerSec = streamFrames(xClient);
+    NetIo_disconnect(xClient);
+    xReader.join();
+
+    NetIo_terminate(xServer);
+    NetIo_terminate(xClient);
+    NetIoPipe_terminateListener(xListener);
+
+    return dBytesPerSec;
+}
+
+static double measureTcp(void)
+{
+    struct sockaddr_in xAddr;
+    socklen_t uAddrLen = sizeof(xAddr);
+    int xListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int xServerFd = -1;
+    char pcPort[8];
+    NetIoHandle xClient = NetIo_create();
+    double dBytesPerSec = 0;
+
+    memset(&xAddr, 0, sizeof(xAddr));
+    xAddr.sin_family = AF_INET;
+    xAddr.sin_addr.s_addr = inet_addr(LOOPBACK_HOST);
+    EXPECT_EQ(0, bind(xListenFd, (struct sockaddr *)&xAddr, sizeof(xAddr)));
+    EXPECT_EQ(0, listen(xListenFd, 1));
+    EXPECT_EQ(0, getsockname(xListenFd, (struct sockaddr *)&xAddr, &uAddrLen));
+    snprintf(pcPort, sizeof(pcPort), "%u", (unsigned)ntohs(xAddr.sin_port));
+
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setTransport(xClient, NetIoTransport_getTcp()));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, LOOPBACK_HOST, pcPort));
+    EXPECT_GE((xServerFd = accept(xListenFd, NULL, NULL)), 0);
+
+    std::thread xReader([xServerFd]() {
+        char pBuf[16 * 1024];
+
+        while (recv(xServerFd, pBuf, sizeof(pBuf), 0) > 0)
+        {
+            /* nop */
+        }
+    });
+    dBytesPerSec = streamFrames(xClient);
+    NetIo_disconnect(xClient);
+    xReader.join();
+
+    close(xServerFd);
+    close(xListenFd);
+    NetIo_terminate(xClient);
+
+    return dBytesPerSec;
+}
+
+TEST(NetIoBenchmark, pipe_vs_tcp_throughput)
+{
+    double dPipe = measurePipe();
+    double dTcp = measureTcp();
+
+    printf("stream + NetIo_sendv of %d frames of %d KB: pipe %8.1f MB/s, TCP loopback %8.1f MB/s\n", THROUGHPUT_FRAME_COUNT, THROUGHPUT_FRAME_SIZE / 1024,
+           dPipe / (1024 * 1024), dTcp / (1024 * 1024));
+
+    EXPECT_GT(dPipe, 0);
+    EXPECT_GT(dTcp, 0);
+}
@@ -0,0 +1,254 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/stream.h"
+}
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#define VIDEO_FRAME_INTERVAL_MS (33)
+#define AUDIO_FRAME_INTERVAL_MS (20)
+#define VIDEO_FRAMES_PER_CLUSTER (60)
+
+/* Number of frames measured on top of each backlog */
+#define MEASURED_FRAME_COUNT (10000)
+
+/* Number of frames each producer thread adds in the contention benchmark */
+#define CONTENDED_FRAME_COUNT (50000)
+#define LOCK_FREE_QUEUE_SIZE (256)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+static char pAudioTrackName[] = "kvs audio track";
+static char pAudioCodecName[] = "A_AAC";
+static uint8_t pAudioCodecPrivate[] = {0x14, 0x08};
+
+typedef struct FrameGenerator
+{
+    uint64_t uVideoTimestampMs;
+    uint64_t uAudioTimestampMs;
+    size_t uVideoFrameCnt;
+} FrameGenerator_t;
+
+static StreamHandle createStream(bool bUsePool, bool bLockFree = false)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    AudioTrackInfo_t xAudioTrackInfo = {0};
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    xAudioTrackInfo.pTrackName = pAudioTrackName;
+    xAudioTrackInfo.pCodecName = pAudioCodecName;
+    xAudioTrackInfo.uFrequency = 8000;
+    xAudioTrackInfo.uChannelNumber = 1;
+    xAudioTrackInfo.pCodecPrivate = pAudioCodecPrivate;
+    xAudioTrackInfo.uCodecPrivateLen = sizeof(pAudioCodecPrivate);
+
+    if (bLockFree)
+    {
+        return Kvs_streamCreateLockFree(&xVideoTrackInfo, &xAudioTrackInfo, sizeof(void *), LOCK_FREE_QUEUE_SIZE);
+    }
+    else if (bUsePool)
+    {
+        return Kvs_streamCreateWithPool(&xVideoTrackInfo, &xAudioTrackInfo, sizeof(void *), 256);
+    }
+    else
+    {
+        return Kvs_streamCreate(&xVideoTrackInfo, &xAudioTrackInfo);
+    }
+}
+
+/* Add the next video or audio frame. Audio frames arrive a little behind video frames as they do on real devices. */
+static bool addNextFrame(StreamHandle xStreamHandle, FrameGenerator_t *pxGen)
+{
+    DataFrameIn_t xDataFrameIn = {};
+
+    xDataFrameIn.uDataLen = 1024;
+    if (pxGen->uAudioTimestampMs + AUDIO_FRAME_INTERVAL_MS <= pxGen->uVideoTimestampMs)
+    {
+        xDataFrameIn.xClusterType = MKV_SIMPLE_BLOCK;
+        xDataFrameIn.uTimestampMs = pxGen->uAudioTimestampMs;
+        xDataFrameIn.xTrackType = TRACK_AUDIO;
+        pxGen->uAudioTimestampMs += AUDIO_FRAME_INTERVAL_MS;
+    }
+    else
+    {
+        xDataFrameIn.bIsKeyFrame = (pxGen->uVideoFrameCnt % VIDEO_FRAMES_PER_CLUSTER) == 0;
+        xDataFrameIn.xClusterType = xDataFrameIn.bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.uTimestampMs = pxGen->uVideoTimestampMs;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        pxGen->uVideoTimestampMs += VIDEO_FRAME_INTERVAL_MS;
+        pxGen->uVideoFrameCnt++;
+    }
+
+    return Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL;
+}
+
+static void releaseStream(StreamHandle xStreamHandle)
+{
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    while ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+    {
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+/* Measure the average cost of adding a frame to a stream which already has uBacklog frames pending. */
+static double measureAddDataFrameNs(size_t uBacklog)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    FrameGenerator_t xGen = {1000, 1000, 0};
+    size_t i = 0;
+
+    EXPECT_TRUE(xStreamHandle != NULL);
+    for (i = 0; i < uBacklog; i++)
+    {
+        EXPECT_TRUE(addNextFrame(xStreamHandle, &xGen));
+    }
+
+    auto xStart = std::chrono::steady_clock::now();
+    for (i = 0; i < MEASURED_FRAME_COUNT; i++)
+    {
+        addNextFrame(xStreamHandle, &xGen);
+    }
+    auto xEnd = std::chrono::steady_clock::now();
+
+    releaseStream(xStreamHandle);
+
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(xEnd - xStart).count() / MEASURED_FRAME_COUNT;
+}
+
+TEST(StreamBenchmark, add_data_frame_with_growing_backlog)
+{
+    const size_t puBacklogs[] = {100, 1000, 10000, 50000};
+    double dBaseNs = 0;
+    double dNs = 0;
+
+    for (size_t i = 0; i < sizeof(puBacklogs) / sizeof(puBacklogs[0]); i++)
+    {
+        dNs = measureAddDataFrameNs(puBacklogs[i]);
+        if (i == 0)
+        {
+            dBaseNs = dNs;
+        }
+        printf("backlog %6zu frames: %8.1f ns per Kvs_streamAddDataFrame\n", puBacklogs[i], dNs);
+    }
+
+    /* Insert cost should stay flat, a linear search would be hundreds of times slower at the largest backlog. */
+    EXPECT_LT(dNs, dBaseNs * 10);
+}
+
+/* Measure the average cost of adding, popping and terminating a frame while the stream holds uBacklog frames. */
+static double measureAddPopTerminateNs(bool bUsePool, size_t uBacklog, bool bLockFree = false)
+{
+    StreamHandle xStreamHandle = createStream(bUsePool, bLockFree);
+    FrameGenerator_t xGen = {1000, 1000, 0};
+    size_t i = 0;
+
+    EXPECT_TRUE(xStreamHandle != NULL);
+    for (i = 0; i < uBacklog; i++)
+    {
+        EXPECT_TRUE(addNextFrame(xStreamHandle, &xGen));
+    }
+
+    auto xStart = std::chrono::steady_clock::now();
+    for (i = 0; i < MEASURED_FRAME_COUNT; i++)
+    {
+        addNextFrame(xStreamHandle, &xGen);
+        Kvs_dataFrameTerminate(Kvs_streamPop(xStreamHandle));
+    }
+    auto xEnd = std::chrono::steady_clock::now();
+
+    releaseStream(xStreamHandle);
+
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(xEnd - xStart).count() / MEASURED_FRAME_COUNT;
+}
+
+TEST(StreamBenchmark, heap_vs_pooled_descriptors)
+{
+    double dHeapNs = measureAddPopTerminateNs(false, 200);
+    double dPoolNs = measureAddPopTerminateNs(true, 200);
+    double dLockFreeNs = measureAddPopTerminateNs(true, 200, true);
+
+    printf("heap descriptors:   %8.1f ns per add/pop/terminate\n", dHeapNs);
+    printf("pooled descriptors: %8.1f ns per add/pop/terminate\n", dPoolNs);
+    printf("lock-free stream:   %8.1f ns per add/pop/terminate\n", dLockFreeNs);
+}
+
+/* A capture thread adds the frames of one track. Both kinds of stream hold the same backlog, so the bounded queue never
+ * runs full. */
+static void produceTrack(StreamHandle xStreamHandle, TrackType_t xTrackType, uint64_t uIntervalMs)
+{
+    DataFrameIn_t xDataFrameIn = {};
+    size_t uFrameCnt = 0;
+    size_t uMemTotal = 0;
+    size_t i = 0;
+
+    xDataFrameIn.uDataLen = 1024;
+    xDataFrameIn.xTrackType = xTrackType;
+    while (i < CONTENDED_FRAME_COUNT)
+    {
+        xDataFrameIn.bIsKeyFrame = (xTrackType == TRACK_VIDEO) && (i % VIDEO_FRAMES_PER_CLUSTER) == 0;
+        xDataFrameIn.xClusterType = xDataFrameIn.bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.uTimestampMs = 1000 + i * uIntervalMs;
+        if (Kvs_streamStatOnTrack(xStreamHandle, xTrackType, &uFrameCnt, &uMemTotal) != KVS_ERRNO_NONE || uFrameCnt >= LOCK_FREE_QUEUE_SIZE / 2)
+        {
+            std::this_thread::yield();
+        }
+        else if (Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL)
+        {
+            i++;
+        }
+    }
+}
+
+/* Measure the average cost of moving a frame from two capture threads to the sending thread. */
+static double measureContendedNs(bool bLockFree)
+{
+    StreamHandle xStreamHandle = createStream(true, bLockFree);
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t uPopCnt = 0;
+
+    EXPECT_TRUE(xStreamHandle != NULL);
+
+    auto xStart = std::chrono::steady_clock::now();
+    std::thread xVideoProducer(produceTrack, xStreamHandle, TRACK_VIDEO, (uint64_t)VIDEO_FRAME_INTERVAL_MS);
+    std::thread xAudioProducer(produceTrack, xStreamHandle, TRACK_AUDIO, (uint64_t)AUDIO_FRAME_INTERVAL_MS);
+    while (uPopCnt < 2 * CONTENDED_FRAME_COUNT)
+    {
+        if ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+        {
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+            uPopCnt++;
+        }
+    }
+    xVideoProducer.join();
+    xAudioProducer.join();
+    auto xEnd = std::chrono::steady_clock::now();
+
+    releaseStream(xStreamHandle);
+
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(xEnd - xStart).count() / (2 * CONTENDED_FRAME_COUNT);
+}
+
+TEST(StreamBenchmark, locked_vs_lock_free_with_producer_threads)
+{
+    double dLockedNs = measureContendedNs(false);
+    double dLockFreeNs = measureContendedNs(true);
+
+    printf("locked stream:    %8.1f ns per frame with 2 producers and 1 consumer\n", dLockedNs);
+    printf("lock-free stream: %8.1f ns per frame with 2 producers and 1 consumer\n", dLockFreeNs);
+}
@@ -0,0 +1,120 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/stream.h"
+#include "kvs/stream_spill.h"
+}
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define SPILL_FRAME_SIZE (16 * 1024)
+#define SPILL_FRAME_COUNT (2048)
+#define SPILL_FRAMES_PER_CLUSTER (30)
+#define SPILL_FRAME_INTERVAL_MS (33)
+#define SPILL_SEGMENT_SIZE (4 * 1024 * 1024)
+#define SPILL_MAX_SIZE (64 * 1024 * 1024)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+
+static void initDataFrameIn(DataFrameIn_t *pxDataFrameIn, char *pData, size_t i)
+{
+    pxDataFrameIn->xClusterType = (i % SPILL_FRAMES_PER_CLUSTER == 0) ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+    pxDataFrameIn->pData = pData;
+    pxDataFrameIn->uDataLen = SPILL_FRAME_SIZE;
+    pxDataFrameIn->uTimestampMs = i * SPILL_FRAME_INTERVAL_MS;
+    pxDataFrameIn->bIsKeyFrame = (pxDataFrameIn->xClusterType == MKV_CLUSTER);
+    pxDataFrameIn->xTrackType = TRACK_VIDEO;
+}
+
+/* The sender copies each MKV header and frame into its send buffer, as the TLS layer does. */
+static void sendToSink(std::vector<uint8_t> &xSink, uint8_t *pMkvHeader, size_t uMkvHeaderLen, uint8_t *pData, size_t uDataLen)
+{
+    memcpy(xSink.data(), pMkvHeader, uMkvHeaderLen);
+    memcpy(xSink.data() + uMkvHeaderLen, pData, uDataLen);
+}
+
+static double toMBps(size_t uBytes, std::chrono::steady_clock::duration xElapsed)
+{
+    return (double)uBytes / (1024.0 * 1024.0) / std::chrono::duration<double>(xElapsed).count();
+}
+
+TEST(StreamSpillBenchmark, upload_from_spill_vs_memory)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    std::vector<char> xData((size_t)SPILL_FRAME_COUNT * SPILL_FRAME_SIZE, 0x5A);
+    std::vector<uint8_t> xSink(SPILL_FRAME_SIZE + 256);
+    DataFrameIn_t xDataFrameIn = {};
+    DataFrameHandle xDataFrameHandle = NULL;
+    StreamHandle xStreamHandle = NULL;
+    StreamSpillHandle xSpillHandle = NULL;
+    SpillFrame_t xSpillFrame = {0};
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    char pcDir[] = "/tmp/kvs_spill_benchmark_XXXXXX";
+    size_t uBytes = (size_t)SPILL_FRAME_COUNT * SPILL_FRAME_SIZE;
+    size_t i = 0;
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    ASSERT_TRUE((xStreamHandle = Kvs_streamCreateWithPool(&xVideoTrackInfo, NULL, 0, SPILL_FRAME_COUNT)) != NULL);
+    ASSERT_TRUE(mkdtemp(pcDir) != NULL);
+    ASSERT_TRUE((xSpillHandle = Kvs_streamSpillCreate(pcDir, SPILL_SEGMENT_SIZE, SPILL_MAX_SIZE)) != NULL);
+
+    /* The in-memory backlog only holds descriptors, and the sender reads each frame from its own application buffer. */
+    for (i = 0; i < SPILL_FRAME_COUNT; i++)
+    {
+        initDataFrameIn(&xDataFrameIn, xData.data() + i * SPILL_FRAME_SIZE, i);
+        ASSERT_TRUE(Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL);
+    }
+
+    auto xMemStart = std::chrono::steady_clock::now();
+    while ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen));
+        sendToSink(xSink, pMkvHeader, uMkvHeaderLen, pData, uDataLen);
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+    auto xMemElapsed = std::chrono::steady_clock::now() - xMemStart;
+
+    auto xSpillWriteStart = std::chrono::steady_clock::now();
+    for (i = 0; i < SPILL_FRAME_COUNT; i++)
+    {
+        initDataFrameIn(&xDataFrameIn, xData.data() + i * SPILL_FRAME_SIZE, i);
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillAppend(xSpillHandle, &xDataFrameIn));
+    }
+    auto xSpillWriteElapsed = std::chrono::steady_clock::now() - xSpillWriteStart;
+
+    auto xSpillReadStart = std::chrono::steady_clock::now();
+    for (i = 0; i < SPILL_FRAME_COUNT; i++)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+        sendToSink(xSink, xSpillFrame.pMkvHdr, xSpillFrame.uMkvHdrLen, xSpillFrame.pData, xSpillFrame.uDataLen);
+    }
+    auto xSpillReadElapsed = std::chrono::steady_clock::now() - xSpillReadStart;
+
+    printf("Upload throughput of %d frames of %d bytes:\n", SPILL_FRAME_COUNT, SPILL_FRAME_SIZE);
+    printf("  in-memory stream: %8.1f MB/s\n", toMBps(uBytes, xMemElapsed));
+    printf("  spill (write):    %8.1f MB/s\n", toMBps(uBytes, xSpillWriteElapsed));
+    printf("  spill (read):     %8.1f MB/s\n", toMBps(uBytes, xSpillReadElapsed));
+
+    Kvs_streamSpillTerminate(xSpillHandle);
+    Kvs_streamTermintate(xStreamHandle);
+    rmdir(pcDir);
+}
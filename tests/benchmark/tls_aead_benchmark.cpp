@@ -0,0 +1,48 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/tls_context.h"
+}
+#endif
+
+#include <stdio.h>
+
+#include <gtest/gtest.h>
+
+#define AEAD_BENCHMARK_LEN (64 * 1024 * 1024)
+
+/* Print the bytes per second of an AEAD, or why it can't be measured. It returns the bytes per second, or 0. */
+static double measureAead(TlsAead_t xAead, const char *pcName)
+{
+    double dBytesPerSec = 0;
+    int res = TlsContext_measureAead(xAead, AEAD_BENCHMARK_LEN, &dBytesPerSec);
+
+    if (res == KVS_ERROR_TLS_CIPHER_NOT_SUPPORTED)
+    {
+        printf("%-18s: not supported by mbedTLS\n", pcName);
+    }
+    else
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, res);
+        printf("%-18s: %8.1f MB/s encrypted in %d MB\n", pcName, dBytesPerSec / (1024 * 1024), AEAD_BENCHMARK_LEN / (1024 * 1024));
+    }
+
+    return dBytesPerSec;
+}
+
+TEST(TlsAeadBenchmark, encrypted_bytes_per_sec)
+{
+    TlsContextHandle xTlsContext = TlsContext_create();
+    TlsAead_t xFastest = TLS_AEAD_DEFAULT;
+    double dAesGcm = measureAead(TLS_AEAD_AES_GCM, "AES-128-GCM");
+    double dChaChaPoly = measureAead(TLS_AEAD_CHACHA20_POLY1305, "ChaCha20-Poly1305");
+
+    ASSERT_TRUE(xTlsContext != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsContext_setAead(xTlsContext, TLS_AEAD_FASTEST));
+    xFastest = TlsContext_getAead(xTlsContext);
+    printf("TLS_AEAD_FASTEST prefers %s\n",
+           (xFastest == TLS_AEAD_AES_GCM) ? "AES-GCM" : (xFastest == TLS_AEAD_CHACHA20_POLY1305) ? "ChaCha20-Poly1305" : "neither");
+    TlsContext_terminate(xTlsContext);
+
+    EXPECT_TRUE(dAesGcm > 0 || dChaChaPoly > 0);
+}
@@ -0,0 +1,318 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/tls_context.h"
+#include "net/netio.h"
+}
+#endif
+
+#include <atomic>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "mbedtls/certs.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+/* The heap is counted by wrapping the allocator of glibc, which mbedTLS uses through calloc and free. */
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+#define LOOPBACK_HOST "127.0.0.1"
+
+#define STREAMING_FRAME_COUNT (300)
+#define STREAMING_FRAME_SIZE (30 * 1024)
+
+extern "C" {
+void *__libc_malloc(size_t uSize);
+void *__libc_calloc(size_t uNum, size_t uSize);
+void *__libc_realloc(void *ptr, size_t uSize);
+void *__libc_memalign(size_t uAlignment, size_t uSize);
+void __libc_free(void *ptr);
+}
+
+static std::atomic<long> xHeapInUse(0);
+static std::atomic<long> xHeapPeak(0);
+
+static void *trackAlloc(void *ptr)
+{
+    long xInUse = 0;
+    long xPeak = 0;
+
+    if (ptr != NULL)
+    {
+        xInUse = (xHeapInUse += (long)malloc_usable_size(ptr));
+        xPeak = xHeapPeak.load();
+        while (xInUse > xPeak && !xHeapPeak.compare_exchange_weak(xPeak, xInUse))
+        {
+            /* nop */
+        }
+    }
+
+    return ptr;
+}
+
+extern "C" void *malloc(size_t uSize)
+{
+    return trackAlloc(__libc_malloc(uSize));
+}
+
+extern "C" void *calloc(size_t uNum, size_t uSize)
+{
+    return trackAlloc(__libc_calloc(uNum, uSize));
+}
+
+extern "C" void *realloc(void *ptr, size_t uSize)
+{
+    size_t uOldSize = (ptr == NULL) ? 0 : malloc_usable_size(ptr);
+    void *pNew = __libc_realloc(ptr, uSize);
+
+    /* The old block is freed if it's moved, or if the size is 0. */
+    if (pNew != NULL || uSize == 0)
+    {
+        xHeapInUse -= (long)uOldSize;
+        trackAlloc(pNew);
+    }
+
+    return pNew;
+}
+
+extern "C" void *memalign(size_t uAlignment, size_t uSize)
+{
+    return trackAlloc(__libc_memalign(uAlignment, uSize));
+}
+
+extern "C" void *aligned_alloc(size_t uAlignment, size_t uSize)
+{
+    return trackAlloc(__libc_memalign(uAlignment, uSize));
+}
+
+extern "C" int posix_memalign(void **pptr, size_t uAlignment, size_t uSize)
+{
+    void *ptr = __libc_memalign(uAlignment, uSize);
+
+    if (ptr == NULL)
+    {
+        return ENOMEM;
+    }
+    *pptr = trackAlloc(ptr);
+
+    return 0;
+}
+
+extern "C" void free(void *ptr)
+{
+    if (ptr != NULL)
+    {
+        xHeapInUse -= (long)malloc_usable_size(ptr);
+        __libc_free(ptr);
+    }
+}
+
+/* Start counting the peak from the heap in use now, and return it. */
+static long resetHeapPeak(void)
+{
+    long xInUse = xHeapInUse.load();
+
+    xHeapPeak = xInUse;
+
+    return xInUse;
+}
+
+/* A TLS server which runs in a child process, so its heap isn't counted. Every connection is served by a process of
+ * its own, which reads everything until the client closes it. */
+class TlsServerProcess
+{
+public:
+    char pcPort[8];
+
+    bool start()
+    {
+        struct sockaddr_in xAddr;
+        socklen_t uAddrLen = sizeof(xAddr);
+        mbedtls_net_context xListenFd;
+
+        mbedtls_net_init(&xListenFd);
+        if (mbedtls_net_bind(&xListenFd, LOOPBACK_HOST, "0", MBEDTLS_NET_PROTO_TCP) != 0 ||
+            getsockname(xListenFd.fd, (struct sockaddr *)&xAddr, &uAddrLen) != 0)
+        {
+            mbedtls_net_free(&xListenFd);
+            return false;
+        }
+        snprintf(pcPort, sizeof(pcPort), "%u", (unsigned)ntohs(xAddr.sin_port));
+
+        if ((xPid = fork()) == 0)
+        {
+            serve(&xListenFd);
+            _exit(0);
+        }
+        mbedtls_net_free(&xListenFd);
+
+        return xPid > 0;
+    }
+
+    void stop()
+    {
+        if (xPid > 0)
+        {
+            kill(xPid, SIGTERM);
+            waitpid(xPid, NULL, 0);
+            xPid = -1;
+        }
+    }
+
+private:
+    pid_t xPid = -1;
+
+    static void serve(mbedtls_net_context *pxListenFd)
+    {
+        mbedtls_net_context xClientFd;
+        mbedtls_ssl_context xSsl;
+        mbedtls_ssl_config xConf;
+        mbedtls_x509_crt xCert;
+        mbedtls_pk_context xKey;
+        mbedtls_ctr_drbg_context xCtrDrbg;
+        mbedtls_entropy_context xEntropy;
+        unsigned char pBuf[16 * 1024];
+
+        signal(SIGCHLD, SIG_IGN);
+        mbedtls_ssl_config_init(&xConf);
+        mbedtls_x509_crt_init(&xCert);
+        mbedtls_pk_init(&xKey);
+        mbedtls_ctr_drbg_init(&xCtrDrbg);
+        mbedtls_entropy_init(&xEntropy);
+        if (mbedtls_ctr_drbg_seed(&xCtrDrbg, mbedtls_entropy_func, &xEntropy, NULL, 0) != 0 ||
+            mbedtls_x509_crt_parse(&xCert, (const unsigned char *)mbedtls_test_srv_crt, mbedtls_test_srv_crt_len) != 0 ||
+            mbedtls_pk_parse_key(&xKey, (const unsigned char *)mbedtls_test_srv_key, mbedtls_test_srv_key_len, NULL, 0) != 0 ||
+            mbedtls_ssl_config_defaults(&xConf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0 ||
+            mbedtls_ssl_conf_own_cert(&xConf, &xCert, &xKey) != 0)
+        {
+            return;
+        }
+        mbedtls_ssl_conf_rng(&xConf, mbedtls_ctr_drbg_random, &xCtrDrbg);
+
+        while (true)
+        {
+            mbedtls_net_init(&xClientFd);
+            if (mbedtls_net_accept(pxListenFd, &xClientFd, NULL, 0, NULL) != 0)
+            {
+                return;
+            }
+            if (fork() == 0)
+            {
+                mbedtls_ssl_init(&xSsl);
+                if (mbedtls_ssl_setup(&xSsl, &xConf) == 0)
+                {
+                    mbedtls_ssl_set_bio(&xSsl, &xClientFd, mbedtls_net_send, mbedtls_net_recv, NULL);
+                    if (mbedtls_ssl_handshake(&xSsl) == 0)
+                    {
+                        while (mbedtls_ssl_read(&xSsl, pBuf, sizeof(pBuf)) > 0)
+                        {
+                            /* nop */
+                        }
+                    }
+                }
+                _exit(0);
+            }
+            mbedtls_net_free(&xClientFd);
+        }
+    }
+};
+
+static NetIoHandle connectTls(const char *pcPort, TlsContextHandle xTlsContext, unsigned int uMaxFragmentLen)
+{
+    NetIoHandle xNetIoHandle = NetIo_create();
+
+    EXPECT_TRUE(xNetIoHandle != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setTlsContext(xNetIoHandle, xTlsContext));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setMaxFragmentLen(xNetIoHandle, uMaxFragmentLen));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_connect(xNetIoHandle, LOOPBACK_HOST, pcPort));
+
+    return xNetIoHandle;
+}
+
+/* KvsApp_open keeps the control plane connection while PUT MEDIA connects, and then PUT MEDIA streams HTTP chunks of
+ * frames. The heap of both phases is counted from the one before open, and the TLS context is created before it like
+ * KvsApp_create does. */
+static void measureHeap(const char *pcPort, unsigned int uMaxFragmentLen, long *pxOpenPeak, long *pxStreaming, long *pxStreamingPeak)
+{
+    static unsigned char pFrame[STREAMING_FRAME_SIZE];
+    TlsContextHandle xTlsContext = TlsContext_create();
+    NetIoHandle xControlPlane = NULL;
+    NetIoHandle xPutMedia = NULL;
+    char pcChunkHeader[16];
+    const char *pcChunkEnd = "\r\n";
+    NetIoVec_t xVecs[3];
+    long xBase = 0;
+
+    ASSERT_TRUE(xTlsContext != NULL);
+
+    xBase = resetHeapPeak();
+    xControlPlane = connectTls(pcPort, xTlsContext, uMaxFragmentLen);
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xControlPlane, pFrame, 1024));
+    xPutMedia = connectTls(pcPort, xTlsContext, uMaxFragmentLen);
+    NetIo_terminate(xControlPlane);
+    *pxOpenPeak = xHeapPeak - xBase;
+
+    resetHeapPeak();
+    snprintf(pcChunkHeader, sizeof(pcChunkHeader), "%lx\r\n", (unsigned long)sizeof(pFrame));
+    xVecs[0].pBuffer = (const unsigned char *)pcChunkHeader;
+    xVecs[0].uLen = strlen(pcChunkHeader);
+    xVecs[1].pBuffer = pFrame;
+    xVecs[1].uLen = sizeof(pFrame);
+    xVecs[2].pBuffer = (const unsigned char *)pcChunkEnd;
+    xVecs[2].uLen = strlen(pcChunkEnd);
+    for (int i = 0; i < STREAMING_FRAME_COUNT; i++)
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, NetIo_sendv(xPutMedia, xVecs, 3));
+    }
+    *pxStreaming = xHeapInUse - xBase;
+    *pxStreamingPeak = xHeapPeak - xBase;
+
+    NetIo_terminate(xPutMedia);
+    TlsContext_terminate(xTlsContext);
+}
+
+TEST(TlsMemoryBenchmark, heap_of_open_and_streaming)
+{
+    TlsServerProcess xServer;
+    unsigned int pMaxFragmentLens[] = {0, 4096, 2048, 1024};
+    long xOpenPeak = 0;
+    long xStreaming = 0;
+    long xStreamingPeak = 0;
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+    const char *pcResized = ", resized after the handshake";
+#else
+    const char *pcResized = "";
+#endif
+
+    ASSERT_TRUE(xServer.start());
+
+    printf("mbedTLS record buffers: in %d B, out %d B%s\n", MBEDTLS_SSL_IN_CONTENT_LEN, MBEDTLS_SSL_OUT_CONTENT_LEN, pcResized);
+    for (size_t i = 0; i < sizeof(pMaxFragmentLens) / sizeof(pMaxFragmentLens[0]); i++)
+    {
+        measureHeap(xServer.pcPort, pMaxFragmentLens[i], &xOpenPeak, &xStreaming, &xStreamingPeak);
+        printf("max fragment length %5u: open peak %6.1f KB, streaming %6.1f KB (peak %6.1f KB)\n", pMaxFragmentLens[i], xOpenPeak / 1024.0,
+               xStreaming / 1024.0, xStreamingPeak / 1024.0);
+
+        EXPECT_GT(xOpenPeak, 0);
+        EXPECT_GT(xStreaming, 0);
+    }
+
+    xServer.stop();
+}
+
+#endif /* __GLIBC__ */
@@ -0,0 +1,170 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/port.h"
+#include "kvs/stream.h"
+}
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define LATENCY_FRAME_COUNT (150)
+#define LATENCY_FRAME_INTERVAL_MS (33)
+#define LATENCY_FRAMES_PER_CLUSTER (30)
+
+/* The sleep of the polling doWork, and the longest wait of the event-driven one */
+#define POLL_INTERVAL_MS (50)
+#define MAX_WAIT_MS (1000)
+
+#define IDLE_DURATION_MS (2000)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+
+typedef std::chrono::steady_clock::time_point TimePoint_t;
+
+typedef struct SenderResult
+{
+    std::vector<double> xLatencyUs;
+    size_t uWakeCnt;
+} SenderResult_t;
+
+static StreamHandle createStream(void)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    return Kvs_streamCreate(&xVideoTrackInfo, NULL);
+}
+
+/* The sender loop of doWork. Frames are popped in the order they're added, so the n-th frame popped is the n-th added. */
+static void runSender(StreamHandle xStreamHandle, WakeupHandle xWakeup, size_t uFrameCnt, std::vector<TimePoint_t> *pxAddTimes,
+                      TimePoint_t xDeadline, SenderResult_t *pxResult)
+{
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t uPopCnt = 0;
+
+    pxResult->uWakeCnt = 0;
+    while (uPopCnt < uFrameCnt && std::chrono::steady_clock::now() < xDeadline)
+    {
+        if ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+        {
+            auto xLatency = std::chrono::steady_clock::now() - (*pxAddTimes)[uPopCnt];
+            pxResult->xLatencyUs.push_back(std::chrono::duration<double, std::micro>(xLatency).count());
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+            uPopCnt++;
+        }
+        else
+        {
+            if (xWakeup != NULL)
+            {
+                wakeupWait(xWakeup, -1, MAX_WAIT_MS);
+            }
+            else
+            {
+                sleepInMs(POLL_INTERVAL_MS);
+            }
+            pxResult->uWakeCnt++;
+        }
+    }
+}
+
+/* A camera adds a frame every LATENCY_FRAME_INTERVAL_MS, and the sender pops it. */
+static void measureLatency(bool bUseWakeup, SenderResult_t *pxResult)
+{
+    StreamHandle xStreamHandle = createStream();
+    WakeupHandle xWakeup = bUseWakeup ? wakeupCreate() : NULL;
+    std::vector<TimePoint_t> xAddTimes(LATENCY_FRAME_COUNT);
+    TimePoint_t xDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    DataFrameIn_t xDataFrameIn = {};
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    if (bUseWakeup)
+    {
+        ASSERT_TRUE(xWakeup != NULL);
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSetWakeup(xStreamHandle, xWakeup));
+    }
+
+    std::thread xSender(runSender, xStreamHandle, xWakeup, (size_t)LATENCY_FRAME_COUNT, &xAddTimes, xDeadline, pxResult);
+
+    for (size_t i = 0; i < LATENCY_FRAME_COUNT; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LATENCY_FRAME_INTERVAL_MS));
+        xDataFrameIn.bIsKeyFrame = (i % LATENCY_FRAMES_PER_CLUSTER) == 0;
+        xDataFrameIn.xClusterType = xDataFrameIn.bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.uDataLen = 1024;
+        xDataFrameIn.uTimestampMs = i * LATENCY_FRAME_INTERVAL_MS;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        xAddTimes[i] = std::chrono::steady_clock::now();
+        EXPECT_TRUE(Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL);
+    }
+    xSender.join();
+
+    Kvs_streamTermintate(xStreamHandle);
+    wakeupTerminate(xWakeup);
+}
+
+/* Count how often the sender wakes up while no frame arrives. */
+static size_t measureIdleWakeups(bool bUseWakeup)
+{
+    StreamHandle xStreamHandle = createStream();
+    WakeupHandle xWakeup = bUseWakeup ? wakeupCreate() : NULL;
+    std::vector<TimePoint_t> xAddTimes(1);
+    SenderResult_t xResult;
+
+    EXPECT_TRUE(xStreamHandle != NULL);
+    runSender(xStreamHandle, xWakeup, 1, &xAddTimes, std::chrono::steady_clock::now() + std::chrono::milliseconds(IDLE_DURATION_MS), &xResult);
+
+    Kvs_streamTermintate(xStreamHandle);
+    wakeupTerminate(xWakeup);
+
+    return xResult.uWakeCnt;
+}
+
+static void printLatency(const char *pcName, SenderResult_t *pxResult)
+{
+    std::vector<double> &xLatencyUs = pxResult->xLatencyUs;
+    double dSum = 0;
+
+    ASSERT_EQ((size_t)LATENCY_FRAME_COUNT, xLatencyUs.size());
+    std::sort(xLatencyUs.begin(), xLatencyUs.end());
+    for (size_t i = 0; i < xLatencyUs.size(); i++)
+    {
+        dSum += xLatencyUs[i];
+    }
+
+    printf("%s: add-to-pop latency mean %9.1f us, p50 %9.1f us, p99 %9.1f us\n", pcName, dSum / xLatencyUs.size(), xLatencyUs[xLatencyUs.size() / 2],
+           xLatencyUs[xLatencyUs.size() * 99 / 100]);
+}
+
+TEST(WakeupBenchmark, sleep_vs_wakeup_latency)
+{
+    SenderResult_t xPoll;
+    SenderResult_t xWakeup;
+    size_t uPollIdleWakeCnt = measureIdleWakeups(false);
+    size_t uWakeupIdleWakeCnt = measureIdleWakeups(true);
+
+    measureLatency(false, &xPoll);
+    measureLatency(true, &xWakeup);
+
+    printLatency("sleep 50 ms", &xPoll);
+    printLatency("wakeup     ", &xWakeup);
+    printf("idle wakeups per second: sleep 50 ms %.1f, wakeup %.1f\n", uPollIdleWakeCnt * 1000.0 / IDLE_DURATION_MS, uWakeupIdleWakeCnt * 1000.0 / IDLE_DURATION_MS);
+
+    /* The median frame waits half a poll interval when polling, but almost nothing with the wakeup. */
+    EXPECT_LT(xWakeup.xLatencyUs[LATENCY_FRAME_COUNT / 2], xPoll.xLatencyUs[LATENCY_FRAME_COUNT / 2]);
+    EXPECT_LT(uWakeupIdleWakeCnt, uPollIdleWakeCnt);
+}
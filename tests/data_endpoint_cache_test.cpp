@@ -0,0 +1,199 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/data_endpoint_cache.h"
+#include "kvs/errors.h"
+#include "os/allocator.h"
+}
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#define TTL_SEC (3600)
+
+static char pRegion[] = "us-east-1";
+static char pStreamName[] = "my-stream";
+static char pEndpoint[] = "https://s-1234abcd.kinesisvideo.us-east-1.amazonaws.com";
+
+class DataEndpointCacheTest : public ::testing::Test
+{
+protected:
+    char pcPath[64];
+    DataEndpointCacheHandle xCache;
+
+    void SetUp() override
+    {
+        int fd = -1;
+
+        strcpy(pcPath, "/tmp/kvs_endpoint_cache_test_XXXXXX");
+        ASSERT_GE(fd = mkstemp(pcPath), 0);
+        close(fd);
+        ASSERT_TRUE((xCache = DataEndpointCache_create()) != NULL);
+    }
+
+    void TearDown() override
+    {
+        DataEndpointCache_terminate(xCache);
+        unlink(pcPath);
+    }
+
+    void writeFile(const char *pcContent)
+    {
+        FILE *fp = fopen(pcPath, "wb");
+
+        ASSERT_TRUE(fp != NULL);
+        fputs(pcContent, fp);
+        fclose(fp);
+    }
+
+    void expectEndpoint(DataEndpointCacheHandle xCache, const char *pcStreamName, const char *pcExpected)
+    {
+        char *pcEndpoint = NULL;
+
+        ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_get(xCache, pRegion, pcStreamName, &pcEndpoint));
+        EXPECT_STREQ(pcExpected, pcEndpoint);
+        kvsFree(pcEndpoint);
+    }
+};
+
+TEST_F(DataEndpointCacheTest, set_get_and_remove)
+{
+    char *pcEndpoint = NULL;
+
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, pStreamName, &pcEndpoint));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, TTL_SEC));
+    expectEndpoint(xCache, pStreamName, pEndpoint);
+
+    /* The same stream name in another region is another stream. */
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, "eu-west-1", pStreamName, &pcEndpoint));
+
+    /* Setting it again replaces the endpoint. */
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, "https://s-new.kinesisvideo.us-east-1.amazonaws.com", TTL_SEC));
+    expectEndpoint(xCache, pStreamName, "https://s-new.kinesisvideo.us-east-1.amazonaws.com");
+
+    DataEndpointCache_remove(xCache, pRegion, pStreamName);
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, pStreamName, &pcEndpoint));
+}
+
+TEST_F(DataEndpointCacheTest, expired_endpoint_is_a_miss)
+{
+    char *pcEndpoint = NULL;
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, 0));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, pStreamName, &pcEndpoint));
+}
+
+TEST_F(DataEndpointCacheTest, save_and_load)
+{
+    DataEndpointCacheHandle xLoadedCache = DataEndpointCache_create();
+
+    ASSERT_TRUE(xLoadedCache != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com", TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xCache, pcPath));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xLoadedCache, pcPath));
+    expectEndpoint(xLoadedCache, pStreamName, pEndpoint);
+    expectEndpoint(xLoadedCache, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com");
+
+    DataEndpointCache_terminate(xLoadedCache);
+}
+
+/* Apps which share the file keep each other's endpoints. */
+TEST_F(DataEndpointCacheTest, save_merges_with_file)
+{
+    DataEndpointCacheHandle xOtherCache = DataEndpointCache_create();
+    DataEndpointCacheHandle xLoadedCache = DataEndpointCache_create();
+
+    ASSERT_TRUE(xOtherCache != NULL && xLoadedCache != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xOtherCache, pRegion, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com", TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xOtherCache, pRegion, pStreamName, "https://s-old.kinesisvideo.us-east-1.amazonaws.com", TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xOtherCache, pcPath));
+
+    /* The endpoint of this cache replaces the one of the same stream in the file. */
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xCache, pcPath));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xLoadedCache, pcPath));
+    expectEndpoint(xLoadedCache, pStreamName, pEndpoint);
+    expectEndpoint(xLoadedCache, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com");
+
+    DataEndpointCache_terminate(xOtherCache);
+    DataEndpointCache_terminate(xLoadedCache);
+}
+
+/* A removed or expired endpoint isn't brought back from the file. */
+TEST_F(DataEndpointCacheTest, save_drops_removed_endpoints)
+{
+    DataEndpointCacheHandle xLoadedCache = DataEndpointCache_create();
+    char *pcEndpoint = NULL;
+
+    ASSERT_TRUE(xLoadedCache != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com", TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xCache, pcPath));
+
+    DataEndpointCache_remove(xCache, pRegion, pStreamName);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, "another-stream", "https://s-5678.kinesisvideo.us-east-1.amazonaws.com", 0));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, "another-stream", &pcEndpoint));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xCache, pcPath));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xLoadedCache, pcPath));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xLoadedCache, pRegion, pStreamName, &pcEndpoint));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xLoadedCache, pRegion, "another-stream", &pcEndpoint));
+
+    DataEndpointCache_terminate(xLoadedCache);
+}
+
+/* An invalid file is replaced by a private one. */
+TEST_F(DataEndpointCacheTest, save_replaces_invalid_file)
+{
+    DataEndpointCacheHandle xLoadedCache = DataEndpointCache_create();
+    struct stat xStat;
+
+    ASSERT_TRUE(xLoadedCache != NULL);
+    writeFile("not a cache file\n");
+    chmod(pcPath, 0644);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_set(xCache, pRegion, pStreamName, pEndpoint, TTL_SEC));
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_save(xCache, pcPath));
+
+    ASSERT_EQ(0, stat(pcPath, &xStat));
+    EXPECT_EQ(0600, xStat.st_mode & 0777);
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xLoadedCache, pcPath));
+    expectEndpoint(xLoadedCache, pStreamName, pEndpoint);
+
+    DataEndpointCache_terminate(xLoadedCache);
+}
+
+TEST_F(DataEndpointCacheTest, load_skips_expired_endpoints)
+{
+    char *pcEndpoint = NULL;
+
+    writeFile("KVSDEC1\n"
+              "1 us-east-1 old-stream https://s-old.kinesisvideo.us-east-1.amazonaws.com\n"
+              "18446744073709551615 us-east-1 my-stream https://s-1234abcd.kinesisvideo.us-east-1.amazonaws.com\n");
+
+    ASSERT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xCache, pcPath));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, "old-stream", &pcEndpoint));
+    expectEndpoint(xCache, pStreamName, pEndpoint);
+}
+
+TEST_F(DataEndpointCacheTest, load_invalid_file)
+{
+    char *pcEndpoint = NULL;
+
+    writeFile("not a cache file\n");
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_INVALID_FILE, DataEndpointCache_load(xCache, pcPath));
+
+    writeFile("KVSDEC1\n18446744073709551615 us-east-1\n");
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_INVALID_FILE, DataEndpointCache_load(xCache, pcPath));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, pRegion, pStreamName, &pcEndpoint));
+
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_IO_ERROR, DataEndpointCache_load(xCache, "/nonexistent/kvs_endpoint_cache"));
+}
@@ -0,0 +1,263 @@
+#ifdef __cplusplus
+extern "C" {
+#include "azure_c_shared_utility/httpheaders.h"
+#include "kvs/control_plane_client.h"
+#include "kvs/errors.h"
+#include "kvs/netio_transport.h"
+#include "net/http_helper.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+}
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#define PIPE_HOST "kinesisvideo.local"
+#define PIPE_HOST_2 "iot.local"
+#define PIPE_PORT "443"
+
+/* A stand-in of a control plane endpoint on a memory pipe. It serves the connections one after another, and answers
+ * every request of a connection until the client closes it. */
+class ControlPlanePipeServer
+{
+public:
+    /* Close the connection after every response, as a server does to an idle connection. */
+    std::atomic<bool> bCloseAfterRsp{false};
+    /* Close the connection without answering the next requests, as a server does when a request arrives just as it
+     * drops the connection. */
+    std::atomic<int> xRequestsToDrop{0};
+
+    std::atomic<int> xAccepted{0};
+    std::atomic<int> xRequests{0};
+    std::atomic<int> xAnswered{0};
+    std::atomic<int> xClosed{0};
+
+    bool start(const char *pcHost)
+    {
+        if ((xListener = NetIoPipe_listen(pcHost, PIPE_PORT)) == NULL)
+        {
+            return false;
+        }
+        xThread = std::thread(&ControlPlanePipeServer::run, this);
+
+        return true;
+    }
+
+    void stop()
+    {
+        if (xListener != NULL)
+        {
+            bStop = true;
+            xThread.join();
+            NetIoPipe_terminateListener(xListener);
+            xListener = NULL;
+        }
+    }
+
+    ~ControlPlanePipeServer()
+    {
+        stop();
+    }
+
+private:
+    NetIoPipeListenerHandle xListener = NULL;
+    std::atomic<bool> bStop{false};
+    std::thread xThread;
+
+    void run()
+    {
+        NetIoHandle xNetIoHandle = NULL;
+
+        while (!bStop)
+        {
+            if ((xNetIoHandle = NetIoPipe_accept(xListener, 50)) != NULL)
+            {
+                xAccepted++;
+                serve(xNetIoHandle);
+                NetIo_terminate(xNetIoHandle);
+                xClosed++;
+            }
+        }
+    }
+
+    void serve(NetIoHandle xNetIoHandle)
+    {
+        const char *pcRsp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n{}";
+        std::string xBuf;
+        unsigned char pBuf[1024];
+        size_t uLen = 0;
+        size_t uHdrEnd = 0;
+
+        while (true)
+        {
+            while ((uHdrEnd = xBuf.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) != KVS_ERRNO_NONE)
+                {
+                    return;
+                }
+                xBuf.append((const char *)pBuf, uLen);
+            }
+            /* The requests of the tests have no body. */
+            xBuf.erase(0, uHdrEnd + 4);
+            xRequests++;
+
+            if (xRequestsToDrop > 0)
+            {
+                xRequestsToDrop--;
+                return;
+            }
+            if (NetIo_send(xNetIoHandle, (const unsigned char *)pcRsp, strlen(pcRsp)) != KVS_ERRNO_NONE)
+            {
+                return;
+            }
+            xAnswered++;
+            if (bCloseAfterRsp)
+            {
+                return;
+            }
+        }
+    }
+};
+
+static int connectPipe(NetIoHandle xNetIoHandle, void *pConnectArg)
+{
+    int res = KVS_ERRNO_NONE;
+
+    if ((res = NetIo_setTransport(xNetIoHandle, NetIoTransport_getPipe())) != KVS_ERRNO_NONE ||
+        (res = NetIo_setRecvTimeout(xNetIoHandle, 1000)) != KVS_ERRNO_NONE ||
+        (res = NetIo_connect(xNetIoHandle, (const char *)pConnectArg, PIPE_PORT)) != KVS_ERRNO_NONE)
+    {
+        /* Propagate the res error */
+    }
+
+    return res;
+}
+
+class ControlPlaneClientTest : public ::testing::Test
+{
+protected:
+    ControlPlanePipeServer xServer;
+    ControlPlaneClientHandle xClient = NULL;
+    HTTP_HEADERS_HANDLE xHeaders = NULL;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(xServer.start(PIPE_HOST));
+        ASSERT_NE(nullptr, xClient = ControlPlaneClient_create());
+        ASSERT_NE(nullptr, xHeaders = HTTPHeaders_Alloc());
+        ASSERT_EQ(HTTP_HEADERS_OK, HTTPHeaders_AddHeaderNameValuePair(xHeaders, "host", PIPE_HOST));
+    }
+
+    void TearDown() override
+    {
+        HTTPHeaders_Free(xHeaders);
+
+        /* The client closes the kept connection, so the server can stop. */
+        ControlPlaneClient_terminate(xClient);
+        xServer.stop();
+    }
+
+    int request(const char *pcHost = PIPE_HOST)
+    {
+        int res = KVS_ERRNO_NONE;
+        unsigned int uHttpStatus = 0;
+        char *pRspBody = NULL;
+        size_t uRspBodyLen = 0;
+
+        if ((res = Http_executeControlPlaneReq(xClient, pcHost, connectPipe, (void *)pcHost, "POST", "/describeStream", xHeaders, "", &uHttpStatus, &pRspBody, &uRspBodyLen)) ==
+            KVS_ERRNO_NONE)
+        {
+            EXPECT_EQ(200u, uHttpStatus);
+            EXPECT_EQ(std::string("{}"), std::string(pRspBody, uRspBodyLen));
+            free(pRspBody);
+        }
+
+        return res;
+    }
+};
+
+TEST_F(ControlPlaneClientTest, reuses_connection)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, request());
+    }
+    EXPECT_EQ(1, xServer.xAccepted);
+    EXPECT_EQ(3, xServer.xAnswered);
+}
+
+/* A connection which the server closed while it was idle isn't used, so no request is sent on it. */
+TEST_F(ControlPlaneClientTest, drops_connection_closed_while_idle)
+{
+    xServer.bCloseAfterRsp = true;
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    while (xServer.xClosed < 1)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+    EXPECT_EQ(2, xServer.xRequests);
+    EXPECT_EQ(2, xServer.xAnswered);
+}
+
+TEST_F(ControlPlaneClientTest, retries_once_on_stale_connection)
+{
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    xServer.xRequestsToDrop = 1;
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+    EXPECT_EQ(3, xServer.xRequests);
+    EXPECT_EQ(2, xServer.xAnswered);
+
+    /* The new connection is kept. */
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+}
+
+/* A request which fails on a new connection isn't retried. */
+TEST_F(ControlPlaneClientTest, does_not_retry_new_connection)
+{
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    xServer.xRequestsToDrop = 3;
+    EXPECT_NE(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+    EXPECT_EQ(3, xServer.xRequests);
+
+    /* The failed connection isn't kept, so the next request connects again. */
+    xServer.xRequestsToDrop = 0;
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(3, xServer.xAccepted);
+}
+
+TEST_F(ControlPlaneClientTest, reconnects_for_another_host)
+{
+    ControlPlanePipeServer xServer2;
+
+    ASSERT_TRUE(xServer2.start(PIPE_HOST_2));
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(KVS_ERRNO_NONE, request(PIPE_HOST_2));
+    EXPECT_EQ(KVS_ERRNO_NONE, request(PIPE_HOST_2));
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+    EXPECT_EQ(1, xServer2.xAccepted);
+}
+
+/* Without a client, every request has its own connection. */
+TEST_F(ControlPlaneClientTest, no_client_closes_connection)
+{
+    ControlPlaneClient_terminate(xClient);
+    xClient = NULL;
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(KVS_ERRNO_NONE, request());
+    EXPECT_EQ(2, xServer.xAccepted);
+}
@@ -0,0 +1,906 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/data_endpoint_cache.h"
+#include "kvs/errors.h"
+#include "kvs/kvsapp.h"
+#include "kvs/kvsapp_group.h"
+#include "kvs/kvsapp_options.h"
+#include "kvs/netio_transport.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+#include "os/allocator.h"
+}
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define PIPE_HOST "kinesisvideo.local"
+#define PIPE_PORT "443"
+
+#define WAIT_TIMEOUT_MS (5000)
+
+/* A stand-in of the KVS service on a memory pipe. The control plane requests are answered, PUT MEDIA is answered with
+ * the configured status code, and the PUT MEDIA data of every connection is kept until the client closes it. */
+class KvsPipeServer
+{
+public:
+    std::atomic<unsigned int> uPutMediaStatus{200};
+    std::atomic<unsigned int> uGetDataEndpointStatus{200};
+    std::atomic<int> xPutMediaRequests{0};
+
+    bool start()
+    {
+        if ((xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT)) == NULL)
+        {
+            return false;
+        }
+        xAcceptThread = std::thread(&KvsPipeServer::acceptLoop, this);
+
+        return true;
+    }
+
+    /* Stop accepting, and wait for the connections to be closed by their clients. */
+    void stop()
+    {
+        if (xListener != NULL)
+        {
+            bStop = true;
+            release();
+            xAcceptThread.join();
+            for (auto &xThread : xConnThreads)
+            {
+                xThread.join();
+            }
+            xConnThreads.clear();
+            NetIoPipe_terminateListener(xListener);
+            xListener = NULL;
+        }
+    }
+
+    ~KvsPipeServer()
+    {
+        stop();
+    }
+
+    /* Hold the responses of PUT MEDIA until release() is called, or only those of a stream if its name is given. */
+    void hold(const std::string &xStreamName = "")
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        bHold = true;
+        xHoldStreamName = xStreamName;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        bHold = false;
+        xCond.notify_all();
+    }
+
+    /* Stop reading the PUT MEDIA data of a stream until resumeReading() is called, so its client fills the pipe. */
+    void pauseReading(const std::string &xStreamName)
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        xPausedStreamName = xStreamName;
+    }
+
+    void resumeReading()
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        xPausedStreamName.clear();
+        xCond.notify_all();
+    }
+
+    /* The number of PUT MEDIA connections which were answered with 200. */
+    size_t putMediaCount()
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        return xPutMediaData.size();
+    }
+
+    std::string putMediaData(size_t uIdx)
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        return (uIdx < xPutMediaData.size()) ? xPutMediaData[uIdx] : std::string();
+    }
+
+    bool isPutMediaClosed(size_t uIdx)
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        return uIdx < xPutMediaClosed.size() && xPutMediaClosed[uIdx];
+    }
+
+    /* The index of the first PUT MEDIA connection of a stream which was answered with 200, or -1. */
+    int putMediaIndex(const std::string &xStreamName)
+    {
+        std::lock_guard<std::mutex> xGuard(xLock);
+        for (size_t i = 0; i < xPutMediaStreamNames.size(); i++)
+        {
+            if (xPutMediaStreamNames[i] == xStreamName)
+            {
+                return (int)i;
+            }
+        }
+
+        return -1;
+    }
+
+private:
+    NetIoPipeListenerHandle xListener = NULL;
+    std::atomic<bool> bStop{false};
+    std::thread xAcceptThread;
+    std::vector<std::thread> xConnThreads;
+
+    std::mutex xLock;
+    std::condition_variable xCond;
+    bool bHold = false;
+    std::string xHoldStreamName;
+    std::string xPausedStreamName;
+    std::vector<std::string> xPutMediaStreamNames;
+    std::vector<std::string> xPutMediaData;
+    std::vector<bool> xPutMediaClosed;
+
+    void acceptLoop()
+    {
+        NetIoHandle xNetIoHandle = NULL;
+
+        while (!bStop)
+        {
+            if ((xNetIoHandle = NetIoPipe_accept(xListener, 50)) != NULL)
+            {
+                xConnThreads.emplace_back(&KvsPipeServer::serve, this, xNetIoHandle);
+            }
+        }
+    }
+
+    static bool recvMore(NetIoHandle xNetIoHandle, std::string &xBuf)
+    {
+        unsigned char pBuf[4096];
+        size_t uLen = 0;
+
+        if (NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) != KVS_ERRNO_NONE)
+        {
+            return false;
+        }
+        xBuf.append((const char *)pBuf, uLen);
+
+        return true;
+    }
+
+    static bool respond(NetIoHandle xNetIoHandle, unsigned int uStatus, const std::string &xBody)
+    {
+        std::string xRsp = "HTTP/1.1 " + std::to_string(uStatus) + ((uStatus == 200) ? " OK" : " Error") + "\r\nContent-Length: " + std::to_string(xBody.size()) + "\r\n\r\n" + xBody;
+
+        return NetIo_send(xNetIoHandle, (const unsigned char *)xRsp.data(), xRsp.size()) == KVS_ERRNO_NONE;
+    }
+
+    static size_t contentLength(std::string xHeader)
+    {
+        size_t uPos = 0;
+
+        std::transform(xHeader.begin(), xHeader.end(), xHeader.begin(), ::tolower);
+        return ((uPos = xHeader.find("content-length:")) == std::string::npos) ? 0 : strtoul(xHeader.c_str() + uPos + 15, NULL, 10);
+    }
+
+    static std::string streamName(std::string xHeader)
+    {
+        std::string xLower = xHeader;
+        size_t uPos = 0;
+
+        std::transform(xLower.begin(), xLower.end(), xLower.begin(), ::tolower);
+        if ((uPos = xLower.find("x-amzn-stream-name:")) == std::string::npos)
+        {
+            return std::string();
+        }
+        uPos = xHeader.find_first_not_of(' ', uPos + 19);
+
+        return xHeader.substr(uPos, xHeader.find("\r\n", uPos) - uPos);
+    }
+
+    /* Answer the control plane requests of a connection until it's closed, or until it turns into PUT MEDIA. */
+    void serve(NetIoHandle xNetIoHandle)
+    {
+        std::string xBuf;
+        std::string xHeader;
+        std::string xUri;
+        size_t uHdrEnd = 0;
+        size_t uBodyLen = 0;
+        bool bIsOpen = true;
+
+        while (bIsOpen)
+        {
+            while ((uHdrEnd = xBuf.find("\r\n\r\n")) == std::string::npos && (bIsOpen = recvMore(xNetIoHandle, xBuf)))
+            {
+            }
+            if (!bIsOpen)
+            {
+                break;
+            }
+            xHeader = xBuf.substr(0, uHdrEnd + 4);
+            xBuf.erase(0, uHdrEnd + 4);
+            xUri = xHeader.substr(xHeader.find(' ') + 1);
+            xUri = xUri.substr(0, xUri.find(' '));
+
+            if (xUri == "/putMedia")
+            {
+                servePutMedia(xNetIoHandle, streamName(xHeader), xBuf);
+                break;
+            }
+
+            uBodyLen = contentLength(xHeader);
+            while (xBuf.size() < uBodyLen && (bIsOpen = recvMore(xNetIoHandle, xBuf)))
+            {
+            }
+            xBuf.erase(0, uBodyLen);
+
+            if (xUri == "/describeStream")
+            {
+                bIsOpen = respond(xNetIoHandle, 200, "{}");
+            }
+            else if (xUri == "/createStream")
+            {
+                bIsOpen = respond(xNetIoHandle, 200, "{\"StreamARN\":\"arn\"}");
+            }
+            else if (xUri == "/getDataEndpoint" && uGetDataEndpointStatus != 200)
+            {
+                bIsOpen = respond(xNetIoHandle, uGetDataEndpointStatus, "{}");
+            }
+            else if (xUri == "/getDataEndpoint")
+            {
+                bIsOpen = respond(xNetIoHandle, 200, "{\"DataEndpoint\":\"https://" PIPE_HOST "\"}");
+            }
+            else
+            {
+                bIsOpen = respond(xNetIoHandle, 404, "{}");
+            }
+        }
+        NetIo_terminate(xNetIoHandle);
+    }
+
+    /* It always returns true, so it can lead the condition of the read loop. */
+    bool waitForReading(const std::string &xStreamName)
+    {
+        std::unique_lock<std::mutex> xGuard(xLock);
+        xCond.wait(xGuard, [this, &xStreamName] { return xPausedStreamName != xStreamName || bStop; });
+
+        return true;
+    }
+
+    void servePutMedia(NetIoHandle xNetIoHandle, const std::string &xStreamName, std::string &xBuf)
+    {
+        size_t uIdx = 0;
+        unsigned int uStatus = 0;
+
+        xPutMediaRequests++;
+        {
+            std::unique_lock<std::mutex> xGuard(xLock);
+            xCond.wait(xGuard, [this, &xStreamName] { return !bHold || bStop || (!xHoldStreamName.empty() && xHoldStreamName != xStreamName); });
+        }
+
+        if ((uStatus = uPutMediaStatus) != 200)
+        {
+            respond(xNetIoHandle, uStatus, "{}");
+        }
+        else if (respond(xNetIoHandle, 200, ""))
+        {
+            {
+                std::lock_guard<std::mutex> xGuard(xLock);
+                uIdx = xPutMediaData.size();
+                xPutMediaStreamNames.push_back(xStreamName);
+                xPutMediaData.push_back(xBuf);
+                xPutMediaClosed.push_back(false);
+            }
+            xBuf.clear();
+            while (waitForReading(xStreamName) && recvMore(xNetIoHandle, xBuf))
+            {
+                std::lock_guard<std::mutex> xGuard(xLock);
+                xPutMediaData[uIdx] += xBuf;
+                xBuf.clear();
+            }
+            std::lock_guard<std::mutex> xGuard(xLock);
+            xPutMediaClosed[uIdx] = true;
+        }
+    }
+};
+
+/* Wait until the condition is met, or the timeout. */
+static bool waitFor(std::function<bool()> xCondition, int xTimeoutMs = WAIT_TIMEOUT_MS)
+{
+    auto xDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(xTimeoutMs);
+
+    while (!xCondition())
+    {
+        if (std::chrono::steady_clock::now() > xDeadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+static std::string frameMarker(int xIdx)
+{
+    char pcMarker[32];
+
+    snprintf(pcMarker, sizeof(pcMarker), "frame-%04d", xIdx);
+
+    return pcMarker;
+}
+
+/* An AVCC frame of one NALU, whose payload is the marker of its index and uPadLen bytes of padding. The first frame is a
+ * key frame. */
+static uint8_t *createFrame(int xIdx, size_t *puLen, size_t uPadLen = 0)
+{
+    std::string xMarker = frameMarker(xIdx);
+    size_t uNaluLen = 1 + xMarker.size() + uPadLen;
+    uint8_t *pFrame = (uint8_t *)malloc(4 + uNaluLen);
+
+    pFrame[0] = (uint8_t)(uNaluLen >> 24);
+    pFrame[1] = (uint8_t)(uNaluLen >> 16);
+    pFrame[2] = (uint8_t)(uNaluLen >> 8);
+    pFrame[3] = (uint8_t)uNaluLen;
+    pFrame[4] = (xIdx == 0) ? 0x65 : 0x41;
+    memcpy(pFrame + 5, xMarker.data(), xMarker.size());
+    memset(pFrame + 5 + xMarker.size(), 'x', uPadLen);
+    *puLen = 4 + uNaluLen;
+
+    return pFrame;
+}
+
+/* A KVS app of a stream which connects to the server on the memory pipe. */
+static KvsAppHandle createKvsApp(const char *pcStreamName)
+{
+    KvsAppHandle xKvsApp = NULL;
+    char pcTrackName[] = "kvs video track";
+    char pcCodecName[] = "V_MPEG4/ISO/AVC";
+    uint8_t pCodecPrivate[] = {0x01, 0x42, 0x00, 0x1e, 0xff, 0xe1};
+    VideoTrackInfo_t xVideoTrackInfo = {};
+
+    xVideoTrackInfo.pTrackName = pcTrackName;
+    xVideoTrackInfo.pCodecName = pcCodecName;
+    xVideoTrackInfo.uWidth = 640;
+    xVideoTrackInfo.uHeight = 480;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    if ((xKvsApp = KvsApp_create(PIPE_HOST, "us-east-1", "kinesisvideo", pcStreamName)) != NULL &&
+        (KvsApp_setoption(xKvsApp, OPTION_AWS_ACCESS_KEY_ID, "AKIDEXAMPLE") != KVS_ERRNO_NONE ||
+         KvsApp_setoption(xKvsApp, OPTION_AWS_SECRET_ACCESS_KEY, "secret") != KVS_ERRNO_NONE ||
+         KvsApp_setoption(xKvsApp, OPTION_KVS_VIDEO_TRACK_INFO, (const char *)&xVideoTrackInfo) != KVS_ERRNO_NONE ||
+         KvsApp_setoption(xKvsApp, OPTION_NETIO_TRANSPORT, (const char *)NetIoTransport_getPipe()) != KVS_ERRNO_NONE))
+    {
+        KvsApp_terminate(xKvsApp);
+        xKvsApp = NULL;
+    }
+
+    return xKvsApp;
+}
+
+static int addFrameTo(KvsAppHandle xKvsApp, int *pxNextFrame, size_t uPadLen = 0)
+{
+    size_t uLen = 0;
+    uint8_t *pFrame = createFrame(*pxNextFrame, &uLen, uPadLen);
+    int res = KvsApp_addFrame(xKvsApp, pFrame, uLen, uLen, 1000000 + (uint64_t)*pxNextFrame * 33, TRACK_VIDEO);
+
+    if (res == KVS_ERRNO_NONE)
+    {
+        (*pxNextFrame)++;
+    }
+
+    return res;
+}
+
+/* Check the frames before xFrameCnt are in the PUT MEDIA data in order. */
+static bool hasFrames(const std::string &xData, int xFrameCnt)
+{
+    size_t uPos = 0;
+
+    for (int i = 0; i < xFrameCnt; i++)
+    {
+        if ((uPos = xData.find(frameMarker(i), uPos)) == std::string::npos)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+class KvsAppTest : public ::testing::Test
+{
+protected:
+    KvsPipeServer xServer;
+    KvsAppHandle xKvsApp = NULL;
+    int xNextFrame = 0;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(xServer.start());
+        ASSERT_NE(nullptr, xKvsApp = createKvsApp("stream"));
+    }
+
+    void TearDown() override
+    {
+        /* The KVS app closes its connections, so the server can stop. */
+        KvsApp_terminate(xKvsApp);
+        xServer.stop();
+    }
+
+    int addFrame()
+    {
+        return addFrameTo(xKvsApp, &xNextFrame);
+    }
+
+    void addFrames(int xCnt)
+    {
+        for (int i = 0; i < xCnt; i++)
+        {
+            ASSERT_EQ(KVS_ERRNO_NONE, addFrame());
+        }
+    }
+
+    /* The sender thread sets up the stream buffer once it's connected, so the first frame is added after that. */
+    bool addFirstFrame()
+    {
+        return waitFor([this] { return addFrame() != KVS_ERROR_STREAM_NOT_READY; }) && xNextFrame == 1;
+    }
+
+    /* Check all the added frames are in the PUT MEDIA data of a connection in order. */
+    bool hasAllFrames(size_t uIdx)
+    {
+        return hasFrames(xServer.putMediaData(uIdx), xNextFrame);
+    }
+};
+
+TEST_F(KvsAppTest, sender_start_and_stop_errors)
+{
+    EXPECT_EQ(KVS_ERROR_KVSAPP_SENDER_IS_NOT_RUNNING, KvsApp_stop(xKvsApp));
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_SENDER_IS_RUNNING, KvsApp_start(xKvsApp, NULL));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_SENDER_IS_NOT_RUNNING, KvsApp_stop(xKvsApp));
+}
+
+TEST_F(KvsAppTest, sender_sends_frames_until_stopped)
+{
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    ASSERT_TRUE(addFirstFrame());
+    addFrames(9);
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(0); }));
+    EXPECT_FALSE(xServer.isPutMediaClosed(0));
+
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    EXPECT_EQ(1u, xServer.putMediaCount());
+}
+
+/* A cached endpoint which PUT MEDIA fails on is removed from the file too, even if it can't be discovered again. */
+TEST_F(KvsAppTest, stale_data_endpoint_removed_from_cache_file)
+{
+    char pcPath[] = "/tmp/kvs_app_endpoint_cache_XXXXXX";
+    int fd = -1;
+    KvsAppHandle xOtherKvsApp = NULL;
+    DataEndpointCacheHandle xCache = NULL;
+    char *pcEndpoint = NULL;
+
+    ASSERT_GE(fd = mkstemp(pcPath), 0);
+    close(fd);
+    unlink(pcPath);
+
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_setoption(xKvsApp, OPTION_KVS_DATA_ENDPOINT_CACHE_FILE, pcPath));
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_open(xKvsApp));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_close(xKvsApp));
+
+    /* Another app loads the endpoint from the file, as it would after a restart. */
+    xServer.uPutMediaStatus = 500;
+    xServer.uGetDataEndpointStatus = 500;
+    ASSERT_NE(nullptr, xOtherKvsApp = createKvsApp("stream"));
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_setoption(xOtherKvsApp, OPTION_KVS_DATA_ENDPOINT_CACHE_FILE, pcPath));
+    EXPECT_NE(KVS_ERRNO_NONE, KvsApp_open(xOtherKvsApp));
+    KvsApp_close(xOtherKvsApp);
+    KvsApp_terminate(xOtherKvsApp);
+
+    ASSERT_NE(nullptr, xCache = DataEndpointCache_create());
+    EXPECT_EQ(KVS_ERRNO_NONE, DataEndpointCache_load(xCache, pcPath));
+    EXPECT_EQ(KVS_ERROR_DATA_ENDPOINT_CACHE_MISS, DataEndpointCache_get(xCache, "us-east-1", "stream", &pcEndpoint));
+    kvsFree(pcEndpoint);
+    DataEndpointCache_terminate(xCache);
+    unlink(pcPath);
+}
+
+/* The frames which are still queued when the sender is stopped are sent before the connection is closed. */
+TEST_F(KvsAppTest, sender_sends_queued_frames_on_stop)
+{
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    ASSERT_TRUE(addFirstFrame());
+    addFrames(200);
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    EXPECT_TRUE(hasAllFrames(0));
+}
+
+TEST_F(KvsAppTest, sender_stopped_by_terminate)
+{
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    ASSERT_TRUE(addFirstFrame());
+    addFrames(20);
+    KvsApp_terminate(xKvsApp);
+    xKvsApp = NULL;
+
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    EXPECT_TRUE(hasAllFrames(0));
+}
+
+TEST_F(KvsAppTest, sender_reconnects_after_put_media_fails)
+{
+    xServer.uPutMediaStatus = 500;
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests >= 1; }));
+    xServer.uPutMediaStatus = 200;
+
+    /* It retries after the backoff. */
+    ASSERT_TRUE(addFirstFrame());
+    addFrames(4);
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(0); }));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_GE(xServer.xPutMediaRequests, 2);
+}
+
+TEST_F(KvsAppTest, sender_stop_interrupts_backoff)
+{
+    std::chrono::steady_clock::time_point xStart;
+
+    xServer.uPutMediaStatus = 500;
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests >= 1; }));
+
+    /* The first backoff is a second. */
+    xStart = std::chrono::steady_clock::now();
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_LT(std::chrono::steady_clock::now() - xStart, std::chrono::milliseconds(500));
+    EXPECT_EQ(1, xServer.xPutMediaRequests);
+    EXPECT_EQ(0u, xServer.putMediaCount());
+}
+
+/* The result of KvsApp_openAsync, and how many times its callback is called. */
+struct OpenResult
+{
+    std::atomic<int> xCalls{0};
+    std::atomic<int> xResult{0};
+    KvsAppHandle *pKvsApp = nullptr;
+};
+
+static void onOpenComplete(int xResult, void *pAppData)
+{
+    OpenResult *pxOpenResult = (OpenResult *)pAppData;
+
+    pxOpenResult->xResult = xResult;
+    pxOpenResult->xCalls++;
+}
+
+/* Frames added while the setup thread runs are sent once the connection is set up. */
+TEST_F(KvsAppTest, open_async_sends_frames_added_while_opening)
+{
+    OpenResult xOpenResult;
+
+    xServer.hold();
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    addFrames(10);
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests == 1; }));
+    EXPECT_EQ(0, xOpenResult.xCalls);
+
+    xServer.release();
+    ASSERT_TRUE(waitFor([&xOpenResult] { return xOpenResult.xCalls == 1; }));
+    EXPECT_EQ(KVS_ERRNO_NONE, xOpenResult.xResult);
+
+    addFrames(5);
+    EXPECT_TRUE(waitFor([this] { return KvsApp_doWork(xKvsApp) == KVS_ERRNO_NONE && hasAllFrames(0); }));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_close(xKvsApp));
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    EXPECT_EQ(1, xOpenResult.xCalls);
+}
+
+TEST_F(KvsAppTest, open_async_reports_failure)
+{
+    OpenResult xOpenResult;
+
+    xServer.uPutMediaStatus = 403;
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    ASSERT_TRUE(waitFor([&xOpenResult] { return xOpenResult.xCalls == 1; }));
+    EXPECT_EQ(KVS_GENERATE_RESTFUL_ERROR(403), xOpenResult.xResult);
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_close(xKvsApp));
+
+    /* It can be opened again. */
+    xServer.uPutMediaStatus = 200;
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    ASSERT_TRUE(waitFor([&xOpenResult] { return xOpenResult.xCalls == 2; }));
+    EXPECT_EQ(KVS_ERRNO_NONE, xOpenResult.xResult);
+    EXPECT_EQ(1u, xServer.putMediaCount());
+}
+
+TEST_F(KvsAppTest, open_async_is_exclusive)
+{
+    OpenResult xOpenResult;
+
+    xServer.hold();
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_start(xKvsApp, NULL));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_open(xKvsApp));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_doWork(xKvsApp));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_doWorkEx(xKvsApp, NULL));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_readFragmentAck(xKvsApp, NULL, NULL, NULL));
+    int xWakeupFd = -1;
+    int xSocketFd = -1;
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_getPollFds(xKvsApp, &xWakeupFd, &xSocketFd));
+    unsigned int uTimeoutMs = 1000;
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_setoption(xKvsApp, OPTION_NETIO_STREAMING_RECV_TIMEOUT, (const char *)&uTimeoutMs));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_OPEN_IS_RUNNING, KvsApp_setoption(xKvsApp, OPTION_AWS_ACCESS_KEY_ID, "AKIDEXAMPLE"));
+    EXPECT_EQ(KVS_ERRNO_NONE, addFrame());
+    xServer.release();
+    ASSERT_TRUE(waitFor([&xOpenResult] { return xOpenResult.xCalls == 1; }));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_setoption(xKvsApp, OPTION_NETIO_STREAMING_RECV_TIMEOUT, (const char *)&uTimeoutMs));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_close(xKvsApp));
+
+    /* The sender thread opens the connection by itself. */
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_start(xKvsApp, NULL));
+    EXPECT_EQ(KVS_ERROR_KVSAPP_SENDER_IS_RUNNING, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_EQ(1, xOpenResult.xCalls);
+}
+
+/* The sender thread started in the callback sends the frames on the connection which the setup thread has set up. */
+static void onOpenCompleteStartSender(int xResult, void *pAppData)
+{
+    OpenResult *pxOpenResult = (OpenResult *)pAppData;
+    KvsAppHandle xKvsApp = *pxOpenResult->pKvsApp;
+
+    pxOpenResult->xResult = (xResult == KVS_ERRNO_NONE) ? KvsApp_start(xKvsApp, NULL) : xResult;
+    pxOpenResult->xCalls++;
+}
+
+TEST_F(KvsAppTest, open_async_starts_sender_in_callback)
+{
+    OpenResult xOpenResult;
+
+    xOpenResult.pKvsApp = &xKvsApp;
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenCompleteStartSender, &xOpenResult));
+    addFrames(5);
+    ASSERT_TRUE(waitFor([&xOpenResult] { return xOpenResult.xCalls == 1; }));
+    EXPECT_EQ(KVS_ERRNO_NONE, xOpenResult.xResult);
+
+    addFrames(5);
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(0); }));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_stop(xKvsApp));
+    EXPECT_EQ(1u, xServer.putMediaCount());
+}
+
+/* Closing the app while the setup thread runs waits for it, and the connection it set up is closed. */
+TEST_F(KvsAppTest, open_async_close_while_opening)
+{
+    OpenResult xOpenResult;
+    std::thread xReleaser;
+
+    xServer.hold();
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests == 1; }));
+    xReleaser = std::thread([this] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        xServer.release();
+    });
+
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsApp_close(xKvsApp));
+    EXPECT_EQ(1, xOpenResult.xCalls);
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    xReleaser.join();
+}
+
+TEST_F(KvsAppTest, open_async_terminate_while_opening)
+{
+    OpenResult xOpenResult;
+    std::thread xReleaser;
+
+    xServer.hold();
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsApp_openAsync(xKvsApp, onOpenComplete, &xOpenResult));
+    addFrames(3);
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests == 1; }));
+    xReleaser = std::thread([this] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        xServer.release();
+    });
+
+    KvsApp_terminate(xKvsApp);
+    xKvsApp = NULL;
+    EXPECT_EQ(1, xOpenResult.xCalls);
+    EXPECT_TRUE(waitFor([this] { return xServer.isPutMediaClosed(0); }));
+    xReleaser.join();
+}
+
+#define GROUP_MEMBER_CNT (2)
+
+/* Two KVS apps in a group of one worker, so a slow member would delay the other if the worker waited for it. */
+class KvsAppGroupTest : public ::testing::Test
+{
+protected:
+    KvsPipeServer xServer;
+    KvsAppGroupHandle xGroup = NULL;
+    KvsAppHandle xKvsApps[GROUP_MEMBER_CNT] = {NULL, NULL};
+    int xNextFrames[GROUP_MEMBER_CNT] = {0, 0};
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(xServer.start());
+        ASSERT_NE(nullptr, xGroup = KvsAppGroup_create(1));
+        for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+        {
+            ASSERT_NE(nullptr, xKvsApps[i] = createKvsApp(streamName(i).c_str()));
+        }
+    }
+
+    void TearDown() override
+    {
+        KvsAppGroup_terminate(xGroup);
+        for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+        {
+            KvsApp_terminate(xKvsApps[i]);
+        }
+        xServer.stop();
+    }
+
+    static std::string streamName(int xMember)
+    {
+        return "stream-" + std::to_string(xMember);
+    }
+
+    /* The stream buffer is set up once the member starts to open, so the first frame is added after that. */
+    void addFrames(int xMember, int xCnt, size_t uPadLen = 0)
+    {
+        if (xNextFrames[xMember] == 0)
+        {
+            ASSERT_TRUE(waitFor([this, xMember, uPadLen] { return addFrameTo(xKvsApps[xMember], &xNextFrames[xMember], uPadLen) != KVS_ERROR_STREAM_NOT_READY; }));
+            ASSERT_EQ(1, xNextFrames[xMember]);
+            xCnt--;
+        }
+        for (int i = 0; i < xCnt; i++)
+        {
+            ASSERT_EQ(KVS_ERRNO_NONE, addFrameTo(xKvsApps[xMember], &xNextFrames[xMember], uPadLen));
+        }
+    }
+
+    bool hasAllFrames(int xMember)
+    {
+        int xIdx = xServer.putMediaIndex(streamName(xMember));
+
+        return xIdx >= 0 && hasFrames(xServer.putMediaData(xIdx), xNextFrames[xMember]);
+    }
+
+    bool isClosed(int xMember)
+    {
+        int xIdx = xServer.putMediaIndex(streamName(xMember));
+
+        return xIdx >= 0 && xServer.isPutMediaClosed(xIdx);
+    }
+};
+
+TEST_F(KvsAppGroupTest, streams_members_until_removed)
+{
+    for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, KvsAppGroup_add(xGroup, xKvsApps[i], NULL));
+        addFrames(i, 10);
+    }
+    for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+    {
+        EXPECT_TRUE(waitFor([this, i] { return hasAllFrames(i); }));
+    }
+
+    /* The remaining frames are sent before the member is closed. */
+    addFrames(0, 5);
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[0]));
+    EXPECT_TRUE(hasAllFrames(0));
+    EXPECT_TRUE(waitFor([this] { return isClosed(0); }));
+    EXPECT_FALSE(isClosed(1));
+    EXPECT_NE(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[0]));
+
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[1]));
+    EXPECT_TRUE(waitFor([this] { return isClosed(1); }));
+    EXPECT_EQ(2u, xServer.putMediaCount());
+}
+
+/* A member whose PUT MEDIA isn't answered yet is opened in the background, so the worker keeps streaming the other one. */
+TEST_F(KvsAppGroupTest, slow_open_does_not_block_other_members)
+{
+    xServer.hold(streamName(0));
+    for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, KvsAppGroup_add(xGroup, xKvsApps[i], NULL));
+        addFrames(i, 5);
+    }
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(1); }));
+    EXPECT_EQ(-1, xServer.putMediaIndex(streamName(0)));
+
+    /* Removing a member doesn't wait for the slow one either. */
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[1]));
+    EXPECT_TRUE(waitFor([this] { return isClosed(1); }));
+    EXPECT_EQ(-1, xServer.putMediaIndex(streamName(0)));
+
+    xServer.release();
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(0); }));
+    EXPECT_EQ(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[0]));
+    EXPECT_TRUE(waitFor([this] { return isClosed(0); }));
+}
+
+/* A member whose peer doesn't read fills its pipe, and its data waits for the pipe without blocking the other member. */
+TEST_F(KvsAppGroupTest, full_connection_does_not_block_other_members)
+{
+    xServer.pauseReading(streamName(0));
+    for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, KvsAppGroup_add(xGroup, xKvsApps[i], NULL));
+    }
+
+    /* More than the 64 KB of the pipe. */
+    addFrames(0, 16, 8 * 1024);
+    addFrames(1, 5);
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(1); }));
+    EXPECT_FALSE(hasAllFrames(0));
+
+    addFrames(1, 5);
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(1); }));
+
+    xServer.resumeReading();
+    EXPECT_TRUE(waitFor([this] { return hasAllFrames(0); }));
+    for (int i = 0; i < GROUP_MEMBER_CNT; i++)
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, KvsAppGroup_remove(xGroup, xKvsApps[i]));
+        EXPECT_TRUE(waitFor([this, i] { return isClosed(i); }));
+    }
+}
+
+/* A remove which waits for a member that is still opening returns once the terminate closes the member. */
+TEST_F(KvsAppGroupTest, terminate_while_removing)
+{
+    std::atomic<int> xRemoveResult{-1};
+    std::thread xRemover;
+    std::thread xReleaser;
+
+    xServer.hold(streamName(0));
+    ASSERT_EQ(KVS_ERRNO_NONE, KvsAppGroup_add(xGroup, xKvsApps[0], NULL));
+    addFrames(0, 3);
+    ASSERT_TRUE(waitFor([this] { return xServer.xPutMediaRequests == 1; }));
+
+    xRemover = std::thread([this, &xRemoveResult] { xRemoveResult = KvsAppGroup_remove(xGroup, xKvsApps[0]); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_EQ(-1, xRemoveResult);
+
+    /* The terminate waits for the setup thread, which ends once the server answers. */
+    xReleaser = std::thread([this] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        xServer.release();
+    });
+    KvsAppGroup_terminate(xGroup);
+    xGroup = NULL;
+    xRemover.join();
+    xReleaser.join();
+
+    EXPECT_EQ(KVS_ERRNO_NONE, xRemoveResult);
+    EXPECT_TRUE(waitFor([this] { return isClosed(0); }));
+}
@@ -63,6 +63,33 @@ TEST(NALU_getNaluType, invalid_parameter)
     EXPECT_EQ(NALU_TYPE_UNKNOWN, NALU_getNaluType(pFrame, 0));
 }
 
+TEST(NALU_isNonReferenceFrame, avcc_nalus)
+{
+    /* SEI, then a P slice whose nal_ref_idc is 0 */
+    uint8_t pNonRefFrame[] = {0x00, 0x00, 0x00, 0x02, 0x06, 0xFF, 0x00, 0x00, 0x00, 0x02, 0x01, 0xFF};
+    /* SEI, then a P slice whose nal_ref_idc is 2 */
+    uint8_t pRefFrame[] = {0x00, 0x00, 0x00, 0x02, 0x06, 0xFF, 0x00, 0x00, 0x00, 0x02, 0x41, 0xFF};
+    /* SEI only */
+    uint8_t pNonVclFrame[] = {0x00, 0x00, 0x00, 0x02, 0x06, 0xFF};
+
+    EXPECT_TRUE(NALU_isNonReferenceFrame(pNonRefFrame, sizeof(pNonRefFrame)));
+    EXPECT_FALSE(NALU_isNonReferenceFrame(pRefFrame, sizeof(pRefFrame)));
+    EXPECT_FALSE(NALU_isNonReferenceFrame(pNonVclFrame, sizeof(pNonVclFrame)));
+}
+
+TEST(NALU_isNonReferenceFrame, annexb_nalus)
+{
+    uint8_t pNonRefFrame[] = {0x00, 0x00, 0x00, 0x01, 0x06, 0xFF, 0x00, 0x00, 0x01, 0x01, 0xFF};
+    uint8_t pRefFrame[] = {0x00, 0x00, 0x00, 0x01, 0x01, 0xFF, 0x00, 0x00, 0x01, 0x21, 0xFF};
+
+    EXPECT_TRUE(NALU_isNonReferenceFrame(pNonRefFrame, sizeof(pNonRefFrame)));
+    EXPECT_FALSE(NALU_isNonReferenceFrame(pRefFrame, sizeof(pRefFrame)));
+
+    /* Test invalid parameter */
+    EXPECT_FALSE(NALU_isNonReferenceFrame(NULL, sizeof(pRefFrame)));
+    EXPECT_FALSE(NALU_isNonReferenceFrame(pNonRefFrame, 0));
+}
+
 TEST(NALU_getNaluFromAvccNalus, valid_nalus)
 {
     int res = 0;
@@ -0,0 +1,410 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/tls_context.h"
+#include "net/netio.h"
+}
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mbedtls/certs.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+
+#define LOOPBACK_HOST "127.0.0.1"
+
+/* A TLS server on loopback which keeps everything a client sends until the client closes the connection. */
+class TlsLoopbackServer
+{
+public:
+    char pcPort[8];
+    std::vector<unsigned char> xReceived;
+
+    TlsLoopbackServer(int xCiphersuite)
+    {
+        pCiphersuites[0] = xCiphersuite;
+        pCiphersuites[1] = 0;
+
+        mbedtls_net_init(&xListenFd);
+        mbedtls_net_init(&xClientFd);
+        mbedtls_ssl_init(&xSsl);
+        mbedtls_ssl_config_init(&xConf);
+        mbedtls_x509_crt_init(&xCert);
+        mbedtls_pk_init(&xKey);
+        mbedtls_ctr_drbg_init(&xCtrDrbg);
+        mbedtls_entropy_init(&xEntropy);
+    }
+
+    ~TlsLoopbackServer()
+    {
+        if (xThread.joinable())
+        {
+            xThread.join();
+        }
+        mbedtls_net_free(&xClientFd);
+        mbedtls_net_free(&xListenFd);
+        mbedtls_ssl_free(&xSsl);
+        mbedtls_ssl_config_free(&xConf);
+        mbedtls_x509_crt_free(&xCert);
+        mbedtls_pk_free(&xKey);
+        mbedtls_ctr_drbg_free(&xCtrDrbg);
+        mbedtls_entropy_free(&xEntropy);
+    }
+
+    bool start()
+    {
+        struct sockaddr_in xAddr;
+        socklen_t uAddrLen = sizeof(xAddr);
+
+        if (mbedtls_ctr_drbg_seed(&xCtrDrbg, mbedtls_entropy_func, &xEntropy, NULL, 0) != 0 ||
+            mbedtls_x509_crt_parse(&xCert, (const unsigned char *)mbedtls_test_srv_crt, mbedtls_test_srv_crt_len) != 0 ||
+            mbedtls_pk_parse_key(&xKey, (const unsigned char *)mbedtls_test_srv_key, mbedtls_test_srv_key_len, NULL, 0) != 0 ||
+            mbedtls_ssl_config_defaults(&xConf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+        {
+            return false;
+        }
+        mbedtls_ssl_conf_rng(&xConf, mbedtls_ctr_drbg_random, &xCtrDrbg);
+        mbedtls_ssl_conf_ciphersuites(&xConf, pCiphersuites);
+
+        if (mbedtls_ssl_conf_own_cert(&xConf, &xCert, &xKey) != 0 || mbedtls_ssl_setup(&xSsl, &xConf) != 0 ||
+            mbedtls_net_bind(&xListenFd, LOOPBACK_HOST, "0", MBEDTLS_NET_PROTO_TCP) != 0 ||
+            getsockname(xListenFd.fd, (struct sockaddr *)&xAddr, &uAddrLen) != 0)
+        {
+            return false;
+        }
+        snprintf(pcPort, sizeof(pcPort), "%u", (unsigned)ntohs(xAddr.sin_port));
+
+        xThread = std::thread(&TlsLoopbackServer::run, this);
+
+        return true;
+    }
+
+    void join()
+    {
+        xThread.join();
+    }
+
+private:
+    int pCiphersuites[2];
+    mbedtls_net_context xListenFd;
+    mbedtls_net_context xClientFd;
+    mbedtls_ssl_context xSsl;
+    mbedtls_ssl_config xConf;
+    mbedtls_x509_crt xCert;
+    mbedtls_pk_context xKey;
+    mbedtls_ctr_drbg_context xCtrDrbg;
+    mbedtls_entropy_context xEntropy;
+    std::thread xThread;
+
+    void run()
+    {
+        unsigned char pBuf[4096];
+        int n = 0;
+
+        if (mbedtls_net_accept(&xListenFd, &xClientFd, NULL, 0, NULL) != 0)
+        {
+            return;
+        }
+        mbedtls_ssl_set_bio(&xSsl, &xClientFd, mbedtls_net_send, mbedtls_net_recv, NULL);
+        if (mbedtls_ssl_handshake(&xSsl) != 0)
+        {
+            return;
+        }
+
+        /* It stops at the close_notify alert, or at the first record it can't decrypt. */
+        while ((n = mbedtls_ssl_read(&xSsl, pBuf, sizeof(pBuf))) > 0)
+        {
+            xReceived.insert(xReceived.end(), pBuf, pBuf + n);
+        }
+    }
+};
+
+static std::vector<unsigned char> makePayload(size_t uLen)
+{
+    std::vector<unsigned char> xPayload(uLen);
+
+    for (size_t i = 0; i < uLen; i++)
+    {
+        xPayload[i] = (unsigned char)(i * 7 + i / 251);
+    }
+
+    return xPayload;
+}
+
+/* Send a large buffer, then small and large buffers gathered by NetIo_sendv, and check the server gets the same bytes. */
+static void sendAndVerify(int xCiphersuite, bool bKtls)
+{
+    TlsLoopbackServer xServer(xCiphersuite);
+    NetIoHandle xNetIoHandle = NULL;
+    std::vector<unsigned char> xPayload = makePayload(100 * 1024);
+    std::vector<unsigned char> xExpected;
+    NetIoVec_t xVecs[4];
+
+    ASSERT_TRUE(xServer.start());
+    ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_setKtls(xNetIoHandle, bKtls));
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xNetIoHandle, LOOPBACK_HOST, xServer.pcPort));
+    if (!bKtls)
+    {
+        EXPECT_FALSE(NetIo_isKtlsActive(xNetIoHandle));
+    }
+    else if (!NetIo_isKtlsActive(xNetIoHandle))
+    {
+        /* The records are still valid when mbedTLS keeps encrypting them. */
+        printf("kTLS isn't available, mbedTLS encrypts the records\n");
+    }
+
+    xVecs[0].pBuffer = &xPayload[0];
+    xVecs[0].uLen = 5;
+    xVecs[1].pBuffer = NULL;
+    xVecs[1].uLen = 0;
+    xVecs[2].pBuffer = &xPayload[5];
+    xVecs[2].uLen = 40 * 1024;
+    xVecs[3].pBuffer = &xPayload[5 + 40 * 1024];
+    xVecs[3].uLen = 2;
+
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xNetIoHandle, &xPayload[0], xPayload.size()));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_sendv(xNetIoHandle, xVecs, 4));
+    NetIo_disconnect(xNetIoHandle);
+    xServer.join();
+    NetIo_terminate(xNetIoHandle);
+
+    xExpected = xPayload;
+    xExpected.insert(xExpected.end(), xPayload.begin(), xPayload.begin() + 5 + 40 * 1024 + 2);
+    EXPECT_TRUE(xServer.xReceived == xExpected);
+}
+
+TEST(NetIo_setKtls, invalid_argument)
+{
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setKtls(NULL, true));
+    EXPECT_FALSE(NetIo_isKtlsActive(NULL));
+}
+
+TEST(NetIo_setKtls, records_of_mbedtls)
+{
+    sendAndVerify(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256, false);
+}
+
+TEST(NetIo_setKtls, records_of_kernel_aes_128_gcm)
+{
+    sendAndVerify(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256, true);
+}
+
+TEST(NetIo_setKtls, records_of_kernel_aes_256_gcm)
+{
+    sendAndVerify(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384, true);
+}
+
+TEST(NetIo_setKtls, cbc_cipher_suite_falls_back_to_mbedtls)
+{
+    sendAndVerify(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256, true);
+}
+
+/* Vectors which are smaller than a record are gathered, whole records are sent from the caller's buffers, and a buffer
+ * which straddles records is split. The server has to get the same bytes in every case. */
+TEST(NetIo_sendv, gather_and_split_records)
+{
+    TlsLoopbackServer xServer(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256);
+    NetIoHandle xNetIoHandle = NULL;
+    std::vector<unsigned char> xPayload;
+    std::vector<unsigned char> xExpected;
+    std::vector<size_t> xVecLens;
+    NetIoVec_t xVecs[4];
+    size_t uRecordLen = 0;
+    size_t uOffset = 0;
+
+    ASSERT_TRUE(xServer.start());
+    ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xNetIoHandle, LOOPBACK_HOST, xServer.pcPort));
+    ASSERT_GT((uRecordLen = NetIo_getSendRecordLen(xNetIoHandle)), 8u);
+    xPayload = makePayload(3 * uRecordLen + 64);
+
+    std::vector<std::vector<size_t>> xVecSets = {
+        /* Smaller than a record */
+        {10, 20, 30},
+        /* Equal to a record, in one buffer and gathered from two */
+        {uRecordLen},
+        {uRecordLen / 2, uRecordLen - uRecordLen / 2},
+        /* Straddling records */
+        {uRecordLen - 1, 2},
+        {3, uRecordLen + 5, uRecordLen - 2},
+        {2 * uRecordLen + 7},
+        {5, 0, uRecordLen - 5, uRecordLen + 1},
+    };
+
+    for (size_t i = 0; i < xVecSets.size(); i++)
+    {
+        xVecLens = xVecSets[i];
+        uOffset = 0;
+        for (size_t j = 0; j < xVecLens.size(); j++)
+        {
+            /* Every set starts at a different offset, so the bytes of consecutive sets differ. */
+            xVecs[j].pBuffer = &xPayload[i + uOffset];
+            xVecs[j].uLen = xVecLens[j];
+            xExpected.insert(xExpected.end(), xPayload.begin() + i + uOffset, xPayload.begin() + i + uOffset + xVecLens[j]);
+            uOffset += xVecLens[j];
+        }
+        EXPECT_EQ(KVS_ERRNO_NONE, NetIo_sendv(xNetIoHandle, xVecs, xVecLens.size()));
+    }
+
+    NetIo_disconnect(xNetIoHandle);
+    xServer.join();
+    NetIo_terminate(xNetIoHandle);
+
+    EXPECT_EQ(xExpected.size(), xServer.xReceived.size());
+    EXPECT_TRUE(xServer.xReceived == xExpected);
+}
+
+TEST(NetIo_setTlsContext, invalid_argument)
+{
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setTlsContext(NULL, NULL));
+}
+
+/* Connections with the same X509 borrow the credentials of the context one after another, and the next connection
+ * still works after the previous one released them. */
+TEST(NetIo_setTlsContext, connections_share_context)
+{
+    TlsContextHandle xTlsContext = NULL;
+    std::vector<unsigned char> xPayload = makePayload(16 * 1024);
+
+    ASSERT_TRUE((xTlsContext = TlsContext_create()) != NULL);
+
+    for (int i = 0; i < 2; i++)
+    {
+        TlsLoopbackServer xServer(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256);
+        NetIoHandle xNetIoHandle = NULL;
+
+        ASSERT_TRUE(xServer.start());
+        ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+        ASSERT_EQ(KVS_ERRNO_NONE, NetIo_setTlsContext(xNetIoHandle, xTlsContext));
+        /* The test server certificate is issued to localhost. */
+        ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connectWithX509(xNetIoHandle, "localhost", xServer.pcPort, mbedtls_test_cas_pem, mbedtls_test_cli_crt, mbedtls_test_cli_key));
+        EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xNetIoHandle, &xPayload[0], xPayload.size()));
+        NetIo_disconnect(xNetIoHandle);
+        xServer.join();
+        NetIo_terminate(xNetIoHandle);
+
+        EXPECT_TRUE(xServer.xReceived == xPayload);
+    }
+
+    TlsContext_terminate(xTlsContext);
+}
+
+TEST(NetIo_setMaxFragmentLen, invalid_argument)
+{
+    NetIoHandle xNetIoHandle = NULL;
+
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setMaxFragmentLen(NULL, 4096));
+    ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setMaxFragmentLen(xNetIoHandle, 3000));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setMaxFragmentLen(xNetIoHandle, 8192));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setMaxFragmentLen(xNetIoHandle, 0));
+    NetIo_terminate(xNetIoHandle);
+}
+
+/* The records sent are limited to the max fragment length, and the data still arrives in order. */
+TEST(NetIo_setMaxFragmentLen, records_of_max_fragment_length)
+{
+    TlsLoopbackServer xServer(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256);
+    NetIoHandle xNetIoHandle = NULL;
+    std::vector<unsigned char> xPayload = makePayload(40 * 1024);
+
+    ASSERT_TRUE(xServer.start());
+    ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_setMaxFragmentLen(xNetIoHandle, 2048));
+    /* kTLS is requested too, and it's not used because the kernel sends full-size records. */
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_setKtls(xNetIoHandle, true));
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xNetIoHandle, LOOPBACK_HOST, xServer.pcPort));
+    EXPECT_FALSE(NetIo_isKtlsActive(xNetIoHandle));
+    EXPECT_EQ(2048u, NetIo_getSendRecordLen(xNetIoHandle));
+
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xNetIoHandle, &xPayload[0], xPayload.size()));
+    NetIo_disconnect(xNetIoHandle);
+    xServer.join();
+    NetIo_terminate(xNetIoHandle);
+
+    EXPECT_TRUE(xServer.xReceived == xPayload);
+}
+
+TEST(TlsContext_setAead, invalid_argument)
+{
+    TlsContextHandle xTlsContext = NULL;
+
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsContext_setAead(NULL, TLS_AEAD_AES_GCM));
+    ASSERT_TRUE((xTlsContext = TlsContext_create()) != NULL);
+    EXPECT_EQ(TLS_AEAD_DEFAULT, TlsContext_getAead(xTlsContext));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsContext_setAead(xTlsContext, (TlsAead_t)(TLS_AEAD_CHACHA20_POLY1305 + 1)));
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsContext_setAead(xTlsContext, TLS_AEAD_CHACHA20_POLY1305));
+    EXPECT_EQ(TLS_AEAD_CHACHA20_POLY1305, TlsContext_getAead(xTlsContext));
+    TlsContext_terminate(xTlsContext);
+}
+
+/* TLS_AEAD_FASTEST resolves to one of the measured AEADs, and keeps it. */
+TEST(TlsContext_setAead, fastest_is_measured)
+{
+    TlsContextHandle xTlsContext = NULL;
+    TlsAead_t xAead = TLS_AEAD_DEFAULT;
+
+    ASSERT_TRUE((xTlsContext = TlsContext_create()) != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsContext_setAead(xTlsContext, TLS_AEAD_FASTEST));
+    xAead = TlsContext_getAead(xTlsContext);
+    EXPECT_TRUE(xAead == TLS_AEAD_AES_GCM || xAead == TLS_AEAD_CHACHA20_POLY1305);
+    EXPECT_EQ(xAead, TlsContext_getAead(xTlsContext));
+    TlsContext_terminate(xTlsContext);
+}
+
+TEST(TlsContext_measureAead, invalid_argument)
+{
+    double dBytesPerSec = 0;
+
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsContext_measureAead(TLS_AEAD_AES_GCM, 1024, NULL));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsContext_measureAead(TLS_AEAD_AES_GCM, 0, &dBytesPerSec));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsContext_measureAead(TLS_AEAD_FASTEST, 1024, &dBytesPerSec));
+}
+
+TEST(TlsContext_measureAead, bytes_per_sec)
+{
+    double dBytesPerSec = 0;
+
+    /* A length which isn't a multiple of the records is measured too. */
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsContext_measureAead(TLS_AEAD_AES_GCM, 40 * 1024 + 3, &dBytesPerSec));
+    EXPECT_GT(dBytesPerSec, 0);
+    dBytesPerSec = 0;
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsContext_measureAead(TLS_AEAD_CHACHA20_POLY1305, 40 * 1024 + 3, &dBytesPerSec));
+    EXPECT_GT(dBytesPerSec, 0);
+}
+
+/* The preferred AEAD is only offered first, so a server without it still negotiates another cipher suite. */
+TEST(TlsContext_setAead, server_without_preferred_aead)
+{
+    TlsContextHandle xTlsContext = NULL;
+    TlsLoopbackServer xServer(MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256);
+    NetIoHandle xNetIoHandle = NULL;
+    std::vector<unsigned char> xPayload = makePayload(16 * 1024);
+
+    ASSERT_TRUE((xTlsContext = TlsContext_create()) != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, TlsContext_setAead(xTlsContext, TLS_AEAD_CHACHA20_POLY1305));
+    ASSERT_TRUE(xServer.start());
+    ASSERT_TRUE((xNetIoHandle = NetIo_create()) != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_setTlsContext(xNetIoHandle, xTlsContext));
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xNetIoHandle, LOOPBACK_HOST, xServer.pcPort));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xNetIoHandle, &xPayload[0], xPayload.size()));
+    NetIo_disconnect(xNetIoHandle);
+    xServer.join();
+    NetIo_terminate(xNetIoHandle);
+    TlsContext_terminate(xTlsContext);
+
+    EXPECT_TRUE(xServer.xReceived == xPayload);
+}
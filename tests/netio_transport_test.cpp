@@ -0,0 +1,258 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/netio_transport.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+}
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define PIPE_HOST "kinesisvideo.local"
+#define PIPE_PORT "443"
+#define LOOPBACK_HOST "127.0.0.1"
+
+#define RECV_TIMEOUT_MS (100)
+
+static std::vector<unsigned char> makePayload(size_t uLen)
+{
+    std::vector<unsigned char> xPayload(uLen);
+
+    for (size_t i = 0; i < uLen; i++)
+    {
+        xPayload[i] = (unsigned char)(i * 7 + i / 251);
+    }
+
+    return xPayload;
+}
+
+/* Receive until the peer closes the connection, and return the received bytes. */
+static std::vector<unsigned char> recvAll(NetIoHandle xNetIoHandle)
+{
+    std::vector<unsigned char> xReceived;
+    unsigned char pBuf[4096];
+    size_t uLen = 0;
+
+    while (NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) == KVS_ERRNO_NONE)
+    {
+        xReceived.insert(xReceived.end(), pBuf, pBuf + uLen);
+    }
+
+    return xReceived;
+}
+
+/* Send a buffer larger than a pipe holds, and small buffers gathered by NetIo_sendv. */
+static std::vector<unsigned char> sendPayload(NetIoHandle xNetIoHandle)
+{
+    std::vector<unsigned char> xPayload = makePayload(300 * 1024);
+    NetIoVec_t xVecs[3];
+
+    xVecs[0].pBuffer = &xPayload[0];
+    xVecs[0].uLen = 5;
+    xVecs[1].pBuffer = NULL;
+    xVecs[1].uLen = 0;
+    xVecs[2].pBuffer = &xPayload[5];
+    xVecs[2].uLen = 7;
+
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xNetIoHandle, &xPayload[0], xPayload.size()));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_sendv(xNetIoHandle, xVecs, 3));
+
+    xPayload.insert(xPayload.end(), xPayload.begin(), xPayload.begin() + 12);
+
+    return xPayload;
+}
+
+static NetIoHandle createHandle(const NetIoTransport_t *pxTransport)
+{
+    NetIoHandle xNetIoHandle = NetIo_create();
+
+    EXPECT_TRUE(xNetIoHandle != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setTransport(xNetIoHandle, pxTransport));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_setRecvTimeout(xNetIoHandle, RECV_TIMEOUT_MS));
+
+    return xNetIoHandle;
+}
+
+TEST(NetIo_transport, not_connected)
+{
+    NetIoHandle xNetIoHandle = NetIo_create();
+    unsigned char pBuf[16] = {0};
+    size_t uLen = 0;
+
+    ASSERT_TRUE(xNetIoHandle != NULL);
+    EXPECT_EQ(KVS_ERROR_NETIO_NOT_CONNECTED, NetIo_send(xNetIoHandle, pBuf, sizeof(pBuf)));
+    EXPECT_EQ(KVS_ERROR_NETIO_NOT_CONNECTED, NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen));
+    EXPECT_FALSE(NetIo_isDataAvailable(xNetIoHandle));
+    EXPECT_EQ(-1, NetIo_getSocket(xNetIoHandle));
+    EXPECT_EQ(0u, NetIo_getSendRecordLen(xNetIoHandle));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setTransport(NULL, NetIoTransport_getPipe()));
+    NetIo_terminate(xNetIoHandle);
+}
+
+TEST(NetIo_transport, pipe_round_trip)
+{
+    NetIoPipeListenerHandle xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT);
+    NetIoHandle xClient = createHandle(NetIoTransport_getPipe());
+    NetIoHandle xServer = NULL;
+    std::vector<unsigned char> xReceived;
+    std::vector<unsigned char> xExpected;
+
+    ASSERT_TRUE(xListener != NULL);
+    EXPECT_TRUE(NetIoPipe_listen(PIPE_HOST, PIPE_PORT) == NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, PIPE_HOST, PIPE_PORT));
+    ASSERT_TRUE((xServer = NetIoPipe_accept(xListener, RECV_TIMEOUT_MS)) != NULL);
+
+    /* The transport can't be changed on a connected handle, and a pipe has no socket nor records. */
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, NetIo_setTransport(xClient, NULL));
+    EXPECT_EQ(-1, NetIo_getSocket(xClient));
+    EXPECT_EQ(0u, NetIo_getSendRecordLen(xClient));
+    EXPECT_FALSE(NetIo_isDataAvailable(xServer));
+
+    std::thread xReader([&]() { xReceived = recvAll(xServer); });
+    xExpected = sendPayload(xClient);
+    NetIo_disconnect(xClient);
+    xReader.join();
+
+    EXPECT_TRUE(xReceived == xExpected);
+
+    NetIo_terminate(xServer);
+    NetIo_terminate(xClient);
+    NetIoPipe_terminateListener(xListener);
+}
+
+TEST(NetIo_transport, pipe_recv_after_peer_closed)
+{
+    NetIoPipeListenerHandle xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT);
+    NetIoHandle xClient = createHandle(NetIoTransport_getPipe());
+    NetIoHandle xServer = NULL;
+    unsigned char pBuf[16] = {0};
+    size_t uLen = 0;
+
+    ASSERT_TRUE(xListener != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, PIPE_HOST, PIPE_PORT));
+    ASSERT_TRUE((xServer = NetIoPipe_accept(xListener, RECV_TIMEOUT_MS)) != NULL);
+
+    EXPECT_EQ(KVS_ERROR_NETIO_RECV_TIMEOUT, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+
+    /* Bytes sent before the close are still received. */
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_send(xServer, (const unsigned char *)"HTTP", 4));
+    NetIo_terminate(xServer);
+    EXPECT_TRUE(NetIo_isDataAvailable(xClient));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+    EXPECT_EQ(4, uLen);
+    EXPECT_EQ(0, memcmp(pBuf, "HTTP", 4));
+    EXPECT_EQ(KVS_ERROR_NETIO_CONNECTION_CLOSED, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+    EXPECT_EQ(KVS_ERROR_NETIO_SEND_FAILED, NetIo_send(xClient, pBuf, sizeof(pBuf)));
+
+    NetIo_terminate(xClient);
+    NetIoPipe_terminateListener(xListener);
+}
+
+TEST(NetIo_transport, pipe_connect_without_listener)
+{
+    NetIoPipeListenerHandle xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT);
+    NetIoHandle xClient = createHandle(NetIoTransport_getPipe());
+
+    ASSERT_TRUE(xListener != NULL);
+    EXPECT_EQ(KVS_ERROR_NETIO_CONNECT_FAILED, NetIo_connect(xClient, PIPE_HOST, "80"));
+    EXPECT_TRUE(NetIoPipe_accept(xListener, 10) == NULL);
+
+    /* A connection which isn't accepted is closed with the listener. */
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, PIPE_HOST, PIPE_PORT));
+    NetIoPipe_terminateListener(xListener);
+    EXPECT_EQ(KVS_ERROR_NETIO_SEND_FAILED, NetIo_send(xClient, (const unsigned char *)"GET", 3));
+    NetIo_disconnect(xClient);
+    EXPECT_EQ(KVS_ERROR_NETIO_CONNECT_FAILED, NetIo_connect(xClient, PIPE_HOST, PIPE_PORT));
+
+    NetIo_terminate(xClient);
+}
+
+TEST(NetIo_transport, tcp_round_trip)
+{
+    struct sockaddr_in xAddr;
+    socklen_t uAddrLen = sizeof(xAddr);
+    int xListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int xServerFd = -1;
+    char pcPort[8];
+    NetIoHandle xClient = createHandle(NetIoTransport_getTcp());
+    std::vector<unsigned char> xReceived;
+    std::vector<unsigned char> xExpected;
+    unsigned char pBuf[4096];
+    ssize_t n = 0;
+    size_t uLen = 0;
+
+    memset(&xAddr, 0, sizeof(xAddr));
+    xAddr.sin_family = AF_INET;
+    xAddr.sin_addr.s_addr = inet_addr(LOOPBACK_HOST);
+    ASSERT_GE(xListenFd, 0);
+    ASSERT_EQ(0, bind(xListenFd, (struct sockaddr *)&xAddr, sizeof(xAddr)));
+    ASSERT_EQ(0, listen(xListenFd, 1));
+    ASSERT_EQ(0, getsockname(xListenFd, (struct sockaddr *)&xAddr, &uAddrLen));
+    snprintf(pcPort, sizeof(pcPort), "%u", (unsigned)ntohs(xAddr.sin_port));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, LOOPBACK_HOST, pcPort));
+    ASSERT_GE((xServerFd = accept(xListenFd, NULL, NULL)), 0);
+    EXPECT_EQ(KVS_ERROR_NETIO_RECV_TIMEOUT, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+
+    std::thread xReader([&]() {
+        while ((n = recv(xServerFd, pBuf, sizeof(pBuf), 0)) > 0)
+        {
+            xReceived.insert(xReceived.end(), pBuf, pBuf + n);
+        }
+    });
+    xExpected = sendPayload(xClient);
+    EXPECT_TRUE(NetIo_getSocket(xClient) >= 0);
+    NetIo_disconnect(xClient);
+    xReader.join();
+    EXPECT_TRUE(xReceived == xExpected);
+
+    close(xServerFd);
+    close(xListenFd);
+    NetIo_terminate(xClient);
+}
+
+TEST(NetIo_transport, tcp_recv_after_peer_closed)
+{
+    struct sockaddr_in xAddr;
+    socklen_t uAddrLen = sizeof(xAddr);
+    int xListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int xServerFd = -1;
+    char pcPort[8];
+    NetIoHandle xClient = createHandle(NetIoTransport_getTcp());
+    unsigned char pBuf[16] = {0};
+    size_t uLen = 0;
+
+    memset(&xAddr, 0, sizeof(xAddr));
+    xAddr.sin_family = AF_INET;
+    xAddr.sin_addr.s_addr = inet_addr(LOOPBACK_HOST);
+    ASSERT_GE(xListenFd, 0);
+    ASSERT_EQ(0, bind(xListenFd, (struct sockaddr *)&xAddr, sizeof(xAddr)));
+    ASSERT_EQ(0, listen(xListenFd, 1));
+    ASSERT_EQ(0, getsockname(xListenFd, (struct sockaddr *)&xAddr, &uAddrLen));
+    snprintf(pcPort, sizeof(pcPort), "%u", (unsigned)ntohs(xAddr.sin_port));
+
+    ASSERT_EQ(KVS_ERRNO_NONE, NetIo_connect(xClient, LOOPBACK_HOST, pcPort));
+    ASSERT_GE((xServerFd = accept(xListenFd, NULL, NULL)), 0);
+    ASSERT_EQ(4, send(xServerFd, "HTTP", 4, 0));
+    close(xServerFd);
+
+    EXPECT_TRUE(NetIo_isDataAvailable(xClient));
+    EXPECT_EQ(KVS_ERRNO_NONE, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+    EXPECT_EQ(4, uLen);
+    EXPECT_EQ(KVS_ERROR_NETIO_CONNECTION_CLOSED, NetIo_recv(xClient, pBuf, sizeof(pBuf), &uLen));
+
+    close(xListenFd);
+    NetIo_terminate(xClient);
+}
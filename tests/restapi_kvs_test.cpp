@@ -0,0 +1,339 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/netio_transport.h"
+#include "kvs/restapi.h"
+#include "net/netio.h"
+#include "net/netio_pipe.h"
+}
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#define PIPE_HOST "kinesisvideo.local"
+#define PIPE_PORT "443"
+
+#define MKV_HEADER_LEN (10)
+#define RECORD_LEN (100)
+
+static size_t getRecordLen(void *pCtx)
+{
+    (void)pCtx;
+    return RECORD_LEN;
+}
+
+/* The pipe transport, which reports the records of a TLS transport so the coalesced chunks are aligned to them. */
+static const NetIoTransport_t *getRecordPipe()
+{
+    static NetIoTransport_t xTransport = *NetIoTransport_getPipe();
+
+    xTransport.getSendRecordLen = getRecordLen;
+    return &xTransport;
+}
+
+static size_t chunkWireLen(size_t uChunkLen)
+{
+    char pcSize[32];
+
+    return snprintf(pcSize, sizeof(pcSize), "%lx", (unsigned long)uChunkLen) + uChunkLen + 4;
+}
+
+/* A stand-in of the PUT MEDIA endpoint on a memory pipe. It answers the request, and then keeps the HTTP chunks the
+ * client sends until the client closes the connection. */
+class PutMediaPipeServer
+{
+public:
+    std::vector<size_t> xChunkLens;
+    std::vector<unsigned char> xChunkData;
+
+    bool start()
+    {
+        if ((xListener = NetIoPipe_listen(PIPE_HOST, PIPE_PORT)) == NULL)
+        {
+            return false;
+        }
+        xThread = std::thread(&PutMediaPipeServer::run, this);
+
+        return true;
+    }
+
+    /* Wait for the client to close the connection, and parse the chunks it sent. */
+    void join()
+    {
+        xThread.join();
+        NetIoPipe_terminateListener(xListener);
+        xListener = NULL;
+        parseChunks();
+    }
+
+    ~PutMediaPipeServer()
+    {
+        if (xThread.joinable())
+        {
+            xThread.join();
+        }
+        if (xListener != NULL)
+        {
+            NetIoPipe_terminateListener(xListener);
+        }
+    }
+
+private:
+    NetIoPipeListenerHandle xListener = NULL;
+    std::thread xThread;
+    std::string xBody;
+
+    void run()
+    {
+        NetIoHandle xNetIoHandle = NetIoPipe_accept(xListener, 1000);
+        const char *pcRsp = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+        std::string xReceived;
+        unsigned char pBuf[4096];
+        size_t uLen = 0;
+        size_t uHdrEnd = std::string::npos;
+
+        if (xNetIoHandle == NULL)
+        {
+            return;
+        }
+        while (uHdrEnd == std::string::npos && NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) == KVS_ERRNO_NONE)
+        {
+            xReceived.append((const char *)pBuf, uLen);
+            uHdrEnd = xReceived.find("\r\n\r\n");
+        }
+        if (uHdrEnd != std::string::npos && NetIo_send(xNetIoHandle, (const unsigned char *)pcRsp, strlen(pcRsp)) == KVS_ERRNO_NONE)
+        {
+            xBody = xReceived.substr(uHdrEnd + 4);
+            while (NetIo_recv(xNetIoHandle, pBuf, sizeof(pBuf), &uLen) == KVS_ERRNO_NONE)
+            {
+                xBody.append((const char *)pBuf, uLen);
+            }
+        }
+        NetIo_terminate(xNetIoHandle);
+    }
+
+    void parseChunks()
+    {
+        size_t uOffset = 0;
+        size_t uLineEnd = 0;
+        size_t uChunkLen = 0;
+
+        while ((uLineEnd = xBody.find("\r\n", uOffset)) != std::string::npos)
+        {
+            uChunkLen = strtoul(xBody.substr(uOffset, uLineEnd - uOffset).c_str(), NULL, 16);
+            ASSERT_LE(uLineEnd + 2 + uChunkLen + 2, xBody.size());
+            ASSERT_EQ("\r\n", xBody.substr(uLineEnd + 2 + uChunkLen, 2));
+            xChunkLens.push_back(uChunkLen);
+            xChunkData.insert(xChunkData.end(), xBody.begin() + uLineEnd + 2, xBody.begin() + uLineEnd + 2 + uChunkLen);
+            uOffset = uLineEnd + 2 + uChunkLen + 2;
+        }
+        EXPECT_EQ(xBody.size(), uOffset);
+    }
+};
+
+class PutMediaCoalesceTest : public ::testing::Test
+{
+protected:
+    PutMediaPipeServer xServer;
+    PutMediaHandle xPutMediaHandle = NULL;
+    std::vector<unsigned char> xSent;
+    unsigned char uNextByte = 0;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(xServer.start());
+    }
+
+    void TearDown() override
+    {
+        if (xPutMediaHandle != NULL)
+        {
+            Kvs_putMediaFinish(xPutMediaHandle);
+        }
+    }
+
+    void startPutMedia(size_t uCoalesceSize, unsigned int uCoalesceDelayMs, const NetIoTransport_t *pxTransport = NetIoTransport_getPipe())
+    {
+        KvsServiceParameter_t xServPara = {};
+        KvsPutMediaParameter_t xPutMediaPara = {};
+        unsigned int uHttpStatusCode = 0;
+        char pcAccessKey[] = "AKIDEXAMPLE";
+        char pcSecretKey[] = "secret";
+        char pcRegion[] = "us-east-1";
+        char pcService[] = "kinesisvideo";
+        char pcHost[] = PIPE_HOST;
+        char pcStreamName[] = "stream";
+
+        xServPara.pcAccessKey = pcAccessKey;
+        xServPara.pcSecretKey = pcSecretKey;
+        xServPara.pcRegion = pcRegion;
+        xServPara.pcService = pcService;
+        xServPara.pcHost = pcHost;
+        xServPara.pcPutMediaEndpoint = pcHost;
+        xServPara.uRecvTimeoutMs = 1000;
+        xServPara.uSendTimeoutMs = 1000;
+        xServPara.pxNetIoTransport = pxTransport;
+
+        xPutMediaPara.pcStreamName = pcStreamName;
+        xPutMediaPara.xTimecodeType = TIMECODE_TYPE_ABSOLUTE;
+        xPutMediaPara.uRecvTimeoutMs = 10;
+        xPutMediaPara.uSendTimeoutMs = 1000;
+        xPutMediaPara.uCoalesceSize = uCoalesceSize;
+        xPutMediaPara.uCoalesceDelayMs = uCoalesceDelayMs;
+
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_putMediaStart(&xServPara, &xPutMediaPara, &uHttpStatusCode, &xPutMediaHandle));
+        ASSERT_EQ(200u, uHttpStatusCode);
+    }
+
+    /* Send a frame of an MKV header and data, whose bytes are counted up so the order can be checked. */
+    void sendFrame(size_t uFrameLen)
+    {
+        std::vector<uint8_t> xFrame(uFrameLen);
+
+        for (size_t i = 0; i < uFrameLen; i++)
+        {
+            xFrame[i] = uNextByte++;
+        }
+        xSent.insert(xSent.end(), xFrame.begin(), xFrame.end());
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaUpdate(xPutMediaHandle, &xFrame[0], MKV_HEADER_LEN, &xFrame[MKV_HEADER_LEN], uFrameLen - MKV_HEADER_LEN));
+    }
+
+    /* Close the connection, and check the server got the frames in chunks of the expected sizes. */
+    void finish(const std::vector<size_t> &xExpectedChunkLens)
+    {
+        Kvs_putMediaFinish(xPutMediaHandle);
+        xPutMediaHandle = NULL;
+        xServer.join();
+
+        EXPECT_EQ(xExpectedChunkLens, xServer.xChunkLens);
+        EXPECT_TRUE(xSent == xServer.xChunkData);
+    }
+};
+
+TEST_F(PutMediaCoalesceTest, every_frame_in_its_own_chunk)
+{
+    startPutMedia(0, 0);
+    sendFrame(100);
+    sendFrame(200);
+    sendFrame(30);
+    finish({100, 200, 30});
+}
+
+TEST_F(PutMediaCoalesceTest, flush_when_size_reached)
+{
+    startPutMedia(1000, 60000);
+    for (int i = 0; i < 4; i++)
+    {
+        sendFrame(250);
+    }
+    sendFrame(100);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaFlush(xPutMediaHandle));
+    finish({1000, 100});
+}
+
+TEST_F(PutMediaCoalesceTest, flush_when_next_frame_does_not_fit)
+{
+    startPutMedia(1000, 60000);
+    sendFrame(300);
+    sendFrame(300);
+    sendFrame(300);
+    sendFrame(300);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaFlush(xPutMediaHandle));
+    finish({900, 300});
+}
+
+/* A frame of the coalescing size or larger is sent in its own chunk, after the frames coalesced before it. */
+TEST_F(PutMediaCoalesceTest, large_frame_in_its_own_chunk)
+{
+    startPutMedia(1000, 60000);
+    sendFrame(200);
+    sendFrame(1500);
+    sendFrame(1000);
+    sendFrame(50);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaFlush(xPutMediaHandle));
+    finish({200, 1500, 1000, 50});
+}
+
+TEST_F(PutMediaCoalesceTest, flush_when_deadline_expired)
+{
+    startPutMedia(1000, 50);
+    sendFrame(100);
+    sendFrame(100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+
+    /* Kvs_putMediaDoWork sends the expired chunk, and so does the next frame. */
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaDoWork(xPutMediaHandle));
+    sendFrame(100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    sendFrame(100);
+    finish({200, 200});
+}
+
+/* The frames still coalesced when the connection is finished are sent before it's closed. */
+TEST_F(PutMediaCoalesceTest, flush_on_finish)
+{
+    startPutMedia(1000, 60000);
+    sendFrame(100);
+    sendFrame(200);
+    finish({300});
+}
+
+/* Raw data is sent after the frames coalesced before it. */
+TEST_F(PutMediaCoalesceTest, flush_before_raw_data)
+{
+    uint8_t pRaw[40] = {0};
+
+    startPutMedia(1000, 60000);
+    sendFrame(100);
+    xSent.insert(xSent.end(), pRaw, pRaw + sizeof(pRaw));
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaUpdateRaw(xPutMediaHandle, pRaw, sizeof(pRaw)));
+    finish({100, 40});
+}
+
+TEST_F(PutMediaCoalesceTest, flush_before_limits_change)
+{
+    startPutMedia(1000, 60000);
+    sendFrame(100);
+    sendFrame(100);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaUpdateCoalescing(xPutMediaHandle, 0, 0));
+    sendFrame(100);
+    finish({200, 100});
+}
+
+/* The coalescing size is shrunk so a full chunk fills whole records, and frames are cut where a chunk is full. */
+TEST_F(PutMediaCoalesceTest, chunks_fill_whole_records)
+{
+    startPutMedia(1000, 60000, getRecordPipe());
+    for (int i = 0; i < 4; i++)
+    {
+        sendFrame(300);
+    }
+    sendFrame(2500);
+    sendFrame(50);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaFlush(xPutMediaHandle));
+    finish({993, 993, 993, 771});
+
+    for (size_t i = 0; i + 1 < xServer.xChunkLens.size(); i++)
+    {
+        EXPECT_EQ(0u, chunkWireLen(xServer.xChunkLens[i]) % RECORD_LEN);
+    }
+}
+
+/* The frame which finds the coalescing delay expired tops the chunk up first, so the chunk is still sent full. */
+TEST_F(PutMediaCoalesceTest, chunks_fill_whole_records_after_deadline)
+{
+    startPutMedia(1000, 50, getRecordPipe());
+    sendFrame(100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    sendFrame(1200);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_putMediaFlush(xPutMediaHandle));
+    finish({993, 307});
+}
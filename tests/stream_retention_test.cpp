@@ -0,0 +1,246 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/stream.h"
+#include "kvs/stream_retention.h"
+}
+#endif
+
+#include <gtest/gtest.h>
+
+#define MEM_LIMIT (1024 * 1024)
+#define MAX_POP_CNT (16)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+
+class StreamRetentionTest : public ::testing::Test
+{
+protected:
+    StreamHandle xStream;
+
+    void SetUp() override
+    {
+        VideoTrackInfo_t xVideoTrackInfo = {};
+
+        xVideoTrackInfo.pTrackName = pTrackName;
+        xVideoTrackInfo.pCodecName = pCodecName;
+        xVideoTrackInfo.uWidth = 1920;
+        xVideoTrackInfo.uHeight = 1080;
+        xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+        xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+        ASSERT_TRUE((xStream = Kvs_streamCreate(&xVideoTrackInfo, NULL)) != NULL);
+    }
+
+    void TearDown() override
+    {
+        Kvs_streamTermintate(xStream);
+    }
+
+    /* Add a frame to the stream and pop it, as if it has just been sent. */
+    DataFrameHandle sendFrame(uint64_t uTimestampMs, bool bIsKeyFrame)
+    {
+        DataFrameIn_t xDataFrameIn = {};
+
+        xDataFrameIn.xClusterType = bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.pData = NULL;
+        xDataFrameIn.uDataLen = 16;
+        xDataFrameIn.uTimestampMs = uTimestampMs;
+        xDataFrameIn.bIsKeyFrame = bIsKeyFrame;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+
+        EXPECT_TRUE(Kvs_streamAddDataFrame(xStream, &xDataFrameIn) != NULL);
+
+        return Kvs_streamPop(xStream);
+    }
+
+    void keepFrame(StreamRetentionHandle xRetention, uint64_t uTimestampMs, bool bIsKeyFrame)
+    {
+        DataFrameHandle xDataFrameHandle = sendFrame(uTimestampMs, bIsKeyFrame);
+        bool bIsRetained = false;
+
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionAdd(xRetention, xDataFrameHandle, &bIsRetained));
+        ASSERT_TRUE(bIsRetained);
+    }
+
+    void terminateFrames(DataFrameHandle *pxDataFrameHandles, size_t uCnt)
+    {
+        for (size_t i = 0; i < uCnt; i++)
+        {
+            Kvs_dataFrameTerminate(pxDataFrameHandles[i]);
+        }
+    }
+
+    void terminateRetention(StreamRetentionHandle xRetention)
+    {
+        DataFrameHandle xDataFrameHandle = NULL;
+
+        while ((xDataFrameHandle = Kvs_streamRetentionPop(xRetention)) != NULL)
+        {
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+        }
+        Kvs_streamRetentionTerminate(xRetention);
+    }
+};
+
+TEST_F(StreamRetentionTest, window_starts_at_a_cluster)
+{
+    StreamRetentionHandle xRetention = Kvs_streamRetentionCreate(MEM_LIMIT);
+    DataFrameHandle xDataFrameHandle = NULL;
+    bool bIsRetained = true;
+
+    ASSERT_TRUE(xRetention != NULL);
+
+    xDataFrameHandle = sendFrame(0, false);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionAdd(xRetention, xDataFrameHandle, &bIsRetained));
+    EXPECT_FALSE(bIsRetained);
+    EXPECT_TRUE(Kvs_streamRetentionIsEmpty(xRetention));
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    keepFrame(xRetention, 33, true);
+    keepFrame(xRetention, 66, false);
+    EXPECT_FALSE(Kvs_streamRetentionIsEmpty(xRetention));
+
+    terminateRetention(xRetention);
+}
+
+TEST_F(StreamRetentionTest, replay_after_rewind)
+{
+    StreamRetentionHandle xRetention = Kvs_streamRetentionCreate(MEM_LIMIT);
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t uFrameCnt = 0;
+    size_t uSize = 0;
+
+    ASSERT_TRUE(xRetention != NULL);
+
+    for (uint64_t uTimestampMs = 0; uTimestampMs < 200; uTimestampMs++)
+    {
+        keepFrame(xRetention, uTimestampMs, uTimestampMs % 50 == 0);
+    }
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionStat(xRetention, &uFrameCnt, &uSize));
+    EXPECT_EQ(200, uFrameCnt);
+    EXPECT_LT(200 * 16, uSize);
+
+    /* Kept frames have been sent on the current connection. */
+    EXPECT_TRUE(Kvs_streamRetentionIsReplayDone(xRetention));
+    EXPECT_TRUE(Kvs_streamRetentionNextReplay(xRetention) == NULL);
+
+    /* A new connection gets every kept frame in order. */
+    Kvs_streamRetentionRewind(xRetention);
+    EXPECT_FALSE(Kvs_streamRetentionIsReplayDone(xRetention));
+    for (uint64_t uTimestampMs = 0; uTimestampMs < 200; uTimestampMs++)
+    {
+        ASSERT_TRUE((xDataFrameHandle = Kvs_streamRetentionNextReplay(xRetention)) != NULL);
+        EXPECT_EQ(uTimestampMs, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    }
+    EXPECT_TRUE(Kvs_streamRetentionIsReplayDone(xRetention));
+
+    /* A frame kept in the middle of a replay is sent after the replayed ones. */
+    Kvs_streamRetentionRewind(xRetention);
+    EXPECT_TRUE(Kvs_streamRetentionNextReplay(xRetention) != NULL);
+    keepFrame(xRetention, 200, false);
+    for (uint64_t uTimestampMs = 1; uTimestampMs <= 200; uTimestampMs++)
+    {
+        ASSERT_TRUE((xDataFrameHandle = Kvs_streamRetentionNextReplay(xRetention)) != NULL);
+        EXPECT_EQ(uTimestampMs, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    }
+    EXPECT_TRUE(Kvs_streamRetentionIsReplayDone(xRetention));
+
+    terminateRetention(xRetention);
+}
+
+TEST_F(StreamRetentionTest, pop_persisted_clusters)
+{
+    StreamRetentionHandle xRetention = Kvs_streamRetentionCreate(MEM_LIMIT);
+    DataFrameHandle xDataFrameHandles[MAX_POP_CNT];
+    size_t uCnt = 0;
+    size_t uFrameCnt = 0;
+    size_t uSize = 0;
+
+    ASSERT_TRUE(xRetention != NULL);
+
+    /* 3 clusters at 0, 100 and 200 with 4 frames each */
+    for (uint64_t uTimestampMs = 0; uTimestampMs < 300; uTimestampMs += 25)
+    {
+        keepFrame(xRetention, uTimestampMs, uTimestampMs % 100 == 0);
+    }
+
+    /* The fragment at 50 doesn't exist, so nothing newer than the cluster at 0 is released. */
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionPopPersisted(xRetention, 50, xDataFrameHandles, MAX_POP_CNT, &uCnt));
+    EXPECT_EQ(4, uCnt);
+    terminateFrames(xDataFrameHandles, uCnt);
+
+    /* A persisted fragment releases every older one. */
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionPopPersisted(xRetention, 200, xDataFrameHandles, MAX_POP_CNT, &uCnt));
+    EXPECT_EQ(8, uCnt);
+    EXPECT_EQ(100, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+    terminateFrames(xDataFrameHandles, uCnt);
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionStat(xRetention, &uFrameCnt, &uSize));
+    EXPECT_EQ(0, uFrameCnt);
+    EXPECT_EQ(0, uSize);
+
+    terminateRetention(xRetention);
+}
+
+TEST_F(StreamRetentionTest, pop_until_mem_evicts_whole_clusters)
+{
+    StreamRetentionHandle xRetention = NULL;
+    DataFrameHandle xDataFrameHandle = NULL;
+    DataFrameHandle xDataFrameHandles[MAX_POP_CNT];
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+    size_t uFrameSize = 0;
+    size_t uCnt = 0;
+    size_t uFrameCnt = 0;
+    size_t uSize = 0;
+
+    /* A simple block is smaller than a cluster frame, so the limit is 6 simple blocks. */
+    xDataFrameHandle = sendFrame(0, false);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen));
+    uFrameSize = uMkvHeaderLen + uDataLen;
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    ASSERT_TRUE((xRetention = Kvs_streamRetentionCreate(uFrameSize * 6)) != NULL);
+
+    /* 2 clusters at 0 and 100 with 4 frames each */
+    for (uint64_t uTimestampMs = 0; uTimestampMs < 200; uTimestampMs += 25)
+    {
+        keepFrame(xRetention, uTimestampMs, uTimestampMs % 100 == 0);
+    }
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionPopUntilMem(xRetention, xDataFrameHandles, MAX_POP_CNT, &uCnt));
+    EXPECT_EQ(4, uCnt);
+    terminateFrames(xDataFrameHandles, uCnt);
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamRetentionStat(xRetention, &uFrameCnt, &uSize));
+    EXPECT_EQ(4, uFrameCnt);
+    EXPECT_GE(uFrameSize * 6, uSize);
+
+    /* The window still starts at a cluster. */
+    Kvs_streamRetentionRewind(xRetention);
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamRetentionNextReplay(xRetention)) != NULL);
+    EXPECT_EQ(100, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+
+    terminateRetention(xRetention);
+}
+
+TEST_F(StreamRetentionTest, invalid_arguments)
+{
+    DataFrameHandle xDataFrameHandles[MAX_POP_CNT];
+    size_t uCnt = 0;
+    size_t uSize = 0;
+    bool bIsRetained = false;
+
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamRetentionAdd(NULL, NULL, &bIsRetained));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamRetentionPopPersisted(NULL, 0, xDataFrameHandles, MAX_POP_CNT, &uCnt));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamRetentionPopUntilMem(NULL, xDataFrameHandles, MAX_POP_CNT, &uCnt));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamRetentionStat(NULL, &uCnt, &uSize));
+    EXPECT_TRUE(Kvs_streamRetentionPop(NULL) == NULL);
+    EXPECT_TRUE(Kvs_streamRetentionIsEmpty(NULL));
+}
@@ -0,0 +1,216 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/stream_spill.h"
+}
+#endif
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+/* The offset of delta timestamp in the simple block header */
+#define SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET (10)
+
+#define FRAME_DATA_LEN (100)
+
+/* Two records of FRAME_DATA_LEN bytes fit in a segment, but the third one doesn't. */
+#define SEGMENT_SIZE (256)
+
+class StreamSpillTest : public ::testing::Test
+{
+protected:
+    char pcDir[64];
+    char pData[FRAME_DATA_LEN];
+
+    void SetUp() override
+    {
+        strcpy(pcDir, "/tmp/kvs_spill_test_XXXXXX");
+        ASSERT_TRUE(mkdtemp(pcDir) != NULL);
+    }
+
+    void TearDown() override
+    {
+        /* Every segment file is removed when the spill is terminated. */
+        EXPECT_EQ(0, countFiles());
+        rmdir(pcDir);
+    }
+
+    size_t countFiles()
+    {
+        DIR *pDir = opendir(pcDir);
+        struct dirent *pEntry = NULL;
+        size_t uCnt = 0;
+
+        while (pDir != NULL && (pEntry = readdir(pDir)) != NULL)
+        {
+            if (pEntry->d_name[0] != '.')
+            {
+                uCnt++;
+            }
+        }
+        if (pDir != NULL)
+        {
+            closedir(pDir);
+        }
+
+        return uCnt;
+    }
+
+    int append(StreamSpillHandle xSpillHandle, TrackType_t xTrackType, uint64_t uTimestampMs, bool bIsCluster)
+    {
+        DataFrameIn_t xDataFrameIn = {};
+
+        memset(pData, (int)(uTimestampMs & 0xFF), sizeof(pData));
+        xDataFrameIn.xClusterType = bIsCluster ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.pData = pData;
+        xDataFrameIn.uDataLen = sizeof(pData);
+        xDataFrameIn.uTimestampMs = uTimestampMs;
+        xDataFrameIn.bIsKeyFrame = bIsCluster;
+        xDataFrameIn.xTrackType = xTrackType;
+
+        return Kvs_streamSpillAppend(xSpillHandle, &xDataFrameIn);
+    }
+};
+
+TEST_F(StreamSpillTest, read_in_order_across_segments)
+{
+    StreamSpillHandle xSpillHandle = Kvs_streamSpillCreate(pcDir, SEGMENT_SIZE, 64 * SEGMENT_SIZE);
+    SpillFrame_t xSpillFrame = {0};
+    uint64_t uTimestamps[] = {1000, 1010, 1033, 1050, 1066, 2000, 2020, 2033};
+    TrackType_t xTrackTypes[] = {TRACK_VIDEO, TRACK_AUDIO, TRACK_VIDEO, TRACK_AUDIO, TRACK_VIDEO, TRACK_VIDEO, TRACK_AUDIO, TRACK_VIDEO};
+    size_t uFrameCnt = 0;
+    size_t uSize = 0;
+    size_t i = 0;
+
+    ASSERT_TRUE(xSpillHandle != NULL);
+    for (i = 0; i < sizeof(uTimestamps) / sizeof(uTimestamps[0]); i++)
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, xTrackTypes[i], uTimestamps[i], uTimestamps[i] % 1000 == 0));
+    }
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillStat(xSpillHandle, &uFrameCnt, &uSize));
+    EXPECT_EQ(8, uFrameCnt);
+    EXPECT_EQ(4, countFiles());
+
+    for (i = 0; i < sizeof(uTimestamps) / sizeof(uTimestamps[0]); i++)
+    {
+        ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+        EXPECT_EQ(uTimestamps[i], xSpillFrame.uTimestampMs);
+        EXPECT_EQ(xTrackTypes[i], xSpillFrame.xTrackType);
+        EXPECT_EQ(Mkv_getClusterHdrLen(xSpillFrame.xClusterType), xSpillFrame.uMkvHdrLen);
+        EXPECT_EQ(FRAME_DATA_LEN, xSpillFrame.uDataLen);
+        EXPECT_EQ((uint8_t)(uTimestamps[i] & 0xFF), xSpillFrame.pData[FRAME_DATA_LEN - 1]);
+        if (xSpillFrame.xClusterType == MKV_SIMPLE_BLOCK)
+        {
+            /* Simple blocks are relative to the cluster read before them. */
+            EXPECT_EQ(uTimestamps[i] % 1000, (xSpillFrame.pMkvHdr[SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET] << 8) | xSpillFrame.pMkvHdr[SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET + 1]);
+        }
+    }
+    EXPECT_TRUE(Kvs_streamSpillIsEmpty(xSpillHandle));
+    EXPECT_EQ(KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+
+    /* Segments which are fully read are removed, except the one still being written. */
+    EXPECT_EQ(1, countFiles());
+
+    Kvs_streamSpillTerminate(xSpillHandle);
+}
+
+TEST_F(StreamSpillTest, append_whole_clusters_only)
+{
+    StreamSpillHandle xSpillHandle = Kvs_streamSpillCreate(pcDir, SEGMENT_SIZE, 2 * SEGMENT_SIZE);
+    SpillFrame_t xSpillFrame = {0};
+    size_t i = 0;
+
+    ASSERT_TRUE(xSpillHandle != NULL);
+
+    /* Nothing is appended until a cluster starts. */
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER, append(xSpillHandle, TRACK_VIDEO, 900, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1000, true));
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER, append(xSpillHandle, TRACK_AUDIO, 999, false));
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER, append(xSpillHandle, TRACK_VIDEO, 1000 + INT16_MAX + 1, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1033, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1066, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1100, false));
+
+    /* Once a frame doesn't fit, the rest of its cluster is rejected too. */
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_IS_FULL, append(xSpillHandle, TRACK_VIDEO, 1133, false));
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER, append(xSpillHandle, TRACK_VIDEO, 1166, false));
+
+    for (i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+    }
+    EXPECT_TRUE(Kvs_streamSpillIsEmpty(xSpillHandle));
+
+    /* The spill is drained, so the next frame has to start a new cluster. */
+    EXPECT_EQ(KVS_ERROR_STREAM_SPILL_FRAME_NOT_IN_CLUSTER, append(xSpillHandle, TRACK_VIDEO, 1200, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 2000, true));
+
+    Kvs_streamSpillTerminate(xSpillHandle);
+}
+
+TEST_F(StreamSpillTest, flush_to_next_cluster)
+{
+    StreamSpillHandle xSpillHandle = Kvs_streamSpillCreate(pcDir, SEGMENT_SIZE, 64 * SEGMENT_SIZE);
+    SpillFrame_t xSpillFrame = {0};
+
+    ASSERT_TRUE(xSpillHandle != NULL);
+    EXPECT_EQ(KVS_ERROR_STREAM_NO_AVAILABLE_DATA_FRAME, Kvs_streamSpillFlushToNextCluster(xSpillHandle));
+
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1000, true));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1033, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 1066, false));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 2000, true));
+    EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandle, TRACK_VIDEO, 2033, false));
+
+    /* The session broke after the first frame, so the rest of its cluster can't be sent. */
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillFlushToNextCluster(xSpillHandle));
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandle, &xSpillFrame));
+    EXPECT_EQ(MKV_CLUSTER, xSpillFrame.xClusterType);
+    EXPECT_EQ(2000, xSpillFrame.uTimestampMs);
+
+    Kvs_streamSpillTerminate(xSpillHandle);
+}
+
+/* Spills of two streams in the same directory keep their own segment files. */
+TEST_F(StreamSpillTest, spills_share_directory)
+{
+    StreamSpillHandle xSpillHandles[2];
+    SpillFrame_t xSpillFrame = {0};
+    uint64_t uTimestamps[2][4] = {{1000, 1033, 2000, 2033}, {5000, 5040, 6000, 6040}};
+    size_t i = 0;
+    size_t j = 0;
+
+    for (j = 0; j < 2; j++)
+    {
+        ASSERT_TRUE((xSpillHandles[j] = Kvs_streamSpillCreate(pcDir, SEGMENT_SIZE, 64 * SEGMENT_SIZE)) != NULL);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 2; j++)
+        {
+            EXPECT_EQ(KVS_ERRNO_NONE, append(xSpillHandles[j], TRACK_VIDEO, uTimestamps[j][i], uTimestamps[j][i] % 1000 == 0));
+        }
+    }
+    EXPECT_EQ(4, countFiles());
+
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 2; j++)
+        {
+            ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamSpillRead(xSpillHandles[j], &xSpillFrame));
+            EXPECT_EQ(uTimestamps[j][i], xSpillFrame.uTimestampMs);
+            EXPECT_EQ((uint8_t)(uTimestamps[j][i] & 0xFF), xSpillFrame.pData[0]);
+            EXPECT_EQ((uint8_t)(uTimestamps[j][i] & 0xFF), xSpillFrame.pData[FRAME_DATA_LEN - 1]);
+        }
+    }
+
+    /* Terminating one spill leaves the files of the other one. */
+    Kvs_streamSpillTerminate(xSpillHandles[0]);
+    EXPECT_EQ(1, countFiles());
+    Kvs_streamSpillTerminate(xSpillHandles[1]);
+}
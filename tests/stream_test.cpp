@@ -0,0 +1,877 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/stream.h"
+}
+#endif
+
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+/* The offset of delta timestamp in the simple block header */
+#define SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET (10)
+
+static char pTrackName[] = "kvs video track";
+static char pCodecName[] = "V_MPEG4/ISO/AVC";
+static uint8_t pCodecPrivate[] = {0x01, 0x64, 0x00, 0x1F, 0xFF, 0xE1, 0x00, 0x00, 0x01, 0x00, 0x00};
+
+static char pAudioTrackName[] = "kvs audio track";
+static char pAudioCodecName[] = "A_AAC";
+static uint8_t pAudioCodecPrivate[] = {0x14, 0x08};
+
+static void initTrackInfo(VideoTrackInfo_t *pxVideoTrackInfo, AudioTrackInfo_t *pxAudioTrackInfo)
+{
+    VideoTrackInfo_t &xVideoTrackInfo = *pxVideoTrackInfo;
+    AudioTrackInfo_t &xAudioTrackInfo = *pxAudioTrackInfo;
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.uWidth = 1920;
+    xVideoTrackInfo.uHeight = 1080;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+
+    xAudioTrackInfo.pTrackName = pAudioTrackName;
+    xAudioTrackInfo.pCodecName = pAudioCodecName;
+    xAudioTrackInfo.uFrequency = 8000;
+    xAudioTrackInfo.uChannelNumber = 1;
+    xAudioTrackInfo.pCodecPrivate = pAudioCodecPrivate;
+    xAudioTrackInfo.uCodecPrivateLen = sizeof(pAudioCodecPrivate);
+}
+
+static StreamHandle createStream(bool bHasAudio)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    AudioTrackInfo_t xAudioTrackInfo = {0};
+
+    initTrackInfo(&xVideoTrackInfo, &xAudioTrackInfo);
+
+    return Kvs_streamCreate(&xVideoTrackInfo, bHasAudio ? &xAudioTrackInfo : NULL);
+}
+
+static StreamHandle createLockFreeStream(bool bHasAudio, size_t uQueueSize)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    AudioTrackInfo_t xAudioTrackInfo = {0};
+
+    initTrackInfo(&xVideoTrackInfo, &xAudioTrackInfo);
+
+    return Kvs_streamCreateLockFree(&xVideoTrackInfo, bHasAudio ? &xAudioTrackInfo : NULL, 0, uQueueSize);
+}
+
+static DataFrameHandle addFrame(StreamHandle xStreamHandle, TrackType_t xTrackType, uint64_t uTimestampMs, bool bIsKeyFrame)
+{
+    DataFrameIn_t xDataFrameIn = {};
+
+    xDataFrameIn.xClusterType = bIsKeyFrame ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+    xDataFrameIn.pData = NULL;
+    xDataFrameIn.uDataLen = 16;
+    xDataFrameIn.uTimestampMs = uTimestampMs;
+    xDataFrameIn.bIsKeyFrame = bIsKeyFrame;
+    xDataFrameIn.xTrackType = xTrackType;
+
+    return Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn);
+}
+
+static uint16_t getDeltaTimestamp(DataFrameHandle xDataFrameHandle)
+{
+    uint8_t *pMkvHeader = NULL;
+    size_t uMkvHeaderLen = 0;
+    uint8_t *pData = NULL;
+    size_t uDataLen = 0;
+
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_dataFrameGetContent(xDataFrameHandle, &pMkvHeader, &uMkvHeaderLen, &pData, &uDataLen));
+
+    return (uint16_t)((pMkvHeader[SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET] << 8) | pMkvHeader[SIMPLE_BLOCK_DELTA_TIMESTAMP_OFFSET + 1]);
+}
+
+static void popAndTerminateAll(StreamHandle xStreamHandle)
+{
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    while ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+    {
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+}
+
+TEST(Kvs_streamAddDataFrame, invalid_parameter)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    DataFrameIn_t xDataFrameIn = {};
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    EXPECT_TRUE(Kvs_streamAddDataFrame(NULL, &xDataFrameIn) == NULL);
+    EXPECT_TRUE(Kvs_streamAddDataFrame(xStreamHandle, NULL) == NULL);
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAddDataFrame, in_order_frames)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uTimestampMs = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    for (uTimestampMs = 1000; uTimestampMs < 1300; uTimestampMs += 33)
+    {
+        ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, uTimestampMs, uTimestampMs == 1000) != NULL);
+    }
+
+    for (uTimestampMs = 1000; uTimestampMs < 1300; uTimestampMs += 33)
+    {
+        xDataFrameHandle = Kvs_streamPop(xStreamHandle);
+        ASSERT_TRUE(xDataFrameHandle != NULL);
+        if (uTimestampMs != 1000)
+        {
+            EXPECT_EQ(uTimestampMs - 1000, getDeltaTimestamp(xDataFrameHandle));
+        }
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAddDataFrame, out_of_order_audio_frames)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xVideo0 = NULL;
+    DataFrameHandle xVideo1 = NULL;
+    DataFrameHandle xAudio0 = NULL;
+    DataFrameHandle xAudio1 = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_TRUE((xVideo0 = addFrame(xStreamHandle, TRACK_VIDEO, 1000, true)) != NULL);
+    ASSERT_TRUE((xVideo1 = addFrame(xStreamHandle, TRACK_VIDEO, 1066, false)) != NULL);
+    ASSERT_TRUE((xAudio0 = addFrame(xStreamHandle, TRACK_AUDIO, 1000, false)) != NULL);
+    ASSERT_TRUE((xAudio1 = addFrame(xStreamHandle, TRACK_AUDIO, 1040, false)) != NULL);
+
+    /* A video frame goes before an audio frame with the same timestamp. */
+    EXPECT_EQ(xVideo0, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xAudio0, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xAudio1, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xVideo1, Kvs_streamPop(xStreamHandle));
+
+    EXPECT_EQ(0, getDeltaTimestamp(xAudio0));
+    EXPECT_EQ(40, getDeltaTimestamp(xAudio1));
+    EXPECT_EQ(66, getDeltaTimestamp(xVideo1));
+
+    Kvs_dataFrameTerminate(xVideo0);
+    Kvs_dataFrameTerminate(xVideo1);
+    Kvs_dataFrameTerminate(xAudio0);
+    Kvs_dataFrameTerminate(xAudio1);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAddDataFrame, insert_cluster_updates_delta_timestamp)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xAudio0 = NULL;
+    DataFrameHandle xAudio1 = NULL;
+    DataFrameHandle xAudio2 = NULL;
+    DataFrameHandle xAudio3 = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    ASSERT_TRUE((xAudio0 = addFrame(xStreamHandle, TRACK_AUDIO, 1500, false)) != NULL);
+    ASSERT_TRUE((xAudio1 = addFrame(xStreamHandle, TRACK_AUDIO, 2500, false)) != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 3000, true) != NULL);
+    ASSERT_TRUE((xAudio2 = addFrame(xStreamHandle, TRACK_AUDIO, 3500, false)) != NULL);
+    EXPECT_EQ(1500, getDeltaTimestamp(xAudio1));
+    EXPECT_EQ(500, getDeltaTimestamp(xAudio2));
+
+    /* A late cluster only changes the delta timestamp of the frames up to the next cluster. */
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 2000, true) != NULL);
+    EXPECT_EQ(500, getDeltaTimestamp(xAudio0));
+    EXPECT_EQ(500, getDeltaTimestamp(xAudio1));
+    EXPECT_EQ(500, getDeltaTimestamp(xAudio2));
+
+    /* Frames after the last cluster are relative to it. */
+    ASSERT_TRUE((xAudio3 = addFrame(xStreamHandle, TRACK_AUDIO, 3700, false)) != NULL);
+    EXPECT_EQ(700, getDeltaTimestamp(xAudio3));
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAddDataFrame, delta_timestamp_after_cluster_popped)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xDataFrameHandle = NULL;
+    DataFrameHandle xAudio0 = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    /* The cluster which has already been sent is still the reference of the following frames. */
+    ASSERT_TRUE((xAudio0 = addFrame(xStreamHandle, TRACK_AUDIO, 1020, false)) != NULL);
+    EXPECT_EQ(20, getDeltaTimestamp(xAudio0));
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAddDataFrame, split_long_gop)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 1000 + INT16_MAX, false)) != NULL);
+    EXPECT_EQ(MKV_SIMPLE_BLOCK, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+    EXPECT_EQ(INT16_MAX, getDeltaTimestamp(xDataFrameHandle));
+
+    /* The delta timestamp would overflow, so the frame starts a cluster although it's not a key frame. */
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 1000 + INT16_MAX + 1, false)) != NULL);
+    EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+    EXPECT_FALSE(((DataFrameIn_t *)xDataFrameHandle)->bIsKeyFrame);
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 1000 + INT16_MAX + 34, false)) != NULL);
+    EXPECT_EQ(33, getDeltaTimestamp(xDataFrameHandle));
+    popAndTerminateAll(xStreamHandle);
+
+    /* Each frame has 16 bytes, so the third one exceeds the size limit. */
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSetClusterLimit(xStreamHandle, 100, 40));
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 100000, true) != NULL);
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 100033, false)) != NULL);
+    EXPECT_EQ(MKV_SIMPLE_BLOCK, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 100066, false)) != NULL);
+    EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+
+    /* The next cluster starts when the duration is reached. */
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSetClusterLimit(xStreamHandle, 100, 0));
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 100165, false)) != NULL);
+    EXPECT_EQ(MKV_SIMPLE_BLOCK, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+    EXPECT_EQ(99, getDeltaTimestamp(xDataFrameHandle));
+    ASSERT_TRUE((xDataFrameHandle = addFrame(xStreamHandle, TRACK_VIDEO, 100166, false)) != NULL);
+    EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamAvailOnTrack, per_track_queue)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xDataFrameHandle = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_VIDEO));
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_AUDIO));
+
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_AUDIO, 1000, false) != NULL);
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_VIDEO));
+    EXPECT_TRUE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_AUDIO));
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, (TrackType_t)0));
+
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    EXPECT_TRUE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_VIDEO));
+
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_VIDEO));
+    EXPECT_TRUE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_AUDIO));
+
+    popAndTerminateAll(xStreamHandle);
+    EXPECT_FALSE(Kvs_streamAvailOnTrack(xStreamHandle, TRACK_AUDIO));
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamPop, merge_tracks_by_timestamp)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xVideo0 = NULL;
+    DataFrameHandle xVideo1 = NULL;
+    DataFrameHandle xAudio0 = NULL;
+    DataFrameHandle xAudio1 = NULL;
+    DataFrameHandle xAudio2 = NULL;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+
+    /* Audio frames arrive before the video cluster they belong to. */
+    ASSERT_TRUE((xAudio0 = addFrame(xStreamHandle, TRACK_AUDIO, 1000, false)) != NULL);
+    ASSERT_TRUE((xAudio1 = addFrame(xStreamHandle, TRACK_AUDIO, 1020, false)) != NULL);
+    ASSERT_TRUE((xAudio2 = addFrame(xStreamHandle, TRACK_AUDIO, 1040, false)) != NULL);
+    ASSERT_TRUE((xVideo0 = addFrame(xStreamHandle, TRACK_VIDEO, 1000, true)) != NULL);
+    ASSERT_TRUE((xVideo1 = addFrame(xStreamHandle, TRACK_VIDEO, 1033, false)) != NULL);
+
+    EXPECT_EQ(xVideo0, Kvs_streamPeek(xStreamHandle));
+    EXPECT_EQ(xVideo0, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xAudio0, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xAudio1, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xVideo1, Kvs_streamPop(xStreamHandle));
+    EXPECT_EQ(xAudio2, Kvs_streamPop(xStreamHandle));
+    EXPECT_TRUE(Kvs_streamPop(xStreamHandle) == NULL);
+
+    EXPECT_EQ(0, getDeltaTimestamp(xAudio0));
+    EXPECT_EQ(20, getDeltaTimestamp(xAudio1));
+    EXPECT_EQ(40, getDeltaTimestamp(xAudio2));
+    EXPECT_EQ(33, getDeltaTimestamp(xVideo1));
+
+    Kvs_dataFrameTerminate(xVideo0);
+    Kvs_dataFrameTerminate(xVideo1);
+    Kvs_dataFrameTerminate(xAudio0);
+    Kvs_dataFrameTerminate(xAudio1);
+    Kvs_dataFrameTerminate(xAudio2);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamStatOnTrack, counters_follow_add_and_pop)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t uMemEmpty = 0;
+    size_t uMemTotal = 0;
+    size_t uVideoFrameCnt = 0;
+    size_t uVideoMem = 0;
+    size_t uAudioFrameCnt = 0;
+    size_t uAudioMem = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemEmpty));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamStatOnTrack(xStreamHandle, (TrackType_t)0, &uVideoFrameCnt, &uVideoMem));
+
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1033, false) != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_AUDIO, 1020, false) != NULL);
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamStatOnTrack(xStreamHandle, TRACK_VIDEO, &uVideoFrameCnt, &uVideoMem));
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamStatOnTrack(xStreamHandle, TRACK_AUDIO, &uAudioFrameCnt, &uAudioMem));
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemTotal));
+    EXPECT_EQ(2, uVideoFrameCnt);
+    EXPECT_EQ(1, uAudioFrameCnt);
+    EXPECT_GT(uVideoMem, uAudioMem);
+    EXPECT_EQ(uMemEmpty + uVideoMem + uAudioMem, uMemTotal);
+
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamStatOnTrack(xStreamHandle, TRACK_VIDEO, &uVideoFrameCnt, &uVideoMem));
+    EXPECT_EQ(1, uVideoFrameCnt);
+
+    popAndTerminateAll(xStreamHandle);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemTotal));
+    EXPECT_EQ(uMemEmpty, uMemTotal);
+
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamPopBatch, pop_ready_frames)
+{
+    StreamHandle xStreamHandles[] = {createStream(true), createLockFreeStream(true, 32)};
+    DataFrameHandle xDataFrameHandles[8];
+    size_t uCnt = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        ASSERT_TRUE(xStreamHandles[i] != NULL);
+        EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, Kvs_streamPopBatch(xStreamHandles[i], 8, SIZE_MAX, false, NULL, &uCnt));
+
+        ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_VIDEO, 1000, true) != NULL);
+        ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_AUDIO, 1010, false) != NULL);
+        ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_VIDEO, 1033, false) != NULL);
+        ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_AUDIO, 1040, false) != NULL);
+        ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_VIDEO, 1066, false) != NULL);
+
+        /* Frames are popped in timestamp order, up to the count limit. */
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopBatch(xStreamHandles[i], 2, SIZE_MAX, false, xDataFrameHandles, &uCnt));
+        ASSERT_EQ(2, uCnt);
+        EXPECT_EQ(1000, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+        EXPECT_EQ(1010, ((DataFrameIn_t *)xDataFrameHandles[1])->uTimestampMs);
+        EXPECT_EQ(10, getDeltaTimestamp(xDataFrameHandles[1]));
+        for (j = 0; j < uCnt; j++)
+        {
+            Kvs_dataFrameTerminate(xDataFrameHandles[j]);
+        }
+
+        /* The first frame is popped even if it exceeds the size limit. */
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopBatch(xStreamHandles[i], 8, 1, false, xDataFrameHandles, &uCnt));
+        ASSERT_EQ(1, uCnt);
+        EXPECT_EQ(1033, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+        Kvs_dataFrameTerminate(xDataFrameHandles[0]);
+
+        /* Once the audio track is empty, the last video frame isn't ready if every track is required. */
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopBatch(xStreamHandles[i], 8, SIZE_MAX, true, xDataFrameHandles, &uCnt));
+        ASSERT_EQ(1, uCnt);
+        EXPECT_EQ(1040, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+        Kvs_dataFrameTerminate(xDataFrameHandles[0]);
+
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopBatch(xStreamHandles[i], 8, SIZE_MAX, false, xDataFrameHandles, &uCnt));
+        ASSERT_EQ(1, uCnt);
+        EXPECT_EQ(66, getDeltaTimestamp(xDataFrameHandles[0]));
+        Kvs_dataFrameTerminate(xDataFrameHandles[0]);
+
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopBatch(xStreamHandles[i], 8, SIZE_MAX, false, xDataFrameHandles, &uCnt));
+        EXPECT_EQ(0, uCnt);
+        EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandles[i]));
+
+        Kvs_streamTermintate(xStreamHandles[i]);
+    }
+}
+
+TEST(Kvs_streamPopUntilMem, pop_in_batches)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    DataFrameHandle xDataFrameHandles[4];
+    size_t uMemEmpty = 0;
+    size_t uMemTotal = 0;
+    size_t uMemLimit = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemEmpty));
+    for (i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000 + i * 33, i == 0) != NULL);
+    }
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemTotal));
+
+    /* Keep the memory of about 3 frames, so 7 frames need to be popped. */
+    uMemLimit = uMemEmpty + (uMemTotal - uMemEmpty) * 3 / 10;
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopUntilMem(xStreamHandle, uMemLimit, xDataFrameHandles, 4, &uCnt));
+    EXPECT_EQ(4, uCnt);
+    EXPECT_EQ(1000, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+    for (i = 0; i < uCnt; i++)
+    {
+        Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+    }
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopUntilMem(xStreamHandle, uMemLimit, xDataFrameHandles, 4, &uCnt));
+    EXPECT_LT(uCnt, 4);
+    for (i = 0; i < uCnt; i++)
+    {
+        Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+    }
+
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemTotal));
+    EXPECT_LE(uMemTotal, uMemLimit);
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+/* Add 3 GOPs of 4 video frames, and audio frames every 50 ms. */
+static void addGops(StreamHandle xStreamHandle)
+{
+    uint64_t uAudioTimestampMs = 1000;
+    size_t i = 0;
+
+    for (i = 0; i < 12; i++)
+    {
+        ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000 + i * 33, (i % 4) == 0) != NULL);
+        for (; uAudioTimestampMs < 1000 + i * 33; uAudioTimestampMs += 50)
+        {
+            ASSERT_TRUE(addFrame(xStreamHandle, TRACK_AUDIO, uAudioTimestampMs, false) != NULL);
+        }
+    }
+}
+
+static size_t popGopsAndTerminate(StreamHandle xStreamHandle, bool bKeepAudio, uint64_t *puMaxTimestampMs)
+{
+    DataFrameHandle xDataFrameHandles[4];
+    size_t uTotalCnt = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    do
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamPopGopUntilMem(xStreamHandle, 0, bKeepAudio, xDataFrameHandles, 4, &uCnt));
+        for (i = 0; i < uCnt; i++)
+        {
+            if (bKeepAudio)
+            {
+                EXPECT_EQ(TRACK_VIDEO, ((DataFrameIn_t *)xDataFrameHandles[i])->xTrackType);
+            }
+            /* Evicted frames are handed out in timestamp order. */
+            EXPECT_GE(((DataFrameIn_t *)xDataFrameHandles[i])->uTimestampMs, *puMaxTimestampMs);
+            *puMaxTimestampMs = ((DataFrameIn_t *)xDataFrameHandles[i])->uTimestampMs;
+            Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+        }
+        uTotalCnt += uCnt;
+    } while (uCnt > 0);
+
+    return uTotalCnt;
+}
+
+TEST(Kvs_streamPopGopUntilMem, evict_whole_gops)
+{
+    StreamHandle xStreamHandles[] = {createStream(true), createLockFreeStream(true, 32)};
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uMaxTimestampMs = 0;
+    size_t i = 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        ASSERT_TRUE(xStreamHandles[i] != NULL);
+        addGops(xStreamHandles[i]);
+
+        /* The newest GOP is kept even if the stream is still over the limit. */
+        uMaxTimestampMs = 0;
+        EXPECT_EQ(8 + 6, popGopsAndTerminate(xStreamHandles[i], false, &uMaxTimestampMs));
+        EXPECT_LT(uMaxTimestampMs, 1264);
+
+        ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandles[i])) != NULL);
+        EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+        EXPECT_EQ(1264, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+
+        popAndTerminateAll(xStreamHandles[i]);
+        Kvs_streamTermintate(xStreamHandles[i]);
+    }
+}
+
+TEST(Kvs_streamPopGopUntilMem, keep_audio)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uMaxTimestampMs = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    addGops(xStreamHandle);
+
+    /* The first cluster has been sent, so the rest of its GOP is evicted first. */
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    EXPECT_EQ(1000, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+    EXPECT_EQ(3 + 4, popGopsAndTerminate(xStreamHandle, true, &uMaxTimestampMs));
+
+    /* The audio frames are moved to the cluster which has been sent. */
+    while ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL && ((DataFrameIn_t *)xDataFrameHandle)->xTrackType == TRACK_AUDIO)
+    {
+        EXPECT_EQ(((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs - 1000, getDeltaTimestamp(xDataFrameHandle));
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+    ASSERT_TRUE(xDataFrameHandle != NULL);
+    EXPECT_EQ(1264, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamPopGopUntilMem, split_clusters_stay_in_gop)
+{
+    StreamHandle xStreamHandles[] = {createStream(false), createLockFreeStream(false, 32)};
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uMaxTimestampMs = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        ASSERT_TRUE(xStreamHandles[i] != NULL);
+        EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSetClusterLimit(xStreamHandles[i], 100, 0));
+
+        /* A GOP of 12 frames is split into 3 clusters, and it's followed by a GOP of 4 frames. */
+        for (j = 0; j < 16; j++)
+        {
+            ASSERT_TRUE(addFrame(xStreamHandles[i], TRACK_VIDEO, 1000 + j * 33, j == 0 || j == 12) != NULL);
+        }
+
+        /* The frames of the split clusters refer to the key frame, so they're evicted with it. */
+        uMaxTimestampMs = 0;
+        EXPECT_EQ(12, popGopsAndTerminate(xStreamHandles[i], false, &uMaxTimestampMs));
+
+        ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandles[i])) != NULL);
+        EXPECT_TRUE(((DataFrameIn_t *)xDataFrameHandle)->bIsKeyFrame);
+        EXPECT_EQ(1396, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+
+        popAndTerminateAll(xStreamHandles[i]);
+        Kvs_streamTermintate(xStreamHandles[i]);
+    }
+}
+
+TEST(Kvs_streamPopDroppableUntilMem, drop_non_reference_frames)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    DataFrameIn_t xDataFrameIn = {};
+    DataFrameHandle xDataFrameHandles[8];
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t uMemEmpty = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemEmpty));
+
+    /* Every other P-frame is droppable. */
+    for (i = 0; i < 8; i++)
+    {
+        xDataFrameIn.xClusterType = (i == 0) ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.bIsKeyFrame = (i == 0);
+        xDataFrameIn.uDataLen = 16;
+        xDataFrameIn.uTimestampMs = 1000 + i * 33;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        xDataFrameIn.xDropClass = (i % 2 == 1) ? DATA_FRAME_DROPPABLE : DATA_FRAME_REFERENCED;
+        ASSERT_TRUE(Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL);
+    }
+
+    /* Only droppable frames are popped even if the stream is still over the limit. */
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopDroppableUntilMem(xStreamHandle, uMemEmpty, xDataFrameHandles, 8, &uCnt));
+    EXPECT_EQ(4, uCnt);
+    for (i = 0; i < uCnt; i++)
+    {
+        EXPECT_EQ(1000 + (2 * i + 1) * 33, ((DataFrameIn_t *)xDataFrameHandles[i])->uTimestampMs);
+        Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+    }
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopDroppableUntilMem(xStreamHandle, uMemEmpty, xDataFrameHandles, 8, &uCnt));
+    EXPECT_EQ(0, uCnt);
+
+    /* The rest keeps its order and delta timestamps. */
+    for (i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+        EXPECT_EQ(1000 + 2 * i * 33, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+        if (i > 0)
+        {
+            EXPECT_EQ(2 * i * 33, getDeltaTimestamp(xDataFrameHandle));
+        }
+        Kvs_dataFrameTerminate(xDataFrameHandle);
+    }
+
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamPopDroppableUntilMem, drop_oldest_of_all_tracks_first)
+{
+    StreamHandle xStreamHandle = createStream(true);
+    DataFrameIn_t xDataFrameIn = {};
+    DataFrameHandle xDataFrameHandles[8];
+    TrackType_t xTrackTypes[] = {TRACK_VIDEO, TRACK_AUDIO, TRACK_VIDEO, TRACK_AUDIO, TRACK_VIDEO};
+    uint64_t uTimestamps[] = {1000, 1050, 1100, 1200, 1300};
+    size_t uMemEmpty = 0;
+    size_t uCnt = 0;
+    size_t i = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamMemStatTotal(xStreamHandle, &uMemEmpty));
+
+    /* Everything but the key frame is droppable. */
+    for (i = 0; i < 5; i++)
+    {
+        xDataFrameIn.xClusterType = (i == 0) ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.bIsKeyFrame = (i == 0);
+        xDataFrameIn.uDataLen = 16;
+        xDataFrameIn.uTimestampMs = uTimestamps[i];
+        xDataFrameIn.xTrackType = xTrackTypes[i];
+        xDataFrameIn.xDropClass = (i == 0) ? DATA_FRAME_REFERENCED : DATA_FRAME_DROPPABLE;
+        ASSERT_TRUE(Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn) != NULL);
+    }
+
+    /* The droppable frames are popped by timestamp across the tracks, not track by track. */
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopDroppableUntilMem(xStreamHandle, uMemEmpty, xDataFrameHandles, 3, &uCnt));
+    ASSERT_EQ(3, uCnt);
+    for (i = 0; i < uCnt; i++)
+    {
+        EXPECT_EQ(uTimestamps[i + 1], ((DataFrameIn_t *)xDataFrameHandles[i])->uTimestampMs);
+        EXPECT_EQ(xTrackTypes[i + 1], ((DataFrameIn_t *)xDataFrameHandles[i])->xTrackType);
+        Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+    }
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamPopDroppableUntilMem(xStreamHandle, uMemEmpty, xDataFrameHandles, 8, &uCnt));
+    ASSERT_EQ(1, uCnt);
+    EXPECT_EQ(1300, ((DataFrameIn_t *)xDataFrameHandles[0])->uTimestampMs);
+    Kvs_dataFrameTerminate(xDataFrameHandles[0]);
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamCreateWithPool, recycle_descriptors)
+{
+    VideoTrackInfo_t xVideoTrackInfo = {0};
+    StreamHandle xStreamHandle = NULL;
+    DataFrameIn_t xDataFrameIn = {};
+    DataFrameHandle xDataFrameHandles[8];
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uUserData = 0x0123456789ABCDEFULL;
+    size_t i = 0;
+
+    xVideoTrackInfo.pTrackName = pTrackName;
+    xVideoTrackInfo.pCodecName = pCodecName;
+    xVideoTrackInfo.pCodecPrivate = pCodecPrivate;
+    xVideoTrackInfo.uCodecPrivateLen = sizeof(pCodecPrivate);
+    ASSERT_TRUE((xStreamHandle = Kvs_streamCreateWithPool(&xVideoTrackInfo, NULL, sizeof(uUserData), 4)) != NULL);
+
+    /* The pool grows when the preallocated descriptors run out. */
+    for (i = 0; i < 8; i++)
+    {
+        xDataFrameIn.xClusterType = (i == 0) ? MKV_CLUSTER : MKV_SIMPLE_BLOCK;
+        xDataFrameIn.bIsKeyFrame = (i == 0);
+        xDataFrameIn.uTimestampMs = 1000 + i * 33;
+        xDataFrameIn.xTrackType = TRACK_VIDEO;
+        xDataFrameIn.pUserData = &uUserData;
+        ASSERT_TRUE((xDataFrameHandles[i] = Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn)) != NULL);
+    }
+    uUserData = 0;
+
+    /* The user data is copied into the descriptor. */
+    for (i = 0; i < 8; i++)
+    {
+        ASSERT_EQ(xDataFrameHandles[i], Kvs_streamPop(xStreamHandle));
+        EXPECT_TRUE(((DataFrameIn_t *)xDataFrameHandles[i])->pUserData != &uUserData);
+        EXPECT_EQ(0x0123456789ABCDEFULL, *(uint64_t *)(((DataFrameIn_t *)xDataFrameHandles[i])->pUserData));
+    }
+
+    /* A terminated descriptor is reused by the next data frame. */
+    Kvs_dataFrameTerminate(xDataFrameHandles[7]);
+    xDataFrameIn.pUserData = NULL;
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamAddDataFrame(xStreamHandle, &xDataFrameIn)) != NULL);
+    EXPECT_EQ(xDataFrameHandles[7], xDataFrameHandle);
+    EXPECT_TRUE(((DataFrameIn_t *)xDataFrameHandle)->pUserData == NULL);
+
+    for (i = 0; i < 7; i++)
+    {
+        Kvs_dataFrameTerminate(xDataFrameHandles[i]);
+    }
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamCreateLockFree, bounded_queue)
+{
+    StreamHandle xStreamHandle = createLockFreeStream(true, 3);
+    DataFrameHandle xDataFrameHandle = NULL;
+    size_t i = 0;
+
+    ASSERT_TRUE(createLockFreeStream(true, 0) == NULL);
+    ASSERT_TRUE(xStreamHandle != NULL);
+
+    /* The queue size is rounded up to 4. */
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    for (i = 1; i < 4; i++)
+    {
+        ASSERT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000 + i * 33, false) != NULL);
+    }
+    EXPECT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1132, false) == NULL);
+
+    /* Each track has its own queue. */
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_AUDIO, 990, false) != NULL);
+    ASSERT_TRUE(addFrame(xStreamHandle, TRACK_AUDIO, 1050, false) != NULL);
+
+    /* The frames are merged by timestamp, and the delta timestamp is relative to the last popped cluster. */
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    EXPECT_EQ(TRACK_AUDIO, ((DataFrameIn_t *)xDataFrameHandle)->xTrackType);
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPeek(xStreamHandle)) != NULL);
+    EXPECT_EQ(MKV_CLUSTER, ((DataFrameIn_t *)xDataFrameHandle)->xClusterType);
+    EXPECT_EQ(xDataFrameHandle, Kvs_streamPop(xStreamHandle));
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    EXPECT_EQ(1033, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+    EXPECT_EQ(33, getDeltaTimestamp(xDataFrameHandle));
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    ASSERT_TRUE((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL);
+    EXPECT_EQ(TRACK_AUDIO, ((DataFrameIn_t *)xDataFrameHandle)->xTrackType);
+    EXPECT_EQ(50, getDeltaTimestamp(xDataFrameHandle));
+    Kvs_dataFrameTerminate(xDataFrameHandle);
+
+    /* Terminated descriptors make room for new frames. */
+    EXPECT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1132, false) != NULL);
+
+    popAndTerminateAll(xStreamHandle);
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+TEST(Kvs_streamCreateLockFree, producer_and_consumer_threads)
+{
+    const uint64_t uFrameCnt = 20000;
+    StreamHandle xStreamHandle = createLockFreeStream(false, 64);
+    DataFrameHandle xDataFrameHandle = NULL;
+    uint64_t uNextTimestamp = 0;
+    size_t uCnt = 0;
+    size_t uMemTotal = 0;
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+
+    std::thread xProducer([xStreamHandle, uFrameCnt]() {
+        uint64_t i = 0;
+        while (i < uFrameCnt)
+        {
+            if (addFrame(xStreamHandle, TRACK_VIDEO, i, (i % 30) == 0) != NULL)
+            {
+                i++;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    /* Every frame arrives once and in order. */
+    while (uNextTimestamp < uFrameCnt)
+    {
+        if ((xDataFrameHandle = Kvs_streamPop(xStreamHandle)) != NULL)
+        {
+            EXPECT_EQ(uNextTimestamp, ((DataFrameIn_t *)xDataFrameHandle)->uTimestampMs);
+            if ((uNextTimestamp % 30) != 0)
+            {
+                EXPECT_EQ(uNextTimestamp % 30, getDeltaTimestamp(xDataFrameHandle));
+            }
+            uNextTimestamp++;
+            Kvs_dataFrameTerminate(xDataFrameHandle);
+        }
+    }
+    xProducer.join();
+
+    EXPECT_TRUE(Kvs_streamIsEmpty(xStreamHandle));
+    ASSERT_EQ(KVS_ERRNO_NONE, Kvs_streamStatOnTrack(xStreamHandle, TRACK_VIDEO, &uCnt, &uMemTotal));
+    EXPECT_EQ(0, uCnt);
+    EXPECT_EQ(0, uMemTotal);
+    Kvs_streamTermintate(xStreamHandle);
+}
+
+static long long waitAndMeasureMs(WakeupHandle xWakeup, uint32_t uTimeoutMs)
+{
+    auto xStart = std::chrono::steady_clock::now();
+
+    EXPECT_EQ(KVS_ERRNO_NONE, wakeupWait(xWakeup, -1, uTimeoutMs));
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - xStart).count();
+}
+
+TEST(Kvs_streamSetWakeup, signal_on_add)
+{
+    StreamHandle xStreamHandle = createStream(false);
+    WakeupHandle xWakeup = wakeupCreate();
+
+    ASSERT_TRUE(xStreamHandle != NULL);
+    ASSERT_TRUE(xWakeup != NULL);
+    EXPECT_EQ(KVS_ERRNO_NONE, Kvs_streamSetWakeup(xStreamHandle, xWakeup));
+
+    /* A frame added before the wait isn't missed. */
+    EXPECT_TRUE(addFrame(xStreamHandle, TRACK_VIDEO, 1000, true) != NULL);
+    EXPECT_LT(waitAndMeasureMs(xWakeup, 5000), 1000);
+
+    /* The signal is consumed, so the next wait times out. */
+    EXPECT_GE(waitAndMeasureMs(xWakeup, 50), 40);
+
+    /* A frame added by another thread wakes up the waiting thread. */
+    std::thread xProducer([xStreamHandle]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        addFrame(xStreamHandle, TRACK_VIDEO, 1033, false);
+    });
+    EXPECT_LT(waitAndMeasureMs(xWakeup, 5000), 1000);
+    xProducer.join();
+
+    popAndTerminateAll(xStreamHandle);
+    Kvs_streamTermintate(xStreamHandle);
+    wakeupTerminate(xWakeup);
+}
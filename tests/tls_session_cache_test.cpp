@@ -0,0 +1,268 @@
+#ifdef __cplusplus
+extern "C" {
+#include "kvs/errors.h"
+#include "kvs/tls_session_cache.h"
+}
+#endif
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/version.h"
+
+/* Session serialization is available since mbedTLS 2.19.0. */
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+
+#define TLS_SESSION_CACHE_FILE_MAGIC "KVSTLSC1"
+
+/* A session which is told from the others by its session ID */
+static std::string serializeSession(unsigned char uId)
+{
+    mbedtls_ssl_session xSession;
+    std::vector<unsigned char> xBuf;
+    size_t uLen = 0;
+
+    mbedtls_ssl_session_init(&xSession);
+    xSession.id_len = 32;
+    memset(xSession.id, uId, sizeof(xSession.id));
+    mbedtls_ssl_session_save(&xSession, NULL, 0, &uLen);
+    xBuf.resize(uLen);
+    EXPECT_EQ(0, mbedtls_ssl_session_save(&xSession, xBuf.data(), xBuf.size(), &uLen));
+    mbedtls_ssl_session_free(&xSession);
+
+    return std::string(xBuf.begin(), xBuf.end());
+}
+
+/* A record of a cache file: the big endian lengths of the host and the session, each followed by its bytes */
+static std::string record(const std::string &xHostPort, const std::string &xSession)
+{
+    std::string xRecord;
+    size_t uLen = xSession.size();
+
+    xRecord += (char)(xHostPort.size() >> 8);
+    xRecord += (char)(xHostPort.size());
+    xRecord += xHostPort;
+    xRecord += (char)(uLen >> 24);
+    xRecord += (char)(uLen >> 16);
+    xRecord += (char)(uLen >> 8);
+    xRecord += (char)(uLen);
+    xRecord += xSession;
+
+    return xRecord;
+}
+
+class TlsSessionCacheTest : public ::testing::Test
+{
+protected:
+    char pcDir[64];
+    std::string xPath;
+    TlsSessionCacheHandle xCache = NULL;
+
+    void SetUp() override
+    {
+        strcpy(pcDir, "/tmp/kvs_tls_session_cache_test_XXXXXX");
+        ASSERT_TRUE(mkdtemp(pcDir) != NULL);
+        xPath = std::string(pcDir) + "/sessions";
+        ASSERT_TRUE((xCache = TlsSessionCache_create(2)) != NULL);
+    }
+
+    void TearDown() override
+    {
+        TlsSessionCache_terminate(xCache);
+        for (const std::string &xName : listDir())
+        {
+            unlink((std::string(pcDir) + "/" + xName).c_str());
+        }
+        rmdir(pcDir);
+    }
+
+    std::vector<std::string> listDir()
+    {
+        std::vector<std::string> xNames;
+        DIR *pxDir = opendir(pcDir);
+        struct dirent *pxEntry = NULL;
+
+        while (pxDir != NULL && (pxEntry = readdir(pxDir)) != NULL)
+        {
+            if (strcmp(pxEntry->d_name, ".") != 0 && strcmp(pxEntry->d_name, "..") != 0)
+            {
+                xNames.push_back(pxEntry->d_name);
+            }
+        }
+        if (pxDir != NULL)
+        {
+            closedir(pxDir);
+        }
+
+        return xNames;
+    }
+
+    void writeFile(const std::string &xContent)
+    {
+        FILE *fp = fopen(xPath.c_str(), "wb");
+
+        ASSERT_TRUE(fp != NULL);
+        fwrite(xContent.data(), 1, xContent.size(), fp);
+        fclose(fp);
+    }
+
+    std::string readFile()
+    {
+        std::string xContent;
+        char pBuf[1024];
+        size_t uLen = 0;
+        FILE *fp = fopen(xPath.c_str(), "rb");
+
+        while (fp != NULL && (uLen = fread(pBuf, 1, sizeof(pBuf), fp)) > 0)
+        {
+            xContent.append(pBuf, uLen);
+        }
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+
+        return xContent;
+    }
+
+    /* Save the cache and read back what it wrote. */
+    std::string saveAndRead()
+    {
+        EXPECT_EQ(KVS_ERRNO_NONE, TlsSessionCache_save(xCache, xPath.c_str()));
+
+        return readFile();
+    }
+};
+
+TEST_F(TlsSessionCacheTest, invalid_argument)
+{
+    EXPECT_TRUE(TlsSessionCache_create(0) == NULL);
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsSessionCache_load(NULL, xPath.c_str()));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsSessionCache_load(xCache, NULL));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsSessionCache_save(NULL, xPath.c_str()));
+    EXPECT_EQ(KVS_ERROR_INVALID_ARGUMENT, TlsSessionCache_save(xCache, NULL));
+}
+
+/* The sessions are saved in the order they were used, so a round trip writes the same file. */
+TEST_F(TlsSessionCacheTest, save_and_load)
+{
+    std::string xFile = TLS_SESSION_CACHE_FILE_MAGIC + record("a.local:443", serializeSession(1)) + record("b.local:443", serializeSession(2));
+    TlsSessionCacheHandle xLoadedCache = TlsSessionCache_create(2);
+
+    writeFile(xFile);
+    ASSERT_EQ(KVS_ERRNO_NONE, TlsSessionCache_load(xCache, xPath.c_str()));
+    unlink(xPath.c_str());
+    EXPECT_EQ(xFile, saveAndRead());
+
+    ASSERT_TRUE(xLoadedCache != NULL);
+    ASSERT_EQ(KVS_ERRNO_NONE, TlsSessionCache_load(xLoadedCache, xPath.c_str()));
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsSessionCache_save(xLoadedCache, xPath.c_str()));
+    EXPECT_EQ(xFile, readFile());
+    TlsSessionCache_terminate(xLoadedCache);
+}
+
+/* The file is private, and it's replaced by a rename, so no temporary file is left. */
+TEST_F(TlsSessionCacheTest, save_replaces_file)
+{
+    struct stat xStat;
+
+    writeFile("an older file which is longer than the new one");
+    chmod(xPath.c_str(), 0644);
+    EXPECT_EQ(std::string(TLS_SESSION_CACHE_FILE_MAGIC), saveAndRead());
+
+    ASSERT_EQ(0, stat(xPath.c_str(), &xStat));
+    EXPECT_EQ(0600, xStat.st_mode & 0777);
+    EXPECT_EQ(std::vector<std::string>({"sessions"}), listDir());
+}
+
+TEST_F(TlsSessionCacheTest, save_to_missing_dir)
+{
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR, TlsSessionCache_save(xCache, (std::string(pcDir) + "/missing/sessions").c_str()));
+    EXPECT_TRUE(listDir().empty());
+}
+
+TEST_F(TlsSessionCacheTest, load_missing_file)
+{
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_IO_ERROR, TlsSessionCache_load(xCache, xPath.c_str()));
+}
+
+TEST_F(TlsSessionCacheTest, load_bad_magic)
+{
+    writeFile("KVSTLSC0" + record("a.local:443", serializeSession(1)));
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE, TlsSessionCache_load(xCache, xPath.c_str()));
+
+    writeFile("KVS");
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE, TlsSessionCache_load(xCache, xPath.c_str()));
+    EXPECT_EQ(std::string(TLS_SESSION_CACHE_FILE_MAGIC), saveAndRead());
+}
+
+/* The records before a truncated one are kept. */
+TEST_F(TlsSessionCacheTest, load_truncated_file)
+{
+    std::string xFirst = record("a.local:443", serializeSession(1));
+    std::string xSecond = record("b.local:443", serializeSession(2));
+    std::string xFile = TLS_SESSION_CACHE_FILE_MAGIC + xFirst + xSecond;
+
+    /* Cut in the host length, the host, the session length, and the session of the second record */
+    for (size_t uCut : {xSecond.size() - 1, xSecond.size() - 3, xSecond.size() - 15, (size_t)1})
+    {
+        writeFile(xFile.substr(0, xFile.size() - uCut));
+        EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE, TlsSessionCache_load(xCache, xPath.c_str()));
+        EXPECT_EQ(TLS_SESSION_CACHE_FILE_MAGIC + xFirst, saveAndRead());
+    }
+}
+
+TEST_F(TlsSessionCacheTest, load_oversized_entry)
+{
+    std::string xSession = serializeSession(1);
+    std::string xRecord = record("a.local:443", xSession);
+
+    /* A host longer than any host and port */
+    writeFile(TLS_SESSION_CACHE_FILE_MAGIC + record(std::string(300, 'a'), xSession));
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE, TlsSessionCache_load(xCache, xPath.c_str()));
+
+    /* A session longer than the file */
+    xRecord[2 + 11] = (char)0xFF;
+    writeFile(TLS_SESSION_CACHE_FILE_MAGIC + xRecord);
+    EXPECT_EQ(KVS_ERROR_TLS_SESSION_CACHE_INVALID_FILE, TlsSessionCache_load(xCache, xPath.c_str()));
+    EXPECT_EQ(std::string(TLS_SESSION_CACHE_FILE_MAGIC), saveAndRead());
+}
+
+/* A session which can't be restored, e.g. saved by another mbedTLS version, is skipped. */
+TEST_F(TlsSessionCacheTest, load_skips_invalid_session)
+{
+    std::string xSecond = record("b.local:443", serializeSession(2));
+
+    writeFile(TLS_SESSION_CACHE_FILE_MAGIC + record("a.local:443", "not a session") + xSecond);
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsSessionCache_load(xCache, xPath.c_str()));
+    EXPECT_EQ(TLS_SESSION_CACHE_FILE_MAGIC + xSecond, saveAndRead());
+}
+
+/* The cache keeps the hosts used most recently, so the first of three hosts is evicted from a cache of two. */
+TEST_F(TlsSessionCacheTest, load_evicts_least_recently_used)
+{
+    std::string xFirst = record("a.local:443", serializeSession(1));
+    std::string xSecond = record("b.local:443", serializeSession(2));
+    std::string xThird = record("c.local:443", serializeSession(3));
+
+    writeFile(TLS_SESSION_CACHE_FILE_MAGIC + xFirst + xSecond + xThird);
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsSessionCache_load(xCache, xPath.c_str()));
+    EXPECT_EQ(TLS_SESSION_CACHE_FILE_MAGIC + xSecond + xThird, saveAndRead());
+
+    /* Loading a host again makes it the most recently used one. */
+    writeFile(TLS_SESSION_CACHE_FILE_MAGIC + xSecond + xFirst);
+    EXPECT_EQ(KVS_ERRNO_NONE, TlsSessionCache_load(xCache, xPath.c_str()));
+    EXPECT_EQ(TLS_SESSION_CACHE_FILE_MAGIC + xSecond + xFirst, saveAndRead());
+}
+
+#endif /* MBEDTLS_VERSION_NUMBER >= 0x02130000 */